@@ -24,6 +24,7 @@
 #include <android/binder_manager.h>
 #include <cutils/properties.h>
 #include <cutils/trace.h>
+#include <inttypes.h>
 #include <log/log.h>
 #include <malloc.h>
 #include <ui/GraphicBufferMapper.h>
@@ -89,6 +90,11 @@ std::shared_ptr<AidlCameraDeviceSession> AidlCameraDeviceSession::Create(
 AidlCameraDeviceSession::~AidlCameraDeviceSession() {
   ATRACE_NAME("AidlCameraDeviceSession::~AidlCameraDeviceSession");
   close();
+  if (num_result_fmq_fallbacks_ > 0) {
+    ALOGI("%s: %" PRIu64 " result metadata were sent without the result "
+          "metadata queue",
+          __FUNCTION__, num_result_fmq_fallbacks_.load());
+  }
   // camera's closing, so flush any unused malloc pages
   mallopt(M_PURGE, 0);
 }
@@ -108,9 +114,11 @@ void AidlCameraDeviceSession::ProcessCaptureResult(
                                      std::to_string(buffer.stream_id));
   }
 
-  std::vector<CaptureResult> aidl_results(1);
-  status_t res = aidl_utils::ConvertToAidlCaptureResult(
-      result_metadata_queue_.get(), std::move(hal_result), &aidl_results[0]);
+  std::vector<std::unique_ptr<google_camera_hal::CaptureResult>> hal_results;
+  hal_results.push_back(std::move(hal_result));
+  std::vector<CaptureResult> aidl_results;
+  status_t res =
+      ConvertToAidlCaptureResults(std::move(hal_results), &aidl_results);
   if (res != OK) {
     ALOGE("%s: Converting to AIDL result failed: %s(%d)", __FUNCTION__,
           strerror(-res), res);
@@ -132,27 +140,24 @@ void AidlCameraDeviceSession::ProcessBatchCaptureResult(
     ALOGE("%s: aidl_device_callback_ is nullptr", __FUNCTION__);
     return;
   }
-  int batch_size = hal_results.size();
-  std::vector<CaptureResult> aidl_results(batch_size);
-  for (size_t i = 0; i < hal_results.size(); ++i) {
-    std::unique_ptr<google_camera_hal::CaptureResult>& hal_result =
-        hal_results[i];
-    auto& aidl_result = aidl_results[i];
-
+  for (auto& hal_result : hal_results) {
     TryLogFirstFrameDone(*hal_result, __FUNCTION__);
 
     for (auto& buffer : hal_result->output_buffers) {
       aidl_profiler_->ProfileFrameRate("Stream " +
                                        std::to_string(buffer.stream_id));
     }
+  }
 
-    status_t res = aidl_utils::ConvertToAidlCaptureResult(
-        result_metadata_queue_.get(), std::move(hal_result), &aidl_result);
-    if (res != OK) {
-      ALOGE("%s: Converting to AIDL result failed: %s(%d)", __FUNCTION__,
-            strerror(-res), res);
-      return;
-    }
+  // Write the metadata of the whole batch to the result metadata queue at
+  // once.
+  std::vector<CaptureResult> aidl_results;
+  status_t res =
+      ConvertToAidlCaptureResults(std::move(hal_results), &aidl_results);
+  if (res != OK) {
+    ALOGE("%s: Converting to AIDL results failed: %s(%d)", __FUNCTION__,
+          strerror(-res), res);
+    return;
   }
 
   auto aidl_res = aidl_device_callback_->processCaptureResult(aidl_results);
@@ -163,6 +168,35 @@ void AidlCameraDeviceSession::ProcessBatchCaptureResult(
   }
 }
 
+status_t AidlCameraDeviceSession::ConvertToAidlCaptureResults(
+    std::vector<std::unique_ptr<google_camera_hal::CaptureResult>> hal_results,
+    std::vector<CaptureResult>* aidl_results) {
+  ATRACE_CALL();
+  uint32_t num_fallbacks = 0;
+  status_t res = aidl_utils::ConvertToAidlCaptureResults(
+      result_metadata_queue_.get(), std::move(hal_results), aidl_results,
+      &num_fallbacks);
+  if (res != OK || num_fallbacks == 0) {
+    return res;
+  }
+
+  // Metadata sent inline is copied through binder, so the queue should be
+  // sized to avoid this in steady state.
+  uint64_t total_fallbacks = num_result_fmq_fallbacks_ += num_fallbacks;
+  ATRACE_INT64("result_fmq_fallbacks", total_fallbacks);
+  if (total_fallbacks == num_fallbacks) {
+    size_t queue_size = result_metadata_queue_ == nullptr
+                            ? 0
+                            : result_metadata_queue_->getQuantumCount();
+    ALOGW(
+        "%s: %u result metadata didn't fit in the %zu-byte result metadata "
+        "queue; consider increasing ro.vendor.camera.res.fmq.size",
+        __FUNCTION__, num_fallbacks, queue_size);
+  }
+
+  return OK;
+}
+
 void AidlCameraDeviceSession::NotifyHalMessage(
     const google_camera_hal::NotifyMessage& hal_message) {
   std::shared_lock lock(aidl_device_callback_lock_);
@@ -736,8 +770,25 @@ ndk::ScopedAStatus AidlCameraDeviceSession::processCaptureRequest(
 }
 
 ndk::ScopedAStatus AidlCameraDeviceSession::signalStreamFlush(
-    const std::vector<int32_t>&, int32_t) {
-  // TODO(b/143902312): Implement this.
+    const std::vector<int32_t>& in_streamIds, int32_t in_streamConfigCounter) {
+  ATRACE_NAME("AidlCameraDeviceSession::signalStreamFlush");
+  // The framework signals a stream flush instead of a flush when switching
+  // modes with a stream configuration.
+  ATRACE_ASYNC_BEGIN("switch_mode", 0);
+  if (device_session_ == nullptr) {
+    return ndk::ScopedAStatus::fromServiceSpecificError(
+        static_cast<int32_t>(Status::INTERNAL_ERROR));
+  }
+
+  // This is only a hint to speed up the following stream configuration, so
+  // failures are logged but not reported to the framework.
+  status_t res = device_session_->SignalStreamFlush(
+      in_streamIds, static_cast<uint32_t>(in_streamConfigCounter));
+  if (res != OK) {
+    ALOGW("%s: Signaling stream flush failed: %s(%d).", __FUNCTION__,
+          strerror(-res), res);
+  }
+
   return ndk::ScopedAStatus::ok();
 }
 
@@ -25,6 +25,7 @@
 #include <fmq/AidlMessageQueue.h>
 #include <utils/StrongPointer.h>
 
+#include <atomic>
 #include <shared_mutex>
 #include <vector>
 
@@ -195,6 +196,13 @@ class AidlCameraDeviceSession
   // Unregister thermal changed callback.
   void UnregisterThermalChangedCallback();
 
+  // Convert HAL results to AIDL results, writing their metadata to
+  // result_metadata_queue_, and keep track of the metadata that didn't fit.
+  status_t ConvertToAidlCaptureResults(
+      std::vector<std::unique_ptr<google_camera_hal::CaptureResult>> hal_results,
+      std::vector<aidl::android::hardware::camera::device::CaptureResult>*
+          aidl_results);
+
   // Log when the first frame buffers are all received.
   void TryLogFirstFrameDone(const google_camera_hal::CaptureResult& result,
                             const char* caller_func_name);
@@ -207,6 +215,10 @@ class AidlCameraDeviceSession
   // Metadata queue to write the result metadata to.
   std::unique_ptr<MetadataQueue> result_metadata_queue_;
 
+  // Number of result metadata sent inline because they didn't fit in
+  // result_metadata_queue_.
+  std::atomic<uint64_t> num_result_fmq_fallbacks_ = 0;
+
   // Assuming callbacks to framework is thread-safe, the shared mutex is only
   // used to protect member variable writing and reading.
   std::shared_mutex aidl_device_callback_lock_;
@@ -26,6 +26,7 @@
 
 #include "aidl_camera_device.h"
 #include "aidl_camera_provider.h"
+#include "camera_metadata_pool.h"
 
 namespace android {
 namespace hardware {
@@ -227,93 +228,89 @@ status_t ConvertToAidlHalStreamConfig(
   return OK;
 }
 
-status_t WriteToResultMetadataQueue(
-    camera_metadata_t* metadata,
-    AidlMessageQueue<int8_t, SynchronizedReadWrite>* result_metadata_queue) {
-  if (result_metadata_queue == nullptr) {
-    return BAD_VALUE;
-  }
-
-  if (result_metadata_queue->availableToWrite() <= 0) {
-    ALOGW("%s: result_metadata_queue is not available to write", __FUNCTION__);
-    return BAD_VALUE;
-  }
-
-  uint32_t size = get_camera_metadata_size(metadata);
-  bool success = result_metadata_queue->write(
-      reinterpret_cast<const int8_t*>(metadata), size);
-  if (!success) {
-    ALOGW("%s: Writing to result metadata queue failed. (size=%u)",
-          __FUNCTION__, size);
-    return INVALID_OPERATION;
-  }
-
-  return OK;
-}
-
-// Try writing result metadata to result metadata queue. If failed, return
-// the metadata to the caller in out_hal_metadata.
-status_t TryWritingToResultMetadataQueue(
-    std::unique_ptr<google_camera_hal::HalCameraMetadata> hal_metadata,
+namespace {
+// Result metadata of a batch of results and where to report it in the AIDL
+// results.
+struct PendingResultMetadata {
+  std::unique_ptr<google_camera_hal::HalCameraMetadata> metadata;
+  std::vector<uint8_t>* aidl_metadata = nullptr;
+  int64_t* fmq_size = nullptr;
+};
+}  // namespace
+
+// Write the metadata of a batch of results to result_metadata_queue with a
+// single write transaction, in the order the client reads them. Metadata that
+// doesn't fit in the queue is attached to its AIDL result instead. Returns
+// the number of metadata attached to AIDL results.
+static uint32_t WriteResultMetadataBatch(
     AidlMessageQueue<int8_t, SynchronizedReadWrite>* result_metadata_queue,
-    uint64_t* fmq_result_size,
-    std::unique_ptr<google_camera_hal::HalCameraMetadata>* out_hal_metadata) {
-  if (out_hal_metadata == nullptr) {
-    ALOGE("%s: out_hal_metadata is nullptr.", __FUNCTION__);
-    return BAD_VALUE;
-  }
-
-  *out_hal_metadata = std::move(hal_metadata);
-
-  if (fmq_result_size == nullptr) {
-    ALOGE("%s: fmq_result_size is nullptr", __FUNCTION__);
-    return BAD_VALUE;
-  }
-
-  *fmq_result_size = 0;
-  if (*out_hal_metadata == nullptr) {
-    return OK;
+    std::vector<PendingResultMetadata>* pending_metadata) {
+  size_t available_size = result_metadata_queue == nullptr
+                              ? 0
+                              : result_metadata_queue->availableToWrite();
+  size_t fmq_size = 0;
+  std::vector<bool> write_to_fmq(pending_metadata->size(), false);
+  for (size_t i = 0; i < pending_metadata->size(); i++) {
+    auto& metadata = (*pending_metadata)[i].metadata;
+    if (metadata == nullptr) {
+      continue;
+    }
+    // Later metadata may still fit if this one doesn't.
+    size_t size = metadata->GetCameraMetadataSize();
+    if (fmq_size + size <= available_size) {
+      write_to_fmq[i] = true;
+      fmq_size += size;
+    }
   }
 
-  camera_metadata_t* metadata = (*out_hal_metadata)->ReleaseCameraMetadata();
-  // Temporarily use the raw metadata to write to metadata queue.
-  status_t res = WriteToResultMetadataQueue(metadata, result_metadata_queue);
-  *out_hal_metadata = google_camera_hal::HalCameraMetadata::Create(metadata);
+  if (fmq_size > 0) {
+    bool success = false;
+    AidlMessageQueue<int8_t, SynchronizedReadWrite>::MemTransaction transaction;
+    if (result_metadata_queue->beginWrite(fmq_size, &transaction)) {
+      size_t offset = 0;
+      success = true;
+      for (size_t i = 0; i < pending_metadata->size() && success; i++) {
+        if (!write_to_fmq[i]) {
+          continue;
+        }
+        auto& metadata = (*pending_metadata)[i].metadata;
+        size_t size = metadata->GetCameraMetadataSize();
+        success = transaction.copyTo(
+            reinterpret_cast<const int8_t*>(metadata->GetRawCameraMetadata()),
+            offset, size);
+        offset += size;
+      }
+      success = success && result_metadata_queue->commitWrite(fmq_size);
+    }
 
-  if (res != OK) {
-    ALOGW("%s: Writing to result metadata queue failed: %s(%d)", __FUNCTION__,
-          strerror(-res), res);
-    return res;
+    if (!success) {
+      ALOGW("%s: Writing %zu bytes to result metadata queue failed.",
+            __FUNCTION__, fmq_size);
+      write_to_fmq.assign(write_to_fmq.size(), false);
+    }
   }
 
-  *fmq_result_size = (*out_hal_metadata)->GetCameraMetadataSize();
-  *out_hal_metadata = nullptr;
-  return OK;
-}
+  uint32_t num_fallbacks = 0;
+  for (size_t i = 0; i < pending_metadata->size(); i++) {
+    PendingResultMetadata& pending = (*pending_metadata)[i];
+    *pending.fmq_size = 0;
+    if (pending.metadata == nullptr) {
+      continue;
+    }
 
-status_t ConvertToAidlResultMetadata(
-    AidlMessageQueue<int8_t, SynchronizedReadWrite>* result_metadata_queue,
-    std::unique_ptr<google_camera_hal::HalCameraMetadata> hal_metadata,
-    std::vector<uint8_t>* aidl_metadata, uint64_t* fmq_result_size) {
-  if (TryWritingToResultMetadataQueue(std::move(hal_metadata),
-                                      result_metadata_queue, fmq_result_size,
-                                      &hal_metadata) == OK) {
-    return OK;
-  }
+    size_t size = pending.metadata->GetCameraMetadataSize();
+    if (write_to_fmq[i]) {
+      *pending.fmq_size = size;
+      continue;
+    }
 
-  // If writing to metadata queue failed, attach the metadata to aidl_metadata.
-  if (aidl_metadata == nullptr) {
-    ALOGE("%s: aidl_metadata is nullptr", __FUNCTION__);
-    return BAD_VALUE;
+    const auto* metadata_p = reinterpret_cast<const uint8_t*>(
+        pending.metadata->GetRawCameraMetadata());
+    pending.aidl_metadata->assign(metadata_p, metadata_p + size);
+    num_fallbacks++;
   }
 
-  uint32_t metadata_size = hal_metadata->GetCameraMetadataSize();
-  const auto* metadata_p =
-      reinterpret_cast<const uint8_t*>(hal_metadata->GetRawCameraMetadata());
-  // TODO: Do we reallly need to copy here ?
-  aidl_metadata->assign(metadata_p, metadata_p + metadata_size);
-
-  return OK;
+  return num_fallbacks;
 }
 
 status_t ConvertToAidlBufferStatus(google_camera_hal::BufferStatus hal_status,
@@ -371,9 +368,10 @@ status_t ConvertToAidlStreamBuffer(
   return OK;
 }
 
+// Convert everything in a HAL result except the metadata.
 status_t ConvertToAidlCaptureResultInternal(
-    AidlMessageQueue<int8_t, SynchronizedReadWrite>* result_metadata_queue,
-    google_camera_hal::CaptureResult* hal_result, CaptureResult* aidl_result) {
+    const google_camera_hal::CaptureResult* hal_result,
+    CaptureResult* aidl_result) {
   if (aidl_result == nullptr) {
     ALOGE("%s: aidl_result is nullptr.", __FUNCTION__);
     return BAD_VALUE;
@@ -386,15 +384,7 @@ status_t ConvertToAidlCaptureResultInternal(
 
   aidl_result->frameNumber = hal_result->frame_number;
 
-  status_t res = ConvertToAidlResultMetadata(
-      result_metadata_queue, std::move(hal_result->result_metadata),
-      &aidl_result->result.metadata, (uint64_t*)&aidl_result->fmqResultSize);
-  if (res != OK) {
-    ALOGE("%s: Converting to AIDL result metadata failed: %s(%d).",
-          __FUNCTION__, strerror(-res), res);
-    return res;
-  }
-
+  status_t res;
   aidl_result->outputBuffers.resize(hal_result->output_buffers.size());
   for (uint32_t i = 0; i < aidl_result->outputBuffers.size(); i++) {
     res = ConvertToAidlStreamBuffer(hal_result->output_buffers[i],
@@ -428,45 +418,55 @@ status_t ConvertToAidlCaptureResultInternal(
   return OK;
 }
 
-status_t ConvertToAidlCaptureResult(
+status_t ConvertToAidlCaptureResults(
     AidlMessageQueue<int8_t, SynchronizedReadWrite>* result_metadata_queue,
-    std::unique_ptr<google_camera_hal::CaptureResult> hal_result,
-    CaptureResult* aidl_result) {
-  if (aidl_result == nullptr) {
-    ALOGE("%s: aidl_result is nullptr.", __FUNCTION__);
-    return BAD_VALUE;
-  }
-
-  if (hal_result == nullptr) {
-    ALOGE("%s: hal_result is nullptr.", __FUNCTION__);
+    std::vector<std::unique_ptr<google_camera_hal::CaptureResult>> hal_results,
+    std::vector<CaptureResult>* aidl_results, uint32_t* num_fmq_fallbacks) {
+  if (aidl_results == nullptr) {
+    ALOGE("%s: aidl_results is nullptr.", __FUNCTION__);
     return BAD_VALUE;
   }
 
-  status_t res = ConvertToAidlCaptureResultInternal(
-      result_metadata_queue, hal_result.get(), aidl_result);
-  if (res != OK) {
-    ALOGE("%s: Converting to AIDL result internal failed: %s(%d).",
-          __FUNCTION__, strerror(-res), res);
-    return res;
-  }
-
-  uint32_t num_physical_metadata = hal_result->physical_metadata.size();
-  aidl_result->physicalCameraMetadata.resize(num_physical_metadata);
-
-  for (uint32_t i = 0; i < num_physical_metadata; i++) {
-    aidl_result->physicalCameraMetadata[i].physicalCameraId =
-        std::to_string(hal_result->physical_metadata[i].physical_camera_id);
+  aidl_results->resize(hal_results.size());
+  std::vector<PendingResultMetadata> pending_metadata;
+  for (size_t i = 0; i < hal_results.size(); i++) {
+    google_camera_hal::CaptureResult* hal_result = hal_results[i].get();
+    CaptureResult& aidl_result = (*aidl_results)[i];
+    if (hal_result == nullptr) {
+      ALOGE("%s: hal_result is nullptr.", __FUNCTION__);
+      return BAD_VALUE;
+    }
 
-    res = ConvertToAidlResultMetadata(
-        result_metadata_queue,
-        std::move(hal_result->physical_metadata[i].metadata),
-        &aidl_result->physicalCameraMetadata[i].metadata.metadata,
-        (uint64_t*)&aidl_result->physicalCameraMetadata[i].fmqMetadataSize);
+    status_t res = ConvertToAidlCaptureResultInternal(hal_result, &aidl_result);
     if (res != OK) {
-      ALOGE("%s: Converting to AIDL physical metadata failed: %s(%d).",
+      ALOGE("%s: Converting to AIDL result internal failed: %s(%d).",
             __FUNCTION__, strerror(-res), res);
       return res;
     }
+
+    pending_metadata.push_back(
+        {.metadata = std::move(hal_result->result_metadata),
+         .aidl_metadata = &aidl_result.result.metadata,
+         .fmq_size = &aidl_result.fmqResultSize});
+
+    uint32_t num_physical_metadata = hal_result->physical_metadata.size();
+    aidl_result.physicalCameraMetadata.resize(num_physical_metadata);
+    for (uint32_t j = 0; j < num_physical_metadata; j++) {
+      auto& physical_metadata = hal_result->physical_metadata[j];
+      auto& aidl_physical_metadata = aidl_result.physicalCameraMetadata[j];
+      aidl_physical_metadata.physicalCameraId =
+          std::to_string(physical_metadata.physical_camera_id);
+      pending_metadata.push_back(
+          {.metadata = std::move(physical_metadata.metadata),
+           .aidl_metadata = &aidl_physical_metadata.metadata.metadata,
+           .fmq_size = &aidl_physical_metadata.fmqMetadataSize});
+    }
+  }
+
+  uint32_t num_fallbacks =
+      WriteResultMetadataBatch(result_metadata_queue, &pending_metadata);
+  if (num_fmq_fallbacks != nullptr) {
+    *num_fmq_fallbacks = num_fallbacks;
   }
 
   return OK;
@@ -702,6 +702,71 @@ status_t ConvertToHalStreamBuffer(
   return OK;
 }
 
+// Read message_queue_setting_size bytes of settings from
+// request_metadata_queue. The bytes are copied once, straight from the queue
+// into a pooled buffer that hal_metadata adopts. They are validated after the
+// copy because the queue is shared with the client, which could modify them
+// after validation.
+static status_t ReadHalMetadataFromQueue(
+    uint32_t message_queue_setting_size,
+    AidlMessageQueue<int8_t, SynchronizedReadWrite>* request_metadata_queue,
+    std::unique_ptr<google_camera_hal::HalCameraMetadata>* hal_metadata) {
+  AidlMessageQueue<int8_t, SynchronizedReadWrite>::MemTransaction transaction;
+  if (!request_metadata_queue->beginRead(message_queue_setting_size,
+                                         &transaction)) {
+    ALOGE("%s: Failed to read from request metadata queue.", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  auto& pool = google_camera_hal::CameraMetadataPool::GetInstance();
+  void* buffer = pool.AllocateBuffer(message_queue_setting_size);
+  bool copied =
+      buffer != nullptr &&
+      transaction.copyFrom(static_cast<int8_t*>(buffer), /*startIdx=*/0,
+                           message_queue_setting_size);
+  // Consume the settings even if they can't be used so that the following
+  // settings in the queue stay in sync.
+  if (!request_metadata_queue->commitRead(message_queue_setting_size)) {
+    ALOGE("%s: Failed to commit reading request metadata queue.",
+          __FUNCTION__);
+    copied = false;
+  }
+
+  camera_metadata_t* metadata = static_cast<camera_metadata_t*>(buffer);
+  if (!copied) {
+    ALOGE("%s: Failed to copy %u bytes from request metadata queue.",
+          __FUNCTION__, message_queue_setting_size);
+    pool.Free(metadata);
+    return buffer == nullptr ? NO_MEMORY : BAD_VALUE;
+  }
+
+  size_t metadata_size = get_camera_metadata_size(metadata);
+  if (metadata_size != message_queue_setting_size) {
+    ALOGE(
+        "%s: Mismatch between camera metadata size (%zu) and message "
+        "queue setting size (%u)",
+        __FUNCTION__, metadata_size, message_queue_setting_size);
+    pool.Free(metadata);
+    return BAD_VALUE;
+  }
+
+  // See the comment in ConvertToHalMetadata() about validation.
+  if (validate_camera_metadata_structure(metadata, /*expected_size=*/NULL) !=
+      OK) {
+    ALOGE("%s: Failed to validate the metadata structure", __FUNCTION__);
+    pool.Free(metadata);
+    return BAD_VALUE;
+  }
+
+  *hal_metadata = google_camera_hal::HalCameraMetadata::Create(metadata);
+  if (*hal_metadata == nullptr) {
+    pool.Free(metadata);
+    return NO_MEMORY;
+  }
+
+  return OK;
+}
+
 status_t ConvertToHalMetadata(
     uint32_t message_queue_setting_size,
     AidlMessageQueue<int8_t, SynchronizedReadWrite>* request_metadata_queue,
@@ -713,7 +778,6 @@ status_t ConvertToHalMetadata(
   }
 
   const camera_metadata_t* metadata = nullptr;
-  std::vector<int8_t> metadata_queue_settings;
   const size_t min_camera_metadata_size =
       calculate_camera_metadata_size(/*entry_count=*/0, /*data_count=*/0);
 
@@ -750,25 +814,8 @@ status_t ConvertToHalMetadata(
       return BAD_VALUE;
     }
 
-    metadata_queue_settings.resize(message_queue_setting_size);
-    bool success = request_metadata_queue->read(metadata_queue_settings.data(),
-                                                message_queue_setting_size);
-    if (!success) {
-      ALOGE("%s: Failed to read from request metadata queue.", __FUNCTION__);
-      return BAD_VALUE;
-    }
-
-    metadata = reinterpret_cast<const camera_metadata_t*>(
-        metadata_queue_settings.data());
-
-    size_t metadata_size = get_camera_metadata_size(metadata);
-    if (metadata_size != message_queue_setting_size) {
-      ALOGE(
-          "%s: Mismatch between camera metadata size (%zu) and message "
-          "queue setting size (%u)",
-          __FUNCTION__, metadata_size, message_queue_setting_size);
-      return BAD_VALUE;
-    }
+    return ReadHalMetadataFromQueue(message_queue_setting_size,
+                                    request_metadata_queue, hal_metadata);
   }
 
   if (metadata == nullptr) {
@@ -123,13 +123,15 @@ status_t ConvertToAidlBufferRequest(
 status_t ConvertToHalBufferStatus(BufferStatus aidl_status,
                                   google_camera_hal::BufferStatus* hal_status);
 
-// Convert a HAL result to a AIDL result. It will try to write the result
-// metadata to result_metadata_queue. If it fails, it will write the result
-// metadata in aidl_result.
-status_t ConvertToAidlCaptureResult(
+// Convert HAL results to AIDL results. The result metadata of all results is
+// written to result_metadata_queue in a single write. Metadata that doesn't
+// fit is attached to its AIDL result instead, and the number of such metadata
+// is returned in num_fmq_fallbacks if it's not nullptr.
+status_t ConvertToAidlCaptureResults(
     AidlMessageQueue<int8_t, SynchronizedReadWrite>* result_metadata_queue,
-    std::unique_ptr<google_camera_hal::CaptureResult> hal_result,
-    CaptureResult* aidl_result);
+    std::vector<std::unique_ptr<google_camera_hal::CaptureResult>> hal_results,
+    std::vector<CaptureResult>* aidl_results,
+    uint32_t* num_fmq_fallbacks = nullptr);
 
 // Convert a HAL stream buffer to a AIDL aidl stream buffer.
 status_t ConvertToAidlStreamBuffer(
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AidlUtilsTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <system/camera_metadata.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "aidl_utils.h"
+#include "hal_camera_metadata.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace implementation {
+namespace aidl_utils {
+
+using MetadataQueue = AidlMessageQueue<int8_t, SynchronizedReadWrite>;
+
+// Queue size that isn't a multiple of the settings size so that settings
+// wrap around the end of the queue.
+static constexpr size_t kQueueSize = 4093;
+
+// Return serialized settings with a few typical entries.
+static std::vector<int8_t> CreateSettings() {
+  camera_metadata_t* metadata =
+      allocate_camera_metadata(/*entry_capacity=*/8, /*data_capacity=*/128);
+  uint8_t control_mode = ANDROID_CONTROL_MODE_AUTO;
+  add_camera_metadata_entry(metadata, ANDROID_CONTROL_MODE, &control_mode, 1);
+  int32_t fps_range[] = {15, 30};
+  add_camera_metadata_entry(metadata, ANDROID_CONTROL_AE_TARGET_FPS_RANGE,
+                            fps_range, 2);
+  float zoom_ratio = 2.0f;
+  add_camera_metadata_entry(metadata, ANDROID_CONTROL_ZOOM_RATIO, &zoom_ratio,
+                            1);
+
+  const int8_t* bytes = reinterpret_cast<const int8_t*>(metadata);
+  size_t size = get_camera_metadata_size(metadata);
+  std::vector<int8_t> settings(bytes, bytes + size);
+  free_camera_metadata(metadata);
+  return settings;
+}
+
+TEST(AidlUtilsTests, ConvertMetadataFromQueue) {
+  MetadataQueue queue(kQueueSize, /*configureEventFlagWord=*/false);
+  ASSERT_TRUE(queue.isValid());
+  std::vector<int8_t> settings = CreateSettings();
+
+  // Go around the queue a few times.
+  for (size_t i = 0; i < 3 * kQueueSize / settings.size(); i++) {
+    ASSERT_TRUE(queue.write(settings.data(), settings.size()));
+    std::unique_ptr<google_camera_hal::HalCameraMetadata> hal_metadata;
+    ASSERT_EQ(ConvertToHalMetadata(settings.size(), &queue,
+                                   /*request_settings=*/{}, &hal_metadata),
+              OK);
+    ASSERT_NE(hal_metadata, nullptr);
+
+    camera_metadata_ro_entry_t entry;
+    ASSERT_EQ(hal_metadata->Get(ANDROID_CONTROL_ZOOM_RATIO, &entry), OK);
+    EXPECT_EQ(entry.data.f[0], 2.0f);
+    EXPECT_EQ(queue.availableToRead(), 0u);
+  }
+}
+
+TEST(AidlUtilsTests, MalformedMetadataInQueueIsConsumed) {
+  MetadataQueue queue(kQueueSize, /*configureEventFlagWord=*/false);
+  ASSERT_TRUE(queue.isValid());
+  std::vector<int8_t> settings = CreateSettings();
+
+  // Settings whose size doesn't match the size of the message.
+  std::vector<int8_t> malformed_settings = settings;
+  malformed_settings.resize(settings.size() + 8);
+  ASSERT_TRUE(
+      queue.write(malformed_settings.data(), malformed_settings.size()));
+  ASSERT_TRUE(queue.write(settings.data(), settings.size()));
+
+  std::unique_ptr<google_camera_hal::HalCameraMetadata> hal_metadata;
+  EXPECT_EQ(ConvertToHalMetadata(malformed_settings.size(), &queue,
+                                 /*request_settings=*/{}, &hal_metadata),
+            BAD_VALUE);
+  EXPECT_EQ(hal_metadata, nullptr);
+
+  // The following settings are still read correctly.
+  EXPECT_EQ(ConvertToHalMetadata(settings.size(), &queue,
+                                 /*request_settings=*/{}, &hal_metadata),
+            OK);
+  EXPECT_NE(hal_metadata, nullptr);
+}
+
+// Return result metadata with a zoom ratio and data_capacity bytes of data.
+static std::unique_ptr<google_camera_hal::HalCameraMetadata>
+CreateResultMetadata(float zoom_ratio, size_t data_capacity) {
+  auto metadata = google_camera_hal::HalCameraMetadata::Create(
+      /*entry_capacity=*/1, data_capacity);
+  if (metadata != nullptr) {
+    metadata->Set(ANDROID_CONTROL_ZOOM_RATIO, &zoom_ratio, 1);
+  }
+  return metadata;
+}
+
+TEST(AidlUtilsTests, ConvertCaptureResultsWithQueueOverflow) {
+  static constexpr size_t kDataCapacity = 64;
+  int64_t metadata_size =
+      CreateResultMetadata(1.0f, kDataCapacity)->GetCameraMetadataSize();
+  // Room for 3 small metadata.
+  MetadataQueue queue(3 * metadata_size + 1, /*configureEventFlagWord=*/false);
+  ASSERT_TRUE(queue.isValid());
+
+  // The second result's metadata is too large for the queue but the ones
+  // before and after it fit.
+  std::vector<std::unique_ptr<google_camera_hal::CaptureResult>> hal_results;
+  for (uint32_t i = 0; i < 3; i++) {
+    auto hal_result = std::make_unique<google_camera_hal::CaptureResult>();
+    hal_result->frame_number = i;
+    hal_result->partial_result = 1;
+    size_t data_capacity =
+        i == 1 ? static_cast<size_t>(4 * metadata_size) : kDataCapacity;
+    hal_result->result_metadata =
+        CreateResultMetadata(static_cast<float>(i), data_capacity);
+    hal_results.push_back(std::move(hal_result));
+  }
+  hal_results[0]->physical_metadata.push_back(
+      {.physical_camera_id = 2,
+       .metadata = CreateResultMetadata(10.0f, kDataCapacity)});
+
+  std::vector<CaptureResult> aidl_results;
+  uint32_t num_fmq_fallbacks = 0;
+  ASSERT_EQ(ConvertToAidlCaptureResults(&queue, std::move(hal_results),
+                                        &aidl_results, &num_fmq_fallbacks),
+            OK);
+  ASSERT_EQ(aidl_results.size(), 3u);
+  EXPECT_EQ(num_fmq_fallbacks, 1u);
+
+  EXPECT_EQ(aidl_results[0].fmqResultSize, metadata_size);
+  EXPECT_TRUE(aidl_results[0].result.metadata.empty());
+  ASSERT_EQ(aidl_results[0].physicalCameraMetadata.size(), 1u);
+  EXPECT_EQ(aidl_results[0].physicalCameraMetadata[0].physicalCameraId, "2");
+  EXPECT_EQ(aidl_results[0].physicalCameraMetadata[0].fmqMetadataSize,
+            metadata_size);
+  EXPECT_EQ(aidl_results[1].fmqResultSize, 0);
+  EXPECT_FALSE(aidl_results[1].result.metadata.empty());
+  EXPECT_EQ(aidl_results[2].fmqResultSize, metadata_size);
+  EXPECT_EQ(aidl_results[2].frameNumber, 2);
+
+  // The queue has the metadata in the order the framework reads them.
+  ASSERT_EQ(queue.availableToRead(), static_cast<size_t>(3 * metadata_size));
+  for (float expected_zoom_ratio : {0.0f, 10.0f, 2.0f}) {
+    std::vector<int8_t> bytes(metadata_size);
+    ASSERT_TRUE(queue.read(bytes.data(), bytes.size()));
+    auto metadata = reinterpret_cast<const camera_metadata_t*>(bytes.data());
+    camera_metadata_ro_entry_t entry;
+    ASSERT_EQ(
+        find_camera_metadata_ro_entry(metadata, ANDROID_CONTROL_ZOOM_RATIO,
+                                      &entry),
+        OK);
+    EXPECT_EQ(entry.data.f[0], expected_zoom_ratio);
+  }
+}
+
+// Compare converting settings from the queue with reading them into a vector
+// first and cloning them, which is what ConvertToHalMetadata() used to do.
+// Disabled by default since it only reports timings.
+TEST(AidlUtilsTests, DISABLED_ConvertMetadataFromQueueBenchmark) {
+  static constexpr uint32_t kNumIterations = 10000;
+  MetadataQueue queue(kQueueSize, /*configureEventFlagWord=*/false);
+  ASSERT_TRUE(queue.isValid());
+  std::vector<int8_t> settings = CreateSettings();
+
+  int64_t convert_ns = 0;
+  int64_t read_and_clone_ns = 0;
+  for (uint32_t i = 0; i < kNumIterations; i++) {
+    ASSERT_TRUE(queue.write(settings.data(), settings.size()));
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<google_camera_hal::HalCameraMetadata> hal_metadata;
+    ASSERT_EQ(ConvertToHalMetadata(settings.size(), &queue,
+                                   /*request_settings=*/{}, &hal_metadata),
+              OK);
+    hal_metadata = nullptr;
+    convert_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+    ASSERT_TRUE(queue.write(settings.data(), settings.size()));
+    start = std::chrono::steady_clock::now();
+    std::vector<int8_t> queue_settings(settings.size());
+    ASSERT_TRUE(queue.read(queue_settings.data(), queue_settings.size()));
+    auto metadata =
+        reinterpret_cast<const camera_metadata_t*>(queue_settings.data());
+    ASSERT_EQ(validate_camera_metadata_structure(metadata, nullptr), OK);
+    hal_metadata = google_camera_hal::HalCameraMetadata::Clone(metadata);
+    hal_metadata = nullptr;
+    read_and_clone_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  }
+
+  printf("%zu-byte settings: convert %.1f ns, read and clone %.1f ns\n",
+         settings.size(), static_cast<double>(convert_ns) / kNumIterations,
+         static_cast<double>(read_and_clone_ns) / kNumIterations);
+}
+
+}  // namespace aidl_utils
+}  // namespace implementation
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
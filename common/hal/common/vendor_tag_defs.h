@@ -50,6 +50,7 @@ enum VendorTagIds : uint32_t {
   kVideoSwDenoiseEnabled,
   kVideo60to30FPSThermalThrottle,
   kVideoFpsThrottle,
+  kZslMetadataKeys,
   // This should not be used as a vendor tag ID on its own, but as a placeholder
   // to indicate the end of currently defined vendor tag IDs
   kEndMarker
@@ -257,6 +258,17 @@ static const std::vector<VendorTag> kInternalVendorTags = {
     {.tag_id = VendorTagIds::kVideoFpsThrottle,
      .tag_name = "VideoFpsThrottle",
      .tag_type = CameraMetadataType::kByte},
+    // ZSL metadata keys
+    //
+    // Lists the result metadata tags that the snapshot pipeline uses from ZSL
+    // buffers. Only these tags are kept with ZSL buffers. Absence of this tag
+    // implies the whole result metadata is kept.
+    //
+    // Present in: Characteristics
+    // Payload: n int32_t tags
+    {.tag_id = VendorTagIds::kZslMetadataKeys,
+     .tag_name = "ZslMetadataKeys",
+     .tag_type = CameraMetadataType::kInt32},
 };
 
 // Google Camera HAL vendor tag sections
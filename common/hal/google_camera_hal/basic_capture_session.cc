@@ -263,5 +263,11 @@ status_t BasicCaptureSession::Flush() {
   return request_processor_->Flush();
 }
 
+status_t BasicCaptureSession::SignalStreamFlush(
+    const std::vector<int32_t>& stream_ids) {
+  ATRACE_CALL();
+  return request_processor_->SignalStreamFlush(stream_ids);
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
@@ -67,6 +67,8 @@ class BasicCaptureSession : public CaptureSession {
   status_t ProcessRequest(const CaptureRequest& request) override;
 
   status_t Flush() override;
+
+  status_t SignalStreamFlush(const std::vector<int32_t>& stream_ids) override;
   // Override functions in CaptureSession end.
 
  protected:
@@ -126,5 +126,16 @@ status_t BasicRequestProcessor::Flush() {
   return process_block_->Flush();
 }
 
+status_t BasicRequestProcessor::SignalStreamFlush(
+    const std::vector<int32_t>& stream_ids) {
+  ATRACE_CALL();
+  std::shared_lock lock(process_block_shared_lock_);
+  if (process_block_ == nullptr) {
+    return OK;
+  }
+
+  return process_block_->SignalStreamFlush(stream_ids);
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
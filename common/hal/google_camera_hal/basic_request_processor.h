@@ -48,6 +48,8 @@ class BasicRequestProcessor : public RequestProcessor {
   status_t ProcessRequest(const CaptureRequest& request) override;
 
   status_t Flush() override;
+
+  status_t SignalStreamFlush(const std::vector<int32_t>& stream_ids) override;
   // Override functions of RequestProcessor end.
 
  protected:
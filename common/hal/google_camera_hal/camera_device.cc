@@ -19,6 +19,7 @@
 #define ATRACE_TAG ATRACE_TAG_CAMERA
 #include "camera_device.h"
 
+#include <cutils/properties.h>
 #include <dlfcn.h>
 #include <errno.h>
 #include <log/log.h>
@@ -30,6 +31,7 @@
 
 #include <thread>
 
+#include "camera_metadata_pool.h"
 #include "utils.h"
 #include "vendor_tags.h"
 
@@ -121,6 +123,10 @@ constexpr char kExternalCaptureSessionDir[] =
 #endif
 #endif
 
+// Set to true to include the camera metadata pool statistics in DumpState().
+constexpr char kMetadataPoolStatsProp[] =
+    "persist.vendor.camera.hal.metadatapoolstats";
+
 std::unique_ptr<CameraDevice> CameraDevice::Create(
     std::unique_ptr<CameraDeviceHwl> camera_device_hwl,
     CameraBufferAllocatorHwl* camera_allocator_hwl,
@@ -317,6 +323,10 @@ status_t CameraDevice::ConstructDefaultRequestSettings(
 
 status_t CameraDevice::DumpState(int fd) {
   ATRACE_CALL();
+  if (property_get_bool(kMetadataPoolStatsProp, false)) {
+    CameraMetadataPool::GetInstance().Dump(fd);
+  }
+
   return camera_device_hwl_->DumpState(fd);
 }
 
@@ -328,6 +338,9 @@ status_t CameraDevice::CreateCameraDeviceSession(
     return BAD_VALUE;
   }
 
+  // Report the metadata pool high-water mark per session.
+  CameraMetadataPool::GetInstance().ResetHighWaterMark();
+
   std::unique_ptr<CameraDeviceSessionHwl> session_hwl;
   status_t res = camera_device_hwl_->CreateCameraDeviceSessionHwl(
       camera_allocator_hwl_, &session_hwl);
@@ -23,6 +23,10 @@
 #include <log/log.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include "basic_capture_session.h"
 #include "capture_session_utils.h"
 #include "dual_ir_capture_session.h"
@@ -42,9 +46,27 @@ namespace google_camera_hal {
 
 constexpr char kMeasureBufferAllocationProp[] =
     "persist.vendor.camera.measure_buffer_allocation";
+constexpr char kPreImportBuffersProp[] =
+    "persist.vendor.camera.hal.preimport_buffers";
 
 static constexpr int64_t kNsPerSec = 1000000000;
 static constexpr int64_t kAllocationThreshold = 33000000;  // 33ms
+// Minimum number of new buffers in a ProcessCaptureRequest() call to import
+// them on multiple threads.
+static constexpr size_t kMinNumPreImportBuffers = 4;
+// Maximum number of threads, including the calling thread, importing buffers.
+static constexpr size_t kMaxNumImportThreads = 4;
+// Upper bound of buffers the stream buffer cache prefetches per stream.
+static constexpr uint32_t kMaxPrefetchBuffers = 3;
+
+static int64_t GetBoottimeNs() {
+  struct timespec time;
+  if (clock_gettime(CLOCK_BOOTTIME, &time)) {
+    ALOGE("%s: Getting boot time failed.", __FUNCTION__);
+    return 0;
+  }
+  return time.tv_sec * kNsPerSec + time.tv_nsec;
+}
 
 std::vector<CaptureSessionEntryFuncs>
     CameraDeviceSession::kCaptureSessionEntries = {
@@ -285,6 +307,17 @@ void CameraDeviceSession::Notify(const NotifyMessage& result) {
     }
   }
 
+  if (result.type == MessageType::kShutter) {
+    int64_t configure_streams_time_ns = configure_streams_time_ns_.exchange(0);
+    if (configure_streams_time_ns != 0) {
+      int64_t time_to_first_frame_ns =
+          GetBoottimeNs() - configure_streams_time_ns;
+      ATRACE_INT64("time_to_first_frame_ns", time_to_first_frame_ns);
+      ALOGI("%s: Time to first frame: %" PRId64 " us", __FUNCTION__,
+            time_to_first_frame_ns / 1000);
+    }
+  }
+
   if (ATRACE_ENABLED() && result.type == MessageType::kShutter) {
     int64_t timestamp_ns_diff = 0;
     int64_t current_timestamp_ns = result.message.shutter.timestamp_ns;
@@ -394,6 +427,7 @@ status_t CameraDeviceSession::Initialize(
       property_get_bool(kMeasureBufferAllocationProp, false);
   ALOGI("%s: measure buffer allocation time: %d ", __FUNCTION__,
         measure_buffer_allocation_time_);
+  pre_import_buffers_ = property_get_bool(kPreImportBuffersProp, true);
 
   camera_id_ = device_session_hwl->GetCameraId();
   device_session_hwl_ = std::move(device_session_hwl);
@@ -686,6 +720,7 @@ status_t CameraDeviceSession::ConfigureStreams(
     ATRACE_NAME("CameraDeviceSession::DestroyOldSession");
     capture_session_ = nullptr;
   }
+  stream_config_counter_ = stream_config.stream_config_counter;
 
   pending_requests_tracker_ = nullptr;
 
@@ -735,6 +770,12 @@ status_t CameraDeviceSession::ConfigureStreams(
   for (auto& stream : stream_config.streams) {
     configured_streams_map_[stream.id] = stream;
   }
+  // Size the imported buffer handle tables up front so that they don't need
+  // to grow while the first requests come in.
+  for (auto& hal_stream : hal_config) {
+    imported_buffer_handle_map_.ReserveStream(hal_stream.id,
+                                              hal_stream.max_buffers);
+  }
   if (session_buffer_management_supported_ && v2) {
     std::set<int32_t> hal_buffer_managed_stream_ids =
         device_session_hwl_->GetHalBufferManagedStreams(stream_config);
@@ -766,7 +807,12 @@ status_t CameraDeviceSession::ConfigureStreams(
   }
 
   stream_buffer_cache_manager_ =
-      StreamBufferCacheManager::Create(hal_buffer_managed_stream_ids_);
+      StreamBufferCacheManager::Create(
+          hal_buffer_managed_stream_ids_,
+          [this](const std::vector<BufferRequest>& buffer_requests,
+                 std::vector<BufferReturn>* buffer_returns) -> status_t {
+            return RequestStreamBuffers(buffer_requests, buffer_returns);
+          });
   if (stream_buffer_cache_manager_ == nullptr) {
     ALOGE("%s: Failed to create stream buffer cache manager.", __FUNCTION__);
     if (set_realtime_thread) {
@@ -821,6 +867,7 @@ status_t CameraDeviceSession::ConfigureStreams(
   thermal_throttling_notified_ = false;
   last_request_settings_ = nullptr;
   last_timestamp_ns_for_trace_ = 0;
+  configure_streams_time_ns_ = GetBoottimeNs();
 
   if (set_realtime_thread) {
     utils::UpdateThreadSched(pthread_self(), schedule_policy, &schedule_param);
@@ -828,7 +875,7 @@ status_t CameraDeviceSession::ConfigureStreams(
   return OK;
 }
 
-status_t CameraDeviceSession::UpdateBufferHandlesLocked(
+status_t CameraDeviceSession::UpdateBufferHandles(
     std::vector<StreamBuffer>* buffers, bool update_hal_buffer_managed_streams) {
   ATRACE_CALL();
   if (buffers == nullptr) {
@@ -848,15 +895,15 @@ status_t CameraDeviceSession::UpdateBufferHandlesLocked(
       continue;
     }
     // Get the buffer handle from buffer handle map.
-    BufferCache buffer_cache = {buffer.stream_id, buffer.buffer_id};
-    auto buffer_handle_it = imported_buffer_handle_map_.find(buffer_cache);
-    if (buffer_handle_it == imported_buffer_handle_map_.end()) {
+    buffer_handle_t buffer_handle =
+        imported_buffer_handle_map_.Find({buffer.stream_id, buffer.buffer_id});
+    if (buffer_handle == nullptr) {
       ALOGE("%s: Cannot find buffer handle for stream %u, buffer %" PRIu64,
             __FUNCTION__, buffer.stream_id, buffer.buffer_id);
       return NAME_NOT_FOUND;
     }
 
-    buffer.buffer = buffer_handle_it->second;
+    buffer.buffer = buffer_handle;
   }
 
   return OK;
@@ -917,22 +964,18 @@ status_t CameraDeviceSession::CreateCaptureRequestLocked(
 
   AppendOutputIntentToSettingsLocked(request, updated_request);
 
-  {
-    std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
-
-    status_t res = UpdateBufferHandlesLocked(&updated_request->input_buffers);
-    if (res != OK) {
-      ALOGE("%s: Updating input buffer handles failed: %s(%d)", __FUNCTION__,
-            strerror(-res), res);
-      return res;
-    }
+  status_t res = UpdateBufferHandles(&updated_request->input_buffers);
+  if (res != OK) {
+    ALOGE("%s: Updating input buffer handles failed: %s(%d)", __FUNCTION__,
+          strerror(-res), res);
+    return res;
+  }
 
-    res = UpdateBufferHandlesLocked(&updated_request->output_buffers);
-    if (res != OK) {
-      ALOGE("%s: Updating output buffer handles failed: %s(%d)", __FUNCTION__,
-            strerror(-res), res);
-      return res;
-    }
+  res = UpdateBufferHandles(&updated_request->output_buffers);
+  if (res != OK) {
+    ALOGE("%s: Updating output buffer handles failed: %s(%d)", __FUNCTION__,
+          strerror(-res), res);
+    return res;
   }
 
   zoom_ratio_mapper_.UpdateCaptureRequest(updated_request);
@@ -954,13 +997,33 @@ status_t CameraDeviceSession::ImportBufferHandleLocked(
   }
 
   BufferCache buffer_cache = {buffer.stream_id, buffer.buffer_id};
-  return AddImportedBufferHandlesLocked(buffer_cache, imported_buffer_handle);
+  status_t res =
+      imported_buffer_handle_map_.Add(buffer_cache, imported_buffer_handle);
+  if (res != OK) {
+    GraphicBufferMapper::get().freeBuffer(imported_buffer_handle);
+  }
+
+  return res;
 }
 
 status_t CameraDeviceSession::ImportBufferHandles(
     const std::vector<StreamBuffer>& buffers) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
+  // Most buffers are imported already, so check that without locking first.
+  bool all_imported = true;
+  for (auto& buffer : buffers) {
+    if (hal_buffer_managed_stream_ids_.find(buffer.stream_id) ==
+            hal_buffer_managed_stream_ids_.end() &&
+        !IsBufferImported(buffer.stream_id, buffer.buffer_id)) {
+      all_imported = false;
+      break;
+    }
+  }
+  if (all_imported) {
+    return OK;
+  }
+
+  std::lock_guard<std::mutex> lock(buffer_import_lock_);
 
   // Import buffers that are new to HAL.
   for (auto& buffer : buffers) {
@@ -977,7 +1040,7 @@ status_t CameraDeviceSession::ImportBufferHandles(
           __FUNCTION__, buffer.stream_id);
       continue;
     }
-    if (!IsBufferImportedLocked(buffer.stream_id, buffer.buffer_id)) {
+    if (!IsBufferImported(buffer.stream_id, buffer.buffer_id)) {
       status_t res = ImportBufferHandleLocked(buffer);
 
       if (res != OK) {
@@ -992,6 +1055,82 @@ status_t CameraDeviceSession::ImportBufferHandles(
   return OK;
 }
 
+void CameraDeviceSession::PreImportBufferHandles(
+    const std::vector<CaptureRequest>& requests) {
+  ATRACE_CALL();
+  std::vector<StreamBuffer> new_buffers;
+  for (auto& request : requests) {
+    for (auto* buffers : {&request.input_buffers, &request.output_buffers}) {
+      for (auto& buffer : *buffers) {
+        if (buffer.buffer == nullptr ||
+            hal_buffer_managed_stream_ids_.find(buffer.stream_id) !=
+                hal_buffer_managed_stream_ids_.end() ||
+            IsBufferImported(buffer.stream_id, buffer.buffer_id)) {
+          continue;
+        }
+        auto same_buffer = [&buffer](const StreamBuffer& new_buffer) {
+          return new_buffer.stream_id == buffer.stream_id &&
+                 new_buffer.buffer_id == buffer.buffer_id;
+        };
+        if (std::none_of(new_buffers.begin(), new_buffers.end(),
+                         same_buffer)) {
+          new_buffers.push_back(buffer);
+        }
+      }
+    }
+  }
+
+  if (new_buffers.size() < kMinNumPreImportBuffers) {
+    return;
+  }
+
+  int64_t start_ns = GetBoottimeNs();
+  std::vector<buffer_handle_t> imported_handles(new_buffers.size(), nullptr);
+  std::atomic<size_t> next_index = 0;
+  auto import_buffers = [&]() {
+    auto& mapper = GraphicBufferMapper::get();
+    for (size_t i = next_index++; i < new_buffers.size(); i = next_index++) {
+      status_t res = mapper.importBufferNoValidate(new_buffers[i].buffer,
+                                                   &imported_handles[i]);
+      if (res != OK) {
+        ALOGW("%s: Importing buffer %" PRIu64 " of stream %d failed: %s",
+              __FUNCTION__, new_buffers[i].buffer_id, new_buffers[i].stream_id,
+              ::android::statusToString(res).c_str());
+        imported_handles[i] = nullptr;
+      }
+    }
+  };
+
+  // The calling thread imports buffers too.
+  size_t num_threads = std::min(new_buffers.size(), kMaxNumImportThreads);
+  std::vector<std::thread> import_threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    import_threads.emplace_back(import_buffers);
+  }
+  import_buffers();
+  for (auto& import_thread : import_threads) {
+    import_thread.join();
+  }
+
+  std::lock_guard<std::mutex> lock(buffer_import_lock_);
+  for (size_t i = 0; i < new_buffers.size(); i++) {
+    if (imported_handles[i] == nullptr) {
+      continue;
+    }
+    BufferCache buffer_cache = {new_buffers[i].stream_id,
+                                new_buffers[i].buffer_id};
+    if (IsBufferImported(buffer_cache.stream_id, buffer_cache.buffer_id) ||
+        imported_buffer_handle_map_.Add(buffer_cache, imported_handles[i]) !=
+            OK) {
+      GraphicBufferMapper::get().freeBuffer(imported_handles[i]);
+    }
+  }
+
+  ALOGI("%s: Imported %zu buffers on %zu threads in %" PRId64 " us",
+        __FUNCTION__, new_buffers.size(), num_threads,
+        (GetBoottimeNs() - start_ns) / 1000);
+}
+
 status_t CameraDeviceSession::ImportRequestBufferHandles(
     const CaptureRequest& request) {
   ATRACE_CALL();
@@ -1330,6 +1469,10 @@ status_t CameraDeviceSession::ProcessCaptureRequest(
   status_t res;
   *num_processed_requests = 0;
 
+  if (pre_import_buffers_) {
+    PreImportBufferHandles(requests);
+  }
+
   for (auto& request : requests) {
     if (ATRACE_ENABLED()) {
       ATRACE_INT("request_frame_number", request.frame_number);
@@ -1430,89 +1573,57 @@ status_t CameraDeviceSession::ProcessCaptureRequest(
   return OK;
 }
 
-bool CameraDeviceSession::IsBufferImportedLocked(int32_t stream_id,
-                                                 uint32_t buffer_id) {
-  BufferCache buffer_cache = {stream_id, buffer_id};
-  return imported_buffer_handle_map_.find(buffer_cache) !=
-         imported_buffer_handle_map_.end();
-}
-
-status_t CameraDeviceSession::AddImportedBufferHandlesLocked(
-    const BufferCache& buffer_cache, buffer_handle_t buffer_handle) {
-  ATRACE_CALL();
-  auto buffer_handle_it = imported_buffer_handle_map_.find(buffer_cache);
-  if (buffer_handle_it == imported_buffer_handle_map_.end()) {
-    // Add a new buffer cache if it doesn't exist.
-    imported_buffer_handle_map_.emplace(buffer_cache, buffer_handle);
-  } else if (buffer_handle_it->second != buffer_handle) {
-    ALOGE(
-        "%s: Cached buffer handle %p doesn't match %p for stream %u buffer "
-        "%" PRIu64,
-        __FUNCTION__, buffer_handle_it->second, buffer_handle,
-        buffer_cache.stream_id, buffer_cache.buffer_id);
-    return BAD_VALUE;
-  }
-
-  return OK;
+bool CameraDeviceSession::IsBufferImported(int32_t stream_id,
+                                           uint64_t buffer_id) {
+  return imported_buffer_handle_map_.Find({stream_id, buffer_id}) != nullptr;
 }
 
 void CameraDeviceSession::RemoveBufferCache(
     const std::vector<BufferCache>& buffer_caches) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
 
   for (auto& buffer_cache : buffer_caches) {
-    auto buffer_handle_it = imported_buffer_handle_map_.find(buffer_cache);
-    if (buffer_handle_it == imported_buffer_handle_map_.end()) {
+    buffer_handle_t buffer_handle =
+        imported_buffer_handle_map_.Remove(buffer_cache);
+    if (buffer_handle == nullptr) {
       ALOGW("%s: Could not find buffer cache for stream %u buffer %" PRIu64,
             __FUNCTION__, buffer_cache.stream_id, buffer_cache.buffer_id);
       continue;
     }
 
-    device_session_hwl_->RemoveCachedBuffers(buffer_handle_it->second);
+    device_session_hwl_->RemoveCachedBuffers(buffer_handle);
 
-    status_t res =
-        GraphicBufferMapper::get().freeBuffer(buffer_handle_it->second);
+    status_t res = GraphicBufferMapper::get().freeBuffer(buffer_handle);
     if (res != OK) {
       ALOGE("%s: Freeing imported buffer failed: %s", __FUNCTION__,
             ::android::statusToString(res).c_str());
     }
-
-    imported_buffer_handle_map_.erase(buffer_handle_it);
   }
 }
 
-void CameraDeviceSession::FreeBufferHandlesLocked(int32_t stream_id) {
-  for (auto buffer_handle_it = imported_buffer_handle_map_.begin();
-       buffer_handle_it != imported_buffer_handle_map_.end();) {
-    if (buffer_handle_it->first.stream_id == stream_id) {
-      status_t res =
-          GraphicBufferMapper::get().freeBuffer(buffer_handle_it->second);
-      if (res != OK) {
-        ALOGE("%s: Freeing imported buffer failed: %s", __FUNCTION__,
-              ::android::statusToString(res).c_str());
-      }
-      buffer_handle_it = imported_buffer_handle_map_.erase(buffer_handle_it);
-    } else {
-      buffer_handle_it++;
+void CameraDeviceSession::FreeBufferHandles(int32_t stream_id) {
+  auto& mapper = GraphicBufferMapper::get();
+  std::vector<buffer_handle_t> buffer_handles =
+      imported_buffer_handle_map_.RemoveStream(stream_id);
+  for (auto buffer_handle : buffer_handles) {
+    status_t res = mapper.freeBuffer(buffer_handle);
+    if (res != OK) {
+      ALOGE("%s: Freeing imported buffer failed: %s", __FUNCTION__,
+            ::android::statusToString(res).c_str());
     }
   }
 }
 
 void CameraDeviceSession::FreeImportedBufferHandles() {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
-
   auto& mapper = GraphicBufferMapper::get();
-  for (auto buffer_handle_it : imported_buffer_handle_map_) {
-    status_t status = mapper.freeBuffer(buffer_handle_it.second);
+  for (auto buffer_handle : imported_buffer_handle_map_.RemoveAll()) {
+    status_t status = mapper.freeBuffer(buffer_handle);
     if (status != OK) {
       ALOGE("%s: Freeing imported buffer failed: %s", __FUNCTION__,
             ::android::statusToString(status).c_str());
     }
   }
-
-  imported_buffer_handle_map_.clear();
 }
 
 void CameraDeviceSession::CleanupStaleStreamsLocked(
@@ -1528,9 +1639,8 @@ void CameraDeviceSession::CleanupStaleStreamsLocked(
       }
     }
     if (!found) {
-      std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
       stream_it = configured_streams_map_.erase(stream_it);
-      FreeBufferHandlesLocked(stream_id);
+      FreeBufferHandles(stream_id);
     } else {
       stream_it++;
     }
@@ -1551,6 +1661,42 @@ status_t CameraDeviceSession::Flush() {
   return res;
 }
 
+status_t CameraDeviceSession::SignalStreamFlush(
+    const std::vector<int32_t>& stream_ids, uint32_t stream_config_counter) {
+  ATRACE_CALL();
+  std::shared_lock lock(capture_session_lock_);
+  if (capture_session_ == nullptr) {
+    return OK;
+  }
+
+  if (stream_config_counter < stream_config_counter_) {
+    ALOGD("%s: Ignoring stream flush for stream config %u (current: %u).",
+          __FUNCTION__, stream_config_counter, stream_config_counter_);
+    return OK;
+  }
+
+  status_t res = capture_session_->SignalStreamFlush(stream_ids);
+  if (res != OK) {
+    ALOGW("%s: Signaling stream flush failed: %s(%d).", __FUNCTION__,
+          strerror(-res), res);
+  }
+
+  // The framework won't request these streams again before they are removed,
+  // so return their cached buffers now instead of at the next stream
+  // configuration.
+  if (stream_buffer_cache_manager_ != nullptr) {
+    status_t cache_res =
+        stream_buffer_cache_manager_->NotifyFlushingStreams(stream_ids);
+    if (cache_res != OK) {
+      ALOGE("%s: Failed to notify SBC manager to flush streams.",
+            __FUNCTION__);
+      res = cache_res;
+    }
+  }
+
+  return res;
+}
+
 void CameraDeviceSession::AppendOutputIntentToSettingsLocked(
     const CaptureRequest& request, CaptureRequest* updated_request) {
   if (updated_request == nullptr || updated_request->settings == nullptr) {
@@ -1637,15 +1783,13 @@ status_t CameraDeviceSession::UpdateRequestedBufferHandles(
     return BAD_VALUE;
   }
 
-  std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
-
   status_t res;
   for (auto& buffer : *buffers) {
     // If buffer handle is not nullptr, we need to add the new buffer handle
     // to buffer cache.
     if (buffer.buffer != nullptr) {
       BufferCache buffer_cache = {buffer.stream_id, buffer.buffer_id};
-      res = AddImportedBufferHandlesLocked(buffer_cache, buffer.buffer);
+      res = imported_buffer_handle_map_.Add(buffer_cache, buffer.buffer);
       if (res != OK) {
         ALOGE("%s: Adding imported buffer handle failed: %s(%d)", __FUNCTION__,
               strerror(-res), res);
@@ -1654,7 +1798,7 @@ status_t CameraDeviceSession::UpdateRequestedBufferHandles(
     }
   }
 
-  res = UpdateBufferHandlesLocked(buffers,
+  res = UpdateBufferHandles(buffers,
                                   /*update_hal_buffer_managed_streams=*/true);
   if (res != OK) {
     ALOGE("%s: Updating output buffer handles failed: %s(%d)", __FUNCTION__,
@@ -1673,11 +1817,13 @@ status_t CameraDeviceSession::RegisterStreamsIntoCacheManagerLocked(
   for (auto& stream : stream_config.streams) {
     uint64_t producer_usage = 0;
     uint64_t consumer_usage = 0;
+    uint32_t max_buffers = 0;
     int32_t stream_id = -1;
     for (auto& hal_stream : hal_streams) {
       if (hal_stream.id == stream.id) {
         producer_usage = hal_stream.producer_usage;
         consumer_usage = hal_stream.consumer_usage;
+        max_buffers = hal_stream.max_buffers;
         stream_id = hal_stream.id;
       }
     }
@@ -1733,6 +1879,10 @@ status_t CameraDeviceSession::RegisterStreamsIntoCacheManagerLocked(
           return OK;
         });
 
+    // Let the cache prefetch up to half of the stream's buffers so that the
+    // framework still has buffers for in-flight requests.
+    uint32_t max_num_buffers_to_cache =
+        std::clamp(max_buffers / 2, 1u, kMaxPrefetchBuffers);
     StreamBufferCacheRegInfo reg_info = {.request_func = session_request_func,
                                          .return_func = session_return_func,
                                          .stream_id = stream_id,
@@ -1741,7 +1891,9 @@ status_t CameraDeviceSession::RegisterStreamsIntoCacheManagerLocked(
                                          .format = stream.format,
                                          .producer_flags = producer_usage,
                                          .consumer_flags = consumer_usage,
-                                         .num_buffers_to_cache = 1};
+                                         .num_buffers_to_cache = 1,
+                                         .max_num_buffers_to_cache =
+                                             max_num_buffers_to_cache};
 
     status_t res = stream_buffer_cache_manager_->RegisterStream(reg_info);
     if (res != OK) {
@@ -1912,6 +2064,93 @@ status_t CameraDeviceSession::RequestStreamBuffers(
   return OK;
 }
 
+status_t CameraDeviceSession::RequestStreamBuffers(
+    const std::vector<BufferRequest>& buffer_requests,
+    std::vector<BufferReturn>* buffer_returns) {
+  ATRACE_CALL();
+  if (buffer_returns == nullptr) {
+    ALOGE("%s: buffer_returns is nullptr", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  buffer_returns->clear();
+  std::vector<BufferRequest> tracked_requests;
+  for (auto& buffer_request : buffer_requests) {
+    status_t res = pending_requests_tracker_->WaitAndTrackAcquiredBuffers(
+        buffer_request.stream_id, buffer_request.num_buffers_requested);
+    if (res != OK) {
+      ALOGW("%s: Waiting until available buffer for stream %d failed: %s(%d)",
+            __FUNCTION__, buffer_request.stream_id, strerror(-res), res);
+      buffer_returns->push_back(
+          {.stream_id = buffer_request.stream_id,
+           .val = {.error = StreamBufferRequestError::kNoBufferAvailable}});
+      continue;
+    }
+    tracked_requests.push_back(buffer_request);
+  }
+
+  if (tracked_requests.empty()) {
+    return OK;
+  }
+
+  std::vector<BufferReturn> framework_returns;
+  BufferRequestStatus status = BufferRequestStatus::kOk;
+  {
+    std::shared_lock lock(session_callback_lock_);
+    int64_t start_ns = measure_buffer_allocation_time_ ? GetBoottimeNs() : 0;
+    status = session_callback_.request_stream_buffers(tracked_requests,
+                                                      &framework_returns);
+    if (measure_buffer_allocation_time_) {
+      int64_t elapsed_ns = GetBoottimeNs() - start_ns;
+      if (elapsed_ns > kAllocationThreshold) {
+        ALOGW("%s: buffer allocation time for %zu streams: %" PRId64 " ms",
+              __FUNCTION__, tracked_requests.size(), elapsed_ns / 1000000);
+      }
+    }
+  }
+  if (status != BufferRequestStatus::kOk) {
+    ALOGW("%s: Requesting buffers for %zu streams returned status %d",
+          __FUNCTION__, tracked_requests.size(), status);
+  }
+
+  for (auto& buffer_request : tracked_requests) {
+    // A stream the framework didn't return anything for, e.g. because the
+    // whole request failed, is retried later instead of being deactivated.
+    BufferReturn buffer_return = {
+        .stream_id = buffer_request.stream_id,
+        .val = {.error = StreamBufferRequestError::kNoBufferAvailable}};
+    for (auto& framework_return : framework_returns) {
+      if (framework_return.stream_id == buffer_request.stream_id) {
+        buffer_return = framework_return;
+        break;
+      }
+    }
+
+    std::vector<StreamBuffer>& buffers = buffer_return.val.buffers;
+    if (buffers.size() < buffer_request.num_buffers_requested) {
+      pending_requests_tracker_->TrackBufferAcquisitionFailure(
+          buffer_request.stream_id,
+          buffer_request.num_buffers_requested - buffers.size());
+    }
+
+    if (!buffers.empty()) {
+      status_t res = UpdateRequestedBufferHandles(&buffers);
+      if (res != OK) {
+        ALOGE("%s: Updating requested buffer handles for stream %d failed: "
+              "%s(%d).",
+              __FUNCTION__, buffer_request.stream_id, strerror(-res), res);
+        ReturnStreamBuffers(buffers);
+        buffers.clear();
+        buffer_return.val.error = StreamBufferRequestError::kNoBufferAvailable;
+      }
+    }
+
+    buffer_returns->push_back(std::move(buffer_return));
+  }
+
+  return OK;
+}
+
 void CameraDeviceSession::ReturnStreamBuffers(
     const std::vector<StreamBuffer>& buffers) {
   {
@@ -29,6 +29,7 @@
 #include "hal_camera_metadata.h"
 #include "hal_types.h"
 #include "hwl_types.h"
+#include "imported_buffer_handle_map.h"
 #include "pending_requests_tracker.h"
 #include "stream_buffer_cache_manager.h"
 #include "thermal_types.h"
@@ -117,6 +118,13 @@ class CameraDeviceSession {
   // Flush all pending requests.
   status_t Flush();
 
+  // Return the pending buffers of stream_ids as soon as possible because the
+  // next stream configuration will remove the streams. Calls with a
+  // stream_config_counter older than the current stream configuration are
+  // ignored.
+  status_t SignalStreamFlush(const std::vector<int32_t>& stream_ids,
+                             uint32_t stream_config_counter);
+
   // Check reconfiguration is required or not
   // old_session is old session parameter
   // new_session is new session parameter
@@ -133,16 +141,6 @@ class CameraDeviceSession {
   CameraDeviceSession() = default;
 
  private:
-  // Define buffer cache hashing in order to use BufferCache as a key of an
-  // unordered map.
-  struct BufferCacheHashing {
-    unsigned long operator()(const BufferCache& buffer_cache) const {
-      std::string s = "s" + std::to_string(buffer_cache.stream_id) + "b" +
-                      std::to_string(buffer_cache.buffer_id);
-      return std::hash<std::string>{}(s);
-    }
-  };
-
   status_t Initialize(
       std::unique_ptr<CameraDeviceSessionHwl> device_session_hwl,
       CameraBufferAllocatorHwl* camera_allocator_hwl,
@@ -155,19 +153,24 @@ class CameraDeviceSession {
   status_t InitializeBufferManagement(HalCameraMetadata* characteristics);
 
   // Update all buffer handles in buffers with the imported buffer handles.
-  // Must be protected by imported_buffer_handle_map_lock_.
-  status_t UpdateBufferHandlesLocked(
+  status_t UpdateBufferHandles(
       std::vector<StreamBuffer>* buffers,
       bool update_hal_buffer_managed_streams = false);
 
   // Import the buffer handles in the request.
   status_t ImportRequestBufferHandles(const CaptureRequest& request);
 
+  // Import the new buffers of all requests at once on a few threads if there
+  // are enough of them, e.g. in the first requests after stream
+  // configuration. Buffers that fail to import are imported again by
+  // ImportRequestBufferHandles().
+  void PreImportBufferHandles(const std::vector<CaptureRequest>& requests);
+
   // Import the buffer handles of buffers.
   status_t ImportBufferHandles(const std::vector<StreamBuffer>& buffers);
 
   // Import the buffer handle of a buffer.
-  // Must be protected by imported_buffer_handle_map_lock_.
+  // Must be protected by buffer_import_lock_.
   status_t ImportBufferHandleLocked(const StreamBuffer& buffer);
 
   // Create a request with updated buffer handles and modified settings.
@@ -175,20 +178,11 @@ class CameraDeviceSession {
   status_t CreateCaptureRequestLocked(const CaptureRequest& request,
                                       CaptureRequest* updated_request);
 
-  // Add a buffer handle to the imported buffer handle map. If the buffer cache
-  // is already in the map but the buffer handle doesn't match, it will
-  // return BAD_VALUE.
-  // Must be protected by imported_buffer_handle_map_lock_.
-  status_t AddImportedBufferHandlesLocked(const BufferCache& buffer_cache,
-                                          buffer_handle_t buffer_handle);
-
   // Return if the buffer handle for a certain buffer ID is imported.
-  // Must be protected by imported_buffer_handle_map_lock_.
-  bool IsBufferImportedLocked(int32_t stream_id, uint32_t buffer_id);
+  bool IsBufferImported(int32_t stream_id, uint64_t buffer_id);
 
   // Free all imported buffer handles belonging to the stream id.
-  // Must be protected by imported_buffer_handle_map_lock_.
-  void FreeBufferHandlesLocked(int32_t stream_id);
+  void FreeBufferHandles(int32_t stream_id);
 
   void FreeImportedBufferHandles();
 
@@ -207,6 +201,13 @@ class CameraDeviceSession {
                                 std::vector<StreamBuffer>* buffers,
                                 StreamBufferRequestError* request_status);
 
+  // Request buffers of multiple streams with a single framework call. Used by
+  // the stream buffer cache manager to batch refills. buffer_returns contains
+  // one entry per requested stream.
+  status_t RequestStreamBuffers(
+      const std::vector<BufferRequest>& buffer_requests,
+      std::vector<BufferReturn>* buffer_returns);
+
   // Invoked by HWL to return stream buffers when buffer management is
   // supported.
   void ReturnStreamBuffers(const std::vector<StreamBuffer>& buffers);
@@ -315,13 +316,12 @@ class CameraDeviceSession {
   // Session callback from HWL session. Protected by session_callback_lock_
   HwlSessionCallback hwl_session_callback_;
 
-  // imported_buffer_handle_map_lock_ protects the following variables as noted.
-  std::mutex imported_buffer_handle_map_lock_;
+  // Serializes importing buffer handles so that each buffer is imported once.
+  std::mutex buffer_import_lock_;
 
-  // Store the imported buffer handles from camera framework. Protected by
-  // imported_buffer_handle_map_lock.
-  std::unordered_map<BufferCache, buffer_handle_t, BufferCacheHashing>
-      imported_buffer_handle_map_;
+  // Store the imported buffer handles from camera framework. Lookups don't
+  // take locks.
+  ImportedBufferHandleMap imported_buffer_handle_map_;
 
   // session_lock_ protects the following variables as noted.
   std::mutex session_lock_;
@@ -332,6 +332,10 @@ class CameraDeviceSession {
   std::unique_ptr<CaptureSession>
       capture_session_;  // Protected by capture_session_lock_.
 
+  // stream_config_counter of the current stream configuration. Protected by
+  // capture_session_lock_.
+  uint32_t stream_config_counter_ = 0;
+
   // Map from a stream ID to the configured stream received from frameworks.
   // Protected by session_lock_.
   std::unordered_map<int32_t, Stream> configured_streams_map_;
@@ -442,6 +446,14 @@ class CameraDeviceSession {
 
   // Whether measure the time of buffer allocation
   bool measure_buffer_allocation_time_ = false;
+
+  // Whether to import the new buffers of a ProcessCaptureRequest() call
+  // together.
+  bool pre_import_buffers_ = true;
+
+  // CLOCK_BOOTTIME when the streams were configured, used to log the time to
+  // the first shutter. 0 once the first shutter is notified.
+  std::atomic<int64_t> configure_streams_time_ns_ = 0;
 };
 
 }  // namespace google_camera_hal
@@ -81,7 +81,7 @@ std::unique_ptr<HdrplusCaptureSession> HdrplusCaptureSession::Create(
     CameraDeviceSessionHwl* device_session_hwl,
     const StreamConfiguration& stream_config,
     ProcessCaptureResultFunc process_capture_result,
-    ProcessBatchCaptureResultFunc /*process_batch_capture_result*/,
+    ProcessBatchCaptureResultFunc process_batch_capture_result,
     NotifyFunc notify, HwlSessionCallback /*session_callback*/,
     std::vector<HalStream>* hal_configured_streams,
     CameraBufferAllocatorHwl* /*camera_allocator_hwl*/) {
@@ -93,9 +93,9 @@ std::unique_ptr<HdrplusCaptureSession> HdrplusCaptureSession::Create(
     return nullptr;
   }
 
-  status_t res = session->Initialize(device_session_hwl, stream_config,
-                                     process_capture_result, notify,
-                                     hal_configured_streams);
+  status_t res = session->Initialize(
+      device_session_hwl, stream_config, process_capture_result,
+      process_batch_capture_result, notify, hal_configured_streams);
   if (res != OK) {
     ALOGE("%s: Initializing HdrplusCaptureSession failed: %s (%d).",
           __FUNCTION__, strerror(-res), res);
@@ -448,8 +448,9 @@ status_t HdrplusCaptureSession::SetupHdrplusProcessChain(
 status_t HdrplusCaptureSession::Initialize(
     CameraDeviceSessionHwl* device_session_hwl,
     const StreamConfiguration& stream_config,
-    ProcessCaptureResultFunc process_capture_result, NotifyFunc notify,
-    std::vector<HalStream>* hal_configured_streams) {
+    ProcessCaptureResultFunc process_capture_result,
+    ProcessBatchCaptureResultFunc process_batch_capture_result,
+    NotifyFunc notify, std::vector<HalStream>* hal_configured_streams) {
   ATRACE_CALL();
   if (!IsStreamConfigurationSupported(device_session_hwl, stream_config)) {
     ALOGE("%s: stream configuration is not supported.", __FUNCTION__);
@@ -485,7 +486,8 @@ status_t HdrplusCaptureSession::Initialize(
   // Create result dispatcher
   result_dispatcher_ =
       ResultDispatcher::Create(kPartialResult, process_capture_result, notify,
-                               stream_config, "HdrplusDispatcher");
+                               stream_config, "HdrplusDispatcher",
+                               process_batch_capture_result);
   if (result_dispatcher_ == nullptr) {
     ALOGE("%s: Cannot create result dispatcher.", __FUNCTION__);
     return UNKNOWN_ERROR;
@@ -81,11 +81,12 @@ class HdrplusCaptureSession : public CaptureSession {
   static const uint32_t kRawMinBufferCount = 12;
   static constexpr uint32_t kPartialResult = 1;
   static const android_pixel_format_t kHdrplusRawFormat = HAL_PIXEL_FORMAT_RAW10;
-  status_t Initialize(CameraDeviceSessionHwl* device_session_hwl,
-                      const StreamConfiguration& stream_config,
-                      ProcessCaptureResultFunc process_capture_result,
-                      NotifyFunc notify,
-                      std::vector<HalStream>* hal_configured_streams);
+  status_t Initialize(
+      CameraDeviceSessionHwl* device_session_hwl,
+      const StreamConfiguration& stream_config,
+      ProcessCaptureResultFunc process_capture_result,
+      ProcessBatchCaptureResultFunc process_batch_capture_result,
+      NotifyFunc notify, std::vector<HalStream>* hal_configured_streams);
 
   // Setup realtime process chain
   status_t SetupRealtimeProcessChain(
@@ -53,6 +53,8 @@ class RealtimeZslRequestProcessor : public RequestProcessor {
   status_t ProcessRequest(const CaptureRequest& request) override;
 
   status_t Flush() override;
+
+  status_t SignalStreamFlush(const std::vector<int32_t>& stream_ids) override;
   // Override functions of RequestProcessor end.
 
  protected:
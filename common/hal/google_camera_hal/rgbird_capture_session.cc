@@ -91,7 +91,7 @@ std::unique_ptr<CaptureSession> RgbirdCaptureSession::Create(
     CameraDeviceSessionHwl* device_session_hwl,
     const StreamConfiguration& stream_config,
     ProcessCaptureResultFunc process_capture_result,
-    ProcessBatchCaptureResultFunc /*process_batch_capture_result*/,
+    ProcessBatchCaptureResultFunc process_batch_capture_result,
     NotifyFunc notify, HwlSessionCallback session_callback,
     std::vector<HalStream>* hal_configured_streams,
     CameraBufferAllocatorHwl* /*camera_allocator_hwl*/) {
@@ -104,7 +104,8 @@ std::unique_ptr<CaptureSession> RgbirdCaptureSession::Create(
   }
 
   status_t res = session->Initialize(
-      device_session_hwl, stream_config, process_capture_result, notify,
+      device_session_hwl, stream_config, process_capture_result,
+      process_batch_capture_result, notify,
       session_callback.request_stream_buffers, hal_configured_streams);
   if (res != OK) {
     ALOGE("%s: Initializing RgbirdCaptureSession failed: %s (%d).",
@@ -949,8 +950,9 @@ status_t RgbirdCaptureSession::InitializeCameraIds(
 status_t RgbirdCaptureSession::Initialize(
     CameraDeviceSessionHwl* device_session_hwl,
     const StreamConfiguration& stream_config,
-    ProcessCaptureResultFunc process_capture_result, NotifyFunc notify,
-    HwlRequestBuffersFunc request_stream_buffers,
+    ProcessCaptureResultFunc process_capture_result,
+    ProcessBatchCaptureResultFunc process_batch_capture_result,
+    NotifyFunc notify, HwlRequestBuffersFunc request_stream_buffers,
     std::vector<HalStream>* hal_configured_streams) {
   ATRACE_CALL();
   if (!IsStreamConfigurationSupported(device_session_hwl, stream_config)) {
@@ -994,7 +996,8 @@ status_t RgbirdCaptureSession::Initialize(
   // Create result dispatcher
   result_dispatcher_ =
       ResultDispatcher::Create(kPartialResult, process_capture_result, notify,
-                               stream_config, "RgbirdDispatcher");
+                               stream_config, "RgbirdDispatcher",
+                               process_batch_capture_result);
   if (result_dispatcher_ == nullptr) {
     ALOGE("%s: Cannot create result dispatcher.", __FUNCTION__);
     return UNKNOWN_ERROR;
@@ -89,12 +89,13 @@ class RgbirdCaptureSession : public CaptureSession {
   static const android_pixel_format_t kHdrplusRawFormat = HAL_PIXEL_FORMAT_RAW10;
   static const uint32_t kDefaultInternalBufferCount = 8;
 
-  status_t Initialize(CameraDeviceSessionHwl* device_session_hwl,
-                      const StreamConfiguration& stream_config,
-                      ProcessCaptureResultFunc process_capture_result,
-                      NotifyFunc notify,
-                      HwlRequestBuffersFunc request_stream_buffers,
-                      std::vector<HalStream>* hal_configured_streams);
+  status_t Initialize(
+      CameraDeviceSessionHwl* device_session_hwl,
+      const StreamConfiguration& stream_config,
+      ProcessCaptureResultFunc process_capture_result,
+      ProcessBatchCaptureResultFunc process_batch_capture_result,
+      NotifyFunc notify, HwlRequestBuffersFunc request_stream_buffers,
+      std::vector<HalStream>* hal_configured_streams);
 
   // Create a process chain that contains a realtime process block and a
   // depth process block.
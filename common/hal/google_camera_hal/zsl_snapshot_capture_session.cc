@@ -763,8 +763,19 @@ status_t ZslSnapshotCaptureSession::Initialize(
     return UNKNOWN_ERROR;
   }
 
+  // Keep only the result metadata the snapshot pipeline uses with ZSL
+  // buffers, if the HWL lists it.
+  std::vector<uint32_t> zsl_metadata_tags;
+  camera_metadata_ro_entry zsl_metadata_keys_entry;
+  res = characteristics->Get(VendorTagIds::kZslMetadataKeys,
+                             &zsl_metadata_keys_entry);
+  if (res == OK) {
+    zsl_metadata_tags.assign(
+        zsl_metadata_keys_entry.data.i32,
+        zsl_metadata_keys_entry.data.i32 + zsl_metadata_keys_entry.count);
+  }
   internal_stream_manager_ = InternalStreamManager::Create(
-      /*buffer_allocator=*/nullptr, partial_result_count_);
+      /*buffer_allocator=*/nullptr, partial_result_count_, zsl_metadata_tags);
   if (internal_stream_manager_ == nullptr) {
     ALOGE("%s: Cannot create internal stream manager.", __FUNCTION__);
     return UNKNOWN_ERROR;
@@ -879,6 +890,14 @@ status_t ZslSnapshotCaptureSession::Flush() {
   return realtime_request_processor_->Flush();
 }
 
+status_t ZslSnapshotCaptureSession::SignalStreamFlush(
+    const std::vector<int32_t>& stream_ids) {
+  ATRACE_CALL();
+  // Requests of the snapshot pipeline are already in flight once they reach
+  // the snapshot process block, so only the realtime pipeline is signaled.
+  return realtime_request_processor_->SignalStreamFlush(stream_ids);
+}
+
 void ZslSnapshotCaptureSession::ProcessCaptureResult(
     std::unique_ptr<CaptureResult> result) {
   ATRACE_CALL();
@@ -129,6 +129,14 @@ class CameraDeviceSessionHwl {
   // Flush all pending requests.
   virtual status_t Flush() = 0;
 
+  // Return the pending buffers of stream_ids as soon as possible because the
+  // streams will be removed by the next stream configuration. Requests keep
+  // being processed for the other streams.
+  virtual status_t SignalStreamFlush(
+      const std::vector<int32_t>& /*stream_ids*/) {
+    return OK;
+  }
+
   // Return the camera ID that this camera device session is associated with.
   virtual uint32_t GetCameraId() const = 0;
 
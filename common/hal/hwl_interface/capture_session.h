@@ -58,6 +58,13 @@ class CaptureSession {
 
   // Flush all pending capture requests.
   virtual status_t Flush() = 0;
+
+  // Return the pending buffers of stream_ids as soon as possible. See
+  // CameraDeviceSessionHwl::SignalStreamFlush().
+  virtual status_t SignalStreamFlush(
+      const std::vector<int32_t>& /*stream_ids*/) {
+    return OK;
+  }
 };
 
 // ExternalCaptureSessionFactory defines the interface of an external capture
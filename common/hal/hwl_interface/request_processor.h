@@ -66,6 +66,13 @@ class RequestProcessor {
 
   // Flush all pending requests.
   virtual status_t Flush() = 0;
+
+  // Return the pending buffers of stream_ids as soon as possible. See
+  // CameraDeviceSessionHwl::SignalStreamFlush().
+  virtual status_t SignalStreamFlush(
+      const std::vector<int32_t>& /*stream_ids*/) {
+    return OK;
+  }
 };
 
 }  // namespace google_camera_hal
@@ -17,12 +17,15 @@
 #define LOG_TAG "CameraDeviceSessionTests"
 #include <dlfcn.h>
 #include <log/log.h>
+#include <stdio.h>
 #include <sys/stat.h>
 
 #include <gtest/gtest.h>
 #include "utils.h"
 
 #include <algorithm>
+#include <chrono>
+#include <thread>
 
 #include "gralloc_buffer_allocator.h"
 #include "hwl_types.h"
@@ -34,6 +37,7 @@ namespace google_camera_hal {
 
 using ::testing::_;
 using ::testing::AtLeast;
+using ::testing::ElementsAre;
 using ::testing::Return;
 
 // HAL external capture session library path
@@ -479,5 +483,156 @@ TEST_F(CameraDeviceSessionTests, PreviewRequests) {
   allocator->FreeBuffers(&preview_buffers);
 }
 
+// Test that stream flushes for an older stream configuration are ignored.
+TEST_F(CameraDeviceSessionTests, SignalStreamFlush) {
+  static constexpr uint32_t kStreamConfigCounter = 2;
+  std::unique_ptr<MockDeviceSessionHwl> session_hwl;
+  CreateMockSessionHwlAndCheck(&session_hwl);
+  session_hwl->DelegateCallsToFakeSession();
+
+  StreamConfiguration preview_config;
+  test_utils::GetPreviewOnlyStreamConfiguration(&preview_config, 640, 480);
+  preview_config.stream_config_counter = kStreamConfigCounter;
+  const int32_t stream_id = preview_config.streams[0].id;
+
+  // Only the flushes for the current and a newer configuration reach the HWL.
+  EXPECT_CALL(*session_hwl, SignalStreamFlush(ElementsAre(stream_id)))
+      .Times(2)
+      .WillRepeatedly(Return(OK));
+
+  std::unique_ptr<CameraDeviceSession> session;
+  CreateSessionAndCheck(std::move(session_hwl), &session);
+
+  // Nothing is flushed before the streams are configured.
+  EXPECT_EQ(session->SignalStreamFlush({stream_id}, kStreamConfigCounter), OK);
+
+  ConfigureStreamsReturn hal_config;
+  ASSERT_EQ(session->ConfigureStreams(preview_config, /*interfaceV3*/ false,
+                                      &hal_config),
+            OK);
+
+  EXPECT_EQ(session->SignalStreamFlush({stream_id}, kStreamConfigCounter - 1),
+            OK);
+  EXPECT_EQ(session->SignalStreamFlush({stream_id}, kStreamConfigCounter), OK);
+  EXPECT_EQ(session->SignalStreamFlush({stream_id}, kStreamConfigCounter + 1),
+            OK);
+}
+
+// Submit requests from one thread while the results are received on another
+// and report the time per request. After the first round all buffers are
+// imported, so this mostly measures the imported buffer handle lookups.
+// Disabled by default since it only reports timings.
+TEST_F(CameraDeviceSessionTests,
+       DISABLED_ProcessCaptureRequestContentionBenchmark) {
+  static constexpr uint32_t kNumRequests = 1000;
+  std::unique_ptr<MockDeviceSessionHwl> session_hwl;
+  CreateMockSessionHwlAndCheck(&session_hwl);
+  session_hwl->DelegateCallsToFakeSession();
+  EXPECT_CALL(*session_hwl, SubmitRequests(_, _)).Times(kNumRequests);
+
+  std::unique_ptr<CameraDeviceSession> session;
+  CreateSessionAndCheck(std::move(session_hwl), &session);
+
+  CameraDeviceSessionCallback session_callback = {
+      .process_capture_result =
+          [&](std::unique_ptr<CaptureResult> result) {
+            ProcessCaptureResult(std::move(result));
+          },
+      .notify = [&](const NotifyMessage& message) { Notify(message); },
+  };
+
+  ThermalCallback thermal_callback = {
+      .register_thermal_changed_callback =
+          google_camera_hal::RegisterThermalChangedCallbackFunc(
+              [](google_camera_hal::NotifyThrottlingFunc /*notify_throttling*/,
+                 bool /*filter_type*/,
+                 google_camera_hal::TemperatureType /*type*/) {
+                return INVALID_OPERATION;
+              }),
+      .unregister_thermal_changed_callback =
+          google_camera_hal::UnregisterThermalChangedCallbackFunc([]() {}),
+  };
+
+  session->SetSessionCallback(session_callback, thermal_callback);
+
+  StreamConfiguration preview_config;
+  test_utils::GetPreviewOnlyStreamConfiguration(&preview_config, 640, 480);
+  ConfigureStreamsReturn hal_config;
+  ASSERT_EQ(session->ConfigureStreams(preview_config, /*interfaceV3*/ false,
+                                      &hal_config),
+            OK);
+  ASSERT_EQ(hal_config.hal_streams.size(), static_cast<uint32_t>(1));
+  const HalStream& hal_stream = hal_config.hal_streams[0];
+
+  auto allocator = GrallocBufferAllocator::Create();
+  ASSERT_NE(allocator, nullptr);
+
+  HalBufferDescriptor buffer_descriptor = {
+      .width = preview_config.streams[0].width,
+      .height = preview_config.streams[0].height,
+      .format = hal_stream.override_format,
+      .producer_flags =
+          hal_stream.producer_usage | preview_config.streams[0].usage,
+      .consumer_flags = hal_stream.consumer_usage,
+      .immediate_num_buffers = hal_stream.max_buffers,
+      .max_num_buffers = hal_stream.max_buffers,
+  };
+
+  std::vector<buffer_handle_t> preview_buffers;
+  ASSERT_EQ(allocator->AllocateBuffers(buffer_descriptor, &preview_buffers), OK);
+
+  std::unique_ptr<HalCameraMetadata> preview_settings;
+  ASSERT_EQ(session->ConstructDefaultRequestSettings(RequestTemplate::kPreview,
+                                                     &preview_settings),
+            OK);
+
+  auto get_preview_buffer = [&](uint32_t frame_number) {
+    uint32_t buffer_index = frame_number % preview_buffers.size();
+    return StreamBuffer{
+        .stream_id = preview_config.streams[0].id,
+        .buffer_id = buffer_index,
+        .buffer = preview_buffers[buffer_index],
+        .status = BufferStatus::kOk,
+        .acquire_fence = nullptr,
+        .release_fence = nullptr,
+    };
+  };
+
+  ClearResultsAndMessages();
+  std::thread result_thread([&] {
+    for (uint32_t i = 0; i < kNumRequests; i++) {
+      CaptureRequest request = {.frame_number = i,
+                                .output_buffers = {get_preview_buffer(i)}};
+      EXPECT_EQ(WaitForResult(request, kCaptureTimeoutMs), OK);
+    }
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < kNumRequests; i++) {
+    std::vector<CaptureRequest> requests(1);
+    requests[0].frame_number = i;
+    // Like a repeating request, only the first request has settings.
+    if (i == 0) {
+      requests[0].settings = HalCameraMetadata::Clone(preview_settings.get());
+    }
+    requests[0].output_buffers = {get_preview_buffer(i)};
+
+    uint32_t num_processed_requests = 0;
+    ASSERT_EQ(session->ProcessCaptureRequest(requests, &num_processed_requests),
+              OK);
+    ASSERT_EQ(num_processed_requests, requests.size());
+  }
+  result_thread.join();
+  auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+  printf("%u requests with %zu buffers: %.1f us/request\n", kNumRequests,
+         preview_buffers.size(),
+         static_cast<double>(elapsed_ns) / kNumRequests / 1000);
+
+  allocator->FreeBuffers(&preview_buffers);
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CameraMetadataPoolTests"
+#include <log/log.h>
+
+#include <camera_metadata_pool.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <system/camera_metadata.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+static constexpr size_t kNumEntries = 64;
+static constexpr size_t kDataBytes = 1024;
+
+TEST(CameraMetadataPoolTests, ReuseFreedBuffer) {
+  CameraMetadataPool pool;
+  camera_metadata_t* metadata = pool.Allocate(kNumEntries, kDataBytes);
+  ASSERT_NE(metadata, nullptr);
+  EXPECT_EQ(get_camera_metadata_entry_capacity(metadata), kNumEntries);
+  EXPECT_EQ(get_camera_metadata_data_capacity(metadata), kDataBytes);
+  pool.Free(metadata);
+
+  // A smaller request in the same size class reuses the buffer.
+  camera_metadata_t* reused = pool.Allocate(kNumEntries / 2, kDataBytes);
+  ASSERT_NE(reused, nullptr);
+  EXPECT_EQ(reused, metadata);
+  EXPECT_EQ(get_camera_metadata_entry_count(reused), 0u);
+  EXPECT_EQ(get_camera_metadata_entry_capacity(reused), kNumEntries / 2);
+  pool.Free(reused);
+
+  CameraMetadataPool::Stats stats = pool.GetStats();
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.outstanding_bytes, 0u);
+  EXPECT_GT(stats.free_bytes, 0u);
+}
+
+TEST(CameraMetadataPoolTests, Clone) {
+  CameraMetadataPool pool;
+  camera_metadata_t* metadata =
+      allocate_camera_metadata(kNumEntries, kDataBytes);
+  ASSERT_NE(metadata, nullptr);
+  uint8_t mode = ANDROID_CONTROL_MODE_AUTO;
+  ASSERT_EQ(add_camera_metadata_entry(metadata, ANDROID_CONTROL_MODE, &mode, 1),
+            OK);
+
+  camera_metadata_t* clone = pool.Clone(metadata);
+  ASSERT_NE(clone, nullptr);
+  camera_metadata_ro_entry_t entry;
+  ASSERT_EQ(find_camera_metadata_ro_entry(clone, ANDROID_CONTROL_MODE, &entry),
+            OK);
+  EXPECT_EQ(entry.data.u8[0], ANDROID_CONTROL_MODE_AUTO);
+
+  pool.Free(clone);
+  free_camera_metadata(metadata);
+}
+
+TEST(CameraMetadataPoolTests, CopyIntoBuffer) {
+  CameraMetadataPool pool;
+  camera_metadata_t* metadata =
+      allocate_camera_metadata(kNumEntries, kDataBytes);
+  ASSERT_NE(metadata, nullptr);
+  size_t size = get_camera_metadata_size(metadata);
+
+  void* buffer = pool.AllocateBuffer(size);
+  ASSERT_NE(buffer, nullptr);
+  memcpy(buffer, metadata, size);
+  camera_metadata_t* copy = reinterpret_cast<camera_metadata_t*>(buffer);
+  EXPECT_EQ(validate_camera_metadata_structure(copy, &size), OK);
+  EXPECT_EQ(get_camera_metadata_entry_capacity(copy), kNumEntries);
+  pool.Free(copy);
+  free_camera_metadata(metadata);
+
+  EXPECT_EQ(pool.Allocate(kNumEntries, kDataBytes), buffer);
+  pool.Free(reinterpret_cast<camera_metadata_t*>(buffer));
+}
+
+TEST(CameraMetadataPoolTests, BypassAndForeignBuffers) {
+  CameraMetadataPool pool;
+
+  // Buffers that don't fit in any size class bypass the pool.
+  camera_metadata_t* large = pool.Allocate(kNumEntries, 1024 * 1024);
+  ASSERT_NE(large, nullptr);
+  pool.Free(large);
+
+  // Buffers that don't come from the pool are freed directly.
+  pool.Free(allocate_camera_metadata(kNumEntries, kDataBytes));
+
+  CameraMetadataPool::Stats stats = pool.GetStats();
+  EXPECT_EQ(stats.bypassed, 1u);
+  EXPECT_EQ(stats.hits + stats.misses, 0u);
+  EXPECT_EQ(stats.free_bytes, 0u);
+}
+
+TEST(CameraMetadataPoolTests, Detach) {
+  CameraMetadataPool pool;
+  camera_metadata_t* metadata = pool.Allocate(kNumEntries, kDataBytes);
+  ASSERT_NE(metadata, nullptr);
+
+  pool.Detach(metadata);
+  EXPECT_EQ(pool.GetStats().outstanding_bytes, 0u);
+
+  // Detached buffers are owned by the caller.
+  free_camera_metadata(metadata);
+}
+
+TEST(CameraMetadataPoolTests, HighWaterMark) {
+  CameraMetadataPool pool;
+  camera_metadata_t* first = pool.Allocate(kNumEntries, kDataBytes);
+  camera_metadata_t* second = pool.Allocate(kNumEntries, kDataBytes);
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+
+  size_t peak = pool.GetStats().outstanding_bytes;
+  pool.Free(first);
+  pool.Free(second);
+  EXPECT_EQ(pool.GetStats().high_water_bytes, peak);
+
+  pool.ResetHighWaterMark();
+  EXPECT_EQ(pool.GetStats().high_water_bytes, 0u);
+
+  first = pool.Allocate(kNumEntries, kDataBytes);
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(pool.GetStats().high_water_bytes, peak / 2);
+  pool.Free(first);
+}
+
+// Keeping a fixed number of buffers in flight only misses until every buffer
+// was allocated once.
+TEST(CameraMetadataPoolTests, SteadyStateReuse) {
+  static constexpr size_t kIterations = 1000;
+  static constexpr size_t kInFlight = 8;
+  CameraMetadataPool pool;
+  camera_metadata_t* in_flight[kInFlight] = {};
+  for (size_t i = 0; i < kIterations; i++) {
+    camera_metadata_t*& slot = in_flight[i % kInFlight];
+    pool.Free(slot);
+    slot = pool.Allocate(kNumEntries, kDataBytes);
+    ASSERT_NE(slot, nullptr);
+  }
+  for (auto& slot : in_flight) {
+    pool.Free(slot);
+  }
+
+  CameraMetadataPool::Stats stats = pool.GetStats();
+  EXPECT_EQ(stats.misses, kInFlight);
+  EXPECT_EQ(stats.hits, kIterations - kInFlight);
+}
+
+// Buffers freed from several threads, mixed with buffers that don't come from
+// the pool, all return to the pool.
+TEST(CameraMetadataPoolTests, ConcurrentFree) {
+  static constexpr size_t kNumThreads = 4;
+  static constexpr size_t kIterations = 1000;
+  static constexpr size_t kInFlight = 64;
+  CameraMetadataPool pool;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&pool, t]() {
+      std::vector<camera_metadata_t*> in_flight(kInFlight, nullptr);
+      for (size_t i = 0; i < kIterations; i++) {
+        camera_metadata_t*& slot = in_flight[i % kInFlight];
+        pool.Free(slot);
+        // Alternate between two size classes.
+        slot = pool.Allocate(kNumEntries, kDataBytes << ((i + t) % 2));
+        ASSERT_NE(slot, nullptr);
+        pool.Free(allocate_camera_metadata(kNumEntries, kDataBytes));
+      }
+      for (auto& slot : in_flight) {
+        pool.Free(slot);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  CameraMetadataPool::Stats stats = pool.GetStats();
+  EXPECT_EQ(stats.hits + stats.misses, kNumThreads * kIterations);
+  EXPECT_EQ(stats.bypassed, 0u);
+  EXPECT_EQ(stats.outstanding_bytes, 0u);
+  EXPECT_GT(stats.high_water_bytes, 0u);
+  EXPECT_GT(stats.free_bytes, 0u);
+}
+
+// Compare the pool with allocating and freeing camera metadata directly. Only
+// reports timings, so it's disabled by default.
+TEST(CameraMetadataPoolTests, DISABLED_Throughput) {
+  static constexpr size_t kIterations = 10000;
+  static constexpr size_t kInFlight = 8;
+  CameraMetadataPool pool;
+  camera_metadata_t* in_flight[kInFlight] = {};
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kIterations; i++) {
+    camera_metadata_t*& slot = in_flight[i % kInFlight];
+    pool.Free(slot);
+    slot = pool.Allocate(kNumEntries, kDataBytes);
+    ASSERT_NE(slot, nullptr);
+  }
+  auto pool_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  for (auto& slot : in_flight) {
+    pool.Free(slot);
+    slot = nullptr;
+  }
+
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kIterations; i++) {
+    camera_metadata_t*& slot = in_flight[i % kInFlight];
+    if (slot != nullptr) {
+      free_camera_metadata(slot);
+    }
+    slot = allocate_camera_metadata(kNumEntries, kDataBytes);
+    ASSERT_NE(slot, nullptr);
+  }
+  auto malloc_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  for (auto& slot : in_flight) {
+    free_camera_metadata(slot);
+  }
+
+  CameraMetadataPool::Stats stats = pool.GetStats();
+  printf(
+      "Pool: %.1f ns/buffer (hits %llu, misses %llu), "
+      "malloc: %.1f ns/buffer\n",
+      static_cast<double>(pool_ns) / kIterations,
+      static_cast<unsigned long long>(stats.hits),
+      static_cast<unsigned long long>(stats.misses),
+      static_cast<double>(malloc_ns) / kIterations);
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FrameTimeoutWheelTests"
+#include <log/log.h>
+
+#include <frame_timeout_wheel.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <map>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+using Clock = FrameTimeoutWheel::Clock;
+using std::chrono::milliseconds;
+
+static constexpr milliseconds kTimeout = milliseconds(100);
+static constexpr uint32_t kNumSlots = 10;
+static constexpr milliseconds kTick = kTimeout / kNumSlots;
+
+// All tests use a fake time starting at kStart.
+static const Clock::time_point kStart = Clock::time_point() + milliseconds(1);
+
+TEST(FrameTimeoutWheelTests, EmptyWheel) {
+  FrameTimeoutWheel wheel(kTimeout, kNumSlots);
+  EXPECT_TRUE(wheel.Empty());
+
+  std::vector<uint32_t> expired;
+  wheel.Advance(kStart, &expired);
+  wheel.Advance(kStart + 10 * kTimeout, &expired);
+  EXPECT_TRUE(expired.empty());
+  EXPECT_TRUE(wheel.Empty());
+}
+
+TEST(FrameTimeoutWheelTests, ScheduleAndAdvance) {
+  FrameTimeoutWheel wheel(kTimeout, kNumSlots);
+  wheel.Schedule(/*frame_number=*/1, kStart);
+  EXPECT_FALSE(wheel.Empty());
+  EXPECT_EQ(wheel.GetNextTick(), kStart + kTick);
+
+  std::vector<uint32_t> expired;
+  wheel.Advance(kStart + kTimeout / 2, &expired);
+  EXPECT_TRUE(expired.empty());
+  wheel.Schedule(/*frame_number=*/2, kStart + kTimeout / 2);
+
+  wheel.Advance(kStart + kTimeout - milliseconds(1), &expired);
+  EXPECT_TRUE(expired.empty());
+  wheel.Advance(kStart + kTimeout, &expired);
+  EXPECT_EQ(expired, std::vector<uint32_t>({1}));
+  EXPECT_FALSE(wheel.Empty());
+
+  expired.clear();
+  wheel.Advance(kStart + kTimeout * 3 / 2, &expired);
+  EXPECT_EQ(expired, std::vector<uint32_t>({2}));
+  EXPECT_TRUE(wheel.Empty());
+}
+
+// Frames expire no earlier than one timeout and less than one tick after it,
+// wherever within a tick they are scheduled, if the wheel is advanced at
+// least once per tick.
+TEST(FrameTimeoutWheelTests, DeadlineRounding) {
+  static constexpr milliseconds kStep = milliseconds(1);
+  static constexpr uint32_t kNumFrames = 50;
+  static constexpr uint32_t kScheduleInterval = 7;
+  FrameTimeoutWheel wheel(kTimeout, kNumSlots);
+  std::map<uint32_t, Clock::time_point> scheduled_times;
+  std::map<uint32_t, Clock::time_point> expired_times;
+
+  std::vector<uint32_t> expired;
+  uint32_t frame_number = 0;
+  for (uint32_t step = 0; expired_times.size() < kNumFrames; step++) {
+    ASSERT_LT(step, kNumFrames * kScheduleInterval + 2 * kTimeout / kStep);
+    Clock::time_point now = kStart + step * kStep;
+    expired.clear();
+    wheel.Advance(now, &expired);
+    for (uint32_t expired_frame : expired) {
+      EXPECT_EQ(expired_times.count(expired_frame), 0u)
+          << "Frame " << expired_frame << " expired twice";
+      expired_times[expired_frame] = now;
+    }
+
+    if (step % kScheduleInterval == 0 && frame_number < kNumFrames) {
+      wheel.Schedule(frame_number, now);
+      scheduled_times[frame_number] = now;
+      frame_number++;
+    }
+  }
+
+  for (auto& [expired_frame, expired_time] : expired_times) {
+    auto delay = expired_time - scheduled_times[expired_frame];
+    EXPECT_GE(delay, kTimeout) << "Frame " << expired_frame;
+    EXPECT_LT(delay, kTimeout + kTick) << "Frame " << expired_frame;
+  }
+  EXPECT_TRUE(wheel.Empty());
+}
+
+// Keep scheduling frames for many timeouts so that the current slot wraps
+// around the wheel several times.
+TEST(FrameTimeoutWheelTests, WrapAround) {
+  static constexpr uint32_t kNumTicks = 10 * (kNumSlots + 2);
+  FrameTimeoutWheel wheel(kTimeout, kNumSlots);
+  std::vector<uint32_t> all_expired;
+  std::vector<uint32_t> expired;
+  for (uint32_t tick = 0; tick < kNumTicks + 2 * kNumSlots; tick++) {
+    Clock::time_point now = kStart + tick * kTick;
+    expired.clear();
+    wheel.Advance(now, &expired);
+    all_expired.insert(all_expired.end(), expired.begin(), expired.end());
+    if (tick < kNumTicks) {
+      wheel.Schedule(/*frame_number=*/tick, now);
+    }
+  }
+
+  EXPECT_TRUE(wheel.Empty());
+  ASSERT_EQ(all_expired.size(), kNumTicks);
+  for (uint32_t i = 0; i < kNumTicks; i++) {
+    EXPECT_EQ(all_expired[i], i);
+  }
+}
+
+// A frame scheduled after the wheel ran empty starts a new tick sequence
+// instead of expiring right away.
+TEST(FrameTimeoutWheelTests, ScheduleAfterIdle) {
+  FrameTimeoutWheel wheel(kTimeout, kNumSlots);
+  std::vector<uint32_t> expired;
+  wheel.Schedule(/*frame_number=*/1, kStart);
+  wheel.Advance(kStart + kTimeout, &expired);
+  ASSERT_EQ(expired, std::vector<uint32_t>({1}));
+  ASSERT_TRUE(wheel.Empty());
+
+  Clock::time_point later = kStart + 100 * kTimeout;
+  expired.clear();
+  wheel.Schedule(/*frame_number=*/2, later);
+  EXPECT_EQ(wheel.GetNextTick(), later + kTick);
+  wheel.Advance(later + kTimeout - milliseconds(1), &expired);
+  EXPECT_TRUE(expired.empty());
+  wheel.Advance(later + kTimeout, &expired);
+  EXPECT_EQ(expired, std::vector<uint32_t>({2}));
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -19,8 +19,11 @@
 
 #include <gtest/gtest.h>
 #include <hal_camera_metadata.h>
+#include <stdio.h>
 #include <system/camera_metadata.h>
 
+#include <chrono>
+
 namespace android {
 namespace google_camera_hal {
 
@@ -355,5 +358,182 @@ TEST(HalCameraMetadataTests, GetByEntryIndex) {
   ASSERT_NE(res, OK) << "Get invalid index 1 failed";
 }
 
+// Return one single value entry for every known tag of the control and
+// sensor sections, in the same order as the tags. Values point to data.
+static std::vector<camera_metadata_ro_entry> GetTestEntries(
+    const int64_t* data) {
+  std::vector<camera_metadata_ro_entry> entries;
+  const std::pair<uint32_t, uint32_t> kTagRanges[] = {
+      {ANDROID_CONTROL_START, ANDROID_CONTROL_END},
+      {ANDROID_SENSOR_START, ANDROID_SENSOR_END}};
+  for (auto& [start, end] : kTagRanges) {
+    for (uint32_t tag = start; tag < end; tag++) {
+      if (get_camera_metadata_tag_type(tag) == -1) {
+        continue;
+      }
+      camera_metadata_ro_entry entry = {};
+      entry.tag = tag;
+      entry.count = 1;
+      entry.data.i64 = data;
+      entries.push_back(entry);
+    }
+  }
+
+  return entries;
+}
+
+TEST(HalCameraMetadataTests, Reserve) {
+  auto hal_metadata =
+      HalCameraMetadata::Create(kDefaultNumEntries, kDefaultDataBytes);
+  ASSERT_NE(hal_metadata, nullptr) << "Creating hal_metadata failed.";
+
+  int64_t data = 0;
+  auto entries = GetTestEntries(&data);
+  ASSERT_EQ(hal_metadata->Reserve(entries.size() + 1,
+                                  entries.size() * sizeof(int64_t)),
+            OK);
+
+  // Nothing is reallocated while the entries fit.
+  const camera_metadata_t* raw_metadata = hal_metadata->GetRawCameraMetadata();
+  for (auto& entry : entries) {
+    ASSERT_EQ(hal_metadata->Set(entry), OK);
+  }
+  EXPECT_EQ(hal_metadata->GetRawCameraMetadata(), raw_metadata);
+  EXPECT_EQ(hal_metadata->GetEntryCount(), entries.size());
+
+  // Reserving what is already there is a no-op.
+  ASSERT_EQ(hal_metadata->Reserve(0, 0), OK);
+  EXPECT_EQ(hal_metadata->GetRawCameraMetadata(), raw_metadata);
+}
+
+TEST(HalCameraMetadataTests, SetBatch) {
+  auto hal_metadata =
+      HalCameraMetadata::Create(kDefaultNumEntries, kDefaultDataBytes);
+  ASSERT_NE(hal_metadata, nullptr) << "Creating hal_metadata failed.";
+
+  int64_t data = 0;
+  auto entries = GetTestEntries(&data);
+  ASSERT_EQ(hal_metadata->Set(entries), OK);
+  EXPECT_EQ(hal_metadata->GetEntryCount(), entries.size());
+
+  // Updating the same entries fits in the resized metadata.
+  const camera_metadata_t* raw_metadata = hal_metadata->GetRawCameraMetadata();
+  ASSERT_EQ(hal_metadata->Set(entries), OK);
+  EXPECT_EQ(hal_metadata->GetRawCameraMetadata(), raw_metadata);
+  EXPECT_EQ(hal_metadata->GetEntryCount(), entries.size());
+
+  camera_metadata_ro_entry entry;
+  for (auto& expected : entries) {
+    ASSERT_EQ(hal_metadata->Get(expected.tag, &entry), OK);
+    EXPECT_EQ(entry.count, expected.count);
+  }
+
+  // An unknown tag fails the whole batch.
+  camera_metadata_ro_entry unknown = {};
+  unknown.tag = ANDROID_SENSOR_END;
+  unknown.count = 1;
+  unknown.data.i64 = &data;
+  entries.push_back(unknown);
+  EXPECT_EQ(hal_metadata->Set(entries), BAD_VALUE);
+}
+
+TEST(HalCameraMetadataTests, Seal) {
+  auto hal_metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  ASSERT_NE(hal_metadata, nullptr) << "Creating hal_metadata failed.";
+
+  // Add the entries in reverse tag order.
+  int64_t data = 0;
+  auto entries = GetTestEntries(&data);
+  for (auto entry = entries.rbegin(); entry != entries.rend(); entry++) {
+    ASSERT_EQ(hal_metadata->Set(*entry), OK);
+  }
+  ASSERT_EQ(hal_metadata->Seal(), OK);
+
+  camera_metadata_ro_entry entry;
+  for (size_t i = 0; i < entries.size(); i++) {
+    ASSERT_EQ(hal_metadata->GetByIndex(&entry, i), OK);
+    EXPECT_EQ(entry.tag, entries[i].tag);
+    ASSERT_EQ(hal_metadata->Get(entries[i].tag, &entry), OK);
+  }
+
+  // Sealed metadata can still be modified.
+  int64_t exposure_time_ns = 1000000000;
+  ASSERT_EQ(
+      hal_metadata->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time_ns, 1),
+      OK);
+  ASSERT_EQ(hal_metadata->Get(ANDROID_SENSOR_EXPOSURE_TIME, &entry), OK);
+  EXPECT_EQ(*entry.data.i64, exposure_time_ns);
+
+  auto empty_metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  ASSERT_NE(empty_metadata, nullptr) << "Creating hal_metadata failed.";
+  free_camera_metadata(empty_metadata->ReleaseCameraMetadata());
+  EXPECT_EQ(empty_metadata->Seal(), INVALID_OPERATION);
+  EXPECT_EQ(empty_metadata->Reserve(1, 1), INVALID_OPERATION);
+}
+
+// Report the throughput of the common operations on a metadata the size of a
+// capture result. Not a pass/fail test beyond the results being correct, so
+// it's disabled by default.
+TEST(HalCameraMetadataTests, DISABLED_Throughput) {
+  static constexpr uint32_t kIterations = 200;
+  int64_t data = 0;
+  auto entries = GetTestEntries(&data);
+  auto report = [&entries](const char* name,
+                           std::chrono::steady_clock::duration duration) {
+    printf("%-12s %8.1f ns per entry\n", name,
+           std::chrono::duration<double, std::nano>(duration).count() /
+               (kIterations * entries.size()));
+  };
+
+  // One Set() per entry, starting from an empty metadata.
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < kIterations; i++) {
+    auto hal_metadata =
+        HalCameraMetadata::Create(kDefaultNumEntries, kDefaultDataBytes);
+    for (auto& entry : entries) {
+      ASSERT_EQ(hal_metadata->Set(entry), OK);
+    }
+  }
+  report("Set", std::chrono::steady_clock::now() - start);
+
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < kIterations; i++) {
+    auto hal_metadata =
+        HalCameraMetadata::Create(kDefaultNumEntries, kDefaultDataBytes);
+    ASSERT_EQ(hal_metadata->Set(entries), OK);
+  }
+  report("Set (batch)", std::chrono::steady_clock::now() - start);
+
+  // Unsorted, as the entries were added in reverse tag order.
+  auto hal_metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  for (auto entry = entries.rbegin(); entry != entries.rend(); entry++) {
+    ASSERT_EQ(hal_metadata->Set(*entry), OK);
+  }
+  camera_metadata_ro_entry entry;
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < kIterations; i++) {
+    for (auto& expected : entries) {
+      ASSERT_EQ(hal_metadata->Get(expected.tag, &entry), OK);
+    }
+  }
+  report("Get", std::chrono::steady_clock::now() - start);
+
+  ASSERT_EQ(hal_metadata->Seal(), OK);
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < kIterations; i++) {
+    for (auto& expected : entries) {
+      ASSERT_EQ(hal_metadata->Get(expected.tag, &entry), OK);
+    }
+  }
+  report("Get (sealed)", std::chrono::steady_clock::now() - start);
+
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < kIterations; i++) {
+    auto clone = HalCameraMetadata::Clone(hal_metadata.get());
+    ASSERT_NE(clone, nullptr);
+  }
+  report("Clone", std::chrono::steady_clock::now() - start);
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
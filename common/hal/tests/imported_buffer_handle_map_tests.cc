@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ImportedBufferHandleMapTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+#include <imported_buffer_handle_map.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace android {
+namespace google_camera_hal {
+
+static constexpr int32_t kStreamId = 3;
+static constexpr uint32_t kNumBuffers = 8;
+
+// Return a fake buffer handle for a buffer ID. The map never dereferences
+// buffer handles.
+static buffer_handle_t GetFakeHandle(uint64_t buffer_id) {
+  return reinterpret_cast<buffer_handle_t>(
+      static_cast<uintptr_t>((buffer_id + 1) * 16));
+}
+
+TEST(ImportedBufferHandleMapTests, AddFindRemove) {
+  ImportedBufferHandleMap map;
+  BufferCache buffer_cache = {.stream_id = kStreamId, .buffer_id = 0};
+  EXPECT_EQ(map.Find(buffer_cache), nullptr);
+  EXPECT_EQ(map.Remove(buffer_cache), nullptr);
+  EXPECT_NE(map.Add(buffer_cache, /*buffer_handle=*/nullptr), OK);
+
+  ASSERT_EQ(map.Add(buffer_cache, GetFakeHandle(0)), OK);
+  EXPECT_EQ(map.Find(buffer_cache), GetFakeHandle(0));
+  EXPECT_EQ(map.Find({.stream_id = kStreamId + 1, .buffer_id = 0}), nullptr);
+
+  // Adding the same handle again is fine but a different one isn't.
+  EXPECT_EQ(map.Add(buffer_cache, GetFakeHandle(0)), OK);
+  EXPECT_EQ(map.Add(buffer_cache, GetFakeHandle(1)), BAD_VALUE);
+
+  EXPECT_EQ(map.Remove(buffer_cache), GetFakeHandle(0));
+  EXPECT_EQ(map.Find(buffer_cache), nullptr);
+  EXPECT_EQ(map.Remove(buffer_cache), nullptr);
+
+  // A removed buffer can be added again with a new handle.
+  ASSERT_EQ(map.Add(buffer_cache, GetFakeHandle(1)), OK);
+  EXPECT_EQ(map.Find(buffer_cache), GetFakeHandle(1));
+}
+
+TEST(ImportedBufferHandleMapTests, GrowAndRemoveStreams) {
+  static constexpr uint64_t kNumAdded = 1000;
+  ImportedBufferHandleMap map;
+  map.ReserveStream(kStreamId, kNumBuffers);
+
+  // Keep kNumBuffers buffers alive while new buffer IDs keep coming, which
+  // leaves removed buffers behind and grows the table.
+  for (uint64_t buffer_id = 0; buffer_id < kNumAdded; buffer_id++) {
+    ASSERT_EQ(map.Add({.stream_id = kStreamId, .buffer_id = buffer_id},
+                      GetFakeHandle(buffer_id)),
+              OK);
+    ASSERT_EQ(map.Add({.stream_id = kStreamId + 1, .buffer_id = buffer_id},
+                      GetFakeHandle(buffer_id)),
+              OK);
+    if (buffer_id >= kNumBuffers) {
+      uint64_t removed_id = buffer_id - kNumBuffers;
+      ASSERT_EQ(map.Remove({.stream_id = kStreamId, .buffer_id = removed_id}),
+                GetFakeHandle(removed_id));
+    }
+  }
+
+  for (uint64_t buffer_id = 0; buffer_id < kNumAdded; buffer_id++) {
+    bool removed = buffer_id < kNumAdded - kNumBuffers;
+    buffer_handle_t expected_handle =
+        removed ? nullptr : GetFakeHandle(buffer_id);
+    EXPECT_EQ(map.Find({.stream_id = kStreamId, .buffer_id = buffer_id}),
+              expected_handle);
+    EXPECT_EQ(map.Find({.stream_id = kStreamId + 1, .buffer_id = buffer_id}),
+              GetFakeHandle(buffer_id));
+  }
+
+  EXPECT_EQ(map.RemoveStream(kStreamId).size(), kNumBuffers);
+  EXPECT_EQ(map.Find({.stream_id = kStreamId, .buffer_id = kNumAdded - 1}),
+            nullptr);
+  EXPECT_EQ(map.RemoveAll().size(), kNumAdded);
+  EXPECT_EQ(map.Find({.stream_id = kStreamId + 1, .buffer_id = 0}), nullptr);
+}
+
+// Buffers that stay in the map are always found while other threads add and
+// remove buffers of the same stream and grow its table.
+TEST(ImportedBufferHandleMapTests, FindWhileModifying) {
+  static constexpr uint32_t kNumReaders = 2;
+  static constexpr uint64_t kNumModifications = 20000;
+  ImportedBufferHandleMap map;
+  for (uint64_t buffer_id = 0; buffer_id < kNumBuffers; buffer_id++) {
+    ASSERT_EQ(map.Add({.stream_id = kStreamId, .buffer_id = buffer_id},
+                      GetFakeHandle(buffer_id)),
+              OK);
+  }
+
+  std::atomic<bool> done = false;
+  std::atomic<uint32_t> num_misses = 0;
+  std::vector<std::thread> readers;
+  for (uint32_t reader = 0; reader < kNumReaders; reader++) {
+    readers.emplace_back([&] {
+      BufferCache buffer_cache = {.stream_id = kStreamId};
+      for (uint64_t i = 0; !done; i++) {
+        buffer_cache.buffer_id = i % kNumBuffers;
+        if (map.Find(buffer_cache) != GetFakeHandle(buffer_cache.buffer_id)) {
+          num_misses++;
+        }
+      }
+    });
+  }
+
+  // Keep kNumBuffers more buffers alive so that the table is rehashed.
+  for (uint64_t buffer_id = kNumBuffers;
+       buffer_id < kNumBuffers + kNumModifications; buffer_id++) {
+    BufferCache buffer_cache = {.stream_id = kStreamId, .buffer_id = buffer_id};
+    ASSERT_EQ(map.Add(buffer_cache, GetFakeHandle(buffer_id)), OK);
+    if (buffer_id >= 2 * kNumBuffers) {
+      uint64_t removed_id = buffer_id - kNumBuffers;
+      ASSERT_EQ(map.Remove({.stream_id = kStreamId, .buffer_id = removed_id}),
+                GetFakeHandle(removed_id));
+    }
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(num_misses, 0u);
+}
+
+// Look up buffers on several threads, like requests of multiple streams do,
+// while another thread keeps replacing buffers, and compare with a mutex
+// protected unordered_map. Only reports timings, so it's disabled by default.
+TEST(ImportedBufferHandleMapTests, DISABLED_ContentionBenchmark) {
+  static constexpr uint32_t kNumReaders = 3;
+  static constexpr uint32_t kNumLookups = 200000;
+
+  struct BufferCacheHashing {
+    size_t operator()(const BufferCache& buffer_cache) const {
+      return std::hash<uint64_t>{}(buffer_cache.buffer_id) ^
+             std::hash<int32_t>{}(buffer_cache.stream_id);
+    }
+  };
+  std::mutex map_lock;
+  std::unordered_map<BufferCache, buffer_handle_t, BufferCacheHashing>
+      locked_map;
+  ImportedBufferHandleMap map;
+
+  auto run = [&](bool use_locked_map) {
+    for (uint32_t reader = 0; reader < kNumReaders; reader++) {
+      map.ReserveStream(reader, kNumBuffers);
+      for (uint64_t buffer_id = 0; buffer_id < kNumBuffers; buffer_id++) {
+        BufferCache buffer_cache = {.stream_id = static_cast<int32_t>(reader),
+                                    .buffer_id = buffer_id};
+        locked_map[buffer_cache] = GetFakeHandle(buffer_id);
+        EXPECT_EQ(map.Add(buffer_cache, GetFakeHandle(buffer_id)), OK);
+      }
+    }
+
+    std::atomic<bool> done = false;
+    std::atomic<uint32_t> num_misses = 0;
+    // The writer replaces buffers of a stream nobody looks up, like results
+    // and buffer cache removals that run next to requests.
+    std::thread writer([&] {
+      uint64_t buffer_id = 0;
+      BufferCache buffer_cache = {.stream_id = kNumReaders};
+      while (!done) {
+        buffer_cache.buffer_id = buffer_id++;
+        if (use_locked_map) {
+          std::lock_guard<std::mutex> lock(map_lock);
+          locked_map[buffer_cache] = GetFakeHandle(buffer_cache.buffer_id);
+          locked_map.erase(buffer_cache);
+        } else {
+          map.Add(buffer_cache, GetFakeHandle(buffer_cache.buffer_id));
+          map.Remove(buffer_cache);
+        }
+      }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> readers;
+    for (uint32_t reader = 0; reader < kNumReaders; reader++) {
+      readers.emplace_back([&, reader] {
+        BufferCache buffer_cache = {.stream_id = static_cast<int32_t>(reader)};
+        for (uint32_t i = 0; i < kNumLookups; i++) {
+          buffer_cache.buffer_id = i % kNumBuffers;
+          buffer_handle_t handle = nullptr;
+          if (use_locked_map) {
+            std::lock_guard<std::mutex> lock(map_lock);
+            handle = locked_map[buffer_cache];
+          } else {
+            handle = map.Find(buffer_cache);
+          }
+          if (handle != GetFakeHandle(buffer_cache.buffer_id)) {
+            num_misses++;
+          }
+        }
+      });
+    }
+    for (auto& reader : readers) {
+      reader.join();
+    }
+    auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    done = true;
+    writer.join();
+
+    EXPECT_EQ(num_misses, 0u);
+    return static_cast<double>(elapsed_ns) / (kNumReaders * kNumLookups);
+  };
+
+  double locked_ns = run(/*use_locked_map=*/true);
+  double lock_free_ns = run(/*use_locked_map=*/false);
+  printf(
+      "Lookups with %u readers and a writer: mutex %.1f ns, lock-free %.1f "
+      "ns\n",
+      kNumReaders, locked_ns, lock_free_ns);
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -162,6 +162,9 @@ class MockDeviceSessionHwl : public CameraDeviceSessionHwl {
 
   MOCK_METHOD0(Flush, status_t());
 
+  MOCK_METHOD1(SignalStreamFlush,
+               status_t(const std::vector<int32_t>& stream_ids));
+
   MOCK_CONST_METHOD0(GetCameraId, uint32_t());
 
   MOCK_CONST_METHOD0(GetPhysicalCameraIds, std::vector<uint32_t>());
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "PendingFrameRingTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+#include <pending_frame_ring.h>
+
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+static constexpr uint32_t kCapacity = 8;
+
+// Return the frame numbers of all entries in the order ForEach() visits them.
+static std::vector<uint32_t> GetFrameNumbers(PendingFrameRing<int>* ring) {
+  std::vector<uint32_t> frame_numbers;
+  ring->ForEach([&frame_numbers](uint32_t frame_number, int& value) {
+    EXPECT_EQ(value, static_cast<int>(frame_number));
+    frame_numbers.push_back(frame_number);
+  });
+  return frame_numbers;
+}
+
+// Insert an entry whose value is its frame number.
+static void InsertFrame(PendingFrameRing<int>* ring, uint32_t frame_number) {
+  int* value = ring->Insert(frame_number);
+  ASSERT_NE(value, nullptr) << "Inserting frame " << frame_number << " failed";
+  *value = frame_number;
+}
+
+TEST(PendingFrameRingTests, InsertFindErase) {
+  PendingFrameRing<int> ring(kCapacity);
+  uint32_t frame_number = 0;
+  EXPECT_TRUE(ring.Empty());
+  EXPECT_EQ(ring.Front(&frame_number), nullptr);
+  EXPECT_EQ(ring.Find(0), nullptr);
+
+  InsertFrame(&ring, 5);
+  EXPECT_EQ(ring.Insert(5), nullptr) << "Duplicate insert succeeded";
+  ASSERT_NE(ring.Find(5), nullptr);
+  EXPECT_EQ(*ring.Find(5), 5);
+  EXPECT_EQ(ring.Find(4), nullptr);
+  EXPECT_EQ(ring.Find(6), nullptr);
+  EXPECT_EQ(ring.Size(), 1u);
+
+  // Erasing a missing frame is a no-op.
+  ring.Erase(4);
+  EXPECT_EQ(ring.Size(), 1u);
+  ring.Erase(5);
+  EXPECT_TRUE(ring.Empty());
+  EXPECT_EQ(ring.Find(5), nullptr);
+}
+
+// Keep a window of frames in flight while frame numbers wrap around the ring
+// many times.
+TEST(PendingFrameRingTests, WrapAround) {
+  static constexpr uint32_t kInFlight = 5;
+  PendingFrameRing<int> ring(kCapacity);
+  for (uint32_t frame_number = 0; frame_number < 10 * kCapacity;
+       frame_number++) {
+    InsertFrame(&ring, frame_number);
+    if (frame_number >= kInFlight) {
+      uint32_t front = 0;
+      int* value = ring.Front(&front);
+      ASSERT_NE(value, nullptr);
+      EXPECT_EQ(front, frame_number - kInFlight);
+      EXPECT_EQ(*value, static_cast<int>(front));
+      ring.Erase(front);
+    }
+    EXPECT_LE(ring.Size(), kInFlight);
+  }
+
+  EXPECT_EQ(ring.Capacity(), kCapacity);
+  EXPECT_EQ(GetFrameNumbers(&ring),
+            std::vector<uint32_t>({75, 76, 77, 78, 79}));
+}
+
+TEST(PendingFrameRingTests, OutOfOrderInsertAndErase) {
+  PendingFrameRing<int> ring(kCapacity);
+  for (uint32_t frame_number : {13, 10, 15, 11, 12, 14}) {
+    InsertFrame(&ring, frame_number);
+  }
+  EXPECT_EQ(GetFrameNumbers(&ring),
+            std::vector<uint32_t>({10, 11, 12, 13, 14, 15}));
+
+  for (uint32_t frame_number : {12, 14, 10}) {
+    ring.Erase(frame_number);
+  }
+  uint32_t front = 0;
+  ASSERT_NE(ring.Front(&front), nullptr);
+  EXPECT_EQ(front, 11u);
+  EXPECT_EQ(GetFrameNumbers(&ring), std::vector<uint32_t>({11, 13, 15}));
+
+  // Frames can be inserted again in the gaps.
+  InsertFrame(&ring, 12);
+  EXPECT_EQ(GetFrameNumbers(&ring), std::vector<uint32_t>({11, 12, 13, 15}));
+}
+
+// Erasing the first or the last frame moves that end of the ring past the
+// erased gaps.
+TEST(PendingFrameRingTests, EraseAtBothEnds) {
+  PendingFrameRing<int> ring(kCapacity);
+  for (uint32_t frame_number : {20, 21, 23, 25, 26}) {
+    InsertFrame(&ring, frame_number);
+  }
+
+  ring.Erase(20);
+  ring.Erase(26);
+  uint32_t front = 0;
+  ASSERT_NE(ring.Front(&front), nullptr);
+  EXPECT_EQ(front, 21u);
+  ring.Erase(21);
+  ASSERT_NE(ring.Front(&front), nullptr);
+  EXPECT_EQ(front, 23u);
+  ring.Erase(25);
+  EXPECT_EQ(GetFrameNumbers(&ring), std::vector<uint32_t>({23}));
+
+  // With only frame 23 left the ring can span kCapacity frames from either
+  // side of it without growing.
+  InsertFrame(&ring, 23 + kCapacity - 1);
+  ring.Erase(23 + kCapacity - 1);
+  InsertFrame(&ring, 23 - kCapacity + 1);
+  EXPECT_EQ(ring.Capacity(), kCapacity);
+  EXPECT_EQ(GetFrameNumbers(&ring), std::vector<uint32_t>({16, 23}));
+
+  ring.Erase(23);
+  ring.Erase(16);
+  EXPECT_TRUE(ring.Empty());
+  EXPECT_EQ(ring.Front(&front), nullptr);
+}
+
+TEST(PendingFrameRingTests, Grow) {
+  PendingFrameRing<int> ring(kCapacity);
+  InsertFrame(&ring, 100);
+  InsertFrame(&ring, 100 + kCapacity);
+  EXPECT_EQ(ring.Capacity(), 2 * kCapacity);
+  InsertFrame(&ring, 100 - 2 * kCapacity);
+  EXPECT_EQ(ring.Capacity(), 4 * kCapacity);
+  EXPECT_EQ(ring.OverflowSize(), 0u);
+
+  // Entries keep their values when the ring grows.
+  EXPECT_EQ(GetFrameNumbers(&ring),
+            std::vector<uint32_t>({100 - 2 * kCapacity, 100, 100 + kCapacity}));
+}
+
+// A frame that never completes must not grow the ring beyond kMaxCapacity
+// while newer frames keep coming and completing.
+TEST(PendingFrameRingTests, StuckFrame) {
+  static constexpr uint32_t kStuckFrame = 1;
+  static constexpr uint32_t kNumFrames =
+      4 * PendingFrameRing<int>::kMaxCapacity;
+  PendingFrameRing<int> ring(kCapacity);
+  InsertFrame(&ring, kStuckFrame);
+  for (uint32_t frame_number = kStuckFrame + 1; frame_number < kNumFrames;
+       frame_number++) {
+    InsertFrame(&ring, frame_number);
+    if (frame_number > kStuckFrame + 2) {
+      ring.Erase(frame_number - 2);
+    }
+    ASSERT_LE(ring.Capacity(), PendingFrameRing<int>::kMaxCapacity);
+  }
+
+  EXPECT_EQ(ring.OverflowSize(), 1u);
+  uint32_t front = 0;
+  int* value = ring.Front(&front);
+  ASSERT_NE(value, nullptr);
+  EXPECT_EQ(front, kStuckFrame);
+  EXPECT_EQ(*value, static_cast<int>(kStuckFrame));
+  ASSERT_NE(ring.Find(kStuckFrame), nullptr);
+  EXPECT_EQ(ring.Insert(kStuckFrame), nullptr) << "Duplicate insert succeeded";
+  EXPECT_EQ(GetFrameNumbers(&ring),
+            std::vector<uint32_t>({kStuckFrame, kNumFrames - 2,
+                                   kNumFrames - 1}));
+
+  // A frame older than the ring also goes to the overflow map.
+  InsertFrame(&ring, kStuckFrame + 1);
+  EXPECT_EQ(ring.OverflowSize(), 2u);
+  EXPECT_EQ(ring.Size(), 4u);
+
+  ring.Erase(kStuckFrame);
+  ring.Erase(kStuckFrame + 1);
+  EXPECT_EQ(ring.OverflowSize(), 0u);
+  ASSERT_NE(ring.Front(&front), nullptr);
+  EXPECT_EQ(front, kNumFrames - 2);
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
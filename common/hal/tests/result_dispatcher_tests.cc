@@ -19,7 +19,12 @@
 
 #include <cutils/properties.h>
 #include <gtest/gtest.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <chrono>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -115,6 +120,21 @@ class ResultDispatcherTests : public ::testing::Test {
     callback_condition_.notify_one();
   }
 
+  // Invoked when receiving batched capture results from the result
+  // dispatcher.
+  void ProcessBatchCaptureResult(
+      std::vector<std::unique_ptr<CaptureResult>> results) {
+    EXPECT_FALSE(results.empty());
+    {
+      std::lock_guard<std::mutex> lock(callback_lock_);
+      received_batch_count_++;
+    }
+
+    for (auto& result : results) {
+      ProcessCaptureResult(std::move(result));
+    }
+  }
+
   // Add a bufffer to the received buffer queue.
   void ProcessReceivedBuffer(uint32_t frame_number, const StreamBuffer& buffer) {
     auto buffers_it = stream_received_buffers_map_.find(buffer.stream_id);
@@ -307,6 +327,9 @@ class ResultDispatcherTests : public ::testing::Test {
   // Protected by callback_lock_.
   std::unordered_map<int32_t, std::vector<ReceivedBuffer>>
       stream_received_buffers_map_;
+
+  // Protected by callback_lock_.
+  uint32_t received_batch_count_ = 0;
 };
 
 TEST_F(ResultDispatcherTests, ShutterOrder) {
@@ -433,6 +456,176 @@ TEST_F(ResultDispatcherTests, ShutterOrderWithRemovePengingRequest) {
   VerifyShuttersOrder();
 }
 
+TEST_F(ResultDispatcherTests, BatchedResults) {
+  static constexpr int32_t kStreamIds[] = {5, 6};
+  static constexpr uint32_t kNumEntries = 10;
+  static constexpr uint32_t kDataBytes = 256;
+
+  StreamConfiguration stream_config;
+  result_dispatcher_ = ResultDispatcher::Create(
+      kPartialResult,
+      [this](std::unique_ptr<CaptureResult> result) {
+        ProcessCaptureResult(std::move(result));
+      },
+      [this](const NotifyMessage& message) { Notify(message); },
+      stream_config, "TestBatchedResultDispatcher",
+      [this](std::vector<std::unique_ptr<CaptureResult>> results) {
+        ProcessBatchCaptureResult(std::move(results));
+      });
+  ASSERT_NE(result_dispatcher_, nullptr);
+
+  std::vector<uint32_t> frame_numbers = {1, 2, 3};
+  std::vector<std::vector<StreamBuffer>> output_buffers;
+  for (uint32_t i = 0; i < frame_numbers.size(); i++) {
+    std::vector<StreamBuffer> buffers;
+    for (auto stream_id : kStreamIds) {
+      buffers.push_back({.stream_id = stream_id, .buffer_id = i});
+    }
+    output_buffers.push_back(buffers);
+  }
+  AddPendingRequestsToDispatcher(frame_numbers, output_buffers);
+
+  // Complete the first frame last, so that all results become ready at once.
+  for (int32_t i = frame_numbers.size() - 1; i >= 0; i--) {
+    auto result = std::make_unique<CaptureResult>(CaptureResult({}));
+    result->frame_number = frame_numbers[i];
+    result->partial_result = kPartialResult;
+    result->result_metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+    result->output_buffers = output_buffers[i];
+
+    EXPECT_EQ(result_dispatcher_->AddResult(std::move(result)), OK);
+  }
+
+  for (auto& frame_number : frame_numbers) {
+    EXPECT_EQ(WaitForResultMetadata(frame_number), OK)
+        << "Waiting for result metadata for frame " << frame_number
+        << " timed out.";
+    for (auto stream_id : kStreamIds) {
+      EXPECT_EQ(WaitForOuptutBuffer(frame_number, stream_id), OK)
+          << "Waiting for output buffers for frame " << frame_number
+          << " timed out.";
+    }
+  }
+
+  VerifyResultMetadataOrder();
+  VerifyBuffersOrder();
+
+  // 9 results were delivered in fewer callbacks.
+  EXPECT_GT(result_dispatcher_->GetAverageResultsPerCallback(), 1.0f);
+  std::lock_guard<std::mutex> lock(callback_lock_);
+  EXPECT_GT(received_batch_count_, 0u);
+  EXPECT_LT(received_batch_count_, 9u);
+}
+
+// Test that a frame that never completes is reported as timed out even though
+// nothing else wakes up the notify thread, and that it's no longer reported
+// once it's removed.
+TEST_F(ResultDispatcherTests, ReportTimedOutFrame) {
+  // ResultDispatcher reports frames that are pending for 500 ms.
+  static constexpr auto kTimeout = std::chrono::milliseconds(500);
+  static constexpr auto kPollInterval = std::chrono::milliseconds(10);
+  auto start = std::chrono::steady_clock::now();
+  AddPendingRequestsToDispatcher({0});
+
+  while (result_dispatcher_->GetTimeoutReportCount() == 0 &&
+         std::chrono::steady_clock::now() - start < 4 * kTimeout) {
+    std::this_thread::sleep_for(kPollInterval);
+  }
+  ASSERT_EQ(result_dispatcher_->GetTimeoutReportCount(), 1u)
+      << "Frame 0 wasn't reported as timed out";
+  EXPECT_GE(std::chrono::steady_clock::now() - start, kTimeout);
+
+  result_dispatcher_->RemovePendingRequest(0);
+  std::this_thread::sleep_for(kTimeout * 3 / 2);
+  EXPECT_EQ(result_dispatcher_->GetTimeoutReportCount(), 1u);
+}
+
+// Measures the per-frame dispatch cost at different frame rates and stream
+// counts. Frames are paced at the given frame rate so that the dispatcher
+// sees the same pattern of wake-ups as with a real camera pipeline. It takes
+// a few seconds and only reports timings, so it's disabled by default; run it
+// with --gtest_also_run_disabled_tests.
+TEST_F(ResultDispatcherTests, DISABLED_DispatchBenchmark) {
+  static constexpr uint32_t kFrameRates[] = {30, 60, 240};
+  static constexpr uint32_t kStreamCounts[] = {1, 2, 4, 8};
+  static constexpr uint32_t kFramesPerCase = 15;
+  static constexpr uint32_t kNumEntries = 10;
+  static constexpr uint32_t kDataBytes = 256;
+
+  uint32_t frame_number = 1;
+  for (uint32_t fps : kFrameRates) {
+    for (uint32_t stream_count : kStreamCounts) {
+      StreamConfiguration stream_config;
+      for (uint32_t i = 0; i < stream_count; i++) {
+        Stream stream = {};
+        stream.id = i;
+        stream_config.streams.push_back(stream);
+      }
+
+      result_dispatcher_ = ResultDispatcher::Create(
+          kPartialResult,
+          [this](std::unique_ptr<CaptureResult> result) {
+            ProcessCaptureResult(std::move(result));
+          },
+          [this](const NotifyMessage& message) { Notify(message); },
+          stream_config, "TestBenchmarkResultDispatcher");
+      ASSERT_NE(result_dispatcher_, nullptr);
+
+      auto frame_duration = std::chrono::nanoseconds(1000000000 / fps);
+      auto next_frame = std::chrono::steady_clock::now();
+      std::chrono::nanoseconds total_add_time(0);
+      std::chrono::nanoseconds total_delivery_time(0);
+      for (uint32_t i = 0; i < kFramesPerCase; i++, frame_number++) {
+        std::this_thread::sleep_until(next_frame);
+        next_frame += frame_duration;
+
+        CaptureRequest request = {};
+        request.frame_number = frame_number;
+        for (uint32_t stream_id = 0; stream_id < stream_count; stream_id++) {
+          request.output_buffers.push_back(
+              {.stream_id = static_cast<int32_t>(stream_id),
+               .buffer_id = frame_number});
+        }
+
+        auto result = std::make_unique<CaptureResult>(CaptureResult({}));
+        result->frame_number = frame_number;
+        result->partial_result = kPartialResult;
+        result->result_metadata =
+            HalCameraMetadata::Create(kNumEntries, kDataBytes);
+        result->output_buffers = request.output_buffers;
+
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_EQ(result_dispatcher_->AddPendingRequest(request), OK);
+        ASSERT_EQ(result_dispatcher_->AddShutter(frame_number, frame_number,
+                                                 frame_number),
+                  OK);
+        ASSERT_EQ(result_dispatcher_->AddResult(std::move(result)), OK);
+        auto added = std::chrono::steady_clock::now();
+
+        EXPECT_EQ(WaitForResultMetadata(frame_number), OK);
+        EXPECT_EQ(WaitForOuptutBuffer(frame_number, stream_count - 1), OK);
+        auto delivered = std::chrono::steady_clock::now();
+
+        total_add_time += added - start;
+        total_delivery_time += delivered - start;
+      }
+
+      result_dispatcher_ = nullptr;
+      printf("%3u fps, %u streams: %" PRId64 " ns to add, %" PRId64
+             " ns to deliver per frame\n",
+             fps, stream_count,
+             static_cast<int64_t>(total_add_time.count() / kFramesPerCase),
+             static_cast<int64_t>(total_delivery_time.count() /
+                                  kFramesPerCase));
+
+      std::lock_guard<std::mutex> lock(callback_lock_);
+      received_shutters_.clear();
+      received_result_metadata_.clear();
+      stream_received_buffers_map_.clear();
+    }
+  }
+}
+
 // TODO(b/138960498): Test errors like adding repeated pending requests and
 // repeated results.
 
@@ -19,6 +19,7 @@
 #include <gtest/gtest.h>
 #include <log/log.h>
 
+#include <atomic>
 #include <chrono>
 #include <map>
 #include <string>
@@ -303,6 +304,32 @@ TEST_F(StreamBufferCacheManagerTests, NotifyFlushingAll) {
       << " Buffer request got dummy buffer.";
 }
 
+// Test NotifyFlushingStreams
+TEST_F(StreamBufferCacheManagerTests, NotifyFlushingStreams) {
+  status_t res = cache_manager_->RegisterStream(kDummyCacheRegInfo);
+  ASSERT_EQ(res, OK) << " RegisterStream failed!" << strerror(res);
+
+  res = cache_manager_->NotifyProviderReadiness(kDummyCacheRegInfo.stream_id);
+  ASSERT_EQ(res, OK) << " NotifyProviderReadiness failed!" << strerror(res);
+
+  // Allow enough time for the buffer allocator to refill the cache
+  std::this_thread::sleep_for(kAllocateBufferFuncLatency);
+
+  // Flushing other streams doesn't return the cached buffer.
+  res = cache_manager_->NotifyFlushingStreams(
+      {kDummyCacheRegInfo.stream_id + 1});
+  ASSERT_EQ(res, OK) << " NotifyFlushingStreams failed!" << strerror(res);
+  std::this_thread::sleep_for(kBufferReturnMaxLatency);
+  ASSERT_EQ(num_return_buffer_func_called, 0)
+      << " ReturnBufferFunc was called for a stream that wasn't flushed!";
+
+  res = cache_manager_->NotifyFlushingStreams({kDummyCacheRegInfo.stream_id});
+  ASSERT_EQ(res, OK) << " NotifyFlushingStreams failed!" << strerror(res);
+  std::this_thread::sleep_for(kBufferReturnMaxLatency);
+  ASSERT_EQ(num_return_buffer_func_called, 1)
+      << " ReturnBufferFunc was not called after NotifyFlushingStreams!";
+}
+
 // Test IsStreamActive
 TEST_F(StreamBufferCacheManagerTests, IsStreamActive) {
   const uint32_t kValidBufferRequests = 1;
@@ -335,5 +362,112 @@ TEST_F(StreamBufferCacheManagerTests, IsStreamActive) {
   ASSERT_EQ(is_active, false) << " StreamBufferCache should be deactived!";
 }
 
+// Test that a slow buffer provider makes the cache prefetch more buffers, and
+// that refills go through the batch request function.
+TEST_F(StreamBufferCacheManagerTests, AdaptivePrefetchWithBatchRequest) {
+  static constexpr auto kConsumeInterval = 4ms;
+  static constexpr uint32_t kNumGetStreamBuffer = 30;
+  std::atomic<uint32_t> num_batch_requests = 0;
+  cache_manager_ = StreamBufferCacheManager::Create(
+      hal_buffer_managed_stream_ids_,
+      [&num_batch_requests](const std::vector<BufferRequest>& buffer_requests,
+                            std::vector<BufferReturn>* buffer_returns) {
+        num_batch_requests++;
+        // Slower than the stream consumes buffers.
+        std::this_thread::sleep_for(kAllocateBufferFuncLatency);
+        for (auto& buffer_request : buffer_requests) {
+          BufferReturn buffer_return = {.stream_id = buffer_request.stream_id};
+          buffer_return.val.error = StreamBufferRequestError::kOk;
+          buffer_return.val.buffers.resize(buffer_request.num_buffers_requested);
+          buffer_returns->push_back(buffer_return);
+        }
+        return OK;
+      });
+  ASSERT_NE(cache_manager_, nullptr);
+
+  StreamBufferCacheRegInfo reg_info = kDummyCacheRegInfo;
+  reg_info.max_num_buffers_to_cache = 4;
+  status_t res = cache_manager_->RegisterStream(reg_info);
+  ASSERT_EQ(res, OK) << " RegisterStream failed!" << strerror(res);
+  res = cache_manager_->NotifyProviderReadiness(reg_info.stream_id);
+  ASSERT_EQ(res, OK) << " NotifyProviderReadiness failed!" << strerror(res);
+
+  for (uint32_t i = 0; i < kNumGetStreamBuffer; i++) {
+    StreamBufferRequestResult req_result;
+    res = cache_manager_->GetStreamBuffer(reg_info.stream_id, &req_result);
+    ASSERT_EQ(res, OK) << " GetStreamBuffer failed!" << strerror(res);
+    std::this_thread::sleep_for(kConsumeInterval);
+  }
+
+  StreamBufferCacheStats stats;
+  res = cache_manager_->GetStreamBufferCacheStats(reg_info.stream_id, &stats);
+  ASSERT_EQ(res, OK) << " GetStreamBufferCacheStats failed!" << strerror(res);
+  EXPECT_GT(stats.watermark, reg_info.num_buffers_to_cache);
+  EXPECT_LE(stats.watermark, reg_info.max_num_buffers_to_cache);
+  EXPECT_GE(stats.average_refill_latency_ns,
+            std::chrono::nanoseconds(kBufferAcquireMinLatency).count());
+  EXPECT_LT(stats.num_dummy_buffers, kNumGetStreamBuffer);
+  EXPECT_GT(num_batch_requests, 0u);
+  EXPECT_TRUE(remaining_number_of_fulfillment_ == kDefaultRemainingFulfillment)
+      << " request_func should not be used with a batch request function.";
+
+  res = cache_manager_->NotifyFlushingAll();
+  ASSERT_EQ(res, OK) << " NotifyFlushingAll failed!" << strerror(res);
+  cache_manager_ = nullptr;
+}
+
+// Test that a failed batch request keeps the stream active and the refill is
+// retried.
+TEST_F(StreamBufferCacheManagerTests, FailedBatchRequestKeepsStreamActive) {
+  static constexpr uint32_t kNumFailedBatchRequests = 2;
+  std::atomic<uint32_t> num_batch_requests = 0;
+  cache_manager_ = StreamBufferCacheManager::Create(
+      hal_buffer_managed_stream_ids_,
+      [&num_batch_requests](const std::vector<BufferRequest>& buffer_requests,
+                            std::vector<BufferReturn>* buffer_returns) {
+        if (num_batch_requests++ < kNumFailedBatchRequests) {
+          // The framework call failed without returning anything.
+          return UNKNOWN_ERROR;
+        }
+        for (auto& buffer_request : buffer_requests) {
+          BufferReturn buffer_return = {.stream_id = buffer_request.stream_id};
+          buffer_return.val.error = StreamBufferRequestError::kOk;
+          buffer_return.val.buffers.resize(buffer_request.num_buffers_requested);
+          buffer_returns->push_back(buffer_return);
+        }
+        return OK;
+      });
+  ASSERT_NE(cache_manager_, nullptr);
+
+  status_t res = cache_manager_->RegisterStream(kDummyCacheRegInfo);
+  ASSERT_EQ(res, OK) << " RegisterStream failed!" << strerror(res);
+  res = cache_manager_->NotifyProviderReadiness(kDummyCacheRegInfo.stream_id);
+  ASSERT_EQ(res, OK) << " NotifyProviderReadiness failed!" << strerror(res);
+
+  // Each GetStreamBuffer triggers another refill until one succeeds.
+  StreamBufferRequestResult req_result;
+  for (uint32_t i = 0; i <= kNumFailedBatchRequests + 1; i++) {
+    res = cache_manager_->GetStreamBuffer(kDummyCacheRegInfo.stream_id,
+                                          &req_result);
+    ASSERT_EQ(res, OK) << " GetStreamBuffer failed!" << strerror(res);
+
+    bool is_active = false;
+    res = cache_manager_->IsStreamActive(kDummyCacheRegInfo.stream_id,
+                                         &is_active);
+    ASSERT_EQ(res, OK) << " IsStreamActive failed!" << strerror(res);
+    ASSERT_TRUE(is_active) << " A failed batch request deactivated the stream";
+    if (!req_result.is_dummy_buffer) {
+      break;
+    }
+  }
+  EXPECT_FALSE(req_result.is_dummy_buffer)
+      << " The refill was not retried after the batch request failed";
+  EXPECT_GT(num_batch_requests, kNumFailedBatchRequests);
+
+  res = cache_manager_->NotifyFlushingAll();
+  ASSERT_EQ(res, OK) << " NotifyFlushingAll failed!" << strerror(res);
+  cache_manager_ = nullptr;
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
@@ -18,8 +18,13 @@
 #include <log/log.h>
 
 #include <gtest/gtest.h>
+#include <stdio.h>
 #include <zsl_buffer_manager.h>
 
+#include <chrono>
+#include <iterator>
+#include <map>
+
 namespace android {
 namespace google_camera_hal {
 
@@ -185,6 +190,200 @@ TEST(ZslBufferManagerTests, ReturnMetadata) {
   }
 }
 
+// Fill kMaxBufferDepth ZSL buffers whose metadata has AE_MODE_ON_AUTO_FLASH
+// and flash_state, and return the metadata by frame number.
+static std::map<uint32_t, std::unique_ptr<HalCameraMetadata>>
+FillAutoFlashBuffers(ZslBufferManager* manager, uint8_t flash_state) {
+  std::map<uint32_t, std::unique_ptr<HalCameraMetadata>> metadata_map;
+  for (uint32_t i = 0; i < kMaxBufferDepth; i++) {
+    StreamBuffer stream_buffer;
+    stream_buffer.buffer = manager->GetEmptyBuffer();
+    EXPECT_NE(stream_buffer.buffer, kInvalidBufferHandle)
+        << "GetEmptyBuffer failed at: " << i;
+    EXPECT_EQ(manager->ReturnFilledBuffer(i, stream_buffer), OK);
+
+    auto metadata = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+    SetMetadata(metadata);
+    uint8_t ae_mode = ANDROID_CONTROL_AE_MODE_ON_AUTO_FLASH;
+    EXPECT_EQ(metadata->Set(ANDROID_CONTROL_AE_MODE, &ae_mode, 1), OK);
+    EXPECT_EQ(metadata->Set(ANDROID_FLASH_STATE, &flash_state, 1), OK);
+    EXPECT_EQ(manager->ReturnMetadata(i, metadata.get(), /*partial_result=*/1),
+              OK);
+    metadata_map[i] = std::move(metadata);
+  }
+
+  return metadata_map;
+}
+
+// Test that no ZSL buffers are returned with AE_MODE_ON_AUTO_FLASH if the
+// flash fired in any ZSL buffer.
+TEST(ZslBufferManagerTests, GetRecentBuffersWithFlashFired) {
+  auto manager = std::make_unique<ZslBufferManager>();
+  ASSERT_NE(manager, nullptr) << "Creating ZslBufferManager failed.";
+  status_t res = manager->AllocateBuffers(kRawBufferDescriptor);
+  ASSERT_EQ(res, OK) << "AllocateBuffers failed: " << strerror(res);
+
+  FillAutoFlashBuffers(manager.get(), ANDROID_FLASH_STATE_FIRED);
+  std::vector<ZslBufferManager::ZslBuffer> filled_buffers;
+  manager->GetMostRecentZslBuffers(&filled_buffers, /*num_buffers=*/1,
+                                   /*min_buffers=*/1);
+  EXPECT_TRUE(filled_buffers.empty());
+}
+
+// Test that ZSL buffers keep only the ZSL metadata tags of all partial results,
+// and the tags used to select ZSL buffers.
+TEST(ZslBufferManagerTests, ZslMetadataTags) {
+  static constexpr uint32_t kNumShadingMapValues = 4 * 17 * 13;
+  auto manager = std::make_unique<ZslBufferManager>(
+      /*allocator=*/nullptr, /*partial_result_count=*/2,
+      std::vector<uint32_t>{ANDROID_SENSOR_EXPOSURE_TIME});
+  ASSERT_NE(manager, nullptr) << "Creating ZslBufferManager failed.";
+  status_t res = manager->AllocateBuffers(kRawBufferDescriptor);
+  ASSERT_EQ(res, OK) << "AllocateBuffers failed: " << strerror(res);
+
+  StreamBuffer stream_buffer;
+  stream_buffer.buffer = manager->GetEmptyBuffer();
+  ASSERT_NE(stream_buffer.buffer, kInvalidBufferHandle);
+  ASSERT_EQ(manager->ReturnFilledBuffer(/*frame_number=*/0, stream_buffer), OK);
+
+  auto first_partial = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  SetMetadata(first_partial);
+  int64_t exposure_time_ns = 10000000;
+  ASSERT_EQ(first_partial->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time_ns,
+                               1),
+            OK);
+  std::vector<float> shading_map(kNumShadingMapValues, 1.0f);
+  ASSERT_EQ(first_partial->Set(ANDROID_STATISTICS_LENS_SHADING_MAP,
+                               shading_map.data(), shading_map.size()),
+            OK);
+  auto last_partial = HalCameraMetadata::Create(kNumEntries, kDataBytes);
+  uint8_t flash_state = ANDROID_FLASH_STATE_READY;
+  ASSERT_EQ(last_partial->Set(ANDROID_FLASH_STATE, &flash_state, 1), OK);
+
+  ASSERT_EQ(manager->ReturnMetadata(/*frame_number=*/0, first_partial.get(),
+                                    /*partial_result=*/1),
+            OK);
+  ASSERT_EQ(manager->ReturnMetadata(/*frame_number=*/0, last_partial.get(),
+                                    /*partial_result=*/2),
+            OK);
+
+  std::vector<ZslBufferManager::ZslBuffer> filled_buffers;
+  manager->GetMostRecentZslBuffers(&filled_buffers, /*num_buffers=*/1,
+                                   /*min_buffers=*/1);
+  ASSERT_EQ(filled_buffers.size(), 1u);
+  const HalCameraMetadata* metadata = filled_buffers[0].metadata.get();
+  ASSERT_NE(metadata, nullptr);
+  camera_metadata_ro_entry entry = {};
+  EXPECT_EQ(metadata->Get(ANDROID_SENSOR_TIMESTAMP, &entry), OK);
+  ASSERT_EQ(metadata->Get(ANDROID_SENSOR_EXPOSURE_TIME, &entry), OK);
+  EXPECT_EQ(entry.data.i64[0], exposure_time_ns);
+  ASSERT_EQ(metadata->Get(ANDROID_FLASH_STATE, &entry), OK);
+  EXPECT_EQ(entry.data.u8[0], flash_state);
+  EXPECT_NE(metadata->Get(ANDROID_STATISTICS_LENS_SHADING_MAP, &entry), OK);
+
+  auto result_metadata = HalCameraMetadata::Clone(first_partial.get());
+  ASSERT_EQ(result_metadata->Append(last_partial->GetRawCameraMetadata()), OK);
+  EXPECT_LT(metadata->GetCameraMetadataSize(),
+            result_metadata->GetCameraMetadataSize());
+  manager->ReturnZslBuffers(std::move(filled_buffers));
+}
+
+// Test that returned ZSL buffers are selected again in the same order.
+TEST(ZslBufferManagerTests, GetReturnedBuffersAgain) {
+  static constexpr uint32_t kNumSnapshotBuffers = 4;
+  auto manager = std::make_unique<ZslBufferManager>();
+  ASSERT_NE(manager, nullptr) << "Creating ZslBufferManager failed.";
+  status_t res = manager->AllocateBuffers(kRawBufferDescriptor);
+  ASSERT_EQ(res, OK) << "AllocateBuffers failed: " << strerror(res);
+  FillAutoFlashBuffers(manager.get(), ANDROID_FLASH_STATE_READY);
+
+  std::vector<uint32_t> first_frame_numbers;
+  for (uint32_t i = 0; i < 3; i++) {
+    std::vector<ZslBufferManager::ZslBuffer> filled_buffers;
+    manager->GetMostRecentZslBuffers(&filled_buffers, kNumSnapshotBuffers,
+                                     /*min_buffers=*/1);
+    ASSERT_EQ(filled_buffers.size(), kNumSnapshotBuffers);
+    std::vector<uint32_t> frame_numbers;
+    for (auto& zsl_buffer : filled_buffers) {
+      frame_numbers.push_back(zsl_buffer.frame_number);
+    }
+    EXPECT_EQ(frame_numbers.back(), kMaxBufferDepth - 1);
+    if (i == 0) {
+      first_frame_numbers = frame_numbers;
+    } else {
+      EXPECT_EQ(frame_numbers, first_frame_numbers);
+    }
+    manager->ReturnZslBuffers(std::move(filled_buffers));
+  }
+}
+
+// Compare selecting the most recent ZSL buffers with scanning their metadata,
+// which is what GetMostRecentZslBuffers() used to do. Disabled by default
+// since it only reports timings.
+TEST(ZslBufferManagerTests, DISABLED_GetRecentBuffersBenchmark) {
+  static constexpr uint32_t kNumIterations = 10000;
+  static constexpr uint32_t kNumSnapshotBuffers = 4;
+  auto manager = std::make_unique<ZslBufferManager>();
+  ASSERT_NE(manager, nullptr) << "Creating ZslBufferManager failed.";
+  status_t res = manager->AllocateBuffers(kRawBufferDescriptor);
+  ASSERT_EQ(res, OK) << "AllocateBuffers failed: " << strerror(res);
+
+  // AE_MODE_ON_AUTO_FLASH makes the selection check the flash state of all
+  // ZSL buffers.
+  auto metadata_map =
+      FillAutoFlashBuffers(manager.get(), ANDROID_FLASH_STATE_READY);
+
+  int64_t get_buffers_ns = 0;
+  int64_t scan_metadata_ns = 0;
+  for (uint32_t i = 0; i < kNumIterations; i++) {
+    std::vector<ZslBufferManager::ZslBuffer> filled_buffers;
+    filled_buffers.reserve(kNumSnapshotBuffers);
+    auto start = std::chrono::steady_clock::now();
+    manager->GetMostRecentZslBuffers(&filled_buffers, kNumSnapshotBuffers,
+                                     /*min_buffers=*/1);
+    get_buffers_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    ASSERT_EQ(filled_buffers.size(), kNumSnapshotBuffers);
+    manager->ReturnZslBuffers(std::move(filled_buffers));
+
+    start = std::chrono::steady_clock::now();
+    auto metadata_iter = metadata_map.begin();
+    std::advance(metadata_iter, metadata_map.size() - kNumSnapshotBuffers);
+    camera_metadata_ro_entry entry = {};
+    bool flash_fired = false;
+    res = metadata_iter->second->Get(ANDROID_CONTROL_AE_MODE, &entry);
+    if (res == OK &&
+        entry.data.u8[0] == ANDROID_CONTROL_AE_MODE_ON_AUTO_FLASH) {
+      for (auto& [frame_number, metadata] : metadata_map) {
+        res = metadata->Get(ANDROID_FLASH_STATE, &entry);
+        if (res == OK && entry.data.u8[0] == ANDROID_FLASH_STATE_FIRED) {
+          flash_fired = true;
+        }
+      }
+    }
+    uint32_t num_recent_buffers = 0;
+    for (; metadata_iter != metadata_map.end(); metadata_iter++) {
+      res = metadata_iter->second->Get(ANDROID_SENSOR_TIMESTAMP, &entry);
+      if (res == OK && entry.count == 1) {
+        num_recent_buffers++;
+      }
+    }
+    scan_metadata_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+    ASSERT_FALSE(flash_fired);
+    ASSERT_EQ(num_recent_buffers, kNumSnapshotBuffers);
+  }
+
+  printf(
+      "Getting %u of %u ZSL buffers: %.1f ns, scanning their metadata %.1f "
+      "ns\n",
+      kNumSnapshotBuffers, kMaxBufferDepth,
+      static_cast<double>(get_buffers_ns) / kNumIterations,
+      static_cast<double>(scan_metadata_ns) / kNumIterations);
+}
+
 TEST(ZslBufferManagerTests, PendingBuffer) {
   auto manager = std::make_unique<ZslBufferManager>();
   ASSERT_NE(manager, nullptr) << "Creating ZslBufferManager failed.";
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "GCH_CameraMetadataPool"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "camera_metadata_pool.h"
+
+namespace android {
+namespace google_camera_hal {
+
+CameraMetadataPool& CameraMetadataPool::GetInstance() {
+  // Never destroyed so that metadata freed during process exit is still safe.
+  static CameraMetadataPool* pool = new CameraMetadataPool();
+  return *pool;
+}
+
+CameraMetadataPool::~CameraMetadataPool() {
+  for (auto& size_class : size_classes_) {
+    for (void* buffer : size_class.free_buffers) {
+      free(buffer);
+    }
+  }
+}
+
+size_t CameraMetadataPool::GetClassSize(uint32_t class_index) {
+  return size_t(1) << (class_index + kMinClassShift);
+}
+
+uint32_t CameraMetadataPool::GetClassIndex(size_t size) {
+  for (uint32_t class_index = 0; class_index < kNumClasses; class_index++) {
+    if (size <= GetClassSize(class_index)) {
+      return class_index;
+    }
+  }
+
+  return kNumClasses;
+}
+
+CameraMetadataPool::OutstandingShard& CameraMetadataPool::GetOutstandingShard(
+    const void* buffer) {
+  // malloc aligns buffers to at least 16 bytes, skip the bits that are
+  // always zero.
+  uintptr_t address = reinterpret_cast<uintptr_t>(buffer);
+  return outstanding_shards_[(address >> 4) % kNumOutstandingShards];
+}
+
+void CameraMetadataPool::AddOutstanding(const void* buffer,
+                                        uint32_t class_index) {
+  OutstandingShard& shard = GetOutstandingShard(buffer);
+  {
+    std::lock_guard<std::mutex> lock(shard.lock);
+    if (shard.spare_nodes.empty()) {
+      shard.buffers.emplace(buffer, class_index);
+    } else {
+      OutstandingMap::node_type node = std::move(shard.spare_nodes.back());
+      shard.spare_nodes.pop_back();
+      node.key() = buffer;
+      node.mapped() = class_index;
+      shard.buffers.insert(std::move(node));
+    }
+  }
+
+  outstanding_buffers_++;
+  size_t outstanding_bytes =
+      outstanding_bytes_.fetch_add(GetClassSize(class_index)) +
+      GetClassSize(class_index);
+  size_t high_water_bytes = high_water_bytes_.load();
+  while (outstanding_bytes > high_water_bytes &&
+         !high_water_bytes_.compare_exchange_weak(high_water_bytes,
+                                                  outstanding_bytes)) {
+  }
+}
+
+uint32_t CameraMetadataPool::RemoveOutstanding(const void* buffer) {
+  OutstandingShard& shard = GetOutstandingShard(buffer);
+  uint32_t class_index = kNumClasses;
+  {
+    std::lock_guard<std::mutex> lock(shard.lock);
+    auto it = shard.buffers.find(buffer);
+    if (it == shard.buffers.end()) {
+      return kNumClasses;
+    }
+
+    class_index = it->second;
+    shard.spare_nodes.push_back(shard.buffers.extract(it));
+  }
+
+  outstanding_buffers_--;
+  outstanding_bytes_ -= GetClassSize(class_index);
+  return class_index;
+}
+
+void* CameraMetadataPool::AllocateBuffer(size_t size) {
+  uint32_t class_index = GetClassIndex(size);
+  if (class_index == kNumClasses) {
+    bypassed_++;
+    return malloc(size);
+  }
+
+  size_t class_size = GetClassSize(class_index);
+  void* buffer = nullptr;
+  {
+    SizeClass& size_class = size_classes_[class_index];
+    std::lock_guard<std::mutex> lock(size_class.lock);
+    if (!size_class.free_buffers.empty()) {
+      buffer = size_class.free_buffers.back();
+      size_class.free_buffers.pop_back();
+    }
+  }
+
+  if (buffer != nullptr) {
+    free_bytes_ -= class_size;
+    hits_++;
+  } else {
+    buffer = malloc(class_size);
+    if (buffer == nullptr) {
+      ALOGE("%s: Allocating %zu bytes failed.", __FUNCTION__, class_size);
+      return nullptr;
+    }
+    misses_++;
+  }
+
+  AddOutstanding(buffer, class_index);
+  return buffer;
+}
+
+camera_metadata_t* CameraMetadataPool::Allocate(size_t entry_capacity,
+                                                size_t data_capacity) {
+  size_t size = calculate_camera_metadata_size(entry_capacity, data_capacity);
+  void* buffer = AllocateBuffer(size);
+  if (buffer == nullptr) {
+    return nullptr;
+  }
+
+  camera_metadata_t* metadata =
+      place_camera_metadata(buffer, size, entry_capacity, data_capacity);
+  if (metadata == nullptr) {
+    ALOGE("%s: Placing metadata (%zu entries, %zu bytes) failed.",
+          __FUNCTION__, entry_capacity, data_capacity);
+    Free(reinterpret_cast<camera_metadata_t*>(buffer));
+    return nullptr;
+  }
+
+  return metadata;
+}
+
+camera_metadata_t* CameraMetadataPool::Clone(
+    const camera_metadata_t* metadata) {
+  if (metadata == nullptr) {
+    ALOGE("%s: metadata is nullptr", __FUNCTION__);
+    return nullptr;
+  }
+
+  camera_metadata_t* clone =
+      Allocate(get_camera_metadata_entry_count(metadata),
+               get_camera_metadata_data_count(metadata));
+  if (clone == nullptr) {
+    return nullptr;
+  }
+
+  status_t res = append_camera_metadata(clone, metadata);
+  if (res != OK) {
+    ALOGE("%s: Appending metadata failed: %s(%d)", __FUNCTION__, strerror(-res),
+          res);
+    Free(clone);
+    return nullptr;
+  }
+
+  return clone;
+}
+
+void CameraMetadataPool::Free(camera_metadata_t* metadata) {
+  if (metadata == nullptr) {
+    return;
+  }
+
+  uint32_t class_index = RemoveOutstanding(metadata);
+  if (class_index == kNumClasses) {
+    free_camera_metadata(metadata);
+    return;
+  }
+
+  {
+    SizeClass& size_class = size_classes_[class_index];
+    std::lock_guard<std::mutex> lock(size_class.lock);
+    if (size_class.free_buffers.size() < kMaxFreeBuffersPerClass) {
+      if (size_class.free_buffers.capacity() == 0) {
+        size_class.free_buffers.reserve(kMaxFreeBuffersPerClass);
+      }
+      size_class.free_buffers.push_back(metadata);
+      free_bytes_ += GetClassSize(class_index);
+      return;
+    }
+  }
+
+  free(metadata);
+}
+
+void CameraMetadataPool::Detach(camera_metadata_t* metadata) {
+  if (metadata != nullptr) {
+    RemoveOutstanding(metadata);
+  }
+}
+
+void CameraMetadataPool::ResetHighWaterMark() {
+  high_water_bytes_ = outstanding_bytes_.load();
+}
+
+CameraMetadataPool::Stats CameraMetadataPool::GetStats() const {
+  return {
+      .hits = hits_,
+      .misses = misses_,
+      .bypassed = bypassed_,
+      .outstanding_bytes = outstanding_bytes_,
+      .high_water_bytes = high_water_bytes_,
+      .free_bytes = free_bytes_,
+  };
+}
+
+void CameraMetadataPool::Dump(int fd) const {
+  Stats stats = GetStats();
+  uint64_t pooled = stats.hits + stats.misses;
+  float hit_rate = pooled == 0 ? 0.0f : 100.0f * stats.hits / pooled;
+
+  dprintf(fd, "Camera metadata pool:\n");
+  dprintf(fd,
+          "  hits: %" PRIu64 ", misses: %" PRIu64 ", bypassed: %" PRIu64
+          ", hit rate: %.1f%%\n",
+          stats.hits, stats.misses, stats.bypassed, hit_rate);
+  dprintf(fd,
+          "  outstanding: %zu bytes (%zu buffers), high water: %zu bytes, "
+          "free: %zu bytes\n",
+          stats.outstanding_bytes, outstanding_buffers_.load(),
+          stats.high_water_bytes, stats.free_bytes);
+  for (uint32_t i = 0; i < kNumClasses; i++) {
+    const SizeClass& size_class = size_classes_[i];
+    std::lock_guard<std::mutex> lock(size_class.lock);
+    if (!size_class.free_buffers.empty()) {
+      dprintf(fd, "  class %zu bytes: %zu free\n", GetClassSize(i),
+              size_class.free_buffers.size());
+    }
+  }
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
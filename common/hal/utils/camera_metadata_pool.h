@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_CAMERA_METADATA_POOL_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_CAMERA_METADATA_POOL_H_
+
+#include <system/camera_metadata.h>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+// CameraMetadataPool recycles camera_metadata_t buffers so that the per-frame
+// settings and result metadata don't go through malloc and free. Buffers are
+// grouped in power-of-two size classes and each class keeps a bounded number
+// of free buffers around. Buffers larger than the largest class are allocated
+// and freed directly.
+//
+// Buffers handed out by the pool are plain malloc'ed memory, so they can
+// always be released with free_camera_metadata() once they are detached.
+//
+// CameraMetadataPool is thread-safe.
+class CameraMetadataPool {
+ public:
+  struct Stats {
+    // Number of allocations served from a free buffer.
+    uint64_t hits = 0;
+    // Number of allocations that needed a new pooled buffer.
+    uint64_t misses = 0;
+    // Number of allocations that bypassed the pool.
+    uint64_t bypassed = 0;
+    // Bytes of pooled buffers currently in use.
+    size_t outstanding_bytes = 0;
+    // Highest outstanding_bytes since the last ResetHighWaterMark().
+    size_t high_water_bytes = 0;
+    // Bytes of free buffers kept in the pool.
+    size_t free_bytes = 0;
+  };
+
+  // Return the pool shared by the HAL. Tests can create their own pools.
+  static CameraMetadataPool& GetInstance();
+
+  CameraMetadataPool() = default;
+  ~CameraMetadataPool();
+
+  // Allocate a camera metadata buffer with the given capacities. Returns
+  // nullptr if the allocation failed.
+  camera_metadata_t* Allocate(size_t entry_capacity, size_t data_capacity);
+
+  // Allocate a buffer of at least size bytes for serialized camera metadata
+  // that the caller copies in, e.g. from a message queue. The caller must
+  // validate the metadata before using it. Release the buffer with Free().
+  // Returns nullptr if the allocation failed.
+  void* AllocateBuffer(size_t size);
+
+  // Allocate a buffer from the pool and copy metadata into it. Returns nullptr
+  // if the allocation failed.
+  camera_metadata_t* Clone(const camera_metadata_t* metadata);
+
+  // Return metadata to the pool. metadata doesn't need to come from the pool;
+  // buffers the pool doesn't own are freed with free_camera_metadata().
+  void Free(camera_metadata_t* metadata);
+
+  // Stop tracking metadata because its ownership is passed to a caller that
+  // will free it with free_camera_metadata().
+  void Detach(camera_metadata_t* metadata);
+
+  // Restart the high-water mark at the current outstanding bytes, e.g. when
+  // a new session is created.
+  void ResetHighWaterMark();
+
+  // The values are read one by one and may be slightly inconsistent while
+  // other threads use the pool.
+  Stats GetStats() const;
+
+  // Print the pool statistics to fd.
+  void Dump(int fd) const;
+
+ private:
+  // Size classes range from 1 KiB to 256 KiB.
+  static constexpr uint32_t kMinClassShift = 10;
+  static constexpr uint32_t kMaxClassShift = 18;
+  static constexpr uint32_t kNumClasses = kMaxClassShift - kMinClassShift + 1;
+
+  // Maximum number of free buffers kept per size class.
+  static constexpr size_t kMaxFreeBuffersPerClass = 16;
+
+  // Number of shards the outstanding buffers are spread over by address.
+  static constexpr size_t kNumOutstandingShards = 16;
+
+  using OutstandingMap = std::unordered_map<const void*, uint32_t>;
+
+  // Pooled buffers in use whose address falls into this shard, mapped to
+  // their size classes.
+  struct OutstandingShard {
+    std::mutex lock;
+    OutstandingMap buffers;
+    // Nodes of removed buffers, reused so that tracking a buffer doesn't
+    // allocate.
+    std::vector<OutstandingMap::node_type> spare_nodes;
+  };
+
+  // Free buffers of a size class.
+  struct SizeClass {
+    mutable std::mutex lock;
+    std::vector<void*> free_buffers;
+  };
+
+  static size_t GetClassSize(uint32_t class_index);
+
+  // Return the size class for a buffer of size bytes, or kNumClasses if it
+  // doesn't fit in any class.
+  static uint32_t GetClassIndex(size_t size);
+
+  OutstandingShard& GetOutstandingShard(const void* buffer);
+
+  // Start tracking a pooled buffer that is handed out.
+  void AddOutstanding(const void* buffer, uint32_t class_index);
+
+  // Stop tracking buffer. Returns its size class, or kNumClasses if buffer
+  // isn't an outstanding pooled buffer.
+  uint32_t RemoveOutstanding(const void* buffer);
+
+  // Outstanding buffers are looked up in a single shard, and each size class
+  // has its own lock, so that threads freeing unrelated metadata don't
+  // contend with each other.
+  std::array<OutstandingShard, kNumOutstandingShards> outstanding_shards_;
+  std::array<SizeClass, kNumClasses> size_classes_;
+
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+  std::atomic<uint64_t> bypassed_ = 0;
+  std::atomic<size_t> outstanding_buffers_ = 0;
+  std::atomic<size_t> outstanding_bytes_ = 0;
+  std::atomic<size_t> high_water_bytes_ = 0;
+  std::atomic<size_t> free_bytes_ = 0;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_UTILS_CAMERA_METADATA_POOL_H_
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_FRAME_TIMEOUT_WHEEL_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_FRAME_TIMEOUT_WHEEL_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+// FrameTimeoutWheel is a hashed timer wheel of frame numbers. Each frame is
+// scheduled to expire one timeout after it was added. Expiry is rounded up to
+// the next tick, which is the timeout divided by the number of slots, so
+// scheduling and expiring a frame are both O(1) and the owner only needs to
+// wake up once per tick while frames are outstanding.
+//
+// FrameTimeoutWheel is not thread-safe.
+class FrameTimeoutWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  FrameTimeoutWheel(std::chrono::milliseconds timeout, uint32_t num_slots)
+      : tick_(timeout / num_slots), slots_(num_slots + 2) {
+  }
+
+  // Schedule frame_number to expire one timeout after now.
+  void Schedule(uint32_t frame_number, Clock::time_point now) {
+    if (size_ == 0) {
+      next_tick_ = now + tick_;
+    }
+
+    // The current slot expires at next_tick_, which is at most one tick
+    // behind now if the owner advances the wheel on every tick. The extra
+    // slot covers that lag.
+    Clock::time_point deadline = now + tick_ * (slots_.size() - 2);
+    auto ticks = (deadline - next_tick_ + tick_ - Clock::duration(1)) / tick_;
+    size_t offset = std::clamp<decltype(ticks)>(ticks, 0, slots_.size() - 1);
+    slots_[(current_ + offset) % slots_.size()].push_back(frame_number);
+    size_++;
+  }
+
+  // Move the frames that expired by now to expired.
+  void Advance(Clock::time_point now, std::vector<uint32_t>* expired) {
+    while (size_ > 0 && now >= next_tick_) {
+      std::vector<uint32_t>& slot = slots_[current_];
+      expired->insert(expired->end(), slot.begin(), slot.end());
+      size_ -= slot.size();
+      // Keep the capacity around for later frames.
+      slot.clear();
+
+      current_ = (current_ + 1) % slots_.size();
+      next_tick_ += tick_;
+    }
+  }
+
+  bool Empty() const {
+    return size_ == 0;
+  }
+
+  // Time at which the next frames expire. Only valid if not empty.
+  Clock::time_point GetNextTick() const {
+    return next_tick_;
+  }
+
+ private:
+  const Clock::duration tick_;
+  std::vector<std::vector<uint32_t>> slots_;
+  size_t current_ = 0;
+  size_t size_ = 0;
+  Clock::time_point next_tick_;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_UTILS_FRAME_TIMEOUT_WHEEL_H_
@@ -22,6 +22,9 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
+
+#include "camera_metadata_pool.h"
 #include "hal_camera_metadata.h"
 
 namespace android {
@@ -46,8 +49,8 @@ std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Create(
 
 std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Create(
     size_t entry_capacity, size_t data_capacity) {
-  camera_metadata_t* metadata =
-      allocate_camera_metadata(entry_capacity, data_capacity);
+  camera_metadata_t* metadata = CameraMetadataPool::GetInstance().Allocate(
+      entry_capacity, data_capacity);
   if (metadata == nullptr) {
     ALOGE("%s: Allocating camera metadata failed.", __FUNCTION__);
     return nullptr;
@@ -55,7 +58,7 @@ std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Create(
 
   auto hal_metadata = Create(metadata);
   if (hal_metadata == nullptr) {
-    free_camera_metadata(metadata);
+    CameraMetadataPool::GetInstance().Free(metadata);
     return nullptr;
   }
 
@@ -69,7 +72,8 @@ std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Clone(
     return nullptr;
   }
 
-  camera_metadata_t* cloned_metadata = clone_camera_metadata(metadata);
+  camera_metadata_t* cloned_metadata =
+      CameraMetadataPool::GetInstance().Clone(metadata);
   if (cloned_metadata == nullptr) {
     ALOGE("%s: Cloning camera metadata failed.", __FUNCTION__);
     return nullptr;
@@ -77,7 +81,7 @@ std::unique_ptr<HalCameraMetadata> HalCameraMetadata::Clone(
 
   auto hal_metadata = Create(cloned_metadata);
   if (hal_metadata == nullptr) {
-    free_camera_metadata(cloned_metadata);
+    CameraMetadataPool::GetInstance().Free(cloned_metadata);
     return nullptr;
   }
 
@@ -97,7 +101,7 @@ HalCameraMetadata::~HalCameraMetadata() {
   std::unique_lock<std::mutex> lock(metadata_lock_);
 
   if (metadata_ != nullptr) {
-    free_camera_metadata(metadata_);
+    CameraMetadataPool::GetInstance().Free(metadata_);
   }
 }
 
@@ -111,6 +115,8 @@ camera_metadata_t* HalCameraMetadata::ReleaseCameraMetadata() {
   camera_metadata_t* metadata = metadata_;
   metadata_ = nullptr;
 
+  // The caller frees the metadata with free_camera_metadata().
+  CameraMetadataPool::GetInstance().Detach(metadata);
   return metadata;
 }
 
@@ -128,6 +134,22 @@ size_t HalCameraMetadata::GetCameraMetadataSize() const {
   return get_camera_metadata_size(metadata_);
 }
 
+status_t HalCameraMetadata::Reallocate(size_t entry_capacity,
+                                       size_t data_capacity) {
+  CameraMetadataPool& pool = CameraMetadataPool::GetInstance();
+  camera_metadata_t* metadata = metadata_;
+  metadata_ = pool.Allocate(entry_capacity, data_capacity);
+  if (metadata_ == nullptr) {
+    ALOGE("%s: Can't allocate larger metadata buffer", __FUNCTION__);
+    metadata_ = metadata;
+    return NO_MEMORY;
+  }
+  append_camera_metadata(metadata_, metadata);
+  pool.Free(metadata);
+
+  return OK;
+}
+
 status_t HalCameraMetadata::ResizeIfNeeded(size_t extra_entries,
                                            size_t extra_data) {
   bool resize = false;
@@ -152,20 +174,64 @@ status_t HalCameraMetadata::ResizeIfNeeded(size_t extra_entries,
   }
 
   if (resize) {
-    camera_metadata_t* metadata = metadata_;
-    metadata_ = allocate_camera_metadata(new_entry_count, new_data_count);
-    if (metadata_ == nullptr) {
-      ALOGE("%s: Can't allocate larger metadata buffer", __FUNCTION__);
-      metadata_ = metadata;
-      return NO_MEMORY;
-    }
-    append_camera_metadata(metadata_, metadata);
-    free_camera_metadata(metadata);
+    return Reallocate(new_entry_count, new_data_count);
   }
 
   return OK;
 }
 
+status_t HalCameraMetadata::Reserve(size_t extra_entries, size_t extra_data) {
+  std::unique_lock<std::mutex> lock(metadata_lock_);
+  if (metadata_ == nullptr) {
+    ALOGE("%s: metadata_ is nullptr", __FUNCTION__);
+    return INVALID_OPERATION;
+  }
+
+  size_t entry_capacity =
+      std::max(get_camera_metadata_entry_count(metadata_) + extra_entries,
+               get_camera_metadata_entry_capacity(metadata_));
+  size_t data_capacity =
+      std::max(get_camera_metadata_data_count(metadata_) + extra_data,
+               get_camera_metadata_data_capacity(metadata_));
+  if (entry_capacity == get_camera_metadata_entry_capacity(metadata_) &&
+      data_capacity == get_camera_metadata_data_capacity(metadata_)) {
+    return OK;
+  }
+
+  return Reallocate(entry_capacity, data_capacity);
+}
+
+status_t HalCameraMetadata::Seal() {
+  std::unique_lock<std::mutex> lock(metadata_lock_);
+  if (metadata_ == nullptr) {
+    ALOGE("%s: metadata_ is nullptr", __FUNCTION__);
+    return INVALID_OPERATION;
+  }
+
+  return sort_camera_metadata(metadata_);
+}
+
+bool HalCameraMetadata::IsDataInMetadata(const void* data) const {
+  size_t buffer_size = get_camera_metadata_size(metadata_);
+  uintptr_t buffer_addr = reinterpret_cast<uintptr_t>(metadata_);
+  uintptr_t data_addr = reinterpret_cast<uintptr_t>(data);
+  return data_addr > buffer_addr && data_addr < (buffer_addr + buffer_size);
+}
+
+status_t HalCameraMetadata::SetEntryLocked(uint32_t tag, const void* data,
+                                           size_t data_count) {
+  camera_metadata_entry_t entry;
+  status_t res = find_camera_metadata_entry(metadata_, tag, &entry);
+  if (res == NAME_NOT_FOUND) {
+    res = add_camera_metadata_entry(metadata_, tag, data, data_count);
+  } else if (res == OK) {
+    res = update_camera_metadata_entry(metadata_, entry.index, data, data_count,
+                                       nullptr);
+  }
+
+  return res;
+}
+
 status_t HalCameraMetadata::SetMetadataRaw(uint32_t tag, const void* data,
                                            size_t data_count) {
   status_t res;
@@ -176,10 +242,7 @@ status_t HalCameraMetadata::SetMetadataRaw(uint32_t tag, const void* data,
   }
   // Safety check - ensure that data isn't pointing to this metadata, since
   // that would get invalidated if a resize is needed
-  size_t buffer_size = get_camera_metadata_size(metadata_);
-  uintptr_t buffer_addr = reinterpret_cast<uintptr_t>(metadata_);
-  uintptr_t data_addr = reinterpret_cast<uintptr_t>(data);
-  if (data_addr > buffer_addr && data_addr < (buffer_addr + buffer_size)) {
+  if (IsDataInMetadata(data)) {
     ALOGE("%s: Update attempted with data from the same metadata buffer!",
           __FUNCTION__);
     return INVALID_OPERATION;
@@ -192,16 +255,7 @@ status_t HalCameraMetadata::SetMetadataRaw(uint32_t tag, const void* data,
     return res;
   }
 
-  camera_metadata_entry_t entry;
-  res = find_camera_metadata_entry(metadata_, tag, &entry);
-  if (res == NAME_NOT_FOUND) {
-    res = add_camera_metadata_entry(metadata_, tag, data, data_count);
-  } else if (res == OK) {
-    res = update_camera_metadata_entry(metadata_, entry.index, data, data_count,
-                                       nullptr);
-  }
-
-  return res;
+  return SetEntryLocked(tag, data, data_count);
 }
 
 bool HalCameraMetadata::IsTypeValid(uint32_t tag, int32_t expected_type) {
@@ -351,6 +405,47 @@ status_t HalCameraMetadata::Set(const camera_metadata_ro_entry& entry) {
   return res;
 }
 
+status_t HalCameraMetadata::Set(
+    const std::vector<camera_metadata_ro_entry>& entries) {
+  std::unique_lock<std::mutex> lock(metadata_lock_);
+  if (metadata_ == nullptr) {
+    ALOGE("%s: metadata_ is nullptr", __FUNCTION__);
+    return INVALID_OPERATION;
+  }
+
+  size_t extra_data = 0;
+  for (auto& entry : entries) {
+    int32_t type = get_camera_metadata_tag_type(entry.tag);
+    if (type == -1) {
+      ALOGE("%s: Tag 0x%x not found", __FUNCTION__, entry.tag);
+      return BAD_VALUE;
+    }
+    if (IsDataInMetadata(entry.data.u8)) {
+      ALOGE("%s: Update attempted with data from the same metadata buffer!",
+            __FUNCTION__);
+      return INVALID_OPERATION;
+    }
+    extra_data += calculate_camera_metadata_entry_data_size(type, entry.count);
+  }
+
+  status_t res = ResizeIfNeeded(entries.size(), extra_data);
+  if (res != OK) {
+    ALOGE("%s: Resize fail", __FUNCTION__);
+    return res;
+  }
+
+  for (auto& entry : entries) {
+    res = SetEntryLocked(entry.tag, entry.data.u8, entry.count);
+    if (res != OK) {
+      ALOGE("%s: Setting tag 0x%x failed: %s (%d)", __FUNCTION__, entry.tag,
+            strerror(-res), res);
+      return res;
+    }
+  }
+
+  return OK;
+}
+
 status_t HalCameraMetadata::Get(uint32_t tag,
                                 camera_metadata_ro_entry* entry) const {
   if (entry == nullptr) {
@@ -425,8 +520,9 @@ status_t HalCameraMetadata::Erase(const std::unordered_set<uint32_t>& tags) {
   size_t data_capacity = (2 * new_data_count);
 
   // Allocate a new buffer with the smaller size
+  CameraMetadataPool& pool = CameraMetadataPool::GetInstance();
   camera_metadata_t* orig_metadata = metadata_;
-  metadata_ = allocate_camera_metadata(entry_capacity, data_capacity);
+  metadata_ = pool.Allocate(entry_capacity, data_capacity);
   if (metadata_ == nullptr) {
     ALOGE("%s: Can't allocate new metadata buffer", __FUNCTION__);
     metadata_ = orig_metadata;
@@ -450,13 +546,13 @@ status_t HalCameraMetadata::Erase(const std::unordered_set<uint32_t>& tags) {
     if (res != OK) {
       ALOGE("%s: Error adding entry at index %zu failed: %s %d", __FUNCTION__,
             entry_index, strerror(-res), res);
-      free_camera_metadata(metadata_);
+      pool.Free(metadata_);
       metadata_ = orig_metadata;
       return res;
     }
   }
 
-  free_camera_metadata(orig_metadata);
+  pool.Free(orig_metadata);
   return OK;
 }
 
@@ -619,7 +715,8 @@ status_t HalCameraMetadata::Append(
     return BAD_VALUE;
   }
 
-  return Append(hal_metadata->ReleaseCameraMetadata());
+  // hal_metadata returns its buffer to the pool when it goes out of scope.
+  return Append(hal_metadata->GetRawCameraMetadata());
 }
 
 status_t HalCameraMetadata::Append(const camera_metadata_t* metadata) {
@@ -91,6 +91,21 @@ class HalCameraMetadata {
   // This is a helper function, it will call related Set(...).
   // You don't need to set type in the entry, it gets type from tag id.
   status_t Set(const camera_metadata_ro_entry& entry);
+  // Set multiple entries at once. The types are taken from the tag ids like
+  // above. The space needed by all entries is computed up front, so the
+  // metadata is resized at most once.
+  status_t Set(const std::vector<camera_metadata_ro_entry>& entries);
+
+  // Make room for extra_entries more entries with extra_data more bytes of
+  // data, so that adding them doesn't need to reallocate the metadata.
+  // Unlike the resize done by Set(), this allocates exactly what is asked for.
+  status_t Reserve(size_t extra_entries, size_t extra_data);
+
+  // Sort the entries by tag, so that Get() on read-mostly metadata, like
+  // static characteristics, does a binary search instead of a linear scan.
+  // Updating existing entries keeps the metadata sorted, adding new entries
+  // or appending metadata drops it.
+  status_t Seal();
 
   // Get a key's value by tag. Returns NAME_NOT_FOUND if the tag does not exist
   status_t Get(uint32_t tag, camera_metadata_ro_entry* entry) const;
@@ -139,8 +154,18 @@ class HalCameraMetadata {
   // Base Set entry method.
   status_t SetMetadataRaw(uint32_t tag, const void* data, size_t data_count);
 
+  // Add or update an entry that is known to fit in metadata_.
+  status_t SetEntryLocked(uint32_t tag, const void* data, size_t data_count);
+
+  // Check that data doesn't point into metadata_, as it could be invalidated
+  // by a resize.
+  bool IsDataInMetadata(const void* data) const;
+
   status_t ResizeIfNeeded(size_t extra_entries, size_t extra_data);
 
+  // Move metadata_ to a new buffer with the given capacities.
+  status_t Reallocate(size_t entry_capacity, size_t data_capacity);
+
   // Copy entry at the given index from source buffer to destination buffer
   status_t CopyEntry(const camera_metadata_t* src, camera_metadata_t* dest,
                      size_t entry_index) const;
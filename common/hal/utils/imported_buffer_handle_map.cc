@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "GCH_ImportedBufferHandleMap"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include "imported_buffer_handle_map.h"
+
+namespace android {
+namespace google_camera_hal {
+
+namespace {
+// Fibonacci hashing spreads the mostly sequential buffer IDs over the table.
+constexpr uint64_t kHashMultiplier = 0x9E3779B97F4A7C15ull;
+// Minimum and maximum number of slots in a table.
+constexpr uint32_t kMinCapacity = 16;
+constexpr uint32_t kMaxCapacity = 1u << 20;
+
+uint32_t GetCapacity(uint32_t num_buffers) {
+  uint32_t capacity = kMinCapacity;
+  // Keep the load factor at or below 1/2 after sizing.
+  while (capacity < kMaxCapacity && capacity / 2 < num_buffers) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+}  // namespace
+
+ImportedBufferHandleMap::~ImportedBufferHandleMap() = default;
+
+std::unique_ptr<ImportedBufferHandleMap::StreamTable>
+ImportedBufferHandleMap::CreateTable(int32_t stream_id, uint32_t num_buffers) {
+  auto table = std::make_unique<StreamTable>();
+  table->stream_id = stream_id;
+  table->capacity = GetCapacity(num_buffers);
+  table->hash_shift = 64;
+  for (uint32_t capacity = table->capacity; capacity > 1; capacity >>= 1) {
+    table->hash_shift--;
+  }
+  table->slots = std::make_unique<Slot[]>(table->capacity);
+  return table;
+}
+
+ImportedBufferHandleMap::Slot* ImportedBufferHandleMap::FindSlot(
+    const StreamTable& table, uint64_t buffer_id) {
+  uint32_t mask = table.capacity - 1;
+  uint32_t index = (buffer_id * kHashMultiplier) >> table.hash_shift;
+  for (uint32_t i = 0; i < table.capacity; i++) {
+    Slot* slot = &table.slots[(index + i) & mask];
+    if (!slot->used.load(std::memory_order_acquire) ||
+        slot->buffer_id.load(std::memory_order_relaxed) == buffer_id) {
+      return slot;
+    }
+  }
+
+  return nullptr;
+}
+
+std::unique_ptr<ImportedBufferHandleMap::StreamTable>
+ImportedBufferHandleMap::Rehash(const StreamTable& table,
+                                uint32_t num_buffers) {
+  // Don't shrink below the current size; rehashing mostly drops the slots of
+  // removed buffers.
+  auto new_table = CreateTable(
+      table.stream_id, std::max(num_buffers, table.capacity / 2));
+  for (uint32_t i = 0; i < table.capacity; i++) {
+    const Slot& slot = table.slots[i];
+    buffer_handle_t handle = slot.handle.load(std::memory_order_relaxed);
+    if (!slot.used.load(std::memory_order_relaxed) || handle == nullptr) {
+      continue;
+    }
+
+    uint64_t buffer_id = slot.buffer_id.load(std::memory_order_relaxed);
+    // The new table isn't published yet, so relaxed stores are enough.
+    Slot* new_slot = FindSlot(*new_table, buffer_id);
+    new_slot->buffer_id.store(buffer_id, std::memory_order_relaxed);
+    new_slot->handle.store(handle, std::memory_order_relaxed);
+    new_slot->used.store(true, std::memory_order_relaxed);
+    new_table->num_used++;
+    new_table->num_buffers++;
+  }
+
+  return new_table;
+}
+
+ImportedBufferHandleMap::StreamTable* ImportedBufferHandleMap::GetTableLocked(
+    int32_t stream_id) const {
+  for (auto& table : tables_) {
+    if (table->stream_id == stream_id) {
+      return table.get();
+    }
+  }
+
+  return nullptr;
+}
+
+void ImportedBufferHandleMap::ReplaceTableLocked(
+    int32_t stream_id, std::unique_ptr<StreamTable> table) {
+  auto table_it =
+      std::find_if(tables_.begin(), tables_.end(), [stream_id](auto& t) {
+        return t->stream_id == stream_id;
+      });
+  if (table_it != tables_.end()) {
+    retired_tables_.push_back(std::move(*table_it));
+    tables_.erase(table_it);
+  }
+  if (table != nullptr) {
+    tables_.push_back(std::move(table));
+  }
+
+  auto directory = std::make_unique<Directory>();
+  for (auto& t : tables_) {
+    directory->tables.push_back(t.get());
+  }
+  directory_.store(directory.get());
+  if (current_directory_ != nullptr) {
+    retired_directories_.push_back(std::move(current_directory_));
+  }
+  current_directory_ = std::move(directory);
+
+  ReclaimLocked();
+}
+
+void ImportedBufferHandleMap::ReclaimLocked() {
+  if (retired_directories_.empty() && retired_tables_.empty()) {
+    return;
+  }
+
+  // Readers that start after the new directory was published can't reach the
+  // retired ones.
+  if (num_readers_.load() == 0) {
+    retired_directories_.clear();
+    retired_tables_.clear();
+  }
+}
+
+void ImportedBufferHandleMap::ReserveStream(int32_t stream_id,
+                                            uint32_t num_buffers) {
+  std::lock_guard<std::mutex> lock(writer_lock_);
+  StreamTable* table = GetTableLocked(stream_id);
+  if (table == nullptr) {
+    ReplaceTableLocked(stream_id, CreateTable(stream_id, num_buffers));
+  } else if (table->capacity < GetCapacity(num_buffers)) {
+    ReplaceTableLocked(stream_id, Rehash(*table, num_buffers));
+  }
+}
+
+buffer_handle_t ImportedBufferHandleMap::Find(
+    const BufferCache& buffer_cache) const {
+  num_readers_.fetch_add(1);
+
+  buffer_handle_t handle = nullptr;
+  Directory* directory = directory_.load();
+  if (directory != nullptr) {
+    for (StreamTable* table : directory->tables) {
+      if (table->stream_id != buffer_cache.stream_id) {
+        continue;
+      }
+
+      Slot* slot = FindSlot(*table, buffer_cache.buffer_id);
+      if (slot != nullptr && slot->used.load(std::memory_order_acquire) &&
+          slot->buffer_id.load(std::memory_order_relaxed) ==
+              buffer_cache.buffer_id) {
+        handle = slot->handle.load(std::memory_order_acquire);
+      }
+      break;
+    }
+  }
+
+  num_readers_.fetch_sub(1, std::memory_order_release);
+  return handle;
+}
+
+status_t ImportedBufferHandleMap::Add(const BufferCache& buffer_cache,
+                                      buffer_handle_t buffer_handle) {
+  ATRACE_CALL();
+  if (buffer_handle == nullptr) {
+    ALOGE("%s: buffer_handle is nullptr", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  std::lock_guard<std::mutex> lock(writer_lock_);
+  StreamTable* table = GetTableLocked(buffer_cache.stream_id);
+  if (table == nullptr) {
+    auto new_table = CreateTable(buffer_cache.stream_id, /*num_buffers=*/0);
+    table = new_table.get();
+    ReplaceTableLocked(buffer_cache.stream_id, std::move(new_table));
+  }
+
+  Slot* slot = FindSlot(*table, buffer_cache.buffer_id);
+  if (slot != nullptr && slot->used.load(std::memory_order_relaxed)) {
+    buffer_handle_t handle = slot->handle.load(std::memory_order_relaxed);
+    if (handle == nullptr) {
+      // The buffer was removed before; reuse its slot.
+      slot->handle.store(buffer_handle, std::memory_order_release);
+      table->num_buffers++;
+    } else if (handle != buffer_handle) {
+      ALOGE(
+          "%s: Cached buffer handle %p doesn't match %p for stream %u buffer "
+          "%" PRIu64,
+          __FUNCTION__, handle, buffer_handle, buffer_cache.stream_id,
+          buffer_cache.buffer_id);
+      return BAD_VALUE;
+    }
+    return OK;
+  }
+
+  // Keep the load factor, including removed buffers, at or below 3/4.
+  if (slot == nullptr || (table->num_used + 1) * 4 > table->capacity * 3) {
+    auto new_table = Rehash(*table, table->num_buffers + 1);
+    table = new_table.get();
+    ReplaceTableLocked(buffer_cache.stream_id, std::move(new_table));
+    slot = FindSlot(*table, buffer_cache.buffer_id);
+  }
+
+  slot->buffer_id.store(buffer_cache.buffer_id, std::memory_order_relaxed);
+  slot->handle.store(buffer_handle, std::memory_order_relaxed);
+  slot->used.store(true, std::memory_order_release);
+  table->num_used++;
+  table->num_buffers++;
+
+  return OK;
+}
+
+buffer_handle_t ImportedBufferHandleMap::Remove(
+    const BufferCache& buffer_cache) {
+  std::lock_guard<std::mutex> lock(writer_lock_);
+  StreamTable* table = GetTableLocked(buffer_cache.stream_id);
+  if (table == nullptr) {
+    return nullptr;
+  }
+
+  Slot* slot = FindSlot(*table, buffer_cache.buffer_id);
+  if (slot == nullptr || !slot->used.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+
+  buffer_handle_t handle = slot->handle.load(std::memory_order_relaxed);
+  if (handle != nullptr) {
+    slot->handle.store(nullptr, std::memory_order_release);
+    table->num_buffers--;
+  }
+
+  return handle;
+}
+
+std::vector<buffer_handle_t> ImportedBufferHandleMap::RemoveStream(
+    int32_t stream_id) {
+  std::lock_guard<std::mutex> lock(writer_lock_);
+  std::vector<buffer_handle_t> handles;
+  StreamTable* table = GetTableLocked(stream_id);
+  if (table == nullptr) {
+    return handles;
+  }
+
+  for (uint32_t i = 0; i < table->capacity; i++) {
+    buffer_handle_t handle =
+        table->slots[i].handle.load(std::memory_order_relaxed);
+    if (handle != nullptr) {
+      handles.push_back(handle);
+    }
+  }
+
+  ReplaceTableLocked(stream_id, /*table=*/nullptr);
+  return handles;
+}
+
+std::vector<buffer_handle_t> ImportedBufferHandleMap::RemoveAll() {
+  std::lock_guard<std::mutex> lock(writer_lock_);
+  std::vector<buffer_handle_t> handles;
+  for (auto& table : tables_) {
+    for (uint32_t i = 0; i < table->capacity; i++) {
+      buffer_handle_t handle =
+          table->slots[i].handle.load(std::memory_order_relaxed);
+      if (handle != nullptr) {
+        handles.push_back(handle);
+      }
+    }
+    retired_tables_.push_back(std::move(table));
+  }
+  tables_.clear();
+
+  directory_.store(nullptr);
+  if (current_directory_ != nullptr) {
+    retired_directories_.push_back(std::move(current_directory_));
+  }
+  ReclaimLocked();
+
+  return handles;
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
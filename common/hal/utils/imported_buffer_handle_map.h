@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_IMPORTED_BUFFER_HANDLE_MAP_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_IMPORTED_BUFFER_HANDLE_MAP_H_
+
+#include <utils/Errors.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "hal_types.h"
+
+namespace android {
+namespace google_camera_hal {
+
+// ImportedBufferHandleMap maps a buffer cache (a stream ID and a buffer ID) to
+// the buffer handle imported for it. Each stream has its own open-addressing
+// table, which can be sized for the stream's maximum number of buffers when
+// the stream is configured.
+//
+// Find() takes no locks, so looking up buffers that were already imported
+// doesn't contend with other requests or with the result path. Modifications
+// are serialized internally. Tables replaced by a modification are freed once
+// no Find() is running.
+class ImportedBufferHandleMap {
+ public:
+  ImportedBufferHandleMap() = default;
+  ~ImportedBufferHandleMap();
+
+  // Size the table of stream_id for num_buffers buffers.
+  void ReserveStream(int32_t stream_id, uint32_t num_buffers);
+
+  // Return the buffer handle of buffer_cache, or nullptr if buffer_cache is
+  // not in the map.
+  buffer_handle_t Find(const BufferCache& buffer_cache) const;
+
+  // Add a buffer handle for buffer_cache. Returns BAD_VALUE if buffer_cache is
+  // already in the map with a different buffer handle.
+  status_t Add(const BufferCache& buffer_cache, buffer_handle_t buffer_handle);
+
+  // Remove buffer_cache from the map and return its buffer handle, or nullptr
+  // if buffer_cache is not in the map.
+  buffer_handle_t Remove(const BufferCache& buffer_cache);
+
+  // Remove all buffers of stream_id and return their buffer handles.
+  std::vector<buffer_handle_t> RemoveStream(int32_t stream_id);
+
+  // Remove all buffers and return their buffer handles.
+  std::vector<buffer_handle_t> RemoveAll();
+
+ private:
+  struct Slot {
+    // A slot is used once a buffer ID is written to it. It keeps the buffer ID
+    // after the buffer is removed so that the probe sequences of other buffers
+    // stay intact; a removed buffer has a nullptr handle.
+    std::atomic<bool> used = false;
+    std::atomic<uint64_t> buffer_id = 0;
+    std::atomic<buffer_handle_t> handle = nullptr;
+  };
+
+  struct StreamTable {
+    int32_t stream_id = -1;
+    // Number of slots. Always a power of 2.
+    uint32_t capacity = 0;
+    // Shift applied to the hash of a buffer ID to get its first slot.
+    uint32_t hash_shift = 0;
+    // Number of used slots, including removed buffers. Only accessed by
+    // writers.
+    uint32_t num_used = 0;
+    // Number of buffers in the table. Only accessed by writers.
+    uint32_t num_buffers = 0;
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  // The tables of all streams. A directory is immutable once it's published
+  // and is replaced whenever a table is added, removed or resized.
+  struct Directory {
+    std::vector<StreamTable*> tables;
+  };
+
+  // Return a new table with enough slots for num_buffers buffers.
+  static std::unique_ptr<StreamTable> CreateTable(int32_t stream_id,
+                                                  uint32_t num_buffers);
+
+  // Return the slot of buffer_id, or the unused slot where it would be
+  // inserted. Returns nullptr if the table is full.
+  static Slot* FindSlot(const StreamTable& table, uint64_t buffer_id);
+
+  // Copy the buffers in table to a new table for num_buffers buffers.
+  static std::unique_ptr<StreamTable> Rehash(const StreamTable& table,
+                                             uint32_t num_buffers);
+
+  // Return the table of stream_id, or nullptr if the stream doesn't have a
+  // table. Must be called with writer_lock_ locked.
+  StreamTable* GetTableLocked(int32_t stream_id) const;
+
+  // Replace the table of stream_id with table, or remove it if table is
+  // nullptr, and publish a new directory. Must be called with writer_lock_
+  // locked.
+  void ReplaceTableLocked(int32_t stream_id,
+                          std::unique_ptr<StreamTable> table);
+
+  // Free the retired tables and directories if no reader is running. Must be
+  // called with writer_lock_ locked.
+  void ReclaimLocked();
+
+  // Serializes modifications.
+  std::mutex writer_lock_;
+
+  // Number of Find() calls in progress.
+  mutable std::atomic<uint32_t> num_readers_ = 0;
+
+  // The published directory. Readers only load it; it's owned by
+  // current_directory_.
+  std::atomic<Directory*> directory_ = nullptr;
+
+  // The following are protected by writer_lock_.
+  std::unique_ptr<Directory> current_directory_;
+  std::vector<std::unique_ptr<StreamTable>> tables_;
+  // Directories and tables that readers may still be using.
+  std::vector<std::unique_ptr<Directory>> retired_directories_;
+  std::vector<std::unique_ptr<StreamTable>> retired_tables_;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_UTILS_IMPORTED_BUFFER_HANDLE_MAP_H_
@@ -41,7 +41,8 @@ int32_t GetNextAvailableStreamId() {
 }  // namespace
 
 std::unique_ptr<InternalStreamManager> InternalStreamManager::Create(
-    IHalBufferAllocator* buffer_allocator, int partial_result_count) {
+    IHalBufferAllocator* buffer_allocator, int partial_result_count,
+    const std::vector<uint32_t>& zsl_metadata_tags) {
   ATRACE_CALL();
   auto stream_manager =
       std::unique_ptr<InternalStreamManager>(new InternalStreamManager());
@@ -50,15 +51,18 @@ std::unique_ptr<InternalStreamManager> InternalStreamManager::Create(
     return nullptr;
   }
 
-  stream_manager->Initialize(buffer_allocator, partial_result_count);
+  stream_manager->Initialize(buffer_allocator, partial_result_count,
+                             zsl_metadata_tags);
 
   return stream_manager;
 }
 
-void InternalStreamManager::Initialize(IHalBufferAllocator* buffer_allocator,
-                                       int partial_result_count) {
+void InternalStreamManager::Initialize(
+    IHalBufferAllocator* buffer_allocator, int partial_result_count,
+    const std::vector<uint32_t>& zsl_metadata_tags) {
   hwl_buffer_allocator_ = buffer_allocator;
   partial_result_count_ = partial_result_count;
+  zsl_metadata_tags_ = zsl_metadata_tags;
 }
 
 status_t InternalStreamManager::IsStreamRegisteredLocked(int32_t stream_id) const {
@@ -176,7 +180,7 @@ status_t InternalStreamManager::AllocateBuffersLocked(
 
   auto buffer_manager = std::make_unique<ZslBufferManager>(
       need_vendor_buffer ? hwl_buffer_allocator_ : nullptr,
-      partial_result_count_);
+      partial_result_count_, zsl_metadata_tags_);
   if (buffer_manager == nullptr) {
     ALOGE("%s: Failed to create a buffer manager for stream %d", __FUNCTION__,
           stream_id);
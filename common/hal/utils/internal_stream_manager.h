@@ -21,6 +21,7 @@
 #include <utils/Errors.h>
 
 #include <unordered_map>
+#include <vector>
 
 #include "camera_buffer_allocator_hwl.h"
 #include "hal_buffer_allocator.h"
@@ -34,9 +35,12 @@ namespace google_camera_hal {
 // create internal streams and allocate internal stream buffers.
 class InternalStreamManager {
  public:
+  // If zsl_metadata_tags is not empty, only these result metadata tags are
+  // kept with ZSL buffers. See ZslBufferManager.
   static std::unique_ptr<InternalStreamManager> Create(
       IHalBufferAllocator* buffer_allocator = nullptr,
-      int partial_result_count = 1);
+      int partial_result_count = 1,
+      const std::vector<uint32_t>& zsl_metadata_tags = {});
   virtual ~InternalStreamManager() = default;
 
   // stream contains the stream info to be registered. if stream.id is smaller
@@ -105,7 +109,8 @@ class InternalStreamManager {
 
   // Initialize internal stream manager
   void Initialize(IHalBufferAllocator* buffer_allocator,
-                  int partial_result_count);
+                  int partial_result_count,
+                  const std::vector<uint32_t>& zsl_metadata_tags);
 
   // Return if a stream is registered. Must be called with stream_mutex_ locked.
   status_t IsStreamRegisteredLocked(int32_t stream_id) const;
@@ -163,6 +168,9 @@ class InternalStreamManager {
 
   // Partial result count reported by camera HAL
   int partial_result_count_ = 1;
+
+  // Result metadata tags kept with ZSL buffers. Empty to keep all tags.
+  std::vector<uint32_t> zsl_metadata_tags_;
 };
 
 }  // namespace google_camera_hal
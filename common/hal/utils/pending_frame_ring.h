@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_PENDING_FRAME_RING_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_PENDING_FRAME_RING_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+// PendingFrameRing keeps one entry per in-flight frame, ordered by frame
+// number. Entries live in a ring indexed by frame number modulo the capacity.
+// Frame numbers of in-flight requests are dense and bounded by the pipeline
+// depth, so once the ring is large enough inserting and erasing entries
+// neither allocates nor moves other entries. If the pending frames span more
+// than the capacity, e.g. because requests are split across several
+// dispatchers, the ring grows to the next power of two that covers the span.
+//
+// The ring never spans more than kMaxCapacity frames. Entries that don't fit,
+// e.g. a frame that never completes while newer frames keep coming, are kept
+// in an ordered overflow map instead, so one stuck frame can't grow the ring
+// without bound.
+//
+// PendingFrameRing is not thread-safe.
+template <typename T>
+class PendingFrameRing {
+ public:
+  static constexpr uint32_t kDefaultCapacity = 32;
+  static constexpr uint32_t kMaxCapacity = 1024;
+
+  // capacity will be rounded up to a power of two and is at most
+  // kMaxCapacity.
+  explicit PendingFrameRing(uint32_t capacity = kDefaultCapacity) {
+    slots_.resize(RoundUpToPowerOfTwo(std::min(capacity, kMaxCapacity)));
+  }
+
+  // Add a default constructed entry for frame_number. Returns nullptr if the
+  // entry already exists.
+  T* Insert(uint32_t frame_number) {
+    if (!overflow_.empty() && overflow_.count(frame_number) > 0) {
+      return nullptr;
+    }
+
+    if (size_ == 0) {
+      begin_ = frame_number;
+      end_ = frame_number + 1;
+    } else {
+      uint32_t begin = std::min(begin_, frame_number);
+      uint32_t end = std::max(end_, frame_number + 1);
+      if (end - begin > kMaxCapacity) {
+        if (frame_number < begin_) {
+          return &overflow_[frame_number];
+        }
+        // Make room for the new frame by moving the oldest entries out.
+        MoveToOverflow(end - kMaxCapacity);
+        begin = size_ == 0 ? frame_number : begin_;
+      }
+      if (end - begin > slots_.size()) {
+        Grow(end - begin);
+      }
+      begin_ = begin;
+      end_ = end;
+    }
+
+    Slot& slot = slots_[frame_number & (slots_.size() - 1)];
+    if (slot.used) {
+      // The span fits in the ring, so this can only be the same frame.
+      return nullptr;
+    }
+
+    slot.frame_number = frame_number;
+    slot.used = true;
+    size_++;
+    return &slot.value;
+  }
+
+  // Return the entry of frame_number or nullptr if there is none.
+  T* Find(uint32_t frame_number) {
+    if (size_ > 0 && frame_number >= begin_ && frame_number < end_ &&
+        IsUsed(frame_number)) {
+      return &slots_[frame_number & (slots_.size() - 1)].value;
+    }
+
+    if (overflow_.empty()) {
+      return nullptr;
+    }
+    auto it = overflow_.find(frame_number);
+    return it == overflow_.end() ? nullptr : &it->second;
+  }
+
+  // Return the entry with the lowest frame number, or nullptr if the ring is
+  // empty.
+  T* Front(uint32_t* frame_number) {
+    if (!overflow_.empty() &&
+        (size_ == 0 || overflow_.begin()->first < begin_)) {
+      *frame_number = overflow_.begin()->first;
+      return &overflow_.begin()->second;
+    }
+
+    if (size_ == 0) {
+      return nullptr;
+    }
+
+    *frame_number = begin_;
+    return &slots_[begin_ & (slots_.size() - 1)].value;
+  }
+
+  void Erase(uint32_t frame_number) {
+    if (size_ == 0 || frame_number < begin_ || frame_number >= end_ ||
+        !IsUsed(frame_number)) {
+      if (!overflow_.empty()) {
+        overflow_.erase(frame_number);
+      }
+      return;
+    }
+
+    Slot& slot = slots_[frame_number & (slots_.size() - 1)];
+    slot.used = false;
+    // Release whatever the entry holds right away.
+    slot.value = T();
+    size_--;
+
+    if (size_ == 0) {
+      begin_ = end_ = 0;
+      return;
+    }
+
+    if (frame_number == begin_) {
+      while (!IsUsed(begin_)) {
+        begin_++;
+      }
+    }
+    if (frame_number + 1 == end_) {
+      while (!IsUsed(end_ - 1)) {
+        end_--;
+      }
+    }
+  }
+
+  bool Empty() const {
+    return size_ == 0 && overflow_.empty();
+  }
+
+  size_t Size() const {
+    return size_ + overflow_.size();
+  }
+
+  size_t Capacity() const {
+    return slots_.size();
+  }
+
+  // Number of entries kept outside of the ring.
+  size_t OverflowSize() const {
+    return overflow_.size();
+  }
+
+  // Invoke func(frame_number, entry) for all entries in frame number order.
+  template <typename Func>
+  void ForEach(Func func) {
+    auto overflow_it = overflow_.begin();
+    for (uint32_t frame_number = begin_; size_ > 0 && frame_number != end_;
+         frame_number++) {
+      if (!IsUsed(frame_number)) {
+        continue;
+      }
+      for (; overflow_it != overflow_.end() &&
+             overflow_it->first < frame_number;
+           overflow_it++) {
+        func(overflow_it->first, overflow_it->second);
+      }
+      func(frame_number, slots_[frame_number & (slots_.size() - 1)].value);
+    }
+    for (; overflow_it != overflow_.end(); overflow_it++) {
+      func(overflow_it->first, overflow_it->second);
+    }
+  }
+
+ private:
+  struct Slot {
+    uint32_t frame_number = 0;
+    bool used = false;
+    T value = {};
+  };
+
+  static uint32_t RoundUpToPowerOfTwo(uint32_t value) {
+    uint32_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  bool IsUsed(uint32_t frame_number) const {
+    const Slot& slot = slots_[frame_number & (slots_.size() - 1)];
+    return slot.used && slot.frame_number == frame_number;
+  }
+
+  void Grow(uint32_t span) {
+    std::vector<Slot> slots(RoundUpToPowerOfTwo(span));
+    for (auto& slot : slots_) {
+      if (slot.used) {
+        slots[slot.frame_number & (slots.size() - 1)] = std::move(slot);
+      }
+    }
+    slots_ = std::move(slots);
+  }
+
+  // Move the ring entries below frame_number to overflow_.
+  void MoveToOverflow(uint32_t frame_number) {
+    uint32_t end = std::min(frame_number, end_);
+    for (uint32_t i = begin_; size_ > 0 && i != end; i++) {
+      if (!IsUsed(i)) {
+        continue;
+      }
+      Slot& slot = slots_[i & (slots_.size() - 1)];
+      overflow_[i] = std::move(slot.value);
+      slot.used = false;
+      slot.value = T();
+      size_--;
+    }
+
+    if (size_ == 0) {
+      begin_ = end_ = 0;
+      return;
+    }
+    begin_ = end;
+    while (!IsUsed(begin_)) {
+      begin_++;
+    }
+  }
+
+  std::vector<Slot> slots_;
+  // Number of entries in slots_.
+  size_t size_ = 0;
+
+  // Entries that don't fit in the ring, ordered by frame number.
+  std::map<uint32_t, T> overflow_;
+
+  // Lowest frame number in the ring and one past the highest one. Only valid
+  // if size_ > 0. end_ - begin_ is at most kMaxCapacity.
+  uint32_t begin_ = 0;
+  uint32_t end_ = 0;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_UTILS_PENDING_FRAME_RING_H_
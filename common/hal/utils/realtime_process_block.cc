@@ -190,6 +190,17 @@ status_t RealtimeProcessBlock::Flush() {
   return device_session_hwl_->Flush();
 }
 
+status_t RealtimeProcessBlock::SignalStreamFlush(
+    const std::vector<int32_t>& stream_ids) {
+  ATRACE_CALL();
+  std::shared_lock lock(configure_shared_mutex_);
+  if (!is_configured_) {
+    return OK;
+  }
+
+  return device_session_hwl_->SignalStreamFlush(stream_ids);
+}
+
 void RealtimeProcessBlock::NotifyHwlPipelineResult(
     std::unique_ptr<HwlPipelineResult> hwl_result) {
   ATRACE_CALL();
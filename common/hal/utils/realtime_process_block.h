@@ -54,6 +54,8 @@ class RealtimeProcessBlock : public ProcessBlock {
       const CaptureRequest& remaining_session_request) override;
 
   status_t Flush() override;
+
+  status_t SignalStreamFlush(const std::vector<int32_t>& stream_ids) override;
   // Override functions of ProcessBlock end.
 
  protected:
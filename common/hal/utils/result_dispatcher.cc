@@ -35,11 +35,12 @@ namespace google_camera_hal {
 std::unique_ptr<ResultDispatcher> ResultDispatcher::Create(
     uint32_t partial_result_count,
     ProcessCaptureResultFunc process_capture_result, NotifyFunc notify,
-    const StreamConfiguration& stream_config, std::string_view name) {
+    const StreamConfiguration& stream_config, std::string_view name,
+    ProcessBatchCaptureResultFunc process_batch_capture_result) {
   ATRACE_CALL();
-  auto dispatcher = std::unique_ptr<ResultDispatcher>(
-      new ResultDispatcher(partial_result_count, process_capture_result, notify,
-                           stream_config, name));
+  auto dispatcher = std::unique_ptr<ResultDispatcher>(new ResultDispatcher(
+      partial_result_count, process_capture_result, notify, stream_config, name,
+      process_batch_capture_result));
   if (dispatcher == nullptr) {
     ALOGE("[%s] %s: Creating ResultDispatcher failed.",
           std::string(name).c_str(), __FUNCTION__);
@@ -52,10 +53,14 @@ std::unique_ptr<ResultDispatcher> ResultDispatcher::Create(
 ResultDispatcher::ResultDispatcher(
     uint32_t partial_result_count,
     ProcessCaptureResultFunc process_capture_result, NotifyFunc notify,
-    const StreamConfiguration& stream_config, std::string_view name)
+    const StreamConfiguration& stream_config, std::string_view name,
+    ProcessBatchCaptureResultFunc process_batch_capture_result)
     : kPartialResultCount(partial_result_count),
       name_(name),
+      timeout_wheel_(std::chrono::milliseconds(kCallbackThreadTimeoutMs),
+                     kTimeoutWheelSlots),
       process_capture_result_(process_capture_result),
+      process_batch_capture_result_(process_batch_capture_result),
       notify_(notify) {
   ATRACE_CALL();
   notify_callback_thread_ =
@@ -84,27 +89,80 @@ ResultDispatcher::~ResultDispatcher() {
 
   notify_callback_condition_.notify_one();
   notify_callback_thread_.join();
+
+  ALOGI("[%s] %s: %.2f results per callback (%s)", name_.c_str(), __FUNCTION__,
+        GetAverageResultsPerCallback(),
+        process_batch_capture_result_ != nullptr ? "batched" : "single");
+}
+
+float ResultDispatcher::GetAverageResultsPerCallback() {
+  std::lock_guard<std::mutex> lock(process_capture_result_lock_);
+  if (callback_count_ == 0) {
+    return 0.0f;
+  }
+
+  return static_cast<float>(callback_result_count_) / callback_count_;
+}
+
+uint32_t ResultDispatcher::GetTimeoutReportCount() {
+  std::lock_guard<std::mutex> lock(result_lock_);
+  return timeout_report_count_;
+}
+
+void ResultDispatcher::UpdateCallbackStatsLocked(uint32_t result_count) {
+  callback_count_++;
+  callback_result_count_ += result_count;
 }
 
 void ResultDispatcher::RemovePendingRequest(uint32_t frame_number) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(result_lock_);
-  RemovePendingRequestLocked(frame_number);
+  {
+    std::lock_guard<std::mutex> lock(result_lock_);
+    RemovePendingRequestLocked(frame_number);
+  }
+  // Results of later frames may be ready now.
+  PostReadyEvents(kAllEvents);
+}
+
+uint64_t ResultDispatcher::GetBufferEvent(size_t stream_index) {
+  return 1ull << std::min<size_t>(kBufferEventShift + stream_index, 63);
+}
+
+void ResultDispatcher::PostReadyEvents(uint64_t events) {
+  if (ready_events_.fetch_or(events, std::memory_order_acq_rel) != 0) {
+    // The notify thread hasn't consumed the earlier events yet and will pick
+    // these up with them.
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(notify_callback_lock_);
+  notify_callback_condition_.notify_one();
 }
 
 status_t ResultDispatcher::AddPendingRequest(
     const CaptureRequest& pending_request) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(result_lock_);
+  bool timeout_scheduled = false;
+  {
+    std::lock_guard<std::mutex> lock(result_lock_);
 
-  status_t res = AddPendingRequestLocked(pending_request);
-  if (res != OK) {
-    ALOGE("[%s] %s: Adding a pending request failed: %s(%d).", name_.c_str(),
-          __FUNCTION__, strerror(-res), res);
-    RemovePendingRequestLocked(pending_request.frame_number);
-    return res;
+    status_t res = AddPendingRequestLocked(pending_request);
+    if (res != OK) {
+      ALOGE("[%s] %s: Adding a pending request failed: %s(%d).", name_.c_str(),
+            __FUNCTION__, strerror(-res), res);
+      RemovePendingRequestLocked(pending_request.frame_number);
+      return res;
+    }
+
+    timeout_scheduled = timeout_wheel_.Empty();
+    timeout_wheel_.Schedule(pending_request.frame_number,
+                            FrameTimeoutWheel::Clock::now());
   }
 
+  if (timeout_scheduled) {
+    // The notify thread doesn't wait for timeouts while no frame is pending.
+    PostReadyEvents(kTimeoutEvent);
+  }
   return OK;
 }
 
@@ -150,27 +208,24 @@ status_t ResultDispatcher::AddPendingRequestLocked(
 
 status_t ResultDispatcher::AddPendingShutterLocked(uint32_t frame_number) {
   ATRACE_CALL();
-  if (pending_shutters_.find(frame_number) != pending_shutters_.end()) {
+  if (pending_shutters_.Insert(frame_number) == nullptr) {
     ALOGE("[%s] %s: Pending shutter for frame %u already exists.",
           name_.c_str(), __FUNCTION__, frame_number);
     return ALREADY_EXISTS;
   }
 
-  pending_shutters_[frame_number] = PendingShutter();
   return OK;
 }
 
 status_t ResultDispatcher::AddPendingFinalResultMetadataLocked(
     uint32_t frame_number) {
   ATRACE_CALL();
-  if (pending_final_metadata_.find(frame_number) !=
-      pending_final_metadata_.end()) {
+  if (pending_final_metadata_.Insert(frame_number) == nullptr) {
     ALOGE("[%s] %s: Pending final result metadata for frame %u already exists.",
           name_.c_str(), __FUNCTION__, frame_number);
     return ALREADY_EXISTS;
   }
 
-  pending_final_metadata_[frame_number] = PendingFinalResultMetadata();
   return OK;
 }
 
@@ -179,32 +234,53 @@ status_t ResultDispatcher::AddPendingBufferLocked(uint32_t frame_number,
                                                   bool is_input) {
   ATRACE_CALL();
   StreamKey stream_key = CreateStreamKey(buffer.stream_id);
-  if (stream_pending_buffers_map_.find(stream_key) ==
-      stream_pending_buffers_map_.end()) {
-    stream_pending_buffers_map_[stream_key] =
-        std::map<uint32_t, PendingBuffer>();
-  }
-
-  if (stream_pending_buffers_map_[stream_key].find(frame_number) !=
-      stream_pending_buffers_map_[stream_key].end()) {
+  PendingFrameRing<PendingBuffer>* pending_buffers =
+      GetPendingBuffersLocked(stream_key, /*create=*/true);
+  PendingBuffer* pending_buffer = pending_buffers->Insert(frame_number);
+  if (pending_buffer == nullptr) {
     ALOGE("[%s] %s: Pending buffer of stream %s for frame %u already exists.",
           name_.c_str(), __FUNCTION__, DumpStreamKey(stream_key).c_str(),
           frame_number);
     return ALREADY_EXISTS;
   }
 
-  PendingBuffer pending_buffer = {.is_input = is_input};
-  stream_pending_buffers_map_[stream_key][frame_number] = pending_buffer;
+  pending_buffer->is_input = is_input;
   return OK;
 }
 
+PendingFrameRing<ResultDispatcher::PendingBuffer>*
+ResultDispatcher::GetPendingBuffersLocked(const StreamKey& stream_key,
+                                          bool create, size_t* stream_index) {
+  for (size_t i = 0; i < stream_pending_buffers_.size(); i++) {
+    if (stream_pending_buffers_[i].first == stream_key) {
+      if (stream_index != nullptr) {
+        *stream_index = i;
+      }
+      return &stream_pending_buffers_[i].second;
+    }
+  }
+
+  if (!create) {
+    return nullptr;
+  }
+
+  // Streams that were not part of the configuration, e.g. input streams of
+  // some sessions, are added on first use.
+  stream_pending_buffers_.emplace_back(stream_key,
+                                       PendingFrameRing<PendingBuffer>());
+  if (stream_index != nullptr) {
+    *stream_index = stream_pending_buffers_.size() - 1;
+  }
+  return &stream_pending_buffers_.back().second;
+}
+
 void ResultDispatcher::RemovePendingRequestLocked(uint32_t frame_number) {
   ATRACE_CALL();
-  pending_shutters_.erase(frame_number);
-  pending_final_metadata_.erase(frame_number);
+  pending_shutters_.Erase(frame_number);
+  pending_final_metadata_.Erase(frame_number);
 
-  for (auto& pending_buffers : stream_pending_buffers_map_) {
-    pending_buffers.second.erase(frame_number);
+  for (auto& pending_buffers : stream_pending_buffers_) {
+    pending_buffers.second.Erase(frame_number);
   }
 }
 
@@ -213,6 +289,7 @@ status_t ResultDispatcher::AddResult(std::unique_ptr<CaptureResult> result) {
   status_t res;
   bool failed = false;
   uint32_t frame_number = result->frame_number;
+  uint64_t events = 0;
 
   if (result->result_metadata != nullptr) {
     res = AddResultMetadata(frame_number, std::move(result->result_metadata),
@@ -222,30 +299,35 @@ status_t ResultDispatcher::AddResult(std::unique_ptr<CaptureResult> result) {
       ALOGE("[%s] %s: Adding result metadata failed: %s (%d)", name_.c_str(),
             __FUNCTION__, strerror(-res), res);
       failed = true;
+    } else {
+      events |= kFinalMetadataEvent;
     }
   }
 
   for (auto& buffer : result->output_buffers) {
-    res = AddBuffer(frame_number, buffer);
+    uint64_t buffer_event = 0;
+    res = AddBuffer(frame_number, buffer, &buffer_event);
     if (res != OK) {
       ALOGE("[%s] %s: Adding an output buffer failed: %s (%d)", name_.c_str(),
             __FUNCTION__, strerror(-res), res);
       failed = true;
     }
+    events |= buffer_event;
   }
 
   for (auto& buffer : result->input_buffers) {
-    res = AddBuffer(frame_number, buffer);
+    uint64_t buffer_event = 0;
+    res = AddBuffer(frame_number, buffer, &buffer_event);
     if (res != OK) {
       ALOGE("[%s] %s: Adding an input buffer failed: %s (%d)", name_.c_str(),
             __FUNCTION__, strerror(-res), res);
       failed = true;
     }
+    events |= buffer_event;
   }
-  {
-    std::unique_lock<std::mutex> lock(notify_callback_lock_);
-    is_result_shutter_updated_ = true;
-    notify_callback_condition_.notify_one();
+
+  if (events != 0) {
+    PostReadyEvents(events);
   }
   return failed ? UNKNOWN_ERROR : OK;
 }
@@ -257,54 +339,61 @@ status_t ResultDispatcher::AddShutter(uint32_t frame_number,
   {
     std::lock_guard<std::mutex> lock(result_lock_);
 
-    auto shutter_it = pending_shutters_.find(frame_number);
-    if (shutter_it == pending_shutters_.end()) {
+    PendingShutter* shutter = pending_shutters_.Find(frame_number);
+    if (shutter == nullptr) {
       ALOGE("[%s] %s: Cannot find the pending shutter for frame %u",
             name_.c_str(), __FUNCTION__, frame_number);
       return NAME_NOT_FOUND;
     }
 
-    if (shutter_it->second.ready) {
+    if (shutter->ready) {
       ALOGE("[%s] %s: Already received shutter (%" PRId64
             ") for frame %u. New timestamp %" PRId64,
-            name_.c_str(), __FUNCTION__, shutter_it->second.timestamp_ns,
-            frame_number, timestamp_ns);
+            name_.c_str(), __FUNCTION__, shutter->timestamp_ns, frame_number,
+            timestamp_ns);
       return ALREADY_EXISTS;
     }
 
-    shutter_it->second.timestamp_ns = timestamp_ns;
-    shutter_it->second.readout_timestamp_ns = readout_timestamp_ns;
-    shutter_it->second.ready = true;
-  }
-  {
-    std::unique_lock<std::mutex> lock(notify_callback_lock_);
-    is_result_shutter_updated_ = true;
-    notify_callback_condition_.notify_one();
+    shutter->timestamp_ns = timestamp_ns;
+    shutter->readout_timestamp_ns = readout_timestamp_ns;
+    shutter->ready = true;
   }
+
+  PostReadyEvents(kShutterEvent);
   return OK;
 }
 
 status_t ResultDispatcher::AddError(const ErrorMessage& error) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(result_lock_);
-  uint32_t frame_number = error.frame_number;
-  // No need to deliver the shutter message on an error
-  if (error.error_code == ErrorCode::kErrorDevice ||
-      error.error_code == ErrorCode::kErrorResult ||
-      error.error_code == ErrorCode::kErrorRequest) {
-    pending_shutters_.erase(frame_number);
-  }
-  // No need to deliver the result metadata on a result metadata error
-  if (error.error_code == ErrorCode::kErrorResult ||
-      error.error_code == ErrorCode::kErrorRequest) {
-    pending_final_metadata_.erase(frame_number);
-  }
+  uint64_t events = 0;
+  {
+    std::lock_guard<std::mutex> lock(result_lock_);
+    uint32_t frame_number = error.frame_number;
+    // No need to deliver the shutter message on an error
+    if (error.error_code == ErrorCode::kErrorDevice ||
+        error.error_code == ErrorCode::kErrorResult ||
+        error.error_code == ErrorCode::kErrorRequest) {
+      pending_shutters_.Erase(frame_number);
+      events |= kShutterEvent;
+    }
+    // No need to deliver the result metadata on a result metadata error
+    if (error.error_code == ErrorCode::kErrorResult ||
+        error.error_code == ErrorCode::kErrorRequest) {
+      pending_final_metadata_.Erase(frame_number);
+      events |= kFinalMetadataEvent;
+    }
 
-  NotifyMessage message = {.type = MessageType::kError, .message.error = error};
-  ALOGV("[%s] %s: Notify error %u for frame %u stream %d", name_.c_str(),
-        __FUNCTION__, error.error_code, frame_number, error.error_stream_id);
-  notify_(message);
+    NotifyMessage message = {.type = MessageType::kError,
+                             .message.error = error};
+    ALOGV("[%s] %s: Notify error %u for frame %u stream %d", name_.c_str(),
+          __FUNCTION__, error.error_code, frame_number, error.error_stream_id);
+    notify_(message);
+  }
 
+  // Shutters and result metadata of later frames may be ready now.
+  if (events != 0) {
+    PostReadyEvents(events);
+  }
   return OK;
 }
 
@@ -320,6 +409,7 @@ void ResultDispatcher::NotifyResultMetadata(
   result->partial_result = partial_result;
 
   std::lock_guard<std::mutex> lock(process_capture_result_lock_);
+  UpdateCallbackStatsLocked(/*result_count=*/1);
   process_capture_result_(std::move(result));
 }
 
@@ -329,22 +419,23 @@ status_t ResultDispatcher::AddFinalResultMetadata(
   ATRACE_CALL();
   std::lock_guard<std::mutex> lock(result_lock_);
 
-  auto metadata_it = pending_final_metadata_.find(frame_number);
-  if (metadata_it == pending_final_metadata_.end()) {
+  PendingFinalResultMetadata* pending_metadata =
+      pending_final_metadata_.Find(frame_number);
+  if (pending_metadata == nullptr) {
     ALOGE("[%s] %s: Cannot find the pending result metadata for frame %u",
           name_.c_str(), __FUNCTION__, frame_number);
     return NAME_NOT_FOUND;
   }
 
-  if (metadata_it->second.ready) {
+  if (pending_metadata->ready) {
     ALOGE("[%s] %s: Already received final result metadata for frame %u.",
           name_.c_str(), __FUNCTION__, frame_number);
     return ALREADY_EXISTS;
   }
 
-  metadata_it->second.metadata = std::move(final_metadata);
-  metadata_it->second.physical_metadata = std::move(physical_metadata);
-  metadata_it->second.ready = true;
+  pending_metadata->metadata = std::move(final_metadata);
+  pending_metadata->physical_metadata = std::move(physical_metadata);
+  pending_metadata->ready = true;
   return OK;
 }
 
@@ -378,35 +469,39 @@ status_t ResultDispatcher::AddResultMetadata(
 }
 
 status_t ResultDispatcher::AddBuffer(uint32_t frame_number,
-                                     StreamBuffer buffer) {
+                                     StreamBuffer buffer,
+                                     uint64_t* buffer_event) {
   ATRACE_CALL();
   std::lock_guard<std::mutex> lock(result_lock_);
 
   StreamKey stream_key = CreateStreamKey(buffer.stream_id);
-  auto pending_buffers_it = stream_pending_buffers_map_.find(stream_key);
-  if (pending_buffers_it == stream_pending_buffers_map_.end()) {
+  size_t stream_index = 0;
+  PendingFrameRing<PendingBuffer>* pending_buffers =
+      GetPendingBuffersLocked(stream_key, /*create=*/false, &stream_index);
+  if (pending_buffers == nullptr) {
     ALOGE("[%s] %s: Cannot find the pending buffer for stream %s",
           name_.c_str(), __FUNCTION__, DumpStreamKey(stream_key).c_str());
     return NAME_NOT_FOUND;
   }
 
-  auto pending_buffer_it = pending_buffers_it->second.find(frame_number);
-  if (pending_buffer_it == pending_buffers_it->second.end()) {
+  PendingBuffer* pending_buffer = pending_buffers->Find(frame_number);
+  if (pending_buffer == nullptr) {
     ALOGE("[%s] %s: Cannot find the pending buffer for stream %s for frame %u",
           name_.c_str(), __FUNCTION__, DumpStreamKey(stream_key).c_str(),
           frame_number);
     return NAME_NOT_FOUND;
   }
 
-  if (pending_buffer_it->second.ready) {
+  if (pending_buffer->ready) {
     ALOGE("[%s] %s: Already received a buffer for stream %s for frame %u",
           name_.c_str(), __FUNCTION__, DumpStreamKey(stream_key).c_str(),
           frame_number);
     return ALREADY_EXISTS;
   }
 
-  pending_buffer_it->second.buffer = std::move(buffer);
-  pending_buffer_it->second.ready = true;
+  pending_buffer->buffer = std::move(buffer);
+  pending_buffer->ready = true;
+  *buffer_event = GetBufferEvent(stream_index);
 
   return OK;
 }
@@ -419,9 +514,23 @@ void ResultDispatcher::NotifyCallbackThreadLoop() {
       name_.substr(/*pos=*/0, /*count=*/kPthreadNameLenMinusOne).c_str());
 
   while (1) {
-    NotifyShutters();
-    NotifyFinalResultMetadata();
-    NotifyBuffers();
+    uint64_t events = ready_events_.exchange(0, std::memory_order_acq_rel);
+    if (events != 0) {
+      if (process_batch_capture_result_ != nullptr) {
+        NotifyBatchedResults(events);
+      } else {
+        if (events & kShutterEvent) {
+          NotifyShutters();
+        }
+        if (events & kFinalMetadataEvent) {
+          NotifyFinalResultMetadata();
+        }
+        NotifyBuffers(events);
+      }
+    }
+
+    FrameTimeoutWheel::Clock::time_point next_timeout;
+    bool has_timeout = CheckTimeouts(&next_timeout);
 
     std::unique_lock<std::mutex> lock(notify_callback_lock_);
     if (notify_callback_thread_exiting_) {
@@ -429,36 +538,70 @@ void ResultDispatcher::NotifyCallbackThreadLoop() {
             __FUNCTION__);
       return;
     }
-    if (!is_result_shutter_updated_) {
-      if (notify_callback_condition_.wait_for(
-              lock, std::chrono::milliseconds(kCallbackThreadTimeoutMs)) ==
-          std::cv_status::timeout) {
-        PrintTimeoutMessages();
-      }
+
+    auto wake_up = [this] {
+      return notify_callback_thread_exiting_ ||
+             ready_events_.load(std::memory_order_acquire) != 0;
+    };
+    if (has_timeout) {
+      notify_callback_condition_.wait_until(lock, next_timeout, wake_up);
+    } else {
+      // AddPendingRequest() posts kTimeoutEvent once a frame can time out.
+      notify_callback_condition_.wait(lock, wake_up);
     }
-    is_result_shutter_updated_ = false;
   }
 }
 
-void ResultDispatcher::PrintTimeoutMessages() {
+bool ResultDispatcher::CheckTimeouts(
+    FrameTimeoutWheel::Clock::time_point* next_timeout) {
   std::lock_guard<std::mutex> lock(result_lock_);
-  for (auto& [frame_number, shutter] : pending_shutters_) {
+  auto now = FrameTimeoutWheel::Clock::now();
+  timed_out_frames_.clear();
+  timeout_wheel_.Advance(now, &timed_out_frames_);
+  for (uint32_t frame_number : timed_out_frames_) {
+    if (PrintTimeoutMessagesLocked(frame_number)) {
+      timeout_report_count_++;
+      // Keep reporting the frame until it completes.
+      timeout_wheel_.Schedule(frame_number, now);
+    }
+  }
+
+  if (timeout_wheel_.Empty()) {
+    return false;
+  }
+
+  *next_timeout = timeout_wheel_.GetNextTick();
+  return true;
+}
+
+bool ResultDispatcher::PrintTimeoutMessagesLocked(uint32_t frame_number) {
+  bool pending = false;
+  PendingShutter* shutter = pending_shutters_.Find(frame_number);
+  if (shutter != nullptr) {
     ALOGW("[%s] %s: pending shutter for frame %u ready %d", name_.c_str(),
-          __FUNCTION__, frame_number, shutter.ready);
+          __FUNCTION__, frame_number, shutter->ready);
+    pending = true;
   }
 
-  for (auto& [frame_number, final_metadata] : pending_final_metadata_) {
+  PendingFinalResultMetadata* final_metadata =
+      pending_final_metadata_.Find(frame_number);
+  if (final_metadata != nullptr) {
     ALOGW("[%s] %s: pending final result metadaata for frame %u ready %d",
-          name_.c_str(), __FUNCTION__, frame_number, final_metadata.ready);
+          name_.c_str(), __FUNCTION__, frame_number, final_metadata->ready);
+    pending = true;
   }
 
-  for (auto& [stream_key, pending_buffers] : stream_pending_buffers_map_) {
-    for (auto& [frame_number, pending_buffer] : pending_buffers) {
+  for (auto& [stream_key, pending_buffers] : stream_pending_buffers_) {
+    PendingBuffer* pending_buffer = pending_buffers.Find(frame_number);
+    if (pending_buffer != nullptr) {
       ALOGW("[%s] %s: pending buffer of stream %s for frame %u ready %d",
             name_.c_str(), __FUNCTION__, DumpStreamKey(stream_key).c_str(),
-            frame_number, pending_buffer.ready);
+            frame_number, pending_buffer->ready);
+      pending = true;
     }
   }
+
+  return pending;
 }
 
 void ResultDispatcher::InitializeGroupStreamIdsMap(
@@ -469,6 +612,12 @@ void ResultDispatcher::InitializeGroupStreamIdsMap(
       group_stream_map_[stream.id] = stream.group_id;
     }
   }
+
+  // Assign the pending buffer slots up front so that requests never have to
+  // add a stream on the hot path.
+  for (const auto& stream : stream_config.streams) {
+    GetPendingBuffersLocked(CreateStreamKey(stream.id), /*create=*/true);
+  }
 }
 
 ResultDispatcher::StreamKey ResultDispatcher::CreateStreamKey(
@@ -499,18 +648,18 @@ status_t ResultDispatcher::GetReadyShutterMessage(NotifyMessage* message) {
     return BAD_VALUE;
   }
 
-  auto shutter_it = pending_shutters_.begin();
-  if (shutter_it == pending_shutters_.end() || !shutter_it->second.ready) {
+  uint32_t frame_number;
+  PendingShutter* shutter = pending_shutters_.Front(&frame_number);
+  if (shutter == nullptr || !shutter->ready) {
     // The first pending shutter is not ready.
     return NAME_NOT_FOUND;
   }
 
   message->type = MessageType::kShutter;
-  message->message.shutter.frame_number = shutter_it->first;
-  message->message.shutter.timestamp_ns = shutter_it->second.timestamp_ns;
-  message->message.shutter.readout_timestamp_ns =
-      shutter_it->second.readout_timestamp_ns;
-  pending_shutters_.erase(shutter_it);
+  message->message.shutter.frame_number = frame_number;
+  message->message.shutter.timestamp_ns = shutter->timestamp_ns;
+  message->message.shutter.readout_timestamp_ns = shutter->readout_timestamp_ns;
+  pending_shutters_.Erase(frame_number);
 
   return OK;
 }
@@ -543,18 +692,23 @@ status_t ResultDispatcher::GetReadyFinalMetadata(
   }
 
   std::lock_guard<std::mutex> lock(result_lock_);
+  return GetReadyFinalMetadataLocked(frame_number, final_metadata,
+                                     physical_metadata);
+}
 
-  auto final_metadata_it = pending_final_metadata_.begin();
-  if (final_metadata_it == pending_final_metadata_.end() ||
-      !final_metadata_it->second.ready) {
+status_t ResultDispatcher::GetReadyFinalMetadataLocked(
+    uint32_t* frame_number, std::unique_ptr<HalCameraMetadata>* final_metadata,
+    std::vector<PhysicalCameraMetadata>* physical_metadata) {
+  PendingFinalResultMetadata* pending_metadata =
+      pending_final_metadata_.Front(frame_number);
+  if (pending_metadata == nullptr || !pending_metadata->ready) {
     // The first pending final metadata is not ready.
     return NAME_NOT_FOUND;
   }
 
-  *frame_number = final_metadata_it->first;
-  *final_metadata = std::move(final_metadata_it->second.metadata);
-  *physical_metadata = std::move(final_metadata_it->second.physical_metadata);
-  pending_final_metadata_.erase(final_metadata_it);
+  *final_metadata = std::move(pending_metadata->metadata);
+  *physical_metadata = std::move(pending_metadata->physical_metadata);
+  pending_final_metadata_.Erase(*frame_number);
 
   return OK;
 }
@@ -575,7 +729,7 @@ void ResultDispatcher::NotifyFinalResultMetadata() {
 }
 
 status_t ResultDispatcher::GetReadyBufferResult(
-    std::unique_ptr<CaptureResult>* result) {
+    uint64_t events, std::unique_ptr<CaptureResult>* result) {
   ATRACE_CALL();
   std::lock_guard<std::mutex> lock(result_lock_);
   if (result == nullptr) {
@@ -583,47 +737,127 @@ status_t ResultDispatcher::GetReadyBufferResult(
     return BAD_VALUE;
   }
 
+  return GetReadyBufferResultLocked(events, result);
+}
+
+status_t ResultDispatcher::GetReadyBufferResultLocked(
+    uint64_t events, std::unique_ptr<CaptureResult>* result) {
   *result = nullptr;
 
-  for (auto& pending_buffers : stream_pending_buffers_map_) {
-    auto buffer_it = pending_buffers.second.begin();
-    while (buffer_it != pending_buffers.second.end()) {
-      if (!buffer_it->second.ready) {
-        // No more buffer ready.
-        break;
-      }
+  for (size_t i = 0; i < stream_pending_buffers_.size(); i++) {
+    if ((events & GetBufferEvent(i)) == 0) {
+      continue;
+    }
 
-      auto buffer_result = std::make_unique<CaptureResult>(CaptureResult({}));
+    auto& pending_buffers = stream_pending_buffers_[i];
+    uint32_t frame_number;
+    PendingBuffer* pending_buffer = pending_buffers.second.Front(&frame_number);
+    if (pending_buffer == nullptr || !pending_buffer->ready) {
+      // No buffer ready for this stream.
+      continue;
+    }
 
-      buffer_result->frame_number = buffer_it->first;
-      if (buffer_it->second.is_input) {
-        buffer_result->input_buffers.push_back(buffer_it->second.buffer);
-      } else {
-        buffer_result->output_buffers.push_back(buffer_it->second.buffer);
-      }
+    auto buffer_result = std::make_unique<CaptureResult>(CaptureResult({}));
 
-      pending_buffers.second.erase(buffer_it);
-      *result = std::move(buffer_result);
-      return OK;
+    buffer_result->frame_number = frame_number;
+    if (pending_buffer->is_input) {
+      buffer_result->input_buffers.push_back(pending_buffer->buffer);
+    } else {
+      buffer_result->output_buffers.push_back(pending_buffer->buffer);
     }
+
+    pending_buffers.second.Erase(frame_number);
+    *result = std::move(buffer_result);
+    return OK;
   }
 
   return NAME_NOT_FOUND;
 }
 
-void ResultDispatcher::NotifyBuffers() {
+void ResultDispatcher::NotifyBuffers(uint64_t events) {
   ATRACE_CALL();
   std::unique_ptr<CaptureResult> result;
 
-  while (GetReadyBufferResult(&result) == OK) {
+  while (GetReadyBufferResult(events, &result) == OK) {
     if (result == nullptr) {
       ALOGE("[%s] %s: result is nullptr", name_.c_str(), __FUNCTION__);
       return;
     }
     std::lock_guard<std::mutex> lock(process_capture_result_lock_);
+    UpdateCallbackStatsLocked(/*result_count=*/1);
     process_capture_result_(std::move(result));
   }
 }
 
+void ResultDispatcher::NotifyBatchedResults(uint64_t events) {
+  ATRACE_CALL();
+  // Ordered by frame number, so the batch is too.
+  std::map<uint32_t, std::unique_ptr<CaptureResult>> frame_results;
+  uint32_t result_count = 0;
+  auto get_frame_result = [&frame_results](uint32_t frame_number) {
+    auto& frame_result = frame_results[frame_number];
+    if (frame_result == nullptr) {
+      frame_result = std::make_unique<CaptureResult>(CaptureResult({}));
+      frame_result->frame_number = frame_number;
+    }
+    return frame_result.get();
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(result_lock_);
+    // Shutters are still notified one by one, but must go out before the
+    // results of the same frame.
+    NotifyMessage message = {};
+    while ((events & kShutterEvent) &&
+           GetReadyShutterMessage(&message) == OK) {
+      ALOGV("[%s] %s: Notify shutter for frame %u", name_.c_str(),
+            __FUNCTION__, message.message.shutter.frame_number);
+      notify_(message);
+    }
+
+    uint32_t frame_number;
+    std::unique_ptr<HalCameraMetadata> final_metadata;
+    std::vector<PhysicalCameraMetadata> physical_metadata;
+    while ((events & kFinalMetadataEvent) &&
+           GetReadyFinalMetadataLocked(&frame_number, &final_metadata,
+                                       &physical_metadata) == OK) {
+      CaptureResult* frame_result = get_frame_result(frame_number);
+      frame_result->result_metadata = std::move(final_metadata);
+      frame_result->physical_metadata = std::move(physical_metadata);
+      frame_result->partial_result = kPartialResultCount;
+      result_count++;
+    }
+
+    std::unique_ptr<CaptureResult> buffer_result;
+    while (GetReadyBufferResultLocked(events, &buffer_result) == OK) {
+      CaptureResult* frame_result =
+          get_frame_result(buffer_result->frame_number);
+      frame_result->output_buffers.insert(frame_result->output_buffers.end(),
+                                          buffer_result->output_buffers.begin(),
+                                          buffer_result->output_buffers.end());
+      frame_result->input_buffers.insert(frame_result->input_buffers.end(),
+                                         buffer_result->input_buffers.begin(),
+                                         buffer_result->input_buffers.end());
+      result_count++;
+    }
+  }
+
+  if (frame_results.empty()) {
+    return;
+  }
+
+  std::vector<std::unique_ptr<CaptureResult>> results;
+  results.reserve(frame_results.size());
+  for (auto& [frame_number, frame_result] : frame_results) {
+    results.push_back(std::move(frame_result));
+  }
+
+  ALOGV("[%s] %s: Notify %u results in %zu frames", name_.c_str(),
+        __FUNCTION__, result_count, results.size());
+  std::lock_guard<std::mutex> lock(process_capture_result_lock_);
+  UpdateCallbackStatsLocked(result_count);
+  process_batch_capture_result_(std::move(results));
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
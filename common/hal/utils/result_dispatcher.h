@@ -17,12 +17,17 @@
 #ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_RESULT_DISPATCHER_H_
 #define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_RESULT_DISPATCHER_H_
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <utility>
+#include <vector>
 
+#include "frame_timeout_wheel.h"
 #include "hal_types.h"
+#include "pending_frame_ring.h"
 
 namespace android {
 namespace google_camera_hal {
@@ -34,6 +39,10 @@ namespace google_camera_hal {
 // any order. ResultDispatcher will invoke ProcessCaptureResultFunc and
 // NotifyFunc to notify result metadata, shutters, and stream buffers in the
 // in the order of increasing frame numbers.
+//
+// The notify thread is event driven. Every change that may make a result
+// ready posts an event bit for the queue it affects, and the notify thread
+// only checks the queues whose bits are set.
 class ResultDispatcher {
  public:
   // Create a ResultDispatcher.
@@ -41,11 +50,15 @@ class ResultDispatcher {
   // process_capture_result is the function to notify capture results.
   // stream_config is the session stream configuration
   // notify is the function to notify shutter messages.
+  // process_batch_capture_result is optional. If set, all shutters, final
+  // result metadata and buffers that are ready are drained at once, coalesced
+  // into one CaptureResult per frame and delivered with a single call.
   static std::unique_ptr<ResultDispatcher> Create(
       uint32_t partial_result_count,
       ProcessCaptureResultFunc process_capture_result, NotifyFunc notify,
       const StreamConfiguration& stream_config,
-      std::string_view name = "ResultDispatcher");
+      std::string_view name = "ResultDispatcher",
+      ProcessBatchCaptureResultFunc process_batch_capture_result = nullptr);
 
   virtual ~ResultDispatcher();
 
@@ -71,13 +84,34 @@ class ResultDispatcher {
   // Remove a pending request.
   void RemovePendingRequest(uint32_t frame_number);
 
-  ResultDispatcher(uint32_t partial_result_count,
-                   ProcessCaptureResultFunc process_capture_result,
-                   NotifyFunc notify, const StreamConfiguration& stream_config,
-                   std::string_view name = "ResultDispatcher");
+  // Average number of individual results (result metadata or stream buffers)
+  // per process_capture_result_ or process_batch_capture_result_ call.
+  float GetAverageResultsPerCallback();
+
+  // Number of times a pending frame was reported as timed out. A frame is
+  // reported once per kCallbackThreadTimeoutMs until it completes.
+  uint32_t GetTimeoutReportCount();
+
+  ResultDispatcher(
+      uint32_t partial_result_count,
+      ProcessCaptureResultFunc process_capture_result, NotifyFunc notify,
+      const StreamConfiguration& stream_config,
+      std::string_view name = "ResultDispatcher",
+      ProcessBatchCaptureResultFunc process_batch_capture_result = nullptr);
 
  private:
   static constexpr uint32_t kCallbackThreadTimeoutMs = 500;
+  // Number of ticks per kCallbackThreadTimeoutMs in timeout_wheel_.
+  static constexpr uint32_t kTimeoutWheelSlots = 4;
+
+  // Ready event bits posted to ready_events_. kTimeoutEvent tells the notify
+  // thread that timeout_wheel_ is no longer empty. Bit kBufferEventShift + i
+  // is stream_pending_buffers_[i]. Streams that don't fit share the last bit.
+  static constexpr uint64_t kShutterEvent = 1ull << 0;
+  static constexpr uint64_t kFinalMetadataEvent = 1ull << 1;
+  static constexpr uint64_t kTimeoutEvent = 1ull << 2;
+  static constexpr uint32_t kBufferEventShift = 3;
+  static constexpr uint64_t kAllEvents = ~0ull;
   const uint32_t kPartialResultCount;
 
   // Define the stream key types. Single stream type is for normal streams.
@@ -87,7 +121,7 @@ class ResultDispatcher {
     kGroupStream,
   };
 
-  // The key of the stream_pending_buffers_map_, which has different types.
+  // The key of the stream_pending_buffers_, which has different types.
   // Type kSingleStream indicates the StreamKey represents a single stream, and
   // the id will be the stream id.
   // Type kGroupStream indicates the StreamKey represents a stream group, and
@@ -136,6 +170,20 @@ class ResultDispatcher {
   // Remove pending shutter, result metadata, and buffers for a frame number.
   void RemovePendingRequestLocked(uint32_t frame_number);
 
+  // Return the pending buffers of a stream key, or nullptr if the stream key
+  // is unknown and create is false. If stream_index is not nullptr, it is set
+  // to the index of the entry in stream_pending_buffers_. Must be protected
+  // with result_lock_.
+  PendingFrameRing<PendingBuffer>* GetPendingBuffersLocked(
+      const StreamKey& stream_key, bool create,
+      size_t* stream_index = nullptr);
+
+  // Return the ready event bit of stream_pending_buffers_[stream_index].
+  static uint64_t GetBufferEvent(size_t stream_index);
+
+  // Post ready events and wake up the notify thread if it may be waiting.
+  void PostReadyEvents(uint64_t events);
+
   // Invoke process_capture_result_ to notify metadata.
   void NotifyResultMetadata(uint32_t frame_number,
                             std::unique_ptr<HalCameraMetadata> metadata,
@@ -151,7 +199,9 @@ class ResultDispatcher {
       std::vector<PhysicalCameraMetadata> physical_metadata,
       uint32_t partial_result);
 
-  status_t AddBuffer(uint32_t frame_number, StreamBuffer buffer);
+  // Add a buffer and return its ready event in buffer_event.
+  status_t AddBuffer(uint32_t frame_number, StreamBuffer buffer,
+                     uint64_t* buffer_event);
 
   // Get a shutter message that is ready to be notified via notify_.
   status_t GetReadyShutterMessage(NotifyMessage* message);
@@ -162,9 +212,19 @@ class ResultDispatcher {
       uint32_t* frame_number, std::unique_ptr<HalCameraMetadata>* final_metadata,
       std::vector<PhysicalCameraMetadata>* physical_metadata);
 
+  // Same as GetReadyFinalMetadata(). Must be protected with result_lock_.
+  status_t GetReadyFinalMetadataLocked(
+      uint32_t* frame_number, std::unique_ptr<HalCameraMetadata>* final_metadata,
+      std::vector<PhysicalCameraMetadata>* physical_metadata);
+
   // Get a result with a buffer that is ready to be notified via
-  // process_capture_result_.
-  status_t GetReadyBufferResult(std::unique_ptr<CaptureResult>* result);
+  // process_capture_result_. Only streams with a bit in events are checked.
+  status_t GetReadyBufferResult(uint64_t events,
+                                std::unique_ptr<CaptureResult>* result);
+
+  // Same as GetReadyBufferResult(). Must be protected with result_lock_.
+  status_t GetReadyBufferResultLocked(uint64_t events,
+                                      std::unique_ptr<CaptureResult>* result);
 
   // Check all pending shutters and invoke notify_ with shutters that are ready.
   void NotifyShutters();
@@ -173,16 +233,35 @@ class ResultDispatcher {
   // with final result metadata that are ready.
   void NotifyFinalResultMetadata();
 
-  // Check all pending buffers and invoke notify_ with buffers that are ready.
-  void NotifyBuffers();
+  // Check pending buffers of streams with a bit in events and invoke notify_
+  // with buffers that are ready.
+  void NotifyBuffers(uint64_t events);
+
+  // Notify all ready shutters and deliver all ready final result metadata and
+  // buffers, merged per frame, with one process_batch_capture_result_ call.
+  // Only the queues with a bit in events are checked.
+  void NotifyBatchedResults(uint64_t events);
+
+  // Account for a callback that delivered 'result_count' results. Must be
+  // protected with process_capture_result_lock_.
+  void UpdateCallbackStatsLocked(uint32_t result_count);
 
   // Thread loop to check pending shutters, result metadata, and buffers. It
   // notifies the client when one is ready.
   void NotifyCallbackThreadLoop();
 
-  void PrintTimeoutMessages();
+  // Print the pending shutter, result metadata and buffers of frames that
+  // timed out, and return in next_timeout when the next frames time out.
+  // Returns false if no frames are waiting for a timeout.
+  bool CheckTimeouts(FrameTimeoutWheel::Clock::time_point* next_timeout);
 
-  // Initialize the group stream ids map if needed. Must be protected with result_lock_.
+  // Print the pending shutter, result metadata and buffers of a frame.
+  // Returns false if nothing of the frame is pending anymore. Must be
+  // protected with result_lock_.
+  bool PrintTimeoutMessagesLocked(uint32_t frame_number);
+
+  // Initialize the group stream ids map if needed and assign the pending
+  // buffer slots of all configured streams.
   void InitializeGroupStreamIdsMap(const StreamConfiguration& stream_config);
 
   // Name used for debugging purpose to disambiguate multiple ResultDispatchers.
@@ -190,9 +269,9 @@ class ResultDispatcher {
 
   std::mutex result_lock_;
 
-  // Maps from frame numbers to pending shutters.
+  // Pending shutters indexed by frame number.
   // Protected by result_lock_.
-  std::map<uint32_t, PendingShutter> pending_shutters_;
+  PendingFrameRing<PendingShutter> pending_shutters_;
 
   // Create a StreamKey for a stream
   inline StreamKey CreateStreamKey(int32_t stream_id) const;
@@ -200,23 +279,41 @@ class ResultDispatcher {
   // Dump a StreamKey to a debug string
   inline std::string DumpStreamKey(const StreamKey& stream_key) const;
 
-  // Maps from a stream or a stream group to "a map from a frame number to a
-  // pending buffer". Protected by result_lock_.
+  // Pending buffers of each stream or stream group, indexed by frame number.
+  // Protected by result_lock_.
   // For single streams, pending buffers would be tracked by streams.
   // For multi-resolution streams, camera HAL can return only one stream buffer
   // within the same stream group each request. So all of the buffers of certain
-  // stream group will be tracked together via a single map.
-  std::map<StreamKey, std::map<uint32_t, PendingBuffer>>
-      stream_pending_buffers_map_;
+  // stream group will be tracked together via a single ring.
+  // The entries of all configured streams are assigned at construction and
+  // sessions only have a handful of streams, so lookups are a linear scan.
+  std::vector<std::pair<StreamKey, PendingFrameRing<PendingBuffer>>>
+      stream_pending_buffers_;
+
+  // Pending final result metadata indexed by frame number.
+  // Protected by result_lock_.
+  PendingFrameRing<PendingFinalResultMetadata> pending_final_metadata_;
+
+  // Frames waiting for a timeout since they were added.
+  // Protected by result_lock_.
+  FrameTimeoutWheel timeout_wheel_;
 
-  // Maps from a stream ID to pending result metadata.
+  // Frames that timed out, kept to reuse the allocation.
   // Protected by result_lock_.
-  std::map<uint32_t, PendingFinalResultMetadata> pending_final_metadata_;
+  std::vector<uint32_t> timed_out_frames_;
+
+  // Protected by result_lock_.
+  uint32_t timeout_report_count_ = 0;
 
   std::mutex process_capture_result_lock_;
   ProcessCaptureResultFunc process_capture_result_;
+  ProcessBatchCaptureResultFunc process_batch_capture_result_;
   NotifyFunc notify_;
 
+  // Protected by process_capture_result_lock_.
+  uint64_t callback_count_ = 0;
+  uint64_t callback_result_count_ = 0;
+
   // A thread to run NotifyCallbackThreadLoop().
   std::thread notify_callback_thread_;
 
@@ -228,8 +325,10 @@ class ResultDispatcher {
   // Protected by notify_callback_lock.
   bool notify_callback_thread_exiting_ = false;
 
-  // State of callback thread is notified or not.
-  volatile bool is_result_shutter_updated_ = false;
+  // Ready event bits posted by any thread and consumed by
+  // notify_callback_thread_. Only posting to an empty set wakes up the
+  // thread, bits posted on top are picked up in the same pass.
+  std::atomic<uint64_t> ready_events_ = 0;
 
   // A map of group streams only, from stream ID to the group ID it belongs.
   std::map</*stream id=*/int32_t, /*group id=*/int32_t> group_stream_map_;
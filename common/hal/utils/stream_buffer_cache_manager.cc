@@ -25,6 +25,7 @@
 #include <sys/resource.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
 #include <chrono>
 
 #include "stream_buffer_cache_manager.h"
@@ -48,9 +49,17 @@ inline constexpr char kRaiseBufAllocationPriority[] =
 // below HWL.
 static constexpr auto kBufferWaitingTimeOutSec = 400ms;
 
+static int64_t GetSteadyTimeNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 StreamBufferCacheManager::StreamBufferCacheManager(
-    const std::set<int32_t>& hal_buffer_managed_stream_ids)
-    : hal_buffer_managed_streams_(hal_buffer_managed_stream_ids) {
+    const std::set<int32_t>& hal_buffer_managed_stream_ids,
+    StreamBufferBatchRequestFunc batch_request_func)
+    : hal_buffer_managed_streams_(hal_buffer_managed_stream_ids),
+      batch_request_func_(batch_request_func) {
   workload_thread_ = std::thread([this] { this->WorkloadThreadLoop(); });
   if (utils::SupportRealtimeThread()) {
     status_t res = utils::SetRealtimeThread(workload_thread_.native_handle());
@@ -73,11 +82,13 @@ StreamBufferCacheManager::~StreamBufferCacheManager() {
 }
 
 std::unique_ptr<StreamBufferCacheManager> StreamBufferCacheManager::Create(
-    const std::set<int32_t>& hal_buffer_managed_stream_ids) {
+    const std::set<int32_t>& hal_buffer_managed_stream_ids,
+    StreamBufferBatchRequestFunc batch_request_func) {
   ATRACE_CALL();
 
   auto manager = std::unique_ptr<StreamBufferCacheManager>(
-      new StreamBufferCacheManager(hal_buffer_managed_stream_ids));
+      new StreamBufferCacheManager(hal_buffer_managed_stream_ids,
+                                   batch_request_func));
   if (manager == nullptr) {
     ALOGE("%s: Failed to create stream buffer cache manager.", __FUNCTION__);
     return nullptr;
@@ -117,6 +128,12 @@ status_t StreamBufferCacheManager::RegisterStream(
     return BAD_VALUE;
   }
 
+  if (reg_info.max_num_buffers_to_cache < reg_info.num_buffers_to_cache) {
+    ALOGE("%s: max_num_buffers_to_cache %u is less than num_buffers_to_cache.",
+          __FUNCTION__, reg_info.max_num_buffers_to_cache);
+    return BAD_VALUE;
+  }
+
   std::lock_guard<std::mutex> lock(caches_map_mutex_);
   if (stream_buffer_caches_.find(reg_info.stream_id) !=
       stream_buffer_caches_.end()) {
@@ -221,6 +238,34 @@ status_t StreamBufferCacheManager::NotifyFlushingAll() {
   return OK;
 }
 
+status_t StreamBufferCacheManager::NotifyFlushingStreams(
+    const std::vector<int32_t>& stream_ids) {
+  std::vector<StreamBufferCache*> stream_buffer_caches;
+  {
+    std::lock_guard<std::mutex> map_lock(caches_map_mutex_);
+    for (int32_t stream_id : stream_ids) {
+      auto it = stream_buffer_caches_.find(stream_id);
+      if (it != stream_buffer_caches_.end()) {
+        stream_buffer_caches.push_back(it->second.get());
+      }
+    }
+  }
+
+  if (stream_buffer_caches.empty()) {
+    return OK;
+  }
+
+  {
+    std::unique_lock<std::mutex> flush_lock(flush_mutex_);
+    for (auto& stream_buffer_cache : stream_buffer_caches) {
+      stream_buffer_cache->SetManagerState(/*active=*/false);
+    }
+  }
+
+  NotifyThreadWorkload();
+  return OK;
+}
+
 status_t StreamBufferCacheManager::IsStreamActive(int32_t stream_id,
                                                   bool* is_active) {
   if (hal_buffer_managed_streams_.find(stream_id) ==
@@ -242,6 +287,24 @@ status_t StreamBufferCacheManager::IsStreamActive(int32_t stream_id,
   return OK;
 }
 
+status_t StreamBufferCacheManager::GetStreamBufferCacheStats(
+    int32_t stream_id, StreamBufferCacheStats* stats) {
+  if (stats == nullptr) {
+    ALOGE("%s: stats is nullptr.", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  StreamBufferCache* stream_buffer_cache = nullptr;
+  status_t res = GetStreamBufferCache(stream_id, &stream_buffer_cache);
+  if (res != OK) {
+    ALOGE("%s: Querying stream buffer cache failed.", __FUNCTION__);
+    return res;
+  }
+
+  *stats = stream_buffer_cache->GetStats();
+  return OK;
+}
+
 status_t StreamBufferCacheManager::AddStreamBufferCacheLocked(
     const StreamBufferCacheRegInfo& reg_info) {
   auto stream_buffer_cache = StreamBufferCacheManager::StreamBufferCache::Create(
@@ -285,11 +348,24 @@ void StreamBufferCacheManager::WorkloadThreadLoop() {
 
     {
       std::unique_lock<std::mutex> flush_lock(flush_mutex_);
+      // Collect the refills of all streams to request them at once.
+      std::vector<BufferRequest> refill_requests;
+      std::vector<StreamBufferCache*> refill_caches;
+      bool batch_refill = batch_request_func_ != nullptr && !exiting;
       for (auto& stream_buffer_cache : stream_buffer_caches) {
-        status_t res = stream_buffer_cache->UpdateCache(exiting);
+        size_t num_requests = refill_requests.size();
+        status_t res = stream_buffer_cache->UpdateCache(
+            exiting, batch_refill ? &refill_requests : nullptr);
         if (res != OK) {
           ALOGE("%s: Updating(flush/refill) cache failed.", __FUNCTION__);
         }
+        if (refill_requests.size() > num_requests) {
+          refill_caches.push_back(stream_buffer_cache);
+        }
+      }
+
+      if (!refill_requests.empty()) {
+        RefillBatch(refill_requests, refill_caches);
       }
     }
 
@@ -301,6 +377,41 @@ void StreamBufferCacheManager::WorkloadThreadLoop() {
   }
 }
 
+void StreamBufferCacheManager::RefillBatch(
+    const std::vector<BufferRequest>& refill_requests,
+    const std::vector<StreamBufferCache*>& caches) {
+  ATRACE_CALL();
+  std::vector<BufferReturn> buffer_returns;
+  int64_t start_ns = GetSteadyTimeNs();
+  status_t res = batch_request_func_(refill_requests, &buffer_returns);
+  int64_t latency_ns = GetSteadyTimeNs() - start_ns;
+  if (res != OK) {
+    ALOGW("%s: Requesting buffers for %zu streams failed: %s(%d)",
+          __FUNCTION__, refill_requests.size(), strerror(-res), res);
+  }
+
+  for (size_t i = 0; i < refill_requests.size(); i++) {
+    // Streams the provider didn't answer for are retried on the next refill.
+    StreamBufferRequestError req_status =
+        StreamBufferRequestError::kNoBufferAvailable;
+    std::vector<StreamBuffer> buffers;
+    for (auto& buffer_return : buffer_returns) {
+      if (buffer_return.stream_id == refill_requests[i].stream_id) {
+        req_status = buffer_return.val.error;
+        buffers = std::move(buffer_return.val.buffers);
+        break;
+      }
+    }
+
+    status_t stream_res =
+        (res == OK && req_status == StreamBufferRequestError::kOk)
+            ? OK
+            : UNKNOWN_ERROR;
+    caches[i]->CompleteRefill(stream_res, req_status, std::move(buffers),
+                              latency_ns);
+  }
+}
+
 void StreamBufferCacheManager::NotifyThreadWorkload() {
   {
     std::lock_guard<std::mutex> lock(workload_mutex_);
@@ -339,10 +450,11 @@ StreamBufferCacheManager::StreamBufferCache::StreamBufferCache(
   std::lock_guard<std::mutex> lock(cache_access_mutex_);
   notify_for_workload_ = notify;
   dummy_buffer_allocator_ = dummy_buffer_allocator;
+  stats_.watermark = cache_info_.num_buffers_to_cache;
 }
 
 status_t StreamBufferCacheManager::StreamBufferCache::UpdateCache(
-    bool forced_flushing) {
+    bool forced_flushing, std::vector<BufferRequest>* refill_requests) {
   status_t res = OK;
   std::unique_lock<std::mutex> cache_lock(cache_access_mutex_);
   if (forced_flushing || !is_active_) {
@@ -353,6 +465,16 @@ status_t StreamBufferCacheManager::StreamBufferCache::UpdateCache(
       return res;
     }
   } else if (RefillableLocked()) {
+    if (refill_requests != nullptr) {
+      if (!stream_deactived_ && cache_info_.request_func != nullptr) {
+        refill_requests->push_back(
+            {.stream_id = cache_info_.stream_id,
+             .num_buffers_requested = static_cast<uint32_t>(
+                 stats_.watermark - cached_buffers_.size())});
+      }
+      return OK;
+    }
+
     cache_lock.unlock();
     res = Refill();
     if (res != OK) {
@@ -375,8 +497,11 @@ status_t StreamBufferCacheManager::StreamBufferCache::GetBuffer(
     return INVALID_OPERATION;
   }
 
+  UpdateConsumeIntervalLocked();
+
   // 1. check if the cache is deactived
   if (stream_deactived_) {
+    stats_.num_dummy_buffers++;
     res->is_dummy_buffer = true;
     res->buffer = dummy_buffer_;
     return OK;
@@ -404,6 +529,7 @@ status_t StreamBufferCacheManager::StreamBufferCache::GetBuffer(
       }
     }
   }
+  last_get_buffer_time_ns_ = GetSteadyTimeNs();
 
   // 3. use dummy buffer if the cache is still empty
   if (cached_buffers_.empty()) {
@@ -415,13 +541,15 @@ status_t StreamBufferCacheManager::StreamBufferCache::GetBuffer(
         return UNKNOWN_ERROR;
       }
     }
+    stats_.num_dummy_buffers++;
     res->is_dummy_buffer = true;
     res->buffer = dummy_buffer_;
     return OK;
   } else {
+    // Hand out the oldest buffer first when several are prefetched.
     res->is_dummy_buffer = false;
-    res->buffer = cached_buffers_.back();
-    cached_buffers_.pop_back();
+    res->buffer = cached_buffers_.front();
+    cached_buffers_.erase(cached_buffers_.begin());
   }
 
   return OK;
@@ -435,6 +563,42 @@ bool StreamBufferCacheManager::StreamBufferCache::IsStreamDeactivated() {
 void StreamBufferCacheManager::StreamBufferCache::SetManagerState(bool active) {
   std::unique_lock<std::mutex> lock(cache_access_mutex_);
   is_active_ = active;
+  // The consumption pattern after a flush is unrelated to the one before.
+  last_get_buffer_time_ns_ = 0;
+}
+
+StreamBufferCacheStats StreamBufferCacheManager::StreamBufferCache::GetStats() {
+  std::unique_lock<std::mutex> lock(cache_access_mutex_);
+  return stats_;
+}
+
+void StreamBufferCacheManager::StreamBufferCache::UpdateConsumeIntervalLocked() {
+  int64_t interval_ns = GetSteadyTimeNs() - last_get_buffer_time_ns_;
+  if (last_get_buffer_time_ns_ != 0 && interval_ns < kMaxConsumeIntervalNs) {
+    int64_t& average_ns = stats_.average_consume_interval_ns;
+    average_ns =
+        average_ns == 0
+            ? interval_ns
+            : average_ns + (interval_ns - average_ns) / kMovingAverageWindow;
+    UpdateWatermarkLocked();
+  }
+}
+
+void StreamBufferCacheManager::StreamBufferCache::UpdateWatermarkLocked() {
+  uint32_t watermark = cache_info_.num_buffers_to_cache;
+  if (stats_.average_consume_interval_ns > 0) {
+    // Buffers taken while a refill is in flight need to be cached already.
+    watermark += stats_.average_refill_latency_ns /
+                 stats_.average_consume_interval_ns;
+  }
+
+  watermark = std::clamp(watermark, cache_info_.num_buffers_to_cache,
+                         cache_info_.max_num_buffers_to_cache);
+  if (watermark != stats_.watermark) {
+    ALOGV("%s: [sbc] Stream %d watermark %u -> %u", __FUNCTION__,
+          cache_info_.stream_id, stats_.watermark, watermark);
+    stats_.watermark = watermark;
+  }
 }
 
 status_t StreamBufferCacheManager::StreamBufferCache::FlushLocked(
@@ -487,13 +651,12 @@ status_t StreamBufferCacheManager::StreamBufferCache::Refill() {
       return OK;
     }
 
-    if (cached_buffers_.size() >= cache_info_.num_buffers_to_cache) {
+    if (cached_buffers_.size() >= stats_.watermark) {
       ALOGV("%s: Stream buffer cache is already full.", __FUNCTION__);
       return INVALID_OPERATION;
     }
 
-    num_buffers_to_acquire =
-        cache_info_.num_buffers_to_cache - cached_buffers_.size();
+    num_buffers_to_acquire = stats_.watermark - cached_buffers_.size();
   }
 
   // Requesting buffer from the provider can take long(e.g. even > 1sec),
@@ -502,10 +665,41 @@ status_t StreamBufferCacheManager::StreamBufferCache::Refill() {
   // locked here.
   std::vector<StreamBuffer> buffers;
   StreamBufferRequestError req_status = StreamBufferRequestError::kOk;
+  int64_t start_ns = GetSteadyTimeNs();
   status_t res =
       cache_info_.request_func(num_buffers_to_acquire, &buffers, &req_status);
+  int64_t latency_ns = GetSteadyTimeNs() - start_ns;
 
   std::unique_lock<std::mutex> cache_lock(cache_access_mutex_);
+  return CompleteRefillLocked(res, req_status, std::move(buffers), latency_ns);
+}
+
+void StreamBufferCacheManager::StreamBufferCache::CompleteRefill(
+    status_t res, StreamBufferRequestError req_status,
+    std::vector<StreamBuffer> buffers, int64_t latency_ns) {
+  std::unique_lock<std::mutex> cache_lock(cache_access_mutex_);
+  status_t result =
+      CompleteRefillLocked(res, req_status, std::move(buffers), latency_ns);
+  if (result != OK) {
+    ALOGE("%s: Failed to refill stream buffer cache for stream %d",
+          __FUNCTION__, cache_info_.stream_id);
+  }
+}
+
+status_t StreamBufferCacheManager::StreamBufferCache::CompleteRefillLocked(
+    status_t res, StreamBufferRequestError req_status,
+    std::vector<StreamBuffer> buffers, int64_t latency_ns) {
+  int64_t& average_ns = stats_.average_refill_latency_ns;
+  average_ns =
+      stats_.num_refills == 0
+          ? latency_ns
+          : average_ns + (latency_ns - average_ns) / kMovingAverageWindow;
+  stats_.max_refill_latency_ns =
+      std::max(stats_.max_refill_latency_ns, latency_ns);
+  stats_.num_refills++;
+  ATRACE_INT64("SbcRefillLatencyNs", latency_ns);
+  UpdateWatermarkLocked();
+
   if (res != OK) {
     status_t result = AllocateDummyBufferLocked();
     if (result != OK) {
@@ -556,8 +750,8 @@ bool StreamBufferCacheManager::StreamBufferCache::RefillableLocked() const {
     return false;
   }
 
-  // Need to refill if the cache is not full
-  return cached_buffers_.size() < cache_info_.num_buffers_to_cache;
+  // Need to refill if the cache is below the watermark
+  return cached_buffers_.size() < stats_.watermark;
 }
 
 status_t StreamBufferCacheManager::StreamBufferCache::AllocateDummyBufferLocked() {
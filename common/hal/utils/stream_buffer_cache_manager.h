@@ -47,6 +47,13 @@ using StreamBufferRequestFunc =
 using StreamBufferReturnFunc =
     std::function<status_t(const std::vector<StreamBuffer>& buffers)>;
 
+// Function to request buffers for several streams with a single call to the
+// buffer provider. The callee appends one BufferReturn per stream in
+// buffer_requests to buffer_returns. The caller owns the buffers returned.
+using StreamBufferBatchRequestFunc =
+    std::function<status_t(const std::vector<BufferRequest>& buffer_requests,
+                           std::vector<BufferReturn>* buffer_returns)>;
+
 // Function to notify the manager for a new thread loop workload
 using NotifyManagerThreadWorkloadFunc = std::function<void()>;
 //
@@ -73,6 +80,32 @@ struct StreamBufferCacheRegInfo {
   uint64_t consumer_flags = 0;
   // Number of buffers that the manager needs to cache
   uint32_t num_buffers_to_cache = 1;
+  // Maximum number of buffers that the manager may cache. When the buffer
+  // provider is slow compared to how fast the stream consumes buffers, the
+  // manager prefetches up to this many buffers.
+  uint32_t max_num_buffers_to_cache = 1;
+};
+
+//
+// StreamBufferCacheStats
+//
+// Statistics of the stream buffer cache of a stream.
+//
+struct StreamBufferCacheStats {
+  // Number of dummy buffers handed out because no buffer was cached in time or
+  // the stream was deactivated.
+  uint64_t num_dummy_buffers = 0;
+  // Number of buffer requests sent to the buffer provider
+  uint64_t num_refills = 0;
+  // Moving average and maximum latency of the buffer requests
+  int64_t average_refill_latency_ns = 0;
+  int64_t max_refill_latency_ns = 0;
+  // Moving average of the time from one GetStreamBuffer call getting its
+  // buffer to the next call. Time spent waiting for a refill is excluded so
+  // that a slow provider doesn't hide how fast the stream consumes buffers.
+  int64_t average_consume_interval_ns = 0;
+  // Number of buffers the cache currently tries to keep
+  uint32_t watermark = 0;
 };
 
 //
@@ -106,9 +139,13 @@ struct StreamBufferRequestResult {
 //
 class StreamBufferCacheManager {
  public:
-  // Create an instance of the StreamBufferCacheManager
+  // Create an instance of the StreamBufferCacheManager. If batch_request_func
+  // is set, the buffers of all streams that need a refill are requested with
+  // a single call of batch_request_func instead of one request_func call per
+  // stream.
   static std::unique_ptr<StreamBufferCacheManager> Create(
-      const std::set<int32_t>& hal_buffer_managed_stream_ids);
+      const std::set<int32_t>& hal_buffer_managed_stream_ids,
+      StreamBufferBatchRequestFunc batch_request_func = nullptr);
 
   virtual ~StreamBufferCacheManager();
 
@@ -136,6 +173,11 @@ class StreamBufferCacheManager {
   // to restart caching buffers for a specific stream.
   status_t NotifyFlushingAll();
 
+  // Same as NotifyFlushingAll but only for the streams in stream_ids, e.g.
+  // when the streams are about to be removed. Streams that are not registered
+  // are ignored.
+  status_t NotifyFlushingStreams(const std::vector<int32_t>& stream_ids);
+
   // Whether stream buffer cache manager can still acquire buffer from the
   // provider successfully(e.g. if a stream is abandoned by the framework, this
   // returns false). Once a stream is inactive, dummy buffer will be used in all
@@ -143,14 +185,27 @@ class StreamBufferCacheManager {
   // a change in this case.
   status_t IsStreamActive(int32_t stream_id, bool* is_active);
 
+  // Get the statistics of the stream buffer cache of stream_id.
+  status_t GetStreamBufferCacheStats(int32_t stream_id,
+                                     StreamBufferCacheStats* stats);
+
  protected:
   StreamBufferCacheManager(
-      const std::set<int32_t>& hal_buffer_managed_stream_ids);
+      const std::set<int32_t>& hal_buffer_managed_stream_ids,
+      StreamBufferBatchRequestFunc batch_request_func);
 
  private:
   // Duration to wait for fence.
   static constexpr uint32_t kSyncWaitTimeMs = 5000;
 
+  // Weight of a new sample in the moving averages of the refill latency and
+  // consume interval is 1 / kMovingAverageWindow.
+  static constexpr int64_t kMovingAverageWindow = 8;
+
+  // GetStreamBuffer calls further apart than this are not counted in the
+  // consume interval, e.g. the first buffer after a pause.
+  static constexpr int64_t kMaxConsumeIntervalNs = 1000000000;
+
   //
   // StreamBufferCache
   //
@@ -176,8 +231,20 @@ class StreamBufferCacheManager {
     // Flush the stream buffer cache if the forced_flushing flag is set or if
     // the stream buffer cache has been notified for flushing. Otherwise, check
     // if the stream buffer cache needs to be and can be refilled. Do so if that
-    // is true.
-    status_t UpdateCache(bool forced_flushing);
+    // is true. If refill_requests is not nullptr, the buffers needed are
+    // appended to it instead of requested from the provider, and the caller
+    // must pass the buffers acquired to CompleteRefill.
+    status_t UpdateCache(bool forced_flushing,
+                         std::vector<BufferRequest>* refill_requests = nullptr);
+
+    // Add the buffers acquired for a refill request appended by UpdateCache.
+    // res and req_status are the result of the request and latency_ns is how
+    // long the buffer provider took.
+    void CompleteRefill(status_t res, StreamBufferRequestError req_status,
+                        std::vector<StreamBuffer> buffers, int64_t latency_ns);
+
+    // Return the statistics of this stream buffer cache.
+    StreamBufferCacheStats GetStats();
 
     // Get a buffer for the client. The buffer returned can be a dummy buffer,
     // in which case, the is_dummy_buffer field in res will be true.
@@ -218,10 +285,27 @@ class StreamBufferCacheManager {
     //                    thread fetches the task and refill the cache separately.
     status_t Refill();
 
+    // Handle the result of a buffer request to refill the cache.
+    // The cache_access_mutex_ must be locked when calling this function.
+    status_t CompleteRefillLocked(status_t res,
+                                  StreamBufferRequestError req_status,
+                                  std::vector<StreamBuffer> buffers,
+                                  int64_t latency_ns);
+
     // Whether a stream buffer cache can be refilled.
     // The cache_access_mutex_ must be locked when calling this function.
     bool RefillableLocked() const;
 
+    // Track the interval since the last GetBuffer call and adapt the
+    // watermark.
+    // The cache_access_mutex_ must be locked when calling this function.
+    void UpdateConsumeIntervalLocked();
+
+    // Update the number of buffers to keep so that a refill requested when a
+    // buffer is taken arrives before the cached buffers run out.
+    // The cache_access_mutex_ must be locked when calling this function.
+    void UpdateWatermarkLocked();
+
     // Allocate dummy buffer for this stream buffer cache. The
     // cache_access_mutex_ needs to be locked before calling this function.
     status_t AllocateDummyBufferLocked();
@@ -265,8 +349,18 @@ class StreamBufferCacheManager {
     // Allocator of the dummy buffer for this stream. The stream buffer cache
     // manager owns this throughout the life cycle of this stream buffer cahce.
     IHalBufferAllocator* dummy_buffer_allocator_ = nullptr;
+    // Time the last GetBuffer call got its buffer, in steady clock
+    // nanoseconds. 0 if there was no call since the cache became active.
+    int64_t last_get_buffer_time_ns_ = 0;
+    // Statistics of this cache, including the current watermark.
+    StreamBufferCacheStats stats_;
   };
 
+  // Request the buffers of refill_requests with batch_request_func_ and pass
+  // them to the respective stream buffer cache in caches.
+  void RefillBatch(const std::vector<BufferRequest>& refill_requests,
+                   const std::vector<StreamBufferCache*>& caches);
+
   // Add stream buffer cache. Lock caches_map_mutex_ before calling this func.
   status_t AddStreamBufferCacheLocked(const StreamBufferCacheRegInfo& reg_info);
 
@@ -287,6 +381,9 @@ class StreamBufferCacheManager {
 
   const std::set<int32_t>& hal_buffer_managed_streams_;
 
+  // Requests the buffers of several streams at once, can be nullptr.
+  const StreamBufferBatchRequestFunc batch_request_func_;
+
   // Mapping from a stream_id to the StreamBufferCache for that stream. Any
   // access to this map must be guarded by the caches_map_mutex.
   std::map<int32_t, std::unique_ptr<StreamBufferCache>> stream_buffer_caches_;
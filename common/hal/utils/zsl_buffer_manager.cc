@@ -21,24 +21,47 @@
 #include <log/log.h>
 #include <utils/Trace.h>
 
+#include <inttypes.h>
 #include <time.h>
 
+#include <algorithm>
+
 #include "zsl_buffer_manager.h"
 
 namespace android {
 namespace google_camera_hal {
 
-ZslBufferManager::ZslBufferManager(IHalBufferAllocator* allocator,
-                                   int partial_result_count)
+ZslBufferManager::ZslBufferManager(
+    IHalBufferAllocator* allocator, int partial_result_count,
+    const std::vector<uint32_t>& zsl_metadata_tags)
     : kMemoryProfilingEnabled(
           property_get_bool("persist.vendor.camera.hal.memoryprofile", false)),
       buffer_allocator_(allocator),
-      partial_result_count_(partial_result_count) {
+      partial_result_count_(partial_result_count),
+      zsl_metadata_tags_(zsl_metadata_tags) {
+  if (!zsl_metadata_tags_.empty()) {
+    // Filled buffers are selected by these tags.
+    zsl_metadata_tags_.insert(
+        zsl_metadata_tags_.end(),
+        {ANDROID_SENSOR_TIMESTAMP, ANDROID_CONTROL_AE_MODE,
+         ANDROID_FLASH_STATE});
+    std::sort(zsl_metadata_tags_.begin(), zsl_metadata_tags_.end());
+    zsl_metadata_tags_.erase(
+        std::unique(zsl_metadata_tags_.begin(), zsl_metadata_tags_.end()),
+        zsl_metadata_tags_.end());
+  }
 }
 
 ZslBufferManager::~ZslBufferManager() {
   ATRACE_CALL();
   std::unique_lock<std::mutex> lock(zsl_buffers_lock_);
+  if (!zsl_metadata_tags_.empty() && num_zsl_metadata_frames_ > 0) {
+    ALOGI("%s: Kept %zu tags, %" PRIu64 " of %" PRIu64
+          " bytes of result metadata per ZSL buffer.",
+          __FUNCTION__, zsl_metadata_tags_.size(),
+          zsl_metadata_bytes_ / num_zsl_metadata_frames_,
+          result_metadata_bytes_ / num_zsl_metadata_frames_);
+  }
   if (buffer_allocator_ != nullptr) {
     buffer_allocator_->FreeBuffers(&buffers_);
   }
@@ -68,6 +91,7 @@ status_t ZslBufferManager::AllocateBuffers(
 
   uint32_t num_buffers = buffer_descriptor.immediate_num_buffers;
   buffer_descriptor_ = buffer_descriptor;
+  ReserveFilledSlotsLocked(buffer_descriptor.max_num_buffers);
   status_t res = AllocateBuffersLocked(num_buffers);
   if (res != OK) {
     ALOGE("%s: Allocating %d buffers failed.", __FUNCTION__, num_buffers);
@@ -154,10 +178,15 @@ buffer_handle_t ZslBufferManager::GetEmptyBufferLocked() {
   if (empty_zsl_buffers_.size() > 0) {
     buffer = empty_zsl_buffers_[0];
     empty_zsl_buffers_.pop_front();
-  } else if (filled_zsl_buffers_.size() > 0) {
-    auto buffer_iter = filled_zsl_buffers_.begin();
-    buffer = buffer_iter->second.buffer.buffer;
-    filled_zsl_buffers_.erase(buffer_iter);
+  } else if (num_filled_zsl_buffers_ > 0) {
+    FilledZslSlot& slot = GetFilledSlotLocked(0);
+    buffer = slot.zsl_buffer.buffer.buffer;
+    if (slot.flash_fired) {
+      num_flash_fired_buffers_--;
+    }
+    slot = {};
+    filled_zsl_head_ = (filled_zsl_head_ + 1) % filled_zsl_slots_.size();
+    num_filled_zsl_buffers_--;
   } else if (partially_filled_zsl_buffers_.size() > 0) {
     auto buffer_iter = partially_filled_zsl_buffers_.begin();
     while (buffer_iter != partially_filled_zsl_buffers_.end()) {
@@ -206,6 +235,66 @@ buffer_handle_t ZslBufferManager::GetEmptyBufferLocked() {
   return buffer;
 }
 
+ZslBufferManager::FilledZslSlot& ZslBufferManager::GetFilledSlotLocked(
+    uint32_t index) {
+  return filled_zsl_slots_[(filled_zsl_head_ + index) %
+                           filled_zsl_slots_.size()];
+}
+
+void ZslBufferManager::ReserveFilledSlotsLocked(uint32_t capacity) {
+  if (capacity <= filled_zsl_slots_.size()) {
+    return;
+  }
+
+  std::vector<FilledZslSlot> slots(capacity);
+  for (uint32_t i = 0; i < num_filled_zsl_buffers_; i++) {
+    slots[i] = std::move(GetFilledSlotLocked(i));
+  }
+  filled_zsl_slots_ = std::move(slots);
+  filled_zsl_head_ = 0;
+}
+
+void ZslBufferManager::AddFilledBufferLocked(ZslBuffer zsl_buffer) {
+  FilledZslSlot filled_slot = {.zsl_buffer = std::move(zsl_buffer)};
+  const HalCameraMetadata* metadata = filled_slot.zsl_buffer.metadata.get();
+  if (metadata != nullptr) {
+    camera_metadata_ro_entry entry = {};
+    if (metadata->Get(ANDROID_SENSOR_TIMESTAMP, &entry) == OK &&
+        entry.count == 1) {
+      filled_slot.has_timestamp = true;
+      filled_slot.timestamp_ns = entry.data.i64[0];
+    }
+    if (metadata->Get(ANDROID_CONTROL_AE_MODE, &entry) == OK &&
+        entry.count == 1) {
+      filled_slot.has_ae_mode = true;
+      filled_slot.ae_mode = entry.data.u8[0];
+    }
+    if (metadata->Get(ANDROID_FLASH_STATE, &entry) == OK && entry.count == 1) {
+      filled_slot.flash_fired = entry.data.u8[0] == ANDROID_FLASH_STATE_FIRED;
+    }
+  }
+
+  if (num_filled_zsl_buffers_ == filled_zsl_slots_.size()) {
+    ReserveFilledSlotsLocked(
+        std::max(kMinFilledZslSlots,
+                 static_cast<uint32_t>(filled_zsl_slots_.size() * 2)));
+  }
+
+  // Buffers are mostly filled in order. ZSL buffers returned after a snapshot
+  // move back in front of the newer ones.
+  uint32_t index = num_filled_zsl_buffers_++;
+  while (index > 0 && GetFilledSlotLocked(index - 1).zsl_buffer.frame_number >
+                          filled_slot.zsl_buffer.frame_number) {
+    GetFilledSlotLocked(index) = std::move(GetFilledSlotLocked(index - 1));
+    index--;
+  }
+
+  if (filled_slot.flash_fired) {
+    num_flash_fired_buffers_++;
+  }
+  GetFilledSlotLocked(index) = std::move(filled_slot);
+}
+
 void ZslBufferManager::FreeUnusedBuffersLocked() {
   ATRACE_CALL();
   if (empty_zsl_buffers_.size() <= kMaxUnusedBuffers ||
@@ -296,10 +385,10 @@ status_t ZslBufferManager::ReturnFilledBuffer(uint32_t frame_number,
         partial_result_count_) {
       ALOGV(
           "%s: both buffer and metadata for frame[%u] are ready. Move to "
-          "filled_zsl_buffers_.",
+          "filled_zsl_slots_.",
           __FUNCTION__, frame_number);
-      filled_zsl_buffers_[frame_number] =
-          std::move(partially_filled_zsl_buffers_[frame_number]);
+      AddFilledBufferLocked(
+          std::move(partially_filled_zsl_buffers_[frame_number]));
       partially_filled_zsl_buffers_.erase(frame_number);
     }
   } else {
@@ -334,48 +423,42 @@ status_t ZslBufferManager::ReturnMetadata(uint32_t frame_number,
         __FUNCTION__, frame_number);
 
     zsl_buffer.buffer = {};
-    zsl_buffer.metadata = HalCameraMetadata::Clone(metadata);
-    if (zsl_buffer.metadata == nullptr) {
-      ALOGE("%s: Failed to Clone camera metadata.", __FUNCTION__);
-      return NO_MEMORY;
+    status_t res = CopyZslMetadataLocked(metadata, &zsl_buffer.metadata);
+    if (res != OK) {
+      ALOGE("%s: Failed to copy camera metadata.", __FUNCTION__);
+      return res;
     }
     partially_filled_zsl_buffers_[frame_number] = std::move(zsl_buffer);
   } else if (partial_result < partial_result_count_) {
     partially_filled_buffer_it->second.partial_result = partial_result;
-    // Need to wait for more partial results
-    if (partially_filled_buffer_it->second.metadata == nullptr) {
-      // This is the first partial result, clone to create an entry
-      partially_filled_buffer_it->second.metadata =
-          HalCameraMetadata::Clone(metadata);
-      if (partially_filled_buffer_it->second.metadata == nullptr) {
-        ALOGE("%s: Failed to Clone camera metadata.", __FUNCTION__);
-        return NO_MEMORY;
-      }
-    } else {
-      // Append to previously received partial results
-      partially_filled_buffer_it->second.metadata->Append(
-          metadata->GetRawCameraMetadata());
+    // Need to wait for more partial results. The first partial result creates
+    // the metadata and later ones are appended to it.
+    status_t res = CopyZslMetadataLocked(
+        metadata, &partially_filled_buffer_it->second.metadata);
+    if (res != OK) {
+      ALOGE("%s: Failed to copy camera metadata.", __FUNCTION__);
+      return res;
     }
   } else {
     zsl_buffer.buffer = partially_filled_buffer_it->second.buffer;
     partially_filled_buffer_it->second.partial_result = partial_result;
-    if (partially_filled_buffer_it->second.metadata == nullptr) {
-      // This will happen if partial_result_count_ == 1
-      partially_filled_buffer_it->second.metadata =
-          HalCameraMetadata::Clone(metadata);
+    // This is the last partial result, or the only one if
+    // partial_result_count_ == 1.
+    if (CopyZslMetadataLocked(
+            metadata, &partially_filled_buffer_it->second.metadata) != OK) {
+      ALOGE("%s: Failed to copy camera metadata.", __FUNCTION__);
     } else {
-      // This is the last partial result, append it to the others
-      partially_filled_buffer_it->second.metadata->Append(
-          metadata->GetRawCameraMetadata());
+      zsl_metadata_bytes_ +=
+          partially_filled_buffer_it->second.metadata->GetCameraMetadataSize();
+      num_zsl_metadata_frames_++;
     }
     if (partially_filled_buffer_it->second.buffer.buffer !=
         kInvalidBufferHandle) {
       ALOGV(
           "%s: both buffer and metadata for frame[%u] are ready. Move to "
-          "filled_zsl_buffers_.",
+          "filled_zsl_slots_.",
           __FUNCTION__, frame_number);
-      filled_zsl_buffers_[frame_number] =
-          std::move(partially_filled_buffer_it->second);
+      AddFilledBufferLocked(std::move(partially_filled_buffer_it->second));
       partially_filled_zsl_buffers_.erase(frame_number);
     }
   }
@@ -389,6 +472,47 @@ status_t ZslBufferManager::ReturnMetadata(uint32_t frame_number,
   return OK;
 }
 
+status_t ZslBufferManager::CopyZslMetadataLocked(
+    const HalCameraMetadata* metadata,
+    std::unique_ptr<HalCameraMetadata>* zsl_metadata) {
+  if (metadata == nullptr || zsl_metadata == nullptr) {
+    ALOGE("%s: metadata (%p) or zsl_metadata (%p) is nullptr", __FUNCTION__,
+          metadata, zsl_metadata);
+    return BAD_VALUE;
+  }
+
+  result_metadata_bytes_ += metadata->GetCameraMetadataSize();
+  if (zsl_metadata_tags_.empty()) {
+    if (*zsl_metadata == nullptr) {
+      *zsl_metadata = HalCameraMetadata::Clone(metadata);
+      return *zsl_metadata == nullptr ? NO_MEMORY : OK;
+    }
+    return (*zsl_metadata)->Append(metadata->GetRawCameraMetadata());
+  }
+
+  std::vector<camera_metadata_ro_entry> entries;
+  entries.reserve(zsl_metadata_tags_.size());
+  size_t data_size = 0;
+  for (uint32_t tag : zsl_metadata_tags_) {
+    camera_metadata_ro_entry entry = {};
+    if (metadata->Get(tag, &entry) == OK) {
+      entries.push_back(entry);
+      data_size +=
+          calculate_camera_metadata_entry_data_size(entry.type, entry.count);
+    }
+  }
+
+  if (*zsl_metadata == nullptr) {
+    // Size the metadata for the first partial result exactly.
+    *zsl_metadata = HalCameraMetadata::Create(entries.size(), data_size);
+    if (*zsl_metadata == nullptr) {
+      return NO_MEMORY;
+    }
+  }
+
+  return entries.empty() ? OK : (*zsl_metadata)->Set(entries);
+}
+
 status_t ZslBufferManager::GetCurrentTimestampNs(int64_t* current_timestamp) {
   if (current_timestamp == nullptr) {
     ALOGE("%s: current_timestamp is nullptr", __FUNCTION__);
@@ -423,67 +547,68 @@ void ZslBufferManager::GetMostRecentZslBuffers(
   }
 
   std::unique_lock<std::mutex> lock(zsl_buffers_lock_);
-  if (filled_zsl_buffers_.size() < min_buffers) {
-    ALOGD("%s: Requested min_buffers = %u, ZslBufferManager only has %zu",
-          __FUNCTION__, min_buffers, filled_zsl_buffers_.size());
+  if (num_filled_zsl_buffers_ < min_buffers) {
+    ALOGD("%s: Requested min_buffers = %u, ZslBufferManager only has %u",
+          __FUNCTION__, min_buffers, num_filled_zsl_buffers_);
     ALOGD("%s: Not enough ZSL buffers to get, returns empty zsl_buffers.",
           __FUNCTION__);
     return;
   }
 
-  num_buffers =
-      std::min(static_cast<uint32_t>(filled_zsl_buffers_.size()), num_buffers);
-  auto zsl_buffer_iter = filled_zsl_buffers_.begin();
+  num_buffers = std::min(num_filled_zsl_buffers_, num_buffers);
+  if (num_buffers == 0) {
+    return;
+  }
 
   // Skip the older ones.
-  for (uint32_t i = 0; i < filled_zsl_buffers_.size() - num_buffers; i++) {
-    zsl_buffer_iter++;
-  }
+  uint32_t first_index = num_filled_zsl_buffers_ - num_buffers;
 
   // Fallback to realtime pipeline capture if there are any flash-fired frame
   // in zsl buffers with AE_MODE_ON_AUTO_FLASH.
-  camera_metadata_ro_entry entry = {};
-  res = zsl_buffer_iter->second.metadata->Get(ANDROID_CONTROL_AE_MODE, &entry);
-  if (res == OK && entry.data.u8[0] == ANDROID_CONTROL_AE_MODE_ON_AUTO_FLASH) {
-    for (auto search_iter = filled_zsl_buffers_.begin();
-         search_iter != filled_zsl_buffers_.end(); search_iter++) {
-      res = search_iter->second.metadata->Get(ANDROID_FLASH_STATE, &entry);
-      if (res == OK && entry.count == 1) {
-        if (entry.data.u8[0] == ANDROID_FLASH_STATE_FIRED) {
-          ALOGD("%s: Returns empty zsl_buffers due to flash fired",
-                __FUNCTION__);
-          return;
-        }
-      }
-    }
+  const FilledZslSlot& first_slot = GetFilledSlotLocked(first_index);
+  if (first_slot.has_ae_mode &&
+      first_slot.ae_mode == ANDROID_CONTROL_AE_MODE_ON_AUTO_FLASH &&
+      num_flash_fired_buffers_ > 0) {
+    ALOGD("%s: Returns empty zsl_buffers due to flash fired", __FUNCTION__);
+    return;
   }
 
-  for (uint32_t i = 0; i < num_buffers; i++) {
-    camera_metadata_ro_entry entry = {};
-    int64_t buffer_timestamp;
-    res =
-        zsl_buffer_iter->second.metadata->Get(ANDROID_SENSOR_TIMESTAMP, &entry);
-    if (res != OK || entry.count != 1) {
-      ALOGW("%s: Getting sensor timestamp failed: %s(%d)", __FUNCTION__,
-            strerror(-res), res);
-      return;
+  // Take the recent buffers and move the ones left behind down to fill the
+  // gaps, towards the oldest end, so the ring stays contiguous.
+  uint32_t num_kept = first_index;
+  bool timestamp_missing = false;
+  for (uint32_t i = first_index; i < num_filled_zsl_buffers_; i++) {
+    FilledZslSlot& slot = GetFilledSlotLocked(i);
+    if (!timestamp_missing && !slot.has_timestamp) {
+      ALOGW("%s: Frame %u has no sensor timestamp.", __FUNCTION__,
+            slot.zsl_buffer.frame_number);
+      timestamp_missing = true;
     }
 
-    buffer_timestamp = entry.data.i64[0];
     // Only include recent buffers.
-    if (current_timestamp - buffer_timestamp < kMaxBufferTimestampDiff) {
-      zsl_buffers->push_back(std::move(zsl_buffer_iter->second));
-      zsl_buffer_iter = filled_zsl_buffers_.erase(zsl_buffer_iter);
-    } else {
-      zsl_buffer_iter++;
+    if (!timestamp_missing &&
+        current_timestamp - slot.timestamp_ns < kMaxBufferTimestampDiff) {
+      if (slot.flash_fired) {
+        num_flash_fired_buffers_--;
+      }
+      zsl_buffers->push_back(std::move(slot.zsl_buffer));
+      slot = {};
+      continue;
+    }
+
+    if (num_kept != i) {
+      GetFilledSlotLocked(num_kept) = std::move(slot);
+      slot = {};
     }
+    num_kept++;
   }
+  num_filled_zsl_buffers_ = num_kept;
 }
 
 void ZslBufferManager::ReturnZslBuffer(ZslBuffer zsl_buffer) {
   ATRACE_CALL();
   std::unique_lock<std::mutex> lock(zsl_buffers_lock_);
-  filled_zsl_buffers_[zsl_buffer.frame_number] = std::move(zsl_buffer);
+  AddFilledBufferLocked(std::move(zsl_buffer));
 }
 
 void ZslBufferManager::ReturnZslBuffers(std::vector<ZslBuffer> zsl_buffers) {
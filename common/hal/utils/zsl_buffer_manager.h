@@ -39,8 +39,12 @@ class ZslBufferManager {
  public:
   // allocator will be used to allocate buffers. If allocator is nullptr,
   // GrallocBufferAllocator will be used to allocate buffers.
+  // zsl_metadata_tags are the result metadata tags that snapshots use. If it's
+  // not empty, ZSL buffers keep only these tags instead of a copy of the whole
+  // result metadata.
   ZslBufferManager(IHalBufferAllocator* allocator = nullptr,
-                   int partial_result_count = 1);
+                   int partial_result_count = 1,
+                   const std::vector<uint32_t>& zsl_metadata_tags = {});
   virtual ~ZslBufferManager();
 
   // Defines a ZSL buffer.
@@ -49,7 +53,8 @@ class ZslBufferManager {
     uint32_t frame_number = 0;
     // Buffer
     StreamBuffer buffer;
-    // Original result metadata of this ZSL buffer captured by HAL.
+    // Original result metadata of this ZSL buffer captured by HAL, or only
+    // its ZSL metadata tags if they are specified.
     std::unique_ptr<HalCameraMetadata> metadata;
     // Last partial result received
     int partial_result = 0;
@@ -73,7 +78,8 @@ class ZslBufferManager {
 
   // Return the metadata part of a filled buffer
   // that was previously obtained by GetEmptyBuffer().
-  // ZSL buffer manager will make a copy of metadata.
+  // ZSL buffer manager will make a copy of metadata, or of its ZSL metadata
+  // tags.
   // The caller still owns metadata.
   status_t ReturnMetadata(uint32_t frame_number,
                           const HalCameraMetadata* metadata, int partial_result);
@@ -129,8 +135,26 @@ class ZslBufferManager {
   // buffers.
   static const uint32_t kMaxIdelBufferFrameCounter = 300;
 
+  // Capacity of filled_zsl_slots_ when buffers are filled before
+  // AllocateBuffers() sizes it.
+  static constexpr uint32_t kMinFilledZslSlots = 8;
+
   const bool kMemoryProfilingEnabled;
 
+  // A filled ZSL buffer and the fields of its result metadata that snapshots
+  // check, decoded once when the buffer is filled.
+  struct FilledZslSlot {
+    ZslBuffer zsl_buffer;
+    // ANDROID_SENSOR_TIMESTAMP, if has_timestamp is true.
+    bool has_timestamp = false;
+    int64_t timestamp_ns = 0;
+    // ANDROID_CONTROL_AE_MODE, if has_ae_mode is true.
+    bool has_ae_mode = false;
+    uint8_t ae_mode = 0;
+    // Whether ANDROID_FLASH_STATE is ANDROID_FLASH_STATE_FIRED.
+    bool flash_fired = false;
+  };
+
   // Remove the oldest metadata.
   status_t RemoveOldestMetadataLocked();
 
@@ -146,6 +170,25 @@ class ZslBufferManager {
   // Try to free unused buffers. Must be protected by zsl_buffers_lock_.
   void FreeUnusedBuffersLocked();
 
+  // Add a filled ZSL buffer, keeping the filled buffers ordered by frame
+  // number. Must be protected by zsl_buffers_lock_.
+  void AddFilledBufferLocked(ZslBuffer zsl_buffer);
+
+  // Return the filled slot at index, 0 being the oldest one. Must be protected
+  // by zsl_buffers_lock_.
+  FilledZslSlot& GetFilledSlotLocked(uint32_t index);
+
+  // Grow filled_zsl_slots_ to capacity slots. Must be protected by
+  // zsl_buffers_lock_.
+  void ReserveFilledSlotsLocked(uint32_t capacity);
+
+  // Copy the ZSL metadata tags of a partial result to zsl_metadata, creating
+  // it if it's nullptr. Copies all of metadata if zsl_metadata_tags_ is empty.
+  // Must be protected by zsl_buffers_lock_.
+  status_t CopyZslMetadataLocked(
+      const HalCameraMetadata* metadata,
+      std::unique_ptr<HalCameraMetadata>* zsl_metadata);
+
   bool allocated_ = false;
   std::mutex zsl_buffers_lock_;
 
@@ -158,16 +201,23 @@ class ZslBufferManager {
   // Empty ZSL buffer queue. Protected by mZslBuffersLock.
   std::deque<buffer_handle_t> empty_zsl_buffers_;
 
-  // Filled ZSL buffers. Map from frameNumber to ZslBuffer.
-  // Ordered from the oldest to the newest buffers.
-  // Protected by mZslBuffersLock.
-  std::map<uint32_t, ZslBuffer> filled_zsl_buffers_;
+  // Ring of filled ZSL buffers, ordered from the oldest to the newest frame
+  // number starting at filled_zsl_head_. AllocateBuffers() sizes it for the
+  // maximum number of buffers; AddFilledBufferLocked() doubles it, starting at
+  // kMinFilledZslSlots, if it's full. Protected by zsl_buffers_lock_.
+  std::vector<FilledZslSlot> filled_zsl_slots_;
+  uint32_t filled_zsl_head_ = 0;
+  uint32_t num_filled_zsl_buffers_ = 0;
+
+  // Number of filled ZSL buffers whose flash fired. Protected by
+  // zsl_buffers_lock_.
+  uint32_t num_flash_fired_buffers_ = 0;
 
   // Partially filled ZSL buffers. Either the metadata or
   // the buffer is returned. Once the metadata and the buffer are both ready,
-  // the ZslBuffer will be moved to the filled_zsl_buffers_.
+  // the ZslBuffer will be moved to the filled_zsl_slots_.
   // Map from frameNumber to ZslBuffer. Ordered from the oldest to the newest
-  // buffers. filled_zsl_buffers_ protected by zsl_buffers_lock_.
+  // buffers. partially_filled_zsl_buffers_ protected by zsl_buffers_lock_.
   std::map<uint32_t, ZslBuffer> partially_filled_zsl_buffers_;
 
   // Store all allocated buffers return from GrallocBufferAllocator
@@ -187,6 +237,15 @@ class ZslBufferManager {
 
   // Partial result count reported by camera HAL
   int partial_result_count_ = 1;
+
+  // Result metadata tags kept with ZSL buffers. Empty to keep all tags.
+  std::vector<uint32_t> zsl_metadata_tags_;
+
+  // Bytes of result metadata received and bytes kept, and the number of frames
+  // whose metadata is complete. Protected by zsl_buffers_lock_.
+  uint64_t result_metadata_bytes_ = 0;
+  uint64_t zsl_metadata_bytes_ = 0;
+  uint32_t num_zsl_metadata_frames_ = 0;
 };
 
 }  // namespace google_camera_hal
@@ -378,6 +378,7 @@ status_t EmulatedCameraDeviceSessionHwlImpl::BuildPipelines() {
   }
 
   if (ret == OK) {
+    request_processor_->ConfigureStreams(pipelines_);
     pipelines_built_ = true;
   }
 
@@ -476,6 +477,13 @@ status_t EmulatedCameraDeviceSessionHwlImpl::Flush() {
   return request_processor_->Flush();
 }
 
+status_t EmulatedCameraDeviceSessionHwlImpl::SignalStreamFlush(
+    const std::vector<int32_t>& stream_ids) {
+  ATRACE_CALL();
+  std::lock_guard<std::mutex> lock(api_mutex_);
+  return request_processor_->SignalStreamFlush(stream_ids);
+}
+
 uint32_t EmulatedCameraDeviceSessionHwlImpl::GetCameraId() const {
   return camera_id_;
 }
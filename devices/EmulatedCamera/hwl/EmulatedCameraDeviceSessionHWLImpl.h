@@ -128,6 +128,8 @@ class EmulatedCameraDeviceSessionHwlImpl : public CameraDeviceSessionHwl {
 
   status_t Flush() override;
 
+  status_t SignalStreamFlush(const std::vector<int32_t>& stream_ids) override;
+
   uint32_t GetCameraId() const override;
 
   std::vector<uint32_t> GetPhysicalCameraIds() const override;
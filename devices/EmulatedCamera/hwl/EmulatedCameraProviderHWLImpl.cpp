@@ -666,6 +666,9 @@ uint32_t EmulatedCameraProviderHwlImpl::ParseCharacteristics(
   int32_t payload_frames = 0;
   static_meta->Set(google_camera_hal::kHdrplusPayloadFrames, &payload_frames, 1);
 
+  // The characteristics are only read from now on, clones stay sorted too.
+  static_meta->Seal();
+
   if (id < 0) {
     static_metadata_.push_back(std::move(static_meta));
     id = static_metadata_.size() - 1;
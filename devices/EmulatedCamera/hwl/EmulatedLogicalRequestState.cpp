@@ -129,7 +129,7 @@ EmulatedLogicalRequestState::InitializeLogicalResult(uint32_t pipeline_id,
 }
 
 status_t EmulatedLogicalRequestState::InitializeLogicalSettings(
-    std::unique_ptr<HalCameraMetadata> request_settings,
+    SettingsSnapshot request_settings,
     std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids,
     uint32_t override_frame_number,
     EmulatedSensor::LogicalCameraSettings* logical_settings /*out*/) {
@@ -155,8 +155,7 @@ status_t EmulatedLogicalRequestState::InitializeLogicalSettings(
       // and apply their settings.
       EmulatedSensor::SensorSettings physical_sensor_settings;
       auto ret = physical_request_state.second->InitializeSensorSettings(
-          HalCameraMetadata::Clone(request_settings.get()),
-          override_frame_number, &physical_sensor_settings);
+          request_settings, override_frame_number, &physical_sensor_settings);
       if (ret != OK) {
         ALOGE(
             "%s: Initialization of physical sensor settings for device id: %u  "
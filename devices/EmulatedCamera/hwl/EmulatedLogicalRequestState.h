@@ -71,7 +71,7 @@ class EmulatedLogicalRequestState {
       uint32_t pipeline_id, uint32_t frame_number, bool is_partial_result);
 
   status_t InitializeLogicalSettings(
-      std::unique_ptr<HalCameraMetadata> request_settings,
+      SettingsSnapshot request_settings,
       std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids,
       uint32_t frame_number,
       EmulatedSensor::LogicalCameraSettings* logical_settings /*out*/);
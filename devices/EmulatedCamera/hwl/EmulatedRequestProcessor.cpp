@@ -21,12 +21,16 @@
 
 #include <HandleImporter.h>
 #include <hardware/gralloc.h>
+#include <inttypes.h>
 #include <log/log.h>
-#include <sync/sync.h>
 #include <utils/Timers.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
+#include <iterator>
 #include <memory>
+#include <unordered_set>
+#include <vector>
 
 #include "GrallocSensorBuffer.h"
 
@@ -56,9 +60,16 @@ EmulatedRequestProcessor::EmulatedRequestProcessor(
 
 EmulatedRequestProcessor::~EmulatedRequestProcessor() {
   ATRACE_CALL();
-  processor_done_ = true;
+  {
+    std::lock_guard<std::mutex> lock(process_mutex_);
+    processor_done_ = true;
+  }
+  pending_request_condition_.notify_one();
   request_thread_.join();
 
+  ALOGI("%s: %" PRIu64 " frames missed vsync", __FUNCTION__,
+        sensor_->GetMissedVSyncCount());
+
   auto ret = sensor_->ShutDown();
   if (ret != OK) {
     ALOGE("%s: Failed during sensor shutdown %s (%d)", __FUNCTION__,
@@ -122,28 +133,45 @@ status_t EmulatedRequestProcessor::ProcessPipelineRequests(
         pipelines[request.pipeline_id].cb, request.input_width,
         request.input_height);
 
+    // Start watching the fences right away, by the time the request thread
+    // gets to this request they have likely signaled already.
+    res = WatchFences(output_buffers.get());
+    if (res == OK) {
+      res = WatchFences(input_buffers.get());
+      if (res != OK) {
+        UnwatchFences(output_buffers.get());
+      }
+    }
+    if (res != OK) {
+      return res;
+    }
+
+    // The only copy of the request settings, shared with the override queue
+    // and any following repeating frames.
+    SettingsSnapshot settings =
+        HalCameraMetadata::Clone(request.settings.get());
+
     // Check if there are any settings that need to be overridden.
     camera_metadata_ro_entry_t entry;
-    if (request.settings.get() != nullptr) {
-      auto ret = request.settings.get()->Get(ANDROID_CONTROL_SETTINGS_OVERRIDE,
-                                             &entry);
+    if (settings != nullptr) {
+      auto ret = settings->Get(ANDROID_CONTROL_SETTINGS_OVERRIDE, &entry);
       if ((ret == OK) && (entry.count == 1)) {
-        std::unique_ptr<HalCameraMetadata> override_setting =
-            HalCameraMetadata::Clone(request.settings.get());
-        override_settings_.push({.settings = std::move(override_setting),
-                                 .frame_number = frame_number});
+        override_settings_.push(
+            {.frame_number = frame_number, .settings = settings});
       }
     } else {
       override_settings_.push(
-          {.settings = nullptr, .frame_number = frame_number});
+          {.frame_number = frame_number, .settings = nullptr});
     }
     pending_requests_.push(
         {.frame_number = frame_number,
          .pipeline_id = request.pipeline_id,
          .callback = pipelines[request.pipeline_id].cb,
-         .settings = HalCameraMetadata::Clone(request.settings.get()),
+         .settings = std::move(settings),
          .input_buffers = std::move(input_buffers),
          .output_buffers = std::move(output_buffers)});
+    sensor_->AddPendingRequests(1);
+    pending_request_condition_.notify_one();
   }
 
   return OK;
@@ -226,8 +254,33 @@ void EmulatedRequestProcessor::NotifyFailedRequest(const PendingRequest& request
   request.callback.notify(request.pipeline_id, msg);
 }
 
+void EmulatedRequestProcessor::FailInFlightRequestLocked(
+    PendingRequest* request) {
+  NotifyFailedRequest(*request);
+  UnwatchFences(request->output_buffers.get());
+  UnwatchFences(request->input_buffers.get());
+  request->output_buffers = nullptr;
+  request->input_buffers = nullptr;
+  sensor_->AddPendingRequests(-1);
+  FinishInFlightRequestLocked();
+}
+
+void EmulatedRequestProcessor::FinishInFlightRequestLocked() {
+  request_in_flight_ = false;
+  in_flight_condition_.notify_all();
+}
+
 status_t EmulatedRequestProcessor::Flush() {
-  std::lock_guard<std::mutex> lock(process_mutex_);
+  std::unique_lock<std::mutex> lock(process_mutex_);
+  // The request thread may be waiting on the fences of a request it already
+  // took off 'pending_requests_'. Fail it so that it doesn't reach the sensor
+  // after the flush.
+  if (request_in_flight_) {
+    fail_in_flight_request_ = true;
+    fence_reactor_.Interrupt();
+    in_flight_condition_.wait(lock, [this] { return !request_in_flight_; });
+  }
+
   // First flush in-flight requests
   auto ret = sensor_->Flush();
 
@@ -235,12 +288,95 @@ status_t EmulatedRequestProcessor::Flush() {
   while (!pending_requests_.empty()) {
     const auto& request = pending_requests_.front();
     NotifyFailedRequest(request);
+    UnwatchFences(request.output_buffers.get());
+    UnwatchFences(request.input_buffers.get());
     pending_requests_.pop();
+    sensor_->AddPendingRequests(-1);
   }
 
   return ret;
 }
 
+status_t EmulatedRequestProcessor::SignalStreamFlush(
+    const std::vector<int32_t>& stream_ids) {
+  ATRACE_CALL();
+  std::unordered_set<int32_t> flushed_streams(stream_ids.begin(),
+                                              stream_ids.end());
+  Buffers flushed_buffers;
+  std::vector<PendingRequest> failed_requests;
+  {
+    std::lock_guard<std::mutex> lock(process_mutex_);
+    // Frames already queued on the sensor complete within a frame duration.
+    // The request being prepared drops its buffers of these streams once its
+    // fences are resolved, the pending requests are handled here.
+    if (request_in_flight_) {
+      in_flight_flushed_streams_.insert(stream_ids.begin(), stream_ids.end());
+    }
+    size_t request_count = pending_requests_.size();
+    for (size_t i = 0; i < request_count; i++) {
+      PendingRequest request = std::move(pending_requests_.front());
+      pending_requests_.pop();
+      if (request.output_buffers == nullptr ||
+          request.output_buffers->empty()) {
+        pending_requests_.push(std::move(request));
+        continue;
+      }
+
+      auto& buffers = *request.output_buffers;
+      auto flushed = std::stable_partition(
+          buffers.begin(), buffers.end(), [&](const auto& buffer) {
+            return flushed_streams.count(buffer->stream_buffer.stream_id) == 0;
+          });
+      if (flushed == buffers.begin()) {
+        // Nothing is left to capture, fail the whole request instead.
+        UnwatchFences(request.output_buffers.get());
+        UnwatchFences(request.input_buffers.get());
+        sensor_->AddPendingRequests(-1);
+        failed_requests.push_back(std::move(request));
+        continue;
+      }
+
+      std::move(flushed, buffers.end(), std::back_inserter(flushed_buffers));
+      buffers.erase(flushed, buffers.end());
+      pending_requests_.push(std::move(request));
+    }
+    UnwatchFences(&flushed_buffers);
+  }
+
+  // Returning the buffers invokes the result callbacks, so the lock is
+  // released first.
+  ALOGV("%s: Returning %zu buffers and failing %zu requests", __FUNCTION__,
+        flushed_buffers.size(), failed_requests.size());
+  for (auto& buffer : flushed_buffers) {
+    buffer->stream_buffer.status = BufferStatus::kError;
+  }
+  flushed_buffers.clear();
+  for (auto& request : failed_requests) {
+    NotifyFailedRequest(request);
+  }
+  failed_requests.clear();
+
+  return OK;
+}
+
+void EmulatedRequestProcessor::ConfigureStreams(
+    const std::vector<EmulatedPipeline>& pipelines) {
+  std::vector<EmulatedSensor::StreamInfo> streams;
+  for (const auto& pipeline : pipelines) {
+    for (const auto& stream : pipeline.streams) {
+      EmulatedSensor::StreamInfo info;
+      info.width = stream.second.width;
+      info.height = stream.second.height;
+      info.format = stream.second.override_format;
+      info.is_input = stream.second.is_input;
+      streams.push_back(info);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(process_mutex_);
+  sensor_->ConfigureStreams(streams);
+}
+
 status_t EmulatedRequestProcessor::GetBufferSizeAndStride(
     const EmulatedStream& stream, buffer_handle_t buffer,
     uint32_t* size /*out*/, uint32_t* stride /*out*/) {
@@ -413,6 +549,70 @@ std::unique_ptr<SensorBuffer> EmulatedRequestProcessor::CreateSensorBuffer(
   return buffer;
 }
 
+status_t EmulatedRequestProcessor::WatchFences(const Buffers* buffers) {
+  if (buffers == nullptr) {
+    return OK;
+  }
+
+  for (auto it = buffers->begin(); it != buffers->end(); it++) {
+    if ((*it)->acquire_fence_fd < 0) {
+      continue;
+    }
+
+    auto ret = fence_reactor_.Watch((*it)->acquire_fence_fd);
+    if (ret != OK) {
+      ALOGE("%s: Failed to watch acquire fence: %s (%d)", __FUNCTION__,
+            strerror(-ret), ret);
+      for (auto watched = buffers->begin(); watched != it; watched++) {
+        if ((*watched)->acquire_fence_fd >= 0) {
+          fence_reactor_.Unwatch((*watched)->acquire_fence_fd);
+        }
+      }
+      return ret;
+    }
+  }
+
+  return OK;
+}
+
+void EmulatedRequestProcessor::UnwatchFences(const Buffers* buffers) {
+  if (buffers == nullptr) {
+    return;
+  }
+
+  for (const auto& buffer : *buffers) {
+    if (buffer->acquire_fence_fd >= 0) {
+      fence_reactor_.Unwatch(buffer->acquire_fence_fd);
+    }
+  }
+}
+
+status_t EmulatedRequestProcessor::WaitForFences(
+    const PendingRequest& request) {
+  ATRACE_CALL();
+  std::vector<int> fences;
+  for (const auto* buffers :
+       {request.output_buffers.get(), request.input_buffers.get()}) {
+    if (buffers == nullptr) {
+      continue;
+    }
+    for (const auto& buffer : *buffers) {
+      if (buffer->acquire_fence_fd >= 0) {
+        fences.push_back(buffer->acquire_fence_fd);
+      }
+    }
+  }
+
+  if (fences.empty()) {
+    return OK;
+  }
+
+  // All fences of the request share one deadline, a slow consumer no longer
+  // delays the wait on the other buffers.
+  return fence_reactor_.WaitForFences(
+      fences, EmulatedSensor::kSupportedFrameDurationRange[1]);
+}
+
 std::unique_ptr<Buffers> EmulatedRequestProcessor::AcquireBuffers(
     Buffers* buffers) {
   if ((buffers == nullptr) || (buffers->empty())) {
@@ -423,17 +623,19 @@ std::unique_ptr<Buffers> EmulatedRequestProcessor::AcquireBuffers(
   acquired_buffers->reserve(buffers->size());
   auto output_buffer = buffers->begin();
   while (output_buffer != buffers->end()) {
-    status_t ret = OK;
-    if ((*output_buffer)->acquire_fence_fd >= 0) {
-      ret = sync_wait((*output_buffer)->acquire_fence_fd,
-                      ns2ms(EmulatedSensor::kSupportedFrameDurationRange[1]));
-      if (ret != OK) {
-        ALOGE("%s: Fence sync failed: %s, (%d)", __FUNCTION__, strerror(-ret),
-              ret);
+    bool ready = true;
+    int fence_fd = (*output_buffer)->acquire_fence_fd;
+    if (fence_fd >= 0) {
+      ready = fence_reactor_.IsSignaled(fence_fd);
+      // The fence is closed along with the buffer, stop watching it first
+      fence_reactor_.Unwatch(fence_fd);
+      if (!ready) {
+        ALOGE("%s: Fence %d of frame %u failed or timed out", __FUNCTION__,
+              fence_fd, (*output_buffer)->frame_number);
       }
     }
 
-    if (ret == OK) {
+    if (ready) {
       acquired_buffers->push_back(std::move(*output_buffer));
     }
 
@@ -443,104 +645,177 @@ std::unique_ptr<Buffers> EmulatedRequestProcessor::AcquireBuffers(
   return acquired_buffers;
 }
 
-void EmulatedRequestProcessor::RequestProcessorLoop() {
+void EmulatedRequestProcessor::PrepareReadyFrame(PendingRequest request) {
   ATRACE_CALL();
+  status_t ret = UNKNOWN_ERROR;
+  auto frame_number = request.frame_number;
+  auto notify_callback = request.callback;
+  auto pipeline_id = request.pipeline_id;
+
+  // Fences are waited on without holding 'process_mutex_' so that new
+  // requests and flushes can still come in. Flush() interrupts the wait.
+  WaitForFences(request);
+  // Declared before 'lock' so that the flushed buffers are returned after the
+  // lock is released.
+  Buffers flushed_buffers;
+  std::unique_lock<std::mutex> lock(process_mutex_);
+  if (fail_in_flight_request_) {
+    FailInFlightRequestLocked(&request);
+    return;
+  }
+  lock.unlock();
+
+  // Buffers whose fence signaled are used even if another fence of the same
+  // request failed.
+  auto output_buffers = AcquireBuffers(request.output_buffers.get());
+  auto input_buffers = AcquireBuffers(request.input_buffers.get());
+  if ((output_buffers != nullptr) && !output_buffers->empty()) {
+    EmulatedSensor::ReadyFrame frame;
+    frame.settings = std::make_unique<EmulatedSensor::LogicalCameraSettings>();
+
+    lock.lock();
+    // SignalStreamFlush() can't reach the buffers of this request while its
+    // fences are waited on, drop the ones of flushed streams now.
+    if (!in_flight_flushed_streams_.empty()) {
+      auto flushed = std::stable_partition(
+          output_buffers->begin(), output_buffers->end(),
+          [this](const auto& buffer) {
+            return in_flight_flushed_streams_.count(
+                       buffer->stream_buffer.stream_id) == 0;
+          });
+      std::move(flushed, output_buffers->end(),
+                std::back_inserter(flushed_buffers));
+      output_buffers->erase(flushed, output_buffers->end());
+      if (output_buffers->empty()) {
+        // Nothing is left to capture, fail the whole request instead.
+        request.output_buffers->swap(flushed_buffers);
+        request.input_buffers = std::move(input_buffers);
+        FailInFlightRequestLocked(&request);
+        return;
+      }
+    }
 
-  bool vsync_status_ = true;
-  while (!processor_done_ && vsync_status_) {
-    {
-      std::lock_guard<std::mutex> lock(process_mutex_);
-      if (!pending_requests_.empty()) {
-        status_t ret;
-        const auto& request = pending_requests_.front();
-        auto frame_number = request.frame_number;
-        auto notify_callback = request.callback;
-        auto pipeline_id = request.pipeline_id;
-
-        auto output_buffers = AcquireBuffers(request.output_buffers.get());
-        auto input_buffers = AcquireBuffers(request.input_buffers.get());
-        if ((output_buffers != nullptr) && !output_buffers->empty()) {
-          std::unique_ptr<EmulatedSensor::LogicalCameraSettings> logical_settings =
-              std::make_unique<EmulatedSensor::LogicalCameraSettings>();
-
-          std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids =
-              std::make_unique<std::set<uint32_t>>();
-          for (const auto& it : *output_buffers) {
-            if (it->camera_id != camera_id_) {
-              physical_camera_output_ids->emplace(it->camera_id);
-            }
-          }
+    std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids =
+        std::make_unique<std::set<uint32_t>>();
+    for (const auto& it : *output_buffers) {
+      if (it->camera_id != camera_id_) {
+        physical_camera_output_ids->emplace(it->camera_id);
+      }
+    }
 
-          // Repeating requests usually include valid settings only during the
-          // initial call. Afterwards an invalid settings pointer means that
-          // there are no changes in the parameters and Hal should re-use the
-          // last valid values.
-          // TODO: Add support for individual physical camera requests.
-          if (request.settings.get() != nullptr) {
-            auto override_frame_number =
-                ApplyOverrideSettings(frame_number, request.settings);
-            ret = request_state_->InitializeLogicalSettings(
-                HalCameraMetadata::Clone(request.settings.get()),
-                std::move(physical_camera_output_ids), override_frame_number,
-                logical_settings.get());
-            last_settings_ = HalCameraMetadata::Clone(request.settings.get());
-          } else {
-            auto override_frame_number =
-                ApplyOverrideSettings(frame_number, last_settings_);
-            ret = request_state_->InitializeLogicalSettings(
-                HalCameraMetadata::Clone(last_settings_.get()),
-                std::move(physical_camera_output_ids), override_frame_number,
-                logical_settings.get());
-          }
+    // Repeating requests usually include valid settings only during the
+    // initial call. Afterwards an invalid settings pointer means that there
+    // are no changes in the parameters and Hal should re-use the last valid
+    // values.
+    // TODO: Add support for individual physical camera requests.
+    SettingsSnapshot settings = (request.settings != nullptr)
+                                    ? std::move(request.settings)
+                                    : last_settings_;
+    auto override_frame_number = ApplyOverrideSettings(frame_number, &settings);
+    ret = request_state_->InitializeLogicalSettings(
+        settings, std::move(physical_camera_output_ids), override_frame_number,
+        frame.settings.get());
+    last_settings_ = std::move(settings);
 
-          if (ret == OK) {
-            auto partial_result = request_state_->InitializeLogicalResult(
-                pipeline_id, frame_number,
-                /*partial result*/ true);
-            auto result = request_state_->InitializeLogicalResult(
-                pipeline_id, frame_number,
-                /*partial result*/ false);
-            // The screen rotation will be the same for all logical and physical devices
-            uint32_t screen_rotation = screen_rotation_;
-            for (auto it = logical_settings->begin();
-                 it != logical_settings->end(); it++) {
-              it->second.screen_rotation = screen_rotation;
-            }
+    if (ret == OK) {
+      frame.partial_result = request_state_->InitializeLogicalResult(
+          pipeline_id, frame_number,
+          /*partial result*/ true);
+      frame.result = request_state_->InitializeLogicalResult(
+          pipeline_id, frame_number,
+          /*partial result*/ false);
+
+      // The screen rotation will be the same for all logical and physical
+      // devices
+      uint32_t screen_rotation = screen_rotation_;
+      for (auto it = frame.settings->begin(); it != frame.settings->end();
+           it++) {
+        it->second.screen_rotation = screen_rotation;
+      }
+      frame.input_buffers = std::move(input_buffers);
+      frame.output_buffers = std::move(output_buffers);
+
+      // The frame is queued under 'process_mutex_', so Flush() either finds
+      // it on the sensor or has it failed here. Only this thread queues
+      // frames and it checked for a free slot, but stay on the safe side.
+      while (!fail_in_flight_request_) {
+        if (sensor_->QueueReadyFrame(std::move(frame))) {
+          FinishInFlightRequestLocked();
+          return;
+        }
 
-            sensor_->SetCurrentRequest(
-                std::move(logical_settings), std::move(result),
-                std::move(partial_result), std::move(input_buffers),
-                std::move(output_buffers));
-          } else {
-            NotifyMessage msg{.type = MessageType::kError,
-                              .message.error = {
-                                  .frame_number = frame_number,
-                                  .error_stream_id = -1,
-                                  .error_code = ErrorCode::kErrorResult,
-                              }};
-
-            notify_callback.notify(pipeline_id, msg);
-          }
-        } else {
-          // No further processing is needed, just fail the result which will
-          // complete this request.
-          NotifyMessage msg{.type = MessageType::kError,
-                            .message.error = {
-                                .frame_number = frame_number,
-                                .error_stream_id = -1,
-                                .error_code = ErrorCode::kErrorResult,
-                            }};
-
-          notify_callback.notify(pipeline_id, msg);
+        lock.unlock();
+        bool vsync = sensor_->WaitForVSync(
+            EmulatedSensor::kSupportedFrameDurationRange[1]);
+        lock.lock();
+        if (!vsync) {
+          ALOGE("%s: Failed to queue frame %u", __FUNCTION__, frame_number);
+          sensor_->AddPendingRequests(-1);
+          FinishInFlightRequestLocked();
+          return;
         }
+      }
+
+      request.output_buffers = std::move(frame.output_buffers);
+      request.input_buffers = std::move(frame.input_buffers);
+      FailInFlightRequestLocked(&request);
+      return;
+    }
+    lock.unlock();
+  }
 
-        pending_requests_.pop();
-        request_condition_.notify_one();
+  // No further processing is needed, just fail the result which will
+  // complete this request.
+  NotifyMessage msg{.type = MessageType::kError,
+                    .message.error = {
+                        .frame_number = frame_number,
+                        .error_stream_id = -1,
+                        .error_code = ErrorCode::kErrorResult,
+                    }};
+
+  notify_callback.notify(pipeline_id, msg);
+  sensor_->AddPendingRequests(-1);
+  output_buffers = nullptr;
+  input_buffers = nullptr;
+  lock.lock();
+  FinishInFlightRequestLocked();
+}
+
+void EmulatedRequestProcessor::RequestProcessorLoop() {
+  ATRACE_CALL();
+
+  bool vsync_status_ = true;
+  while (!processor_done_ && vsync_status_) {
+    // Frames are prepared ahead of the sensor up to its pipeline depth, once
+    // that many are ready the next slot frees up on vsync.
+    if (sensor_->GetReadyFrameCount() >= EmulatedSensor::kPipelineDepth) {
+      vsync_status_ = sensor_->WaitForVSync(
+          EmulatedSensor::kSupportedFrameDurationRange[1]);
+      continue;
+    }
+
+    PendingRequest request;
+    {
+      std::unique_lock<std::mutex> lock(process_mutex_);
+      pending_request_condition_.wait_for(
+          lock,
+          std::chrono::nanoseconds(
+              EmulatedSensor::kSupportedFrameDurationRange[1]),
+          [this] { return processor_done_ || !pending_requests_.empty(); });
+      if (processor_done_ || pending_requests_.empty()) {
+        continue;
       }
+
+      request = std::move(pending_requests_.front());
+      pending_requests_.pop();
+      request_in_flight_ = true;
+      fail_in_flight_request_ = false;
+      in_flight_flushed_streams_.clear();
+      fence_reactor_.ClearInterrupt();
+      request_condition_.notify_one();
     }
 
-    vsync_status_ =
-        sensor_->WaitForVSync(EmulatedSensor::kSupportedFrameDurationRange[1]);
+    PrepareReadyFrame(std::move(request));
   }
 }
 
@@ -565,9 +840,8 @@ status_t EmulatedRequestProcessor::GetDefaultRequest(
 }
 
 uint32_t EmulatedRequestProcessor::ApplyOverrideSettings(
-    uint32_t frame_number,
-    const std::unique_ptr<HalCameraMetadata>& request_settings) {
-  while (!override_settings_.empty() && request_settings.get() != nullptr) {
+    uint32_t frame_number, SettingsSnapshot* request_settings) {
+  while (!override_settings_.empty() && request_settings->get() != nullptr) {
     auto override_frame_number = override_settings_.front().frame_number;
     bool repeatingOverride = (override_settings_.front().settings == nullptr);
     const auto& override_setting = repeatingOverride
@@ -580,22 +854,11 @@ uint32_t EmulatedRequestProcessor::ApplyOverrideSettings(
     bool overriding = false;
     if ((ret == OK) && (entry.count == 1) &&
         (entry.data.i32[0] == ANDROID_CONTROL_SETTINGS_OVERRIDE_ZOOM)) {
-      ApplyOverrideZoom(override_setting, request_settings,
-                        ANDROID_CONTROL_SETTINGS_OVERRIDE);
-      ApplyOverrideZoom(override_setting, request_settings,
-                        ANDROID_CONTROL_ZOOM_RATIO);
-      ApplyOverrideZoom(override_setting, request_settings,
-                        ANDROID_SCALER_CROP_REGION);
-      ApplyOverrideZoom(override_setting, request_settings,
-                        ANDROID_CONTROL_AE_REGIONS);
-      ApplyOverrideZoom(override_setting, request_settings,
-                        ANDROID_CONTROL_AWB_REGIONS);
-      ApplyOverrideZoom(override_setting, request_settings,
-                        ANDROID_CONTROL_AF_REGIONS);
+      ApplyOverrideZoom(override_setting, request_settings);
       overriding = true;
     }
     if (!repeatingOverride) {
-      last_override_settings_ = HalCameraMetadata::Clone(override_setting.get());
+      last_override_settings_ = override_setting;
     }
 
     override_settings_.pop();
@@ -612,24 +875,56 @@ uint32_t EmulatedRequestProcessor::ApplyOverrideSettings(
 }
 
 void EmulatedRequestProcessor::ApplyOverrideZoom(
-    const std::unique_ptr<HalCameraMetadata>& override_setting,
-    const std::unique_ptr<HalCameraMetadata>& request_settings,
-    camera_metadata_tag tag) {
-  status_t ret;
-  camera_metadata_ro_entry_t entry;
-  ret = override_setting->Get(tag, &entry);
-  if (ret == OK) {
+    const SettingsSnapshot& override_setting,
+    SettingsSnapshot* request_settings) {
+  static const camera_metadata_tag kOverrideZoomTags[] = {
+      ANDROID_CONTROL_SETTINGS_OVERRIDE, ANDROID_CONTROL_ZOOM_RATIO,
+      ANDROID_SCALER_CROP_REGION,        ANDROID_CONTROL_AE_REGIONS,
+      ANDROID_CONTROL_AWB_REGIONS,       ANDROID_CONTROL_AF_REGIONS};
+
+  // The settings are copied on the first value that differs, repeating
+  // frames usually carry the override values already.
+  std::unique_ptr<HalCameraMetadata> settings;
+  for (auto tag : kOverrideZoomTags) {
+    camera_metadata_ro_entry_t entry;
+    status_t ret = override_setting->Get(tag, &entry);
+    if (ret != OK) {
+      auto missing_tag = get_camera_metadata_tag_name(tag);
+      ALOGE("%s: %s needs to be specified for overriding zoom", __func__,
+            missing_tag);
+      continue;
+    }
+    if ((entry.type != TYPE_INT32) && (entry.type != TYPE_FLOAT)) {
+      ALOGE("%s: Unsupported override key %d", __FUNCTION__, tag);
+      continue;
+    }
+
+    if (settings == nullptr) {
+      camera_metadata_ro_entry_t current;
+      ret = (*request_settings)->Get(tag, &current);
+      if ((ret == OK) && (current.type == entry.type) &&
+          (current.count == entry.count) &&
+          (memcmp(current.data.u8, entry.data.u8,
+                  entry.count * camera_metadata_type_size[entry.type]) == 0)) {
+        continue;
+      }
+
+      settings = HalCameraMetadata::Clone(request_settings->get());
+      if (settings == nullptr) {
+        ALOGE("%s: Failed to copy the request settings", __FUNCTION__);
+        return;
+      }
+    }
+
     if (entry.type == TYPE_INT32) {
-      request_settings->Set(tag, entry.data.i32, entry.count);
-    } else if (entry.type == TYPE_FLOAT) {
-      request_settings->Set(tag, entry.data.f, entry.count);
+      settings->Set(tag, entry.data.i32, entry.count);
     } else {
-      ALOGE("%s: Unsupported override key %d", __FUNCTION__, tag);
+      settings->Set(tag, entry.data.f, entry.count);
     }
-  } else {
-    auto missing_tag = get_camera_metadata_tag_name(tag);
-    ALOGE("%s: %s needs to be specified for overriding zoom", __func__,
-          missing_tag);
+  }
+
+  if (settings != nullptr) {
+    *request_settings = std::move(settings);
   }
 }
 
@@ -22,6 +22,7 @@
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <unordered_set>
 
 #include "EmulatedLogicalRequestState.h"
 #include "EmulatedSensor.h"
@@ -29,6 +30,7 @@
 #include "android/frameworks/sensorservice/1.0/ISensorManager.h"
 #include "android/frameworks/sensorservice/1.0/types.h"
 #include "hwl_types.h"
+#include "utils/FenceReactor.h"
 
 namespace android {
 
@@ -48,14 +50,14 @@ struct PendingRequest {
   uint32_t frame_number;
   uint32_t pipeline_id;
   HwlPipelineCallback callback;
-  std::unique_ptr<HalCameraMetadata> settings;
+  SettingsSnapshot settings;
   std::unique_ptr<Buffers> input_buffers;
   std::unique_ptr<Buffers> output_buffers;
 };
 
 struct OverrideRequest {
   uint32_t frame_number;
-  std::unique_ptr<HalCameraMetadata> settings;
+  SettingsSnapshot settings;
 };
 
 class EmulatedRequestProcessor {
@@ -78,6 +80,16 @@ class EmulatedRequestProcessor {
 
   status_t Flush();
 
+  // Returns the buffers of 'stream_ids' in requests that didn't reach the
+  // sensor yet, the rest of those requests is still processed. Requests with
+  // no other output buffers fail with ERROR_REQUEST. The buffers of the
+  // request that is waiting on its fences are returned once the wait is
+  // over.
+  status_t SignalStreamFlush(const std::vector<int32_t>& stream_ids);
+
+  // Lets the sensor preallocate whatever the configured streams need
+  void ConfigureStreams(const std::vector<EmulatedPipeline>& pipelines);
+
   status_t Initialize(std::unique_ptr<EmulatedCameraDeviceInfo> device_info,
                       PhysicalDeviceMapPtr physical_devices);
   void InitializeSensorQueue(std::weak_ptr<EmulatedRequestProcessor> processor);
@@ -132,28 +144,50 @@ class EmulatedRequestProcessor {
       uint32_t frame_number, const EmulatedStream& stream, uint32_t pipeline_id,
       HwlPipelineCallback callback, StreamBuffer stream_buffer,
       int32_t override_width, int32_t override_height);
+  status_t WatchFences(const Buffers* buffers);
+  void UnwatchFences(const Buffers* buffers);
+  // Waits for all acquire fences of 'request' with a single deadline
+  status_t WaitForFences(const PendingRequest& request);
+  // Returns the buffers whose acquire fence signaled, the rest are dropped
   std::unique_ptr<Buffers> AcquireBuffers(Buffers* buffers);
+  // Waits for the request fences and builds its sensor settings, then queues
+  // it on the sensor or fails it.
+  void PrepareReadyFrame(PendingRequest request);
   void NotifyFailedRequest(const PendingRequest& request);
-  uint32_t ApplyOverrideSettings(
-      uint32_t frame_number,
-      const std::unique_ptr<HalCameraMetadata>& request_settings);
-  void ApplyOverrideZoom(
-      const std::unique_ptr<HalCameraMetadata>& override_setting,
-      const std::unique_ptr<HalCameraMetadata>& request_settings,
-      camera_metadata_tag tag);
+  // Fails the request taken off 'pending_requests_' when Flush() interrupted
+  // it or all its output streams were flushed, and returns its buffers.
+  void FailInFlightRequestLocked(PendingRequest* request);
+  void FinishInFlightRequestLocked();
+  // Applies any pending zoom override to 'request_settings'. The snapshot is
+  // only replaced by a modified copy if the override changes its values.
+  uint32_t ApplyOverrideSettings(uint32_t frame_number,
+                                 SettingsSnapshot* request_settings);
+  void ApplyOverrideZoom(const SettingsSnapshot& override_setting,
+                         SettingsSnapshot* request_settings);
 
   std::mutex process_mutex_;
   std::condition_variable request_condition_;
+  std::condition_variable pending_request_condition_;
   std::queue<PendingRequest> pending_requests_;
+  // Set while the request thread prepares a request that is neither in
+  // 'pending_requests_' nor queued on the sensor yet. Flush() sets
+  // 'fail_in_flight_request_' and waits on 'in_flight_condition_' until that
+  // request is failed.
+  bool request_in_flight_ = false;
+  bool fail_in_flight_request_ = false;
+  // Streams flushed by SignalStreamFlush() while a request was in flight
+  std::unordered_set<int32_t> in_flight_flushed_streams_;
+  std::condition_variable in_flight_condition_;
   std::queue<OverrideRequest> override_settings_;
   uint32_t camera_id_;
   sp<EmulatedSensor> sensor_;
   HwlSessionCallback session_callback_;
   std::unique_ptr<EmulatedLogicalRequestState>
       request_state_;  // Stores and handles 3A and related camera states.
-  std::unique_ptr<HalCameraMetadata> last_settings_;
-  std::unique_ptr<HalCameraMetadata> last_override_settings_;
+  SettingsSnapshot last_settings_;
+  SettingsSnapshot last_override_settings_;
   std::shared_ptr<HandleImporter> importer_;
+  FenceReactor fence_reactor_;
 
   EmulatedRequestProcessor(const EmulatedRequestProcessor&) = delete;
   EmulatedRequestProcessor& operator=(const EmulatedRequestProcessor&) = delete;
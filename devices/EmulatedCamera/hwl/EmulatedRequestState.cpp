@@ -22,6 +22,9 @@
 #include <inttypes.h>
 #include <log/log.h>
 #include <utils/HWLUtils.h>
+#include <utils/Trace.h>
+
+#include <algorithm>
 
 #include "EmulatedRequestProcessor.h"
 
@@ -583,8 +586,7 @@ status_t EmulatedRequestState::ProcessAE() {
 }
 
 status_t EmulatedRequestState::InitializeSensorSettings(
-    std::unique_ptr<HalCameraMetadata> request_settings,
-    uint32_t override_frame_number,
+    SettingsSnapshot request_settings, uint32_t override_frame_number,
     EmulatedSensor::SensorSettings* sensor_settings /*out*/) {
   auto& info = *device_info_;
   if ((sensor_settings == nullptr) || (request_settings.get() == nullptr)) {
@@ -904,8 +906,10 @@ std::unique_ptr<HwlPipelineResult> EmulatedRequestState::InitializeResult(
   result->camera_id = camera_id_;
   result->pipeline_id = pipeline_id;
   result->frame_number = frame_number;
-  result->result_metadata = HalCameraMetadata::Clone(request_settings_.get());
+  result->result_metadata = CreateResultMetadata();
   result->partial_result = GetPartialResultCount(/*is partial result*/ false);
+  const camera_metadata_t* initial_metadata =
+      result->result_metadata->GetRawCameraMetadata();
 
   // Results supported on all emulated devices
   result->result_metadata->Set(ANDROID_REQUEST_PIPELINE_DEPTH,
@@ -1094,13 +1098,97 @@ std::unique_ptr<HwlPipelineResult> EmulatedRequestState::InitializeResult(
     result->result_metadata->Set(ANDROID_CONTROL_EXTENDED_SCENE_MODE,
                                  &info.extended_scene_mode_, 1);
   }
+
+  // Any Set() above that didn't fit has moved the metadata to a new buffer.
+  // Reserve what this frame needed for the following ones.
+  const camera_metadata_t* metadata =
+      result->result_metadata->GetRawCameraMetadata();
+  if (metadata != initial_metadata) {
+    result_metadata_realloc_count_++;
+    ATRACE_INT("ResultMetadataReallocs", result_metadata_realloc_count_);
+    const camera_metadata_t* settings =
+        request_settings_->GetRawCameraMetadata();
+    result_entry_capacity_ = std::max(
+        result_entry_capacity_, get_camera_metadata_entry_capacity(metadata) -
+                                    get_camera_metadata_entry_count(settings));
+    result_data_capacity_ = std::max(
+        result_data_capacity_, get_camera_metadata_data_capacity(metadata) -
+                                   get_camera_metadata_data_count(settings));
+    ALOGV("%s: Result metadata of frame %u reallocated, reserving %zu entries "
+          "and %zu bytes",
+          __FUNCTION__, frame_number, result_entry_capacity_,
+          result_data_capacity_);
+  }
+
   return result;
 }
 
+std::unique_ptr<HalCameraMetadata>
+EmulatedRequestState::CreateResultMetadata() {
+  const camera_metadata_t* settings = request_settings_->GetRawCameraMetadata();
+  // HalCameraMetadata::Set() always asks for room for one more entry, even
+  // when updating an existing one.
+  auto metadata = HalCameraMetadata::Create(
+      get_camera_metadata_entry_count(settings) + result_entry_capacity_ + 1,
+      get_camera_metadata_data_count(settings) + result_data_capacity_);
+  if ((metadata == nullptr) || (metadata->Append(settings) != OK)) {
+    ALOGE("%s: Failed to create result metadata, falling back to a clone",
+          __FUNCTION__);
+    return HalCameraMetadata::Clone(settings);
+  }
+
+  return metadata;
+}
+
+size_t EmulatedRequestState::GetMaxResultEntryCount(int32_t tag) {
+  auto& info = *device_info_;
+  switch (tag) {
+    case ANDROID_STATISTICS_LENS_SHADING_MAP:
+      return info.shading_map_size_[0] * info.shading_map_size_[1] * 4;
+    case ANDROID_SENSOR_NOISE_PROFILE:
+      // Two coefficients per color channel
+      return 2 * 4;
+    default:
+      break;
+  }
+
+  // Most result keys mirror a request or static key of the same size.
+  size_t count = 0;
+  camera_metadata_ro_entry_t entry;
+  if (info.static_metadata_->Get(tag, &entry) == OK) {
+    count = std::max(count, entry.count);
+  }
+  for (const auto& default_request : info.default_requests_) {
+    if ((default_request.get() != nullptr) &&
+        (default_request->Get(tag, &entry) == OK)) {
+      count = std::max(count, entry.count);
+    }
+  }
+
+  return (count > 0) ? count : kDefaultResultEntryCount;
+}
+
+void EmulatedRequestState::InitializeResultMetadataCapacity() {
+  auto& info = *device_info_;
+  result_entry_capacity_ = info.available_results_.size();
+  result_data_capacity_ = 0;
+  for (int32_t tag : info.available_results_) {
+    int type = get_camera_metadata_tag_type(tag);
+    if (type == -1) {
+      continue;
+    }
+    // Set() also asks for the new data before updating an entry in place,
+    // so every key is accounted for on top of the request settings.
+    result_data_capacity_ += calculate_camera_metadata_entry_data_size(
+        type, GetMaxResultEntryCount(tag));
+  }
+}
+
 status_t EmulatedRequestState::Initialize(
     std::unique_ptr<EmulatedCameraDeviceInfo> deviceInfo) {
   std::lock_guard<std::mutex> lock(request_state_mutex_);
   device_info_ = std::move(deviceInfo);
+  InitializeResultMetadataCapacity();
 
   return OK;
 }
@@ -17,6 +17,7 @@
 #ifndef EMULATOR_CAMERA_HAL_HWL_REQUEST_STATE_H
 #define EMULATOR_CAMERA_HAL_HWL_REQUEST_STATE_H
 
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 
@@ -35,6 +36,11 @@ using google_camera_hal::RequestTemplate;
 
 struct PendingRequest;
 
+// Request settings are not modified once they are queued, so frames of a
+// repeating request and the physical devices of a logical camera share one
+// settings snapshot instead of copying it.
+using SettingsSnapshot = std::shared_ptr<const HalCameraMetadata>;
+
 class EmulatedRequestState {
  public:
   EmulatedRequestState(uint32_t camera_id) : camera_id_(camera_id) {
@@ -54,7 +60,7 @@ class EmulatedRequestState {
       uint32_t pipeline_id, uint32_t frame_number);
 
   status_t InitializeSensorSettings(
-      std::unique_ptr<HalCameraMetadata> request_settings,
+      SettingsSnapshot request_settings,
       uint32_t override_frame_number,
       EmulatedSensor::SensorSettings* sensor_settings /*out*/);
 
@@ -70,12 +76,29 @@ class EmulatedRequestState {
                                   const HalCameraMetadata& settings,
                                   int32_t* region /*out*/);
 
+  // Compute the result metadata capacity needed on top of the request
+  // settings for all keys in ANDROID_REQUEST_AVAILABLE_RESULT_KEYS.
+  void InitializeResultMetadataCapacity();
+  size_t GetMaxResultEntryCount(int32_t tag);
+  std::unique_ptr<HalCameraMetadata> CreateResultMetadata();
+
   std::mutex request_state_mutex_;
-  std::unique_ptr<HalCameraMetadata> request_settings_;
+  SettingsSnapshot request_settings_;
 
   // Supported capabilities and features
   std::unique_ptr<EmulatedCameraDeviceInfo> device_info_;
 
+  // Result metadata capacity reserved on top of the request settings, so
+  // that neither InitializeResult() nor the sensor needs to reallocate the
+  // result metadata. Grows if a frame needed more.
+  size_t result_entry_capacity_ = 0;
+  size_t result_data_capacity_ = 0;
+  // Traced as "ResultMetadataReallocs", stays constant in steady state.
+  size_t result_metadata_realloc_count_ = 0;
+  // Value count assumed for result keys that are neither part of the static
+  // metadata nor of the default requests.
+  static constexpr size_t kDefaultResultEntryCount = 8;
+
   size_t ae_frame_counter_ = 0;
   const size_t kAEPrecaptureMinFrames = 10;
   // Fake AE related constants
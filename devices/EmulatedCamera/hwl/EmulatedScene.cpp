@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <utils/Log.h>
 
+#include <algorithm>
 #include <cmath>
 
 // TODO: This should probably be done host-side in OpenGL for speed and better
@@ -406,54 +407,149 @@ void EmulatedScene::InitiliazeSceneRotation(bool clock_wise) {
 }
 
 void EmulatedScene::SetReadoutPixel(int x, int y) {
-  current_x_ = x;
-  current_y_ = y;
-  sub_x_ = (x + offset_x_ + handshake_x_) % map_div_;
-  sub_y_ = (y + offset_y_ + handshake_y_) % map_div_;
-  scene_x_ = (x + offset_x_ + handshake_x_) / map_div_;
-  scene_y_ = (y + offset_y_ + handshake_y_) / map_div_;
-  scene_idx_ = scene_y_ * kSceneWidth + scene_x_;
-  current_scene_material_ = &(current_colors_[current_scene_[scene_idx_]]);
+  SetReadoutPixel(x, y, &readout_cursor_);
+}
+
+void EmulatedScene::SetReadoutPixel(int x, int y,
+                                    ReadoutCursor* cursor /*out*/) const {
+  cursor->x = x;
+  cursor->y = y;
+  cursor->sub_x = (x + offset_x_ + handshake_x_) % map_div_;
+  cursor->sub_y = (y + offset_y_ + handshake_y_) % map_div_;
+  int scene_x = (x + offset_x_ + handshake_x_) / map_div_;
+  int scene_y = (y + offset_y_ + handshake_y_) / map_div_;
+  cursor->scene_idx = scene_y * kSceneWidth + scene_x;
+  cursor->material = &(current_colors_[current_scene_[cursor->scene_idx]]);
 }
 
 const uint32_t* EmulatedScene::GetPixelElectrons() {
+  return GetPixelElectrons(&readout_cursor_);
+}
+
+const uint32_t* EmulatedScene::GetPixelElectrons(
+    ReadoutCursor* cursor /*in/out*/) const {
   if (test_pattern_mode_) return test_pattern_data_;
 
-  const uint32_t* pixel = current_scene_material_;
-  current_x_++;
-  sub_x_++;
-  if (current_x_ >= sensor_width_) {
-    current_x_ = 0;
-    current_y_++;
-    if (current_y_ >= sensor_height_) current_y_ = 0;
-    SetReadoutPixel(current_x_, current_y_);
-  } else if (sub_x_ > map_div_) {
-    scene_idx_++;
-    scene_x_++;
-    current_scene_material_ = &(current_colors_[current_scene_[scene_idx_]]);
-    sub_x_ = 0;
+  const uint32_t* pixel = cursor->material;
+  cursor->x++;
+  cursor->sub_x++;
+  if (cursor->x >= sensor_width_) {
+    int y = cursor->y + 1;
+    if (y >= sensor_height_) y = 0;
+    SetReadoutPixel(0, y, cursor);
+  } else if (cursor->sub_x > map_div_) {
+    cursor->scene_idx++;
+    cursor->material = &(current_colors_[current_scene_[cursor->scene_idx]]);
+    cursor->sub_x = 0;
   }
   return pixel;
 }
 
 const uint32_t* EmulatedScene::GetPixelElectronsColumn() {
-  const uint32_t* pixel = current_scene_material_;
-  current_y_++;
-  sub_y_++;
-  if (current_y_ >= sensor_height_) {
-    current_y_ = 0;
-    current_x_++;
-    if (current_x_ >= sensor_width_) current_x_ = 0;
-    SetReadoutPixel(current_x_, current_y_);
-  } else if (sub_y_ > map_div_) {
-    scene_idx_ += kSceneWidth;
-    scene_y_++;
-    current_scene_material_ = &(current_colors_[current_scene_[scene_idx_]]);
-    sub_y_ = 0;
+  return GetPixelElectronsColumn(&readout_cursor_);
+}
+
+const uint32_t* EmulatedScene::GetPixelElectronsColumn(
+    ReadoutCursor* cursor /*in/out*/) const {
+  const uint32_t* pixel = cursor->material;
+  cursor->y++;
+  cursor->sub_y++;
+  if (cursor->y >= sensor_height_) {
+    int x = cursor->x + 1;
+    if (x >= sensor_width_) x = 0;
+    SetReadoutPixel(x, 0, cursor);
+  } else if (cursor->sub_y > map_div_) {
+    cursor->scene_idx += kSceneWidth;
+    cursor->material = &(current_colors_[current_scene_[cursor->scene_idx]]);
+    cursor->sub_y = 0;
   }
   return pixel;
 }
 
+void EmulatedScene::FillElectronSpan(const uint32_t* material, size_t offset,
+                                     size_t count, const ElectronSpan& out) {
+  std::fill_n(out.r + offset, count, material[R]);
+  std::fill_n(out.gr + offset, count, material[Gr]);
+  std::fill_n(out.gb + offset, count, material[Gb]);
+  std::fill_n(out.b + offset, count, material[B]);
+}
+
+int EmulatedScene::GetNextTileBoundary(int pos) const {
+  // Scene coordinates are divided with truncation, so the tile at index 0
+  // extends into negative coordinates as well.
+  int tile = pos / map_div_;
+  return (tile >= 0) ? (tile + 1) * map_div_ : tile * map_div_ + 1;
+}
+
+void EmulatedScene::GetPixelElectrons(ReadoutCursor* cursor /*in/out*/,
+                                      size_t count,
+                                      const ElectronSpan& out /*out*/) const {
+  if (test_pattern_mode_) {
+    FillElectronSpan(test_pattern_data_, 0, count, out);
+    return;
+  }
+
+  size_t offset = 0;
+  while (offset < count) {
+    // Pixels left until either the tile or the row changes
+    size_t run = std::min(map_div_ - cursor->sub_x + 1,
+                          sensor_width_ - cursor->x);
+    run = std::min(run, count - offset);
+    FillElectronSpan(cursor->material, offset, run, out);
+    offset += run;
+
+    cursor->x += run;
+    cursor->sub_x += run;
+    if (cursor->x >= sensor_width_) {
+      int y = cursor->y + 1;
+      if (y >= sensor_height_) y = 0;
+      SetReadoutPixel(0, y, cursor);
+    } else if (cursor->sub_x > map_div_) {
+      cursor->scene_idx++;
+      cursor->material = &(current_colors_[current_scene_[cursor->scene_idx]]);
+      cursor->sub_x = 0;
+    }
+  }
+}
+
+void EmulatedScene::GetRowElectrons(int x, int y, size_t count,
+                                    const ElectronSpan& out /*out*/) const {
+  if (test_pattern_mode_) {
+    FillElectronSpan(test_pattern_data_, 0, count, out);
+    return;
+  }
+
+  int scene_row = ((y + offset_y_ + handshake_y_) / map_div_) * kSceneWidth;
+  int pos = x + offset_x_ + handshake_x_;
+  size_t offset = 0;
+  while (offset < count) {
+    size_t run =
+        std::min<size_t>(GetNextTileBoundary(pos) - pos, count - offset);
+    FillElectronSpan(
+        &(current_colors_[current_scene_[scene_row + pos / map_div_]]), offset,
+        run, out);
+    offset += run;
+    pos += run;
+  }
+}
+
+void EmulatedScene::GetColumnElectrons(int x, int y, size_t count,
+                                       const ElectronSpan& out /*out*/) const {
+  int scene_column = (x + offset_x_ + handshake_x_) / map_div_;
+  int pos = y + offset_y_ + handshake_y_;
+  size_t offset = 0;
+  while (offset < count) {
+    size_t run =
+        std::min<size_t>(GetNextTileBoundary(pos) - pos, count - offset);
+    FillElectronSpan(
+        &(current_colors_[current_scene_[(pos / map_div_) * kSceneWidth +
+                                         scene_column]]),
+        offset, run, out);
+    offset += run;
+    pos += run;
+  }
+}
+
 // Handshake model constants.
 // Frequencies measured in a nanosecond timebase
 const float EmulatedScene::kHorizShakeFreq1 = 2 * M_PI * 2 / 1e9;   // 2 Hz
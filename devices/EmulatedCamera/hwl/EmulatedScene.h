@@ -26,6 +26,8 @@
 #ifndef HW_EMULATOR_CAMERA2_SCENE_H
 #define HW_EMULATOR_CAMERA2_SCENE_H
 
+#include <stddef.h>
+
 #include "utils/Timers.h"
 
 namespace android {
@@ -70,20 +72,66 @@ class EmulatedScene {
   // the hour. Resets pixel readout location to 0,0
   void CalculateScene(nsecs_t time, int32_t handshake_divider);
 
+  // Readout position within the calculated scene. The scene itself is not
+  // modified during readout, so any number of threads can read out the same
+  // scene concurrently as long as each one uses its own cursor.
+  struct ReadoutCursor {
+    int x = 0;
+    int y = 0;
+    int sub_x = 0;
+    int sub_y = 0;
+    int scene_idx = 0;
+    const uint32_t* material = nullptr;
+  };
+
   // Set sensor pixel readout location.
   void SetReadoutPixel(int x, int y);
+  void SetReadoutPixel(int x, int y, ReadoutCursor* cursor /*out*/) const;
 
   // Get sensor response in physical units (electrons) for light hitting the
   // current readout pixel, after passing through color filters. The readout
   // pixel will be auto-incremented horizontally. The returned array can be
   // indexed with ColorChannels.
   const uint32_t* GetPixelElectrons();
+  const uint32_t* GetPixelElectrons(ReadoutCursor* cursor /*in/out*/) const;
 
   // Get sensor response in physical units (electrons) for light hitting the
   // current readout pixel, after passing through color filters. The readout
   // pixel will be auto-incremented vertically. The returned array can be
   // indexed with ColorChannels.
   const uint32_t* GetPixelElectronsColumn();
+  const uint32_t* GetPixelElectronsColumn(
+      ReadoutCursor* cursor /*in/out*/) const;
+
+  // Caller-provided structure of arrays receiving the per-pixel electron
+  // counts of a readout span. Each array must hold at least 'count' elements.
+  struct ElectronSpan {
+    uint32_t* r = nullptr;
+    uint32_t* gr = nullptr;
+    uint32_t* gb = nullptr;
+    uint32_t* b = nullptr;
+  };
+
+  // Bulk versions of the readout API above. The span is filled one scene tile
+  // at a time, so callers can process the result with straight-line loops
+  // instead of querying the scene pixel by pixel.
+
+  // Read out 'count' pixels starting at the cursor position. Same as calling
+  // GetPixelElectrons() 'count' times.
+  void GetPixelElectrons(ReadoutCursor* cursor /*in/out*/, size_t count,
+                         const ElectronSpan& out /*out*/) const;
+
+  // Read out 'count' consecutive pixels of row 'y' starting at column 'x'.
+  // Same as calling SetReadoutPixel() followed by GetPixelElectrons() for
+  // every pixel.
+  void GetRowElectrons(int x, int y, size_t count,
+                       const ElectronSpan& out /*out*/) const;
+
+  // Read out 'count' consecutive pixels of column 'x' starting at row 'y'.
+  // Same as calling SetReadoutPixel() followed by GetPixelElectronsColumn()
+  // for every pixel.
+  void GetColumnElectrons(int x, int y, size_t count,
+                          const ElectronSpan& out /*out*/) const;
 
   enum ColorChannels { R = 0, Gr, Gb, B, Y, Cb, Cr, NUM_CHANNELS };
 
@@ -93,6 +141,13 @@ class EmulatedScene {
  private:
   void InitiliazeSceneRotation(bool clock_wise);
 
+  // Fills 'count' elements of 'out' starting at 'offset' with 'material'.
+  static void FillElectronSpan(const uint32_t* material, size_t offset,
+                               size_t count, const ElectronSpan& out);
+  // Returns the first scene coordinate past 'pos' that maps to a different
+  // scene tile.
+  int GetNextTileBoundary(int pos) const;
+
   uint8_t scene_rot0_[kSceneWidth*kSceneHeight];
   uint8_t scene_rot90_[kSceneWidth*kSceneHeight];
   uint8_t scene_rot180_[kSceneWidth*kSceneHeight];
@@ -115,14 +170,8 @@ class EmulatedScene {
 
   int sensor_width_;
   int sensor_height_;
-  int current_x_;
-  int current_y_;
-  int sub_x_;
-  int sub_y_;
-  int scene_x_;
-  int scene_y_;
-  int scene_idx_;
-  uint32_t* current_scene_material_;
+  // Cursor used by the single-threaded readout API
+  ReadoutCursor readout_cursor_;
 
   int hour_;
   float exposure_duration_;
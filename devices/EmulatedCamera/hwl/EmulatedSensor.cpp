@@ -117,6 +117,8 @@ const float EmulatedSensor::kReadNoiseVarBeforeGain =
 const float EmulatedSensor::kReadNoiseVarAfterGain =
     EmulatedSensor::kReadNoiseStddevAfterGain *
     EmulatedSensor::kReadNoiseStddevAfterGain;
+// Fixed, so that frames with the same settings replay the same noise
+const uint64_t EmulatedSensor::kNoiseSeed = 0x5EED5EED5EED5EED;
 
 const uint32_t EmulatedSensor::kMaxRAWStreams = 1;
 const uint32_t EmulatedSensor::kMaxProcessedStreams = 3;
@@ -125,8 +127,6 @@ const uint32_t EmulatedSensor::kMaxInputStreams = 1;
 
 const uint32_t EmulatedSensor::kMaxLensShadingMapSize[2]{64, 64};
 const int32_t EmulatedSensor::kFixedBitPrecision = 64;  // 6-bit
-// In fixed-point math, saturation point of sensor after gain
-const int32_t EmulatedSensor::kSaturationPoint = kFixedBitPrecision * 255;
 const camera_metadata_rational EmulatedSensor::kNeutralColorPoint[3] = {
     {255, 1}, {255, 1}, {255, 1}};
 const float EmulatedSensor::kGreenSplit = 1.f;  // No divergence
@@ -175,32 +175,11 @@ static const XyzMatrix kBt2020Matrix = {1.7167f,  -0.3556f, -0.2534f,
                                         -0.6666f, 1.6164f,  0.0158f,
                                         0.0177f,  -0.0428f, 0.9421f};
 
-/** A few utility functions for math, normal distributions */
-
-// Take advantage of IEEE floating-point format to calculate an approximate
-// square root. Accurate to within +-3.6%
-float sqrtf_approx(float r) {
-  // Modifier is based on IEEE floating-point representation; the
-  // manipulations boil down to finding approximate log2, dividing by two, and
-  // then inverting the log2. A bias is added to make the relative error
-  // symmetric about the real answer.
-  const int32_t modifier = 0x1FBB4000;
-
-  int32_t r_i = *(int32_t*)(&r);
-  r_i = (r_i >> 1) + modifier;
-
-  return *(float*)(&r_i);
-}
-
-EmulatedSensor::EmulatedSensor() : Thread(false), got_vsync_(false) {
-  gamma_table_sRGB_.resize(kSaturationPoint + 1);
-  gamma_table_smpte170m_.resize(kSaturationPoint + 1);
-  gamma_table_hlg_.resize(kSaturationPoint + 1);
-  for (int32_t i = 0; i <= kSaturationPoint; i++) {
-    gamma_table_sRGB_[i] = ApplysRGBGamma(i, kSaturationPoint);
-    gamma_table_smpte170m_[i] = ApplySMPTE170MGamma(i, kSaturationPoint);
-    gamma_table_hlg_[i] = ApplyHLGGamma(i, kSaturationPoint);
-  }
+EmulatedSensor::EmulatedSensor()
+    : Thread(false),
+      got_vsync_(false),
+      ready_frames_(kPipelineDepth),
+      noise_generator_(kNoiseSeed) {
 }
 
 EmulatedSensor::~EmulatedSensor() {
@@ -663,7 +642,16 @@ status_t EmulatedSensor::StartUp(
       device_chars->second.full_res_width, device_chars->second.full_res_height,
       kElectronsPerLuxSecond, device_chars->second.orientation,
       device_chars->second.is_front_facing);
-  jpeg_compressor_ = std::make_unique<JpegCompressor>();
+  // A value of 0 picks a JPEG worker per online core, up to
+  // JpegCompressor::kMaxThreadCount. Large frames are additionally split in
+  // slices encoded on all online cores, 1 disables slicing.
+  jpeg_compressor_ = std::make_unique<JpegCompressor>(
+      property_get_int32("ro.vendor.camera.jpeg_threads", 0),
+      property_get_int32("ro.vendor.camera.jpeg_slice_threads", 0));
+  // A value of 0 lets the readout use all online cores, 1 renders on the
+  // sensor thread only.
+  readout_pool_ = std::make_unique<ReadoutThreadPool>(
+      property_get_int32("ro.vendor.camera.readout_threads", 0));
 
   auto res = run(LOG_TAG, ANDROID_PRIORITY_URGENT_DISPLAY);
   if (res != OK) {
@@ -682,18 +670,68 @@ status_t EmulatedSensor::ShutDown() {
   return res;
 }
 
-void EmulatedSensor::SetCurrentRequest(
-    std::unique_ptr<LogicalCameraSettings> logical_settings,
-    std::unique_ptr<HwlPipelineResult> result,
-    std::unique_ptr<HwlPipelineResult> partial_result,
-    std::unique_ptr<Buffers> input_buffers,
-    std::unique_ptr<Buffers> output_buffers) {
-  Mutex::Autolock lock(control_mutex_);
-  current_settings_ = std::move(logical_settings);
-  current_result_ = std::move(result);
-  current_input_buffers_ = std::move(input_buffers);
-  current_output_buffers_ = std::move(output_buffers);
-  partial_result_ = std::move(partial_result);
+size_t EmulatedSensor::GetYUV420ScratchSize(const StreamInfo& output,
+                                            uint32_t input_width,
+                                            uint32_t input_height) {
+  if ((output.width == 0) || (output.height == 0)) {
+    return 0;
+  }
+
+  bool is_p010 = static_cast<android_pixel_format_v1_1_t>(output.format) ==
+                 HAL_PIXEL_FORMAT_YCBCR_P010;
+  size_t bytes_per_pixel = is_p010 ? 2 : 1;
+
+  // REGULAR renders a small frame with the output aspect ratio, REPROCESS
+  // splits the chroma planes of the input.
+  float aspect_ratio = static_cast<float>(output.width) / output.height;
+  size_t regular_width = EmulatedScene::kSceneWidth * aspect_ratio;
+  size_t regular_size = (regular_width * EmulatedScene::kSceneHeight * 3 *
+                         bytes_per_pixel) / 2;
+  size_t reprocess_size = (input_width * input_height) / 2;
+  size_t size = ScratchArena::kAlignment +
+                std::max(regular_size, reprocess_size);
+
+  // Planar chroma of semi-planar outputs. JPEG input is always planar.
+  if (output.format != HAL_PIXEL_FORMAT_BLOB) {
+    size += ScratchArena::kAlignment +
+            (output.width * output.height * bytes_per_pixel) / 2;
+  }
+
+  return size;
+}
+
+void EmulatedSensor::ConfigureStreams(const std::vector<StreamInfo>& streams) {
+  ATRACE_CALL();
+  uint32_t input_width = 0, input_height = 0;
+  for (const auto& stream : streams) {
+    if (stream.is_input) {
+      input_width = std::max(input_width, stream.width);
+      input_height = std::max(input_height, stream.height);
+    }
+  }
+
+  size_t scratch_size = 0;
+  for (const auto& stream : streams) {
+    if (!stream.is_input && (stream.format != HAL_PIXEL_FORMAT_RAW16)) {
+      scratch_size =
+          std::max(scratch_size,
+                   GetYUV420ScratchSize(stream, input_width, input_height));
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(yuv_scratch_mutex_);
+  yuv_scratch_.Reserve(scratch_size);
+  ALOGV("%s: YUV scratch size %zu bytes", __FUNCTION__, scratch_size);
+}
+
+bool EmulatedSensor::QueueReadyFrame(ReadyFrame&& frame) {
+  ATRACE_CALL();
+  if (!ready_frames_.TryPush(std::move(frame))) {
+    return false;
+  }
+
+  ATRACE_INT("SensorReadyFrames", ready_frames_.Size());
+  return true;
 }
 
 bool EmulatedSensor::WaitForVSyncLocked(nsecs_t reltime) {
@@ -715,43 +753,46 @@ bool EmulatedSensor::WaitForVSync(nsecs_t reltime) {
   return WaitForVSyncLocked(reltime);
 }
 
-status_t EmulatedSensor::Flush() {
-  Mutex::Autolock lock(control_mutex_);
-  auto ret = WaitForVSyncLocked(kSupportedFrameDurationRange[1]);
-
-  // First recreate the jpeg compressor. This will abort any ongoing processing
-  // and flush any pending jobs.
-  jpeg_compressor_ = std::make_unique<JpegCompressor>();
-
-  // Then return any pending frames here
-  if ((current_input_buffers_.get() != nullptr) &&
-      (!current_input_buffers_->empty())) {
-    current_input_buffers_->clear();
+void EmulatedSensor::FailReadyFrame(ReadyFrame* frame) {
+  if ((frame->input_buffers.get() != nullptr) &&
+      (!frame->input_buffers->empty())) {
+    frame->input_buffers->clear();
   }
-  if ((current_output_buffers_.get() != nullptr) &&
-      (!current_output_buffers_->empty())) {
-    for (const auto& buffer : *current_output_buffers_) {
+  if ((frame->output_buffers.get() != nullptr) &&
+      (!frame->output_buffers->empty())) {
+    for (const auto& buffer : *frame->output_buffers) {
       buffer->stream_buffer.status = BufferStatus::kError;
     }
 
-    if ((current_result_.get() != nullptr) &&
-        (current_result_->result_metadata.get() != nullptr)) {
-      if (current_output_buffers_->at(0)->callback.notify != nullptr) {
+    if ((frame->result.get() != nullptr) &&
+        (frame->result->result_metadata.get() != nullptr)) {
+      if (frame->output_buffers->at(0)->callback.notify != nullptr) {
         NotifyMessage msg{
             .type = MessageType::kError,
             .message.error = {
-                .frame_number = current_output_buffers_->at(0)->frame_number,
+                .frame_number = frame->output_buffers->at(0)->frame_number,
                 .error_stream_id = -1,
                 .error_code = ErrorCode::kErrorResult,
             }};
 
-        current_output_buffers_->at(0)->callback.notify(
-            current_result_->pipeline_id, msg);
+        frame->output_buffers->at(0)->callback.notify(
+            frame->result->pipeline_id, msg);
       }
     }
 
-    current_output_buffers_->clear();
+    frame->output_buffers->clear();
   }
+}
+
+status_t EmulatedSensor::Flush() {
+  Mutex::Autolock lock(control_mutex_);
+  // The ready frames are returned by the sensor thread on its next vsync, it
+  // is the only consumer of the ring.
+  flush_requested_ = true;
+  auto ret = WaitForVSyncLocked(kSupportedFrameDurationRange[1]);
+
+  // Then abort any ongoing jpeg processing and flush any pending jobs
+  jpeg_compressor_->Flush();
 
   return ret ? OK : TIMED_OUT;
 }
@@ -773,29 +814,44 @@ bool EmulatedSensor::threadLoop() {
   /**
    * Stage 1: Read in latest control parameters
    */
-  std::unique_ptr<Buffers> next_buffers;
-  std::unique_ptr<Buffers> next_input_buffer;
-  std::unique_ptr<HwlPipelineResult> next_result;
-  std::unique_ptr<HwlPipelineResult> partial_result;
-  std::unique_ptr<LogicalCameraSettings> settings;
+  ReadyFrame frame;
   HwlPipelineCallback callback = {
       .process_pipeline_result = nullptr,
       .process_pipeline_batch_result = nullptr,
       .notify = nullptr,
   };
+  if (ready_frames_.TryPop(&frame)) {
+    pending_requests_--;
+  } else if (pending_requests_ > 0) {
+    // A request was accepted but its fences or settings weren't ready in time
+    uint64_t missed = ++missed_vsync_count_;
+    ATRACE_INT("SensorMissedVSync", missed);
+    ALOGV("%s: Frame missed vsync, %" PRIu64 " so far", __FUNCTION__, missed);
+  }
   {
     Mutex::Autolock lock(control_mutex_);
-    std::swap(settings, current_settings_);
-    std::swap(next_buffers, current_output_buffers_);
-    std::swap(next_input_buffer, current_input_buffers_);
-    std::swap(next_result, current_result_);
-    std::swap(partial_result, partial_result_);
+    if (flush_requested_) {
+      flush_requested_ = false;
+      FailReadyFrame(&frame);
+      ReadyFrame pending_frame;
+      while (ready_frames_.TryPop(&pending_frame)) {
+        pending_requests_--;
+        FailReadyFrame(&pending_frame);
+      }
+      frame = ReadyFrame();
+    }
 
     // Signal VSync for start of readout
     ALOGVV("Sensor VSync");
     got_vsync_ = true;
     vsync_.signal();
   }
+  std::unique_ptr<LogicalCameraSettings> settings = std::move(frame.settings);
+  std::unique_ptr<HwlPipelineResult> next_result = std::move(frame.result);
+  std::unique_ptr<HwlPipelineResult> partial_result =
+      std::move(frame.partial_result);
+  std::unique_ptr<Buffers> next_input_buffer = std::move(frame.input_buffers);
+  std::unique_ptr<Buffers> next_buffers = std::move(frame.output_buffers);
 
   auto frame_duration = EmulatedSensor::kSupportedFrameDurationRange[0];
   auto exposure_time = EmulatedSensor::kSupportedExposureTimeRange[0];
@@ -991,17 +1047,20 @@ bool EmulatedSensor::threadLoop() {
                     .raw_in_sensor_zoom_applied = true;
                 CaptureRawInSensorZoom(
                     (*b)->plane.img.img, (*b)->plane.img.stride_in_bytes,
-                    device_settings->second.gain, device_chars->second);
+                    device_settings->second.gain, (*b)->frame_number,
+                    device_chars->second);
 
               } else {
                 CaptureRawBinned(
                     (*b)->plane.img.img, (*b)->plane.img.stride_in_bytes,
-                    device_settings->second.gain, device_chars->second);
+                    device_settings->second.gain, (*b)->frame_number,
+                    device_chars->second);
               }
             } else {
               CaptureRawFullRes(
                   (*b)->plane.img.img, (*b)->plane.img.stride_in_bytes,
-                  device_settings->second.gain, device_chars->second);
+                  device_settings->second.gain, (*b)->frame_number,
+                  device_chars->second);
             }
           } else {
             if (!device_chars->second.quad_bayer_sensor) {
@@ -1460,32 +1519,33 @@ status_t EmulatedSensor::RemosaicRAW16Image(uint16_t* img_in, uint16_t* img_out,
 }
 
 void EmulatedSensor::CaptureRawBinned(uint8_t* img, size_t row_stride_in_bytes,
-                                      uint32_t gain,
+                                      uint32_t gain, uint32_t frame_number,
                                       const SensorCharacteristics& chars) {
-  CaptureRaw(img, row_stride_in_bytes, gain, chars, /*in_sensor_zoom*/ false,
-             /*binned*/ true);
+  CaptureRaw(img, row_stride_in_bytes, gain, frame_number, chars,
+             /*in_sensor_zoom*/ false, /*binned*/ true);
   return;
 }
 
 void EmulatedSensor::CaptureRawInSensorZoom(uint8_t* img,
                                             size_t row_stride_in_bytes,
                                             uint32_t gain,
+                                            uint32_t frame_number,
                                             const SensorCharacteristics& chars) {
-  CaptureRaw(img, row_stride_in_bytes, gain, chars, /*in_sensor_zoom*/ true,
-             /*binned*/ false);
+  CaptureRaw(img, row_stride_in_bytes, gain, frame_number, chars,
+             /*in_sensor_zoom*/ true, /*binned*/ false);
   return;
 }
 
 void EmulatedSensor::CaptureRawFullRes(uint8_t* img, size_t row_stride_in_bytes,
-                                       uint32_t gain,
+                                       uint32_t gain, uint32_t frame_number,
                                        const SensorCharacteristics& chars) {
-  CaptureRaw(img, row_stride_in_bytes, gain, chars, /*inSensorZoom*/ false,
-             /*binned*/ false);
+  CaptureRaw(img, row_stride_in_bytes, gain, frame_number, chars,
+             /*inSensorZoom*/ false, /*binned*/ false);
   return;
 }
 
 void EmulatedSensor::CaptureRaw(uint8_t* img, size_t row_stride_in_bytes,
-                                uint32_t gain,
+                                uint32_t gain, uint32_t frame_number,
                                 const SensorCharacteristics& chars,
                                 bool in_sensor_zoom, bool binned) {
   ATRACE_CALL();
@@ -1493,40 +1553,105 @@ void EmulatedSensor::CaptureRaw(uint8_t* img, size_t row_stride_in_bytes,
     ALOGE("%s: Can't perform in-sensor zoom in binned mode", __FUNCTION__);
     return;
   }
+
+  const float raw_zoom_ratio = in_sensor_zoom ? 2.0f : 1.0f;
+  unsigned int image_width =
+      in_sensor_zoom || binned ? chars.width : chars.full_res_width;
+  unsigned int image_height =
+      in_sensor_zoom || binned ? chars.height : chars.full_res_height;
+  if ((image_width == 0) || (image_height == 0)) {
+    return;
+  }
+
+  // The sensor column read out for each output column is the same in all
+  // rows.
+  const float norm_left_top = 0.5f - 0.5f / raw_zoom_ratio;
+  std::vector<int> columns(image_width);
+  for (unsigned int out_x = 0; out_x < image_width; out_x++) {
+    float norm_x = out_x / (image_width * raw_zoom_ratio);
+    int x = static_cast<int>(chars.full_res_width * (norm_left_top + norm_x));
+    columns[out_x] = std::min(std::max(x, 0), (int)chars.full_res_width - 1);
+  }
+
+  float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
+  noise_generator_.SetGain(total_gain, kReadNoiseVarBeforeGain,
+                           kReadNoiseVarAfterGain, kSaturationElectrons);
+
+  readout_pool_->Render(
+      image_height, /*row_alignment*/ 2,
+      [&](uint32_t /*band_idx*/, uint32_t row_begin, uint32_t row_end) {
+        CaptureRawRows(img, row_stride_in_bytes, gain, chars, in_sensor_zoom,
+                       binned, frame_number, columns, row_begin, row_end);
+      });
+  ALOGVV("Raw sensor image captured");
+}
+
+// Row buffers of a readout thread. They are reused by all the bands the thread
+// renders, so only the first frames of the largest size allocate.
+struct ReadoutScratch {
+  std::vector<uint32_t> electrons;
+  std::vector<uint32_t> samples;
+  std::vector<float> noise;
+};
+
+static ReadoutScratch& GetReadoutScratch() {
+  thread_local ReadoutScratch scratch;
+  return scratch;
+}
+
+void EmulatedSensor::CaptureRawRows(uint8_t* img, size_t row_stride_in_bytes,
+                                    uint32_t gain,
+                                    const SensorCharacteristics& chars,
+                                    bool in_sensor_zoom, bool binned,
+                                    uint32_t frame_number,
+                                    const std::vector<int>& columns,
+                                    uint32_t row_begin,
+                                    uint32_t row_end) const {
   float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
-  float noise_var_gain = total_gain * total_gain;
-  float read_noise_var =
-      kReadNoiseVarBeforeGain * noise_var_gain + kReadNoiseVarAfterGain;
 
-  scene_->SetReadoutPixel(0, 0);
   // RGGB
   int bayer_select[4] = {EmulatedScene::R, EmulatedScene::Gr, EmulatedScene::Gb,
                          EmulatedScene::B};
   const float raw_zoom_ratio = in_sensor_zoom ? 2.0f : 1.0f;
-  unsigned int image_width =
-      in_sensor_zoom || binned ? chars.width : chars.full_res_width;
+  unsigned int image_width = columns.size();
   unsigned int image_height =
       in_sensor_zoom || binned ? chars.height : chars.full_res_height;
   const float norm_left_top = 0.5f - 0.5f / raw_zoom_ratio;
-  for (unsigned int out_y = 0; out_y < image_height; out_y++) {
+
+  // Electron counts of all sensor pixels between the first and last sampled
+  // column, indexed by ColorChannels
+  const int first_column = columns.front();
+  const size_t span_width = columns.back() - first_column + 1;
+  ReadoutScratch& scratch = GetReadoutScratch();
+  std::vector<uint32_t>& electrons = scratch.electrons;
+  electrons.resize(4 * span_width);
+  const uint32_t* channels[4];
+  EmulatedScene::ElectronSpan span;
+  channels[EmulatedScene::R] = span.r = electrons.data();
+  channels[EmulatedScene::Gr] = span.gr = span.r + span_width;
+  channels[EmulatedScene::Gb] = span.gb = span.gr + span_width;
+  channels[EmulatedScene::B] = span.b = span.gb + span_width;
+  // Standard normal noise samples of the current row
+  std::vector<float>& noise = scratch.noise;
+  noise.resize(image_width);
+
+  for (unsigned int out_y = row_begin; out_y < row_end; out_y++) {
     int* bayer_row = bayer_select + (out_y & 0x1) * 2;
     uint16_t* px = (uint16_t*)img + out_y * (row_stride_in_bytes / 2);
 
     float norm_y = out_y / (image_height * raw_zoom_ratio);
     int y = static_cast<int>(chars.full_res_height * (norm_left_top + norm_y));
     y = std::min(std::max(y, 0), (int)chars.full_res_height - 1);
+    scene_->GetRowElectrons(first_column, y, span_width, span);
+    noise_generator_.FillGaussianRow(frame_number, out_y, image_width,
+                                     noise.data());
 
     for (unsigned int out_x = 0; out_x < image_width; out_x++) {
       int color_idx = chars.quad_bayer_sensor && !(in_sensor_zoom || binned)
                           ? GetQuadBayerColor(out_x, out_y)
                           : bayer_row[out_x & 0x1];
-      float norm_x = out_x / (image_width * raw_zoom_ratio);
-      int x = static_cast<int>(chars.full_res_width * (norm_left_top + norm_x));
-      x = std::min(std::max(x, 0), (int)chars.full_res_width - 1);
-
-      uint32_t electron_count;
-      scene_->SetReadoutPixel(x, y);
-      electron_count = scene_->GetPixelElectrons()[color_idx];
+      uint32_t electron_count =
+          channels[color_idx][columns[out_x] - first_column];
 
       // TODO: Better pixel saturation curve?
       electron_count = (electron_count < kSaturationElectrons)
@@ -1538,22 +1663,17 @@ void EmulatedSensor::CaptureRaw(uint8_t* img, size_t row_stride_in_bytes,
       raw_count =
           (raw_count < chars.max_raw_value) ? raw_count : chars.max_raw_value;
 
-      // Calculate noise value
-      // TODO: Use more-correct Gaussian instead of uniform noise
-      float photon_noise_var = electron_count * noise_var_gain;
-      float noise_stddev = sqrtf_approx(read_noise_var + photon_noise_var);
-      // Scaled to roughly match gaussian/uniform noise stddev
-      float noise_sample = rand_r(&rand_seed_) * (2.5 / (1.0 + RAND_MAX)) - 1.25;
+      // Read and photon noise
+      float noise_stddev = noise_generator_.GetStddev(electron_count);
 
       raw_count += chars.black_level_pattern[color_idx];
-      raw_count += noise_stddev * noise_sample;
+      raw_count += noise_stddev * noise[out_x];
 
       *px++ = raw_count;
     }
     // TODO: Handle this better
     // simulatedTime += mRowReadoutTime;
   }
-  ALOGVV("Raw sensor image captured");
 }
 
 void EmulatedSensor::CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
@@ -1561,23 +1681,50 @@ void EmulatedSensor::CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
                                 uint32_t gain, int32_t color_space,
                                 const SensorCharacteristics& chars) {
   ATRACE_CALL();
+  uint32_t inc_v = ceil((float)chars.full_res_height / height);
+  uint32_t row_count = (chars.full_res_height + inc_v - 1) / inc_v;
+
+  readout_pool_->Render(
+      row_count, /*row_alignment*/ 1,
+      [&](uint32_t /*band_idx*/, uint32_t row_begin, uint32_t row_end) {
+        CaptureRGBRows(img, width, height, stride, layout, gain, color_space,
+                       chars, row_begin, row_end);
+      });
+  ALOGVV("RGB sensor image captured");
+}
+
+void EmulatedSensor::CaptureRGBRows(uint8_t* img, uint32_t width,
+                                    uint32_t height, uint32_t stride,
+                                    RGBLayout layout, uint32_t gain,
+                                    int32_t color_space,
+                                    const SensorCharacteristics& chars,
+                                    uint32_t row_begin,
+                                    uint32_t row_end) const {
   float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
   // In fixed-point math, calculate total scaling from electrons to 8bpp
   int scale64x = 64 * total_gain * 255 / chars.max_raw_value;
   uint32_t inc_h = ceil((float)chars.full_res_width / width);
   uint32_t inc_v = ceil((float)chars.full_res_height / height);
 
-  for (unsigned int y = 0, outy = 0; y < chars.full_res_height;
+  std::vector<uint32_t>& electrons = GetReadoutScratch().electrons;
+  electrons.resize(4 * chars.full_res_width);
+  EmulatedScene::ElectronSpan span = {
+      .r = electrons.data(),
+      .gr = electrons.data() + chars.full_res_width,
+      .gb = electrons.data() + 2 * chars.full_res_width,
+      .b = electrons.data() + 3 * chars.full_res_width};
+  EmulatedScene::ReadoutCursor cursor;
+  for (unsigned int outy = row_begin, y = row_begin * inc_v; outy < row_end;
        y += inc_v, outy++) {
-    scene_->SetReadoutPixel(0, y);
+    scene_->SetReadoutPixel(0, y, &cursor);
+    scene_->GetPixelElectrons(&cursor, chars.full_res_width, span);
     uint8_t* px = img + outy * stride;
     for (unsigned int x = 0; x < chars.full_res_width; x += inc_h) {
       uint32_t r_count, g_count, b_count;
       // TODO: Perfect demosaicing is a cheat
-      const uint32_t* pixel = scene_->GetPixelElectrons();
-      r_count = pixel[EmulatedScene::R] * scale64x;
-      g_count = pixel[EmulatedScene::Gr] * scale64x;
-      b_count = pixel[EmulatedScene::B] * scale64x;
+      r_count = span.r[x] * scale64x;
+      g_count = span.gr[x] * scale64x;
+      b_count = span.b[x] * scale64x;
 
       if (color_space !=
           ANDROID_REQUEST_AVAILABLE_COLOR_SPACE_PROFILES_MAP_UNSPECIFIED) {
@@ -1609,10 +1756,8 @@ void EmulatedSensor::CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
           ALOGE("%s: RGB layout: %d not supported", __FUNCTION__, layout);
           return;
       }
-      for (unsigned int j = 1; j < inc_h; j++) scene_->GetPixelElectrons();
     }
   }
-  ALOGVV("RGB sensor image captured");
 }
 
 void EmulatedSensor::CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width,
@@ -1621,20 +1766,9 @@ void EmulatedSensor::CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width,
                                    int32_t color_space,
                                    const SensorCharacteristics& chars) {
   ATRACE_CALL();
-  float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
-  // Using fixed-point math with 6 bits of fractional precision.
-  // In fixed-point math, calculate total scaling from electrons to 8bpp
-  const int scale64x =
-      kFixedBitPrecision * total_gain * 255 / chars.max_raw_value;
-  // Fixed-point coefficients for RGB-YUV transform
-  // Based on JFIF RGB->YUV transform.
-  // Cb/Cr offset scaled by 64x twice since they're applied post-multiply
-  const int rgb_to_y[] = {19, 37, 7};
-  const int rgb_to_cb[] = {-10, -21, 32, 524288};
-  const int rgb_to_cr[] = {32, -26, -5, 524288};
-  // Scale back to 8bpp non-fixed-point
-  const int scale_out = 64;
-  const int scale_out_sq = scale_out * scale_out;  // after multiplies
+  if ((width == 0) || (height == 0)) {
+    return;
+  }
 
   // inc = how many pixels to skip while reading every next pixel
   const float aspect_ratio = static_cast<float>(width) / height;
@@ -1648,118 +1782,186 @@ void EmulatedSensor::CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width,
   const float norm_rot_left =
       norm_left_top + (norm_width + norm_rot_width) * 0.5f;
 
+  // Every output row reads out a single sensor row, or a single sensor
+  // column when rotating. 'line_coords' holds the sensor line for each output
+  // row and 'pixel_coords' the position within that line for each output
+  // column.
+  std::vector<int> line_coords(height);
+  std::vector<int> pixel_coords(width);
   for (unsigned int out_y = 0; out_y < height; out_y++) {
-    uint8_t* px_y = yuv_layout.img_y + out_y * yuv_layout.y_stride;
-    uint8_t* px_cb = yuv_layout.img_cb + (out_y / 2) * yuv_layout.cbcr_stride;
-    uint8_t* px_cr = yuv_layout.img_cr + (out_y / 2) * yuv_layout.cbcr_stride;
+    float norm_y = out_y / (height * zoom_ratio);
+    int line;
+    if (rotate) {
+      line = static_cast<int>(chars.full_res_width *
+                              (norm_rot_left - norm_y * norm_rot_width));
+      line = std::min(std::max(line, 0), (int)chars.full_res_width - 1);
+    } else {
+      line = static_cast<int>(chars.full_res_height * (norm_left_top + norm_y));
+      line = std::min(std::max(line, 0), (int)chars.full_res_height - 1);
+    }
+    line_coords[out_y] = line;
+  }
+  for (unsigned int out_x = 0; out_x < width; out_x++) {
+    float norm_x = out_x / (width * zoom_ratio);
+    int pixel;
+    if (rotate) {
+      pixel = static_cast<int>(chars.full_res_height *
+                               (norm_rot_top + norm_x * norm_rot_height));
+      pixel = std::min(std::max(pixel, 0), (int)chars.full_res_height - 1);
+    } else {
+      pixel = static_cast<int>(chars.full_res_width * (norm_left_top + norm_x));
+      pixel = std::min(std::max(pixel, 0), (int)chars.full_res_width - 1);
+    }
+    pixel_coords[out_x] = pixel;
+  }
 
-    for (unsigned int out_x = 0; out_x < width; out_x++) {
-      int x, y;
-      float norm_x = out_x / (width * zoom_ratio);
-      float norm_y = out_y / (height * zoom_ratio);
-      if (rotate) {
-        x = static_cast<int>(chars.full_res_width *
-                             (norm_rot_left - norm_y * norm_rot_width));
-        y = static_cast<int>(chars.full_res_height *
-                             (norm_rot_top + norm_x * norm_rot_height));
-      } else {
-        x = static_cast<int>(chars.full_res_width * (norm_left_top + norm_x));
-        y = static_cast<int>(chars.full_res_height * (norm_left_top + norm_y));
-      }
-      x = std::min(std::max(x, 0), (int)chars.full_res_width - 1);
-      y = std::min(std::max(y, 0), (int)chars.full_res_height - 1);
-      scene_->SetReadoutPixel(x, y);
+  // Chroma is sub-sampled vertically, keep both rows of a chroma row in the
+  // same band.
+  readout_pool_->Render(
+      height, /*row_alignment*/ 2,
+      [&](uint32_t /*band_idx*/, uint32_t row_begin, uint32_t row_end) {
+        CaptureYUV420Rows(yuv_layout, gain, rotate, color_space, chars,
+                          line_coords, pixel_coords, row_begin, row_end);
+      });
+  ALOGVV("YUV420 sensor image captured");
+}
 
-      uint32_t r_count, g_count, b_count;
-      // TODO: Perfect demosaicing is a cheat
-      const uint32_t* pixel = rotate ? scene_->GetPixelElectronsColumn()
-                                     : scene_->GetPixelElectrons();
-      r_count = pixel[EmulatedScene::R] * scale64x;
-      g_count = pixel[EmulatedScene::Gr] * scale64x;
-      b_count = pixel[EmulatedScene::B] * scale64x;
+void EmulatedSensor::CaptureYUV420Rows(YCbCrPlanes yuv_layout, uint32_t gain,
+                                       bool rotate, int32_t color_space,
+                                       const SensorCharacteristics& chars,
+                                       const std::vector<int>& line_coords,
+                                       const std::vector<int>& pixel_coords,
+                                       uint32_t row_begin,
+                                       uint32_t row_end) const {
+  float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
+  // Using fixed-point math with 6 bits of fractional precision.
+  // In fixed-point math, calculate total scaling from electrons to 8bpp
+  const int scale64x =
+      kFixedBitPrecision * total_gain * 255 / chars.max_raw_value;
 
-      if (color_space !=
-          ANDROID_REQUEST_AVAILABLE_COLOR_SPACE_PROFILES_MAP_UNSPECIFIED) {
-        RgbToRgb(&r_count, &g_count, &b_count);
-      }
+  if ((yuv_layout.bytesPerPixel != 1) && (yuv_layout.bytesPerPixel != 2)) {
+    ALOGE("%s: Unsupported bytes per pixel value: %zu", __func__,
+          yuv_layout.bytesPerPixel);
+    return;
+  }
 
-      r_count = r_count < kSaturationPoint ? r_count : kSaturationPoint;
-      g_count = g_count < kSaturationPoint ? g_count : kSaturationPoint;
-      b_count = b_count < kSaturationPoint ? b_count : kSaturationPoint;
-
-      // Gamma correction
-      r_count = GammaTable(r_count, color_space);
-      g_count = GammaTable(g_count, color_space);
-      b_count = GammaTable(b_count, color_space);
-
-      uint8_t y8 = (rgb_to_y[0] * r_count + rgb_to_y[1] * g_count +
-                    rgb_to_y[2] * b_count) /
-                   scale_out_sq;
-      if (yuv_layout.bytesPerPixel == 1) {
-        *px_y = y8;
-      } else if (yuv_layout.bytesPerPixel == 2) {
-        *(reinterpret_cast<uint16_t*>(px_y)) = htole16(y8 << 8);
-      } else {
-        ALOGE("%s: Unsupported bytes per pixel value: %zu", __func__,
-              yuv_layout.bytesPerPixel);
-        return;
-      }
-      px_y += yuv_layout.bytesPerPixel;
-
-      if (out_y % 2 == 0 && out_x % 2 == 0) {
-        uint8_t cb8 = (rgb_to_cb[0] * r_count + rgb_to_cb[1] * g_count +
-                       rgb_to_cb[2] * b_count + rgb_to_cb[3]) /
-                      scale_out_sq;
-        uint8_t cr8 = (rgb_to_cr[0] * r_count + rgb_to_cr[1] * g_count +
-                       rgb_to_cr[2] * b_count + rgb_to_cr[3]) /
-                      scale_out_sq;
-        if (yuv_layout.bytesPerPixel == 1) {
-          *px_cb = cb8;
-          *px_cr = cr8;
-        } else if (yuv_layout.bytesPerPixel == 2) {
-          *(reinterpret_cast<uint16_t*>(px_cb)) = htole16(cb8 << 8);
-          *(reinterpret_cast<uint16_t*>(px_cr)) = htole16(cr8 << 8);
-        } else {
-          ALOGE("%s: Unsupported bytes per pixel value: %zu", __func__,
-                yuv_layout.bytesPerPixel);
-          return;
-        }
-        px_cr += yuv_layout.cbcr_step;
-        px_cb += yuv_layout.cbcr_step;
-      }
+  YCbCrRowConverter::Params params;
+  params.scale64x = scale64x;
+  params.transfer = GetTransferFunction(color_space);
+  params.bytes_per_pixel = yuv_layout.bytesPerPixel;
+  if (color_space !=
+      ANDROID_REQUEST_AVAILABLE_COLOR_SPACE_PROFILES_MAP_UNSPECIFIED) {
+    params.apply_color_matrix = true;
+    const float color_matrix[] = {
+        rgb_rgb_matrix_.rR, rgb_rgb_matrix_.gR, rgb_rgb_matrix_.bR,
+        rgb_rgb_matrix_.rG, rgb_rgb_matrix_.gG, rgb_rgb_matrix_.bG,
+        rgb_rgb_matrix_.rB, rgb_rgb_matrix_.gB, rgb_rgb_matrix_.bB};
+    std::copy(std::begin(color_matrix), std::end(color_matrix),
+              params.color_matrix);
+  }
+
+  // Electron counts of all sensor pixels between the first and last sampled
+  // position of the current line
+  const unsigned int width = pixel_coords.size();
+  const int first_pixel = pixel_coords.front();
+  const size_t span_width = pixel_coords.back() - first_pixel + 1;
+  ReadoutScratch& scratch = GetReadoutScratch();
+  std::vector<uint32_t>& electrons = scratch.electrons;
+  electrons.resize(4 * span_width);
+  EmulatedScene::ElectronSpan span = {
+      .r = electrons.data(),
+      .gr = electrons.data() + span_width,
+      .gb = electrons.data() + 2 * span_width,
+      .b = electrons.data() + 3 * span_width};
+  // Electron counts at the sampled positions
+  std::vector<uint32_t>& samples = scratch.samples;
+  samples.resize(3 * width);
+  uint32_t* r_samples = samples.data();
+  uint32_t* g_samples = samples.data() + width;
+  uint32_t* b_samples = samples.data() + 2 * width;
+
+  for (unsigned int out_y = row_begin; out_y < row_end; out_y++) {
+    YCbCrRowConverter::Row row;
+    row.y = yuv_layout.img_y + out_y * yuv_layout.y_stride;
+    if (out_y % 2 == 0) {
+      row.cb = yuv_layout.img_cb + (out_y / 2) * yuv_layout.cbcr_stride;
+      row.cr = yuv_layout.img_cr + (out_y / 2) * yuv_layout.cbcr_stride;
+      row.cbcr_step = yuv_layout.cbcr_step;
+    }
+
+    if (rotate) {
+      scene_->GetColumnElectrons(line_coords[out_y], first_pixel, span_width,
+                                 span);
+    } else {
+      scene_->GetRowElectrons(first_pixel, line_coords[out_y], span_width,
+                              span);
+    }
+
+    for (unsigned int out_x = 0; out_x < width; out_x++) {
+      size_t idx = pixel_coords[out_x] - first_pixel;
+      // TODO: Perfect demosaicing is a cheat
+      r_samples[out_x] = span.r[idx];
+      g_samples[out_x] = span.gr[idx];
+      b_samples[out_x] = span.b[idx];
     }
+
+    yuv_converter_.ConvertRow(params, r_samples, g_samples, b_samples, width,
+                              row);
   }
-  ALOGVV("YUV420 sensor image captured");
 }
 
 void EmulatedSensor::CaptureDepth(uint8_t* img, uint32_t gain, uint32_t width,
                                   uint32_t height, uint32_t stride,
                                   const SensorCharacteristics& chars) {
   ATRACE_CALL();
+  uint32_t inc_v = ceil((float)chars.full_res_height / height);
+  uint32_t row_count = (chars.full_res_height + inc_v - 1) / inc_v;
+
+  readout_pool_->Render(
+      row_count, /*row_alignment*/ 1,
+      [&](uint32_t /*band_idx*/, uint32_t row_begin, uint32_t row_end) {
+        CaptureDepthRows(img, gain, width, height, stride, chars, row_begin,
+                         row_end);
+      });
+  ALOGVV("Depth sensor image captured");
+}
+
+void EmulatedSensor::CaptureDepthRows(uint8_t* img, uint32_t gain,
+                                      uint32_t width, uint32_t height,
+                                      uint32_t stride,
+                                      const SensorCharacteristics& chars,
+                                      uint32_t row_begin,
+                                      uint32_t row_end) const {
   float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
   // In fixed-point math, calculate scaling factor to 13bpp millimeters
   int scale64x = 64 * total_gain * 8191 / chars.max_raw_value;
   uint32_t inc_h = ceil((float)chars.full_res_width / width);
   uint32_t inc_v = ceil((float)chars.full_res_height / height);
 
-  for (unsigned int y = 0, out_y = 0; y < chars.full_res_height;
+  std::vector<uint32_t>& electrons = GetReadoutScratch().electrons;
+  electrons.resize(4 * chars.full_res_width);
+  EmulatedScene::ElectronSpan span = {
+      .r = electrons.data(),
+      .gr = electrons.data() + chars.full_res_width,
+      .gb = electrons.data() + 2 * chars.full_res_width,
+      .b = electrons.data() + 3 * chars.full_res_width};
+  EmulatedScene::ReadoutCursor cursor;
+  for (unsigned int out_y = row_begin, y = row_begin * inc_v; out_y < row_end;
        y += inc_v, out_y++) {
-    scene_->SetReadoutPixel(0, y);
+    scene_->SetReadoutPixel(0, y, &cursor);
+    scene_->GetPixelElectrons(&cursor, chars.full_res_width, span);
     uint16_t* px = (uint16_t*)(img + (out_y * stride));
     for (unsigned int x = 0; x < chars.full_res_width; x += inc_h) {
       uint32_t depth_count;
       // TODO: Make up real depth scene instead of using green channel
       // as depth
-      const uint32_t* pixel = scene_->GetPixelElectrons();
-      depth_count = pixel[EmulatedScene::Gr] * scale64x;
+      depth_count = span.gr[x] * scale64x;
 
       *px++ = depth_count < 8191 * 64 ? depth_count / 64 : 0;
-      for (unsigned int j = 1; j < inc_h; j++) scene_->GetPixelElectrons();
     }
     // TODO: Handle this better
     // simulatedTime += mRowReadoutTime;
   }
-  ALOGVV("Depth sensor image captured");
 }
 
 status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
@@ -1771,7 +1973,9 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
   ATRACE_CALL();
   size_t input_width, input_height;
   YCbCrPlanes input_planes, output_planes;
-  std::vector<uint8_t> temp_yuv, temp_output_uv, temp_input_uv;
+  // Temporary buffers only live for the duration of this call
+  std::lock_guard<std::mutex> scratch_lock(yuv_scratch_mutex_);
+  yuv_scratch_.Reset();
 
   // Overwrite HIGH_QUALITY to REGULAR for Emulator if property
   // ro.boot.qemu.camera_hq_edge_processing is false;
@@ -1794,8 +1998,8 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
       // libyuv only supports planar YUV420 during scaling.
       // Split the input U/V plane in separate planes if needed.
       if (input_planes.cbcr_step == 2) {
-        temp_input_uv.resize(input_width * input_height / 2);
-        auto temp_uv_buffer = temp_input_uv.data();
+        auto temp_uv_buffer =
+            yuv_scratch_.Allocate(input_width * input_height / 2);
         input_planes.img_cb = temp_uv_buffer;
         input_planes.img_cr = temp_uv_buffer + (input_width * input_height) / 4;
         input_planes.cbcr_stride = input_width / 2;
@@ -1820,8 +2024,8 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
       zoom_ratio = std::max(1.f, zoom_ratio);
       input_width = EmulatedScene::kSceneWidth * aspect_ratio;
       input_height = EmulatedScene::kSceneHeight;
-      temp_yuv.reserve((input_width * input_height * 3 * bytes_per_pixel) / 2);
-      auto temp_yuv_buffer = temp_yuv.data();
+      auto temp_yuv_buffer = yuv_scratch_.Allocate(
+          (input_width * input_height * 3 * bytes_per_pixel) / 2);
       input_planes = {
           .img_y = temp_yuv_buffer,
           .img_cb =
@@ -1842,8 +2046,8 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
   // Treat the output UV space as planar first and then
   // interleave in the second step.
   if (output_planes.cbcr_step == 2) {
-    temp_output_uv.resize(output.width * output.height * bytes_per_pixel / 2);
-    auto temp_uv_buffer = temp_output_uv.data();
+    auto temp_uv_buffer = yuv_scratch_.Allocate(output.width * output.height *
+                                                bytes_per_pixel / 2);
     output_planes.img_cb = temp_uv_buffer;
     output_planes.img_cr =
         temp_uv_buffer + output.width * output.height * bytes_per_pixel / 4;
@@ -1920,57 +2124,22 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
   return ret;
 }
 
-int32_t EmulatedSensor::ApplysRGBGamma(int32_t value, int32_t saturation) {
-  float n_value = (static_cast<float>(value) / saturation);
-  n_value = (n_value <= 0.0031308f)
-                ? n_value * 12.92f
-                : 1.055f * pow(n_value, 0.4166667f) - 0.055f;
-  return n_value * saturation;
-}
-
-int32_t EmulatedSensor::ApplySMPTE170MGamma(int32_t value, int32_t saturation) {
-  float n_value = (static_cast<float>(value) / saturation);
-  n_value = (n_value <= 0.018f) ? n_value * 4.5f
-                                : 1.099f * pow(n_value, 0.45f) - 0.099f;
-  return n_value * saturation;
-}
-
-int32_t EmulatedSensor::ApplyST2084Gamma(int32_t value, int32_t saturation) {
-  float n_value = (static_cast<float>(value) / saturation);
-  float c2 = 32.f * 2413.f / 4096.f;
-  float c3 = 32.f * 2392.f / 4096.f;
-  float c1 = c3 - c2 + 1.f;
-  float m = 128.f * 2523.f / 4096.f;
-  float n = 0.25f * 2610.f / 4096.f;
-  n_value = pow((c1 + c2 * pow(n_value, n)) / (1 + c3 * pow(n_value, n)), m);
-  return n_value * saturation;
-}
-
-int32_t EmulatedSensor::ApplyHLGGamma(int32_t value, int32_t saturation) {
-  float n_value = (static_cast<float>(value) / saturation);
-  // The full HLG gamma curve has additional parameters for n_value > 1, but n_value
-  // in the emulated camera is always <= 1 due to lack of HDR display features.
-  n_value = 0.5f * pow(n_value, 0.5f);
-  return n_value * saturation;
-}
-
-int32_t EmulatedSensor::GammaTable(int32_t value, int32_t color_space) {
+YCbCrRowConverter::TransferFunction EmulatedSensor::GetTransferFunction(
+    int32_t color_space) {
   switch (color_space) {
     case ColorSpaceNamed::BT709:
-      return gamma_table_smpte170m_[value];
+      return YCbCrRowConverter::TransferFunction::kSMPTE170M;
     case ColorSpaceNamed::BT2020:
-      return gamma_table_hlg_[value];  // Assume HLG
+      return YCbCrRowConverter::TransferFunction::kHLG;  // Assume HLG
     case ColorSpaceNamed::DISPLAY_P3:
     case ColorSpaceNamed::SRGB:
     default:
-      return gamma_table_sRGB_[value];
+      return YCbCrRowConverter::TransferFunction::kSRGB;
   }
-
-  return 0;
 }
 
 void EmulatedSensor::RgbToRgb(uint32_t* r_count, uint32_t* g_count,
-                              uint32_t* b_count) {
+                              uint32_t* b_count) const {
   uint32_t r = *r_count;
   uint32_t g = *g_count;
   uint32_t b = *b_count;
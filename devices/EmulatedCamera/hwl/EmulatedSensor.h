@@ -79,15 +79,22 @@
 #include <hwl_types.h>
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
+#include <mutex>
 
 #include "Base.h"
 #include "EmulatedScene.h"
 #include "JpegCompressor.h"
 #include "utils/Mutex.h"
+#include "utils/ReadoutThreadPool.h"
+#include "utils/ScratchArena.h"
+#include "utils/SensorNoiseGenerator.h"
+#include "utils/SpscRing.h"
 #include "utils/StreamConfigurationMap.h"
 #include "utils/Thread.h"
 #include "utils/Timers.h"
+#include "utils/YCbCrRowConverter.h"
 
 namespace android {
 
@@ -257,6 +264,20 @@ class EmulatedSensor : private Thread, public virtual RefBase {
                    std::unique_ptr<LogicalCharacteristics> logical_chars);
   status_t ShutDown();
 
+  /*
+   * Stream configuration
+   */
+  struct StreamInfo {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    android_pixel_format_t format = HAL_PIXEL_FORMAT_YCBCR_420_888;
+    bool is_input = false;
+  };
+
+  // Preallocates the scratch memory needed to process the given streams, so
+  // that capture requests for them don't allocate any temporary buffers.
+  void ConfigureStreams(const std::vector<StreamInfo>& streams);
+
   /*
    * Physical camera settings control
    */
@@ -285,11 +306,36 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   // Maps physical and logical camera ids to individual device settings
   typedef std::unordered_map<uint32_t, SensorSettings> LogicalCameraSettings;
 
-  void SetCurrentRequest(std::unique_ptr<LogicalCameraSettings> logical_settings,
-                         std::unique_ptr<HwlPipelineResult> result,
-                         std::unique_ptr<HwlPipelineResult> partial_result,
-                         std::unique_ptr<Buffers> input_buffers,
-                         std::unique_ptr<Buffers> output_buffers);
+  // A request whose fences have signaled and whose settings are final, ready
+  // to be picked up by the next vsync.
+  struct ReadyFrame {
+    std::unique_ptr<LogicalCameraSettings> settings;
+    std::unique_ptr<HwlPipelineResult> result;
+    std::unique_ptr<HwlPipelineResult> partial_result;
+    std::unique_ptr<Buffers> input_buffers;
+    std::unique_ptr<Buffers> output_buffers;
+  };
+
+  // Hands a frame over to the sensor thread. Must always be called from the
+  // same thread. Returns false and leaves 'frame' untouched if kPipelineDepth
+  // frames are already waiting.
+  bool QueueReadyFrame(ReadyFrame&& frame);
+
+  size_t GetReadyFrameCount() const {
+    return ready_frames_.Size();
+  }
+
+  // Requests accepted by the caller that will eventually be queued via
+  // QueueReadyFrame(), or dropped. Lets the sensor tell an idle vsync from
+  // one that missed a frame which wasn't ready in time.
+  void AddPendingRequests(int32_t count) {
+    pending_requests_ += count;
+  }
+
+  // Number of vsyncs without a ready frame while requests were pending
+  uint64_t GetMissedVSyncCount() const {
+    return missed_vsync_count_;
+  }
 
   status_t Flush();
 
@@ -344,6 +390,7 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   static const float kReadNoiseStddevAfterGain;   // In raw digital units
   static const float kReadNoiseVarBeforeGain;
   static const float kReadNoiseVarAfterGain;
+  static const uint64_t kNoiseSeed;
   static const camera_metadata_rational kNeutralColorPoint[3];
   static const float kGreenSplit;
 
@@ -353,26 +400,25 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   static const uint32_t kMaxInputStreams;
   static const uint32_t kMaxLensShadingMapSize[2];
   static const int32_t kFixedBitPrecision;
-  static const int32_t kSaturationPoint;
-
-  std::vector<int32_t> gamma_table_sRGB_;
-  std::vector<int32_t> gamma_table_smpte170m_;
-  std::vector<int32_t> gamma_table_hlg_;
 
   Mutex control_mutex_;  // Lock before accessing control parameters
   // Start of control parameters
   Condition vsync_;
   bool got_vsync_;
-  std::unique_ptr<LogicalCameraSettings> current_settings_;
-  std::unique_ptr<HwlPipelineResult> current_result_;
-  std::unique_ptr<HwlPipelineResult> partial_result_;
-  std::unique_ptr<Buffers> current_output_buffers_;
-  std::unique_ptr<Buffers> current_input_buffers_;
+  bool flush_requested_ = false;
   std::unique_ptr<JpegCompressor> jpeg_compressor_;
 
   // End of control parameters
 
-  unsigned int rand_seed_ = 1;
+  SpscRing<ReadyFrame> ready_frames_;
+  std::atomic_int32_t pending_requests_ = 0;
+  std::atomic_uint64_t missed_vsync_count_ = 0;
+
+  SensorNoiseGenerator noise_generator_;
+
+  // Temporary buffers of ProcessYUV420
+  std::mutex yuv_scratch_mutex_;
+  ScratchArena yuv_scratch_;
 
   /**
    * Inherited Thread virtual overrides, and members only used by the
@@ -395,6 +441,9 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   std::map<uint32_t, SensorBinningFactorInfo> sensor_binning_factor_info_;
 
   std::unique_ptr<EmulatedScene> scene_;
+  // Renders the Capture* outputs in parallel row bands
+  std::unique_ptr<ReadoutThreadPool> readout_pool_;
+  YCbCrRowConverter yuv_converter_;
 
   RgbRgbMatrix rgb_rgb_matrix_;
 
@@ -409,15 +458,18 @@ class EmulatedSensor : private Thread, public virtual RefBase {
                                      const SensorCharacteristics& chars);
 
   void CaptureRawBinned(uint8_t* img, size_t row_stride_in_bytes, uint32_t gain,
+                        uint32_t frame_number,
                         const SensorCharacteristics& chars);
 
   void CaptureRawFullRes(uint8_t* img, size_t row_stride_in_bytes,
-                         uint32_t gain, const SensorCharacteristics& chars);
+                         uint32_t gain, uint32_t frame_number,
+                         const SensorCharacteristics& chars);
   void CaptureRawInSensorZoom(uint8_t* img, size_t row_stride_in_bytes,
-                              uint32_t gain, const SensorCharacteristics& chars);
+                              uint32_t gain, uint32_t frame_number,
+                              const SensorCharacteristics& chars);
   void CaptureRaw(uint8_t* img, size_t row_stride_in_bytes, uint32_t gain,
-                  const SensorCharacteristics& chars, bool in_sensor_zoom,
-                  bool binned);
+                  uint32_t frame_number, const SensorCharacteristics& chars,
+                  bool in_sensor_zoom, bool binned);
 
   enum RGBLayout { RGB, RGBA, ARGB };
   void CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
@@ -428,7 +480,30 @@ class EmulatedSensor : private Thread, public virtual RefBase {
                      int32_t color_space, const SensorCharacteristics& chars);
   void CaptureDepth(uint8_t* img, uint32_t gain, uint32_t width, uint32_t height,
                     uint32_t stride, const SensorCharacteristics& chars);
-  void RgbToRgb(uint32_t* r_count, uint32_t* g_count, uint32_t* b_count);
+
+  // Render output rows [row_begin, row_end) of the matching Capture* call.
+  // Only read the calculated scene, so different bands can run concurrently.
+  void CaptureRawRows(uint8_t* img, size_t row_stride_in_bytes, uint32_t gain,
+                      const SensorCharacteristics& chars, bool in_sensor_zoom,
+                      bool binned, uint32_t frame_number,
+                      const std::vector<int>& columns, uint32_t row_begin,
+                      uint32_t row_end) const;
+  void CaptureRGBRows(uint8_t* img, uint32_t width, uint32_t height,
+                      uint32_t stride, RGBLayout layout, uint32_t gain,
+                      int32_t color_space, const SensorCharacteristics& chars,
+                      uint32_t row_begin, uint32_t row_end) const;
+  void CaptureYUV420Rows(YCbCrPlanes yuv_layout, uint32_t gain, bool rotate,
+                         int32_t color_space,
+                         const SensorCharacteristics& chars,
+                         const std::vector<int>& line_coords,
+                         const std::vector<int>& pixel_coords,
+                         uint32_t row_begin, uint32_t row_end) const;
+  void CaptureDepthRows(uint8_t* img, uint32_t gain, uint32_t width,
+                        uint32_t height, uint32_t stride,
+                        const SensorCharacteristics& chars, uint32_t row_begin,
+                        uint32_t row_end) const;
+
+  void RgbToRgb(uint32_t* r_count, uint32_t* g_count, uint32_t* b_count) const;
   void CalculateRgbRgbMatrix(int32_t color_space,
                              const SensorCharacteristics& chars);
 
@@ -439,19 +514,22 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   };
 
   enum ProcessType { REPROCESS, HIGH_QUALITY, REGULAR };
+  // Scratch memory used by ProcessYUV420 for 'output', including the split
+  // chroma planes of a reprocess input of 'input_width' x 'input_height'.
+  static size_t GetYUV420ScratchSize(const StreamInfo& output,
+                                     uint32_t input_width,
+                                     uint32_t input_height);
   status_t ProcessYUV420(const YUV420Frame& input, const YUV420Frame& output,
                          uint32_t gain, ProcessType process_type,
                          float zoom_ratio, bool rotate_and_crop,
                          int32_t color_space,
                          const SensorCharacteristics& chars);
 
-  inline int32_t ApplysRGBGamma(int32_t value, int32_t saturation);
-  inline int32_t ApplySMPTE170MGamma(int32_t value, int32_t saturation);
-  inline int32_t ApplyST2084Gamma(int32_t value, int32_t saturation);
-  inline int32_t ApplyHLGGamma(int32_t value, int32_t saturation);
-  inline int32_t GammaTable(int32_t value, int32_t color_space);
+  static YCbCrRowConverter::TransferFunction GetTransferFunction(
+      int32_t color_space);
 
   bool WaitForVSyncLocked(nsecs_t reltime);
+  void FailReadyFrame(ReadyFrame* frame);
   void CalculateAndAppendNoiseProfile(float gain /*in ISO*/,
                                       float base_gain_factor,
                                       HalCameraMetadata* result /*out*/);
@@ -20,6 +20,7 @@
 #include "JpegCompressor.h"
 
 #include <camera_blob.h>
+#include <inttypes.h>
 #include <cutils/properties.h>
 #include <libyuv.h>
 #include <utils/Log.h>
@@ -33,6 +34,18 @@ using google_camera_hal::ErrorCode;
 using google_camera_hal::MessageType;
 using google_camera_hal::NotifyMessage;
 
+// Slices start at a multiple of 8 MCU rows, see CompressYUV420FrameSliced()
+static constexpr uint32_t kSliceRowAlignment = DCTSIZE * 2 * 8;
+// Smaller frames are encoded in a single pass
+static constexpr size_t kMinSlicedPixelCount = 1920 * 1080;
+static constexpr size_t kMinSliceBufferSize = 64 * 1024;
+// APP1 is limited to 64 KB, so is the thumbnail it embeds
+static constexpr size_t kThumbnailBufferSize = 64 * 1024;
+// Largest APP1 segment including marker and length
+static constexpr size_t kApp1ReserveSize = 4 + 65533;
+static constexpr uint8_t kMarkerSOF0 = 0xC0;
+static constexpr uint8_t kMarkerSOS = 0xDA;
+
 // All ICC profile data sourced from https://github.com/saucecontrol/Compact-ICC-Profiles
 static constexpr uint8_t kIccProfileDisplayP3[] = {
     0x00, 0x00, 0x01, 0xe0, 0x6c, 0x63, 0x6d, 0x73, 0x04, 0x20, 0x00, 0x00,
@@ -159,7 +172,8 @@ static constexpr uint8_t kIccProfileSrgb[] = {
     0x00, 0x03, 0x00, 0x00, 0x00, 0x02, 0x66, 0x69, 0x00, 0x00, 0xf2, 0xa7,
     0x00, 0x00, 0x0d, 0x59, 0x00, 0x00, 0x13, 0xd0, 0x00, 0x00, 0x0a, 0x5b};
 
-JpegCompressor::JpegCompressor() {
+JpegCompressor::JpegCompressor(uint32_t thread_count,
+                               uint32_t slice_thread_count) {
   ATRACE_CALL();
   char value[PROPERTY_VALUE_MAX];
   if (property_get("ro.product.manufacturer", value, "unknown") <= 0) {
@@ -172,20 +186,50 @@ JpegCompressor::JpegCompressor() {
   }
   exif_model_ = std::string(value);
 
-  jpeg_processing_thread_ = std::thread([this] { this->ThreadLoop(); });
+  if (thread_count == 0) {
+    thread_count = std::clamp(std::thread::hardware_concurrency(), 1u,
+                              kMaxThreadCount);
+  }
+  if (slice_thread_count != 1) {
+    slice_pool_ = std::make_unique<ReadoutThreadPool>(slice_thread_count);
+    if (slice_pool_->GetThreadCount() > 1) {
+      for (uint32_t i = 0; i < slice_pool_->GetThreadCount(); i++) {
+        slices_.push_back(std::make_unique<Slice>());
+        InitializeContext(&slices_.back()->context);
+      }
+    } else {
+      slice_pool_.reset();
+    }
+  }
+
+  for (uint32_t i = 0; i < thread_count; i++) {
+    workers_.emplace_back([this] { this->ThreadLoop(); });
+  }
+  ALOGV("%s: Jpeg compression using %u threads", __FUNCTION__, thread_count);
 }
 
 JpegCompressor::~JpegCompressor() {
   ATRACE_CALL();
 
   // Abort the ongoing compression and flush any pending jobs
-  jpeg_done_ = true;
-  condition_.notify_one();
-  jpeg_processing_thread_.join();
-  while (!pending_yuv_jobs_.empty()) {
-    auto job = std::move(pending_yuv_jobs_.front());
-    job->output->stream_buffer.status = BufferStatus::kError;
-    pending_yuv_jobs_.pop();
+  Flush();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_ = true;
+  }
+  condition_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+
+  if (stats_.completed_jobs > 0) {
+    ALOGI("%s: %" PRIu64 " jobs, max queue depth %zu, avg queue time %" PRId64
+          " us, avg encode time %" PRId64 " us, max encode time %" PRId64
+          " us",
+          __FUNCTION__, stats_.completed_jobs, stats_.max_queue_depth,
+          ns2us(stats_.total_queue_time) / stats_.completed_jobs,
+          ns2us(stats_.total_encode_time) / stats_.completed_jobs,
+          ns2us(stats_.max_encode_time));
   }
 }
 
@@ -200,133 +244,335 @@ status_t JpegCompressor::QueueYUV420(std::unique_ptr<JpegYUV420Job> job) {
     return BAD_VALUE;
   }
 
+  auto state = std::make_shared<JobState>();
+  state->queue_time = systemTime(SYSTEM_TIME_MONOTONIC);
+  // Generate the thumbnail and APP1 marker on a second worker, meanwhile the
+  // main image is encoded behind the space the marker may need.
+  state->split = (workers_.size() > 1) &&
+                 (job->exif_utils.get() != nullptr) &&
+                 (job->result_metadata.get() != nullptr) &&
+                 (job->output->plane.img.buffer_size > 2 * kApp1ReserveSize);
+  state->job = std::move(job);
+
   std::unique_lock<std::mutex> lock(mutex_);
-  pending_yuv_jobs_.push(std::move(job));
-  condition_.notify_one();
+  state->sequence = next_sequence_++;
+  if (state->split) {
+    state->pending_tasks = 2;
+    pending_tasks_.push({.type = TaskType::kThumbnail, .state = state});
+    pending_tasks_.push({.type = TaskType::kMainImage, .state = state});
+  } else {
+    pending_tasks_.push({.type = TaskType::kFull, .state = state});
+  }
+  stats_.queue_depth = pending_tasks_.size();
+  stats_.max_queue_depth = std::max(stats_.max_queue_depth,
+                                    stats_.queue_depth);
+  ATRACE_INT("JpegQueueDepth", stats_.queue_depth);
+  condition_.notify_all();
 
   return OK;
 }
 
+void JpegCompressor::Flush() {
+  ATRACE_CALL();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    jpeg_done_ = true;
+    while (!pending_tasks_.empty()) {
+      auto state = std::move(pending_tasks_.front().state);
+      pending_tasks_.pop();
+      state->canceled = true;
+      state->job->output->stream_buffer.status = BufferStatus::kError;
+      // Jobs with a task in progress complete once that task is done
+      if (--state->pending_tasks == 0) {
+        completed_jobs_.emplace(state->sequence, std::move(state->job));
+      }
+    }
+    stats_.queue_depth = 0;
+    ATRACE_INT("JpegQueueDepth", 0);
+
+    idle_condition_.wait(lock, [this] { return active_tasks_ == 0; });
+    jpeg_done_ = false;
+  }
+
+  ReleaseCompletedJobs();
+}
+
+JpegCompressor::Stats JpegCompressor::GetStats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
 void JpegCompressor::ThreadLoop() {
   ATRACE_CALL();
 
-  while (!jpeg_done_) {
-    std::unique_ptr<JpegYUV420Job> current_yuv_job = nullptr;
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      if (!pending_yuv_jobs_.empty()) {
-        current_yuv_job = std::move(pending_yuv_jobs_.front());
-        pending_yuv_jobs_.pop();
-      }
+  WorkerContext context;
+  InitializeContext(&context);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    condition_.wait(lock, [this] { return exit_ || !pending_tasks_.empty(); });
+    if (pending_tasks_.empty()) {
+      // 'exit_' is set and nothing is left to do
+      break;
+    }
+
+    auto task = std::move(pending_tasks_.front());
+    pending_tasks_.pop();
+    stats_.queue_depth = pending_tasks_.size();
+    ATRACE_INT("JpegQueueDepth", stats_.queue_depth);
+    if (task.state->start_time == 0) {
+      task.state->start_time = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+    active_tasks_++;
+    lock.unlock();
+
+    RunTask(&context, task);
+
+    lock.lock();
+    bool job_done = --task.state->pending_tasks == 0;
+    lock.unlock();
+
+    if (job_done) {
+      CompleteJob(task.state);
+    }
+
+    lock.lock();
+    active_tasks_--;
+    if (active_tasks_ == 0) {
+      idle_condition_.notify_all();
     }
+  }
+}
 
-    if (current_yuv_job.get() != nullptr) {
-      CompressYUV420(std::move(current_yuv_job));
+void JpegCompressor::RunTask(WorkerContext* context, const PendingTask& task) {
+  auto job = task.state->job.get();
+  switch (task.type) {
+    case TaskType::kFull: {
+      const uint8_t* app1_buffer = nullptr;
+      size_t app1_buffer_size = 0;
+      GenerateApp1(context, job, &app1_buffer, &app1_buffer_size);
+      task.state->encoded_size = CompressMainImage(
+          context, job, /*offset*/ 0, app1_buffer, app1_buffer_size);
+      break;
     }
+    case TaskType::kThumbnail:
+      GenerateApp1(context, job, &task.state->app1_buffer,
+                   &task.state->app1_buffer_size);
+      break;
+    case TaskType::kMainImage:
+      task.state->encoded_size =
+          CompressMainImage(context, job, kApp1ReserveSize,
+                            /*app1_buffer*/ nullptr, /*app1_buffer_size*/ 0);
+      break;
+  }
+}
 
+void JpegCompressor::CompleteJob(const std::shared_ptr<JobState>& state) {
+  size_t encoded_size = state->encoded_size;
+  if (state->split) {
     std::unique_lock<std::mutex> lock(mutex_);
-    auto ret = condition_.wait_for(lock, std::chrono::milliseconds(10));
-    if (ret == std::cv_status::timeout) {
-      ALOGV("%s: Jpeg thread timeout", __FUNCTION__);
+    bool canceled = state->canceled;
+    lock.unlock();
+
+    if (canceled || (encoded_size == 0)) {
+      encoded_size = 0;
+    } else {
+      encoded_size = SpliceApp1(state->job->output->plane.img.img,
+                                encoded_size, state->app1_buffer,
+                                state->app1_buffer_size);
     }
   }
+  FinishJob(state->job.get(), encoded_size);
+
+  nsecs_t encode_time = systemTime(SYSTEM_TIME_MONOTONIC) - state->start_time;
+  ALOGV("%s: Frame %u encoded in %" PRId64 " us after %" PRId64
+        " us in queue",
+        __FUNCTION__, state->job->output->frame_number, ns2us(encode_time),
+        ns2us(state->start_time - state->queue_time));
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    completed_jobs_.emplace(state->sequence, std::move(state->job));
+    stats_.completed_jobs++;
+    stats_.total_queue_time += state->start_time - state->queue_time;
+    stats_.total_encode_time += encode_time;
+    stats_.max_encode_time = std::max(stats_.max_encode_time, encode_time);
+  }
+
+  ReleaseCompletedJobs();
 }
 
-void JpegCompressor::CompressYUV420(std::unique_ptr<JpegYUV420Job> job) {
-  const uint8_t* app1_buffer = nullptr;
-  size_t app1_buffer_size = 0;
-  std::vector<uint8_t> thumbnail_jpeg_buffer;
-  size_t encoded_thumbnail_size = 0;
-  if ((job->exif_utils.get() != nullptr) &&
-      (job->result_metadata.get() != nullptr)) {
-    if (job->exif_utils->Initialize()) {
-      camera_metadata_ro_entry_t entry;
-      size_t thumbnail_width = 0;
-      size_t thumbnail_height = 0;
-      std::vector<uint8_t> thumb_yuv420_frame;
-      YCbCrPlanes thumb_planes;
-      auto ret = job->result_metadata->Get(ANDROID_JPEG_THUMBNAIL_SIZE, &entry);
-      if ((ret == OK) && (entry.count == 2)) {
-        thumbnail_width = entry.data.i32[0];
-        thumbnail_height = entry.data.i32[1];
-        if ((thumbnail_width > 0) && (thumbnail_height > 0)) {
-          thumb_yuv420_frame.resize((thumbnail_width * thumbnail_height * 3) /
-                                    2);
-          thumb_planes = {
-              .img_y = thumb_yuv420_frame.data(),
-              .img_cb = thumb_yuv420_frame.data() +
-                        thumbnail_width * thumbnail_height,
-              .img_cr = thumb_yuv420_frame.data() +
-                        (thumbnail_width * thumbnail_height * 5) / 4,
-              .y_stride = static_cast<uint32_t>(thumbnail_width),
-              .cbcr_stride = static_cast<uint32_t>(thumbnail_width) / 2};
-          // TODO: Crop thumbnail according to documentation
-          auto stat = I420Scale(
-              job->input->yuv_planes.img_y, job->input->yuv_planes.y_stride,
-              job->input->yuv_planes.img_cb, job->input->yuv_planes.cbcr_stride,
-              job->input->yuv_planes.img_cr, job->input->yuv_planes.cbcr_stride,
-              job->input->width, job->input->height, thumb_planes.img_y,
-              thumb_planes.y_stride, thumb_planes.img_cb,
-              thumb_planes.cbcr_stride, thumb_planes.img_cr,
-              thumb_planes.cbcr_stride, thumbnail_width, thumbnail_height,
-              libyuv::kFilterNone);
-          if (stat != 0) {
-            ALOGE("%s: Failed during thumbnail scaling: %d", __FUNCTION__, stat);
-            thumb_yuv420_frame.clear();
-          }
-        }
+void JpegCompressor::ReleaseCompletedJobs() {
+  std::lock_guard<std::mutex> release_lock(release_mutex_);
+  while (true) {
+    std::unique_ptr<JpegYUV420Job> job;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = completed_jobs_.find(next_release_sequence_);
+      if (it == completed_jobs_.end()) {
+        break;
       }
+      job = std::move(it->second);
+      completed_jobs_.erase(it);
+      next_release_sequence_++;
+    }
 
-      if (job->exif_utils->SetFromMetadata(
-              *job->result_metadata, job->input->width, job->input->height)) {
-        if (!thumb_yuv420_frame.empty()) {
-          thumbnail_jpeg_buffer.resize(64 * 1024);  // APP1 is limited by 64k
-          encoded_thumbnail_size = CompressYUV420Frame(
-              {.output_buffer = thumbnail_jpeg_buffer.data(),
-               .output_buffer_size = thumbnail_jpeg_buffer.size(),
-               .yuv_planes = thumb_planes,
-               .width = thumbnail_width,
-               .height = thumbnail_height,
-               .app1_buffer = nullptr,
-               .app1_buffer_size = 0,
-               .color_space = job->input->color_space});
-          if (encoded_thumbnail_size > 0) {
-            job->output->stream_buffer.status = BufferStatus::kOk;
-          } else {
-            ALOGE("%s: Failed encoding thumbail!", __FUNCTION__);
-            thumbnail_jpeg_buffer.clear();
-          }
-        }
+    // Destroying the output returns the buffer to the framework
+    job.reset();
+  }
+}
 
-        job->exif_utils->SetMake(exif_make_);
-        job->exif_utils->SetModel(exif_model_);
-        job->exif_utils->SetColorSpace(COLOR_SPACE_ICC_PROFILE);
-        if (job->exif_utils->GenerateApp1(thumbnail_jpeg_buffer.empty()
-                                              ? nullptr
-                                              : thumbnail_jpeg_buffer.data(),
-                                          encoded_thumbnail_size)) {
-          app1_buffer = job->exif_utils->GetApp1Buffer();
-          app1_buffer_size = job->exif_utils->GetApp1Length();
-        } else {
-          ALOGE("%s: Unable to generate App1 buffer", __FUNCTION__);
-        }
+void JpegCompressor::GenerateApp1(WorkerContext* context, JpegYUV420Job* job,
+                                  const uint8_t** app1_buffer,
+                                  size_t* app1_buffer_size) {
+  ATRACE_CALL();
+  *app1_buffer = nullptr;
+  *app1_buffer_size = 0;
+  if ((job->exif_utils.get() == nullptr) ||
+      (job->result_metadata.get() == nullptr)) {
+    return;
+  }
+
+  if (!job->exif_utils->Initialize()) {
+    ALOGE("%s: Unable to initialize Exif generator!", __FUNCTION__);
+    return;
+  }
+
+  camera_metadata_ro_entry_t entry;
+  size_t thumbnail_width = 0;
+  size_t thumbnail_height = 0;
+  bool has_thumbnail = false;
+  YCbCrPlanes thumb_planes;
+  auto ret = job->result_metadata->Get(ANDROID_JPEG_THUMBNAIL_SIZE, &entry);
+  if ((ret == OK) && (entry.count == 2)) {
+    thumbnail_width = entry.data.i32[0];
+    thumbnail_height = entry.data.i32[1];
+    if ((thumbnail_width > 0) && (thumbnail_height > 0)) {
+      auto& thumb_yuv420_frame = context->thumbnail_yuv;
+      thumb_yuv420_frame.resize((thumbnail_width * thumbnail_height * 3) / 2);
+      thumb_planes = {
+          .img_y = thumb_yuv420_frame.data(),
+          .img_cb =
+              thumb_yuv420_frame.data() + thumbnail_width * thumbnail_height,
+          .img_cr = thumb_yuv420_frame.data() +
+                    (thumbnail_width * thumbnail_height * 5) / 4,
+          .y_stride = static_cast<uint32_t>(thumbnail_width),
+          .cbcr_stride = static_cast<uint32_t>(thumbnail_width) / 2};
+      // TODO: Crop thumbnail according to documentation
+      auto stat = I420Scale(
+          job->input->yuv_planes.img_y, job->input->yuv_planes.y_stride,
+          job->input->yuv_planes.img_cb, job->input->yuv_planes.cbcr_stride,
+          job->input->yuv_planes.img_cr, job->input->yuv_planes.cbcr_stride,
+          job->input->width, job->input->height, thumb_planes.img_y,
+          thumb_planes.y_stride, thumb_planes.img_cb, thumb_planes.cbcr_stride,
+          thumb_planes.img_cr, thumb_planes.cbcr_stride, thumbnail_width,
+          thumbnail_height, libyuv::kFilterNone);
+      if (stat == 0) {
+        has_thumbnail = true;
       } else {
-        ALOGE("%s: Unable to generate EXIF section!", __FUNCTION__);
+        ALOGE("%s: Failed during thumbnail scaling: %d", __FUNCTION__, stat);
       }
-    } else {
-      ALOGE("%s: Unable to initialize Exif generator!", __FUNCTION__);
     }
   }
 
-  auto encoded_size = CompressYUV420Frame(
-      {.output_buffer = job->output->plane.img.img,
-       .output_buffer_size = job->output->plane.img.buffer_size,
+  if (!job->exif_utils->SetFromMetadata(
+          *job->result_metadata, job->input->width, job->input->height)) {
+    ALOGE("%s: Unable to generate EXIF section!", __FUNCTION__);
+    return;
+  }
+
+  std::unique_ptr<uint8_t[]> thumbnail_jpeg_buffer;
+  size_t encoded_thumbnail_size = 0;
+  if (has_thumbnail) {
+    thumbnail_jpeg_buffer = AcquireThumbnailBuffer();
+    encoded_thumbnail_size = CompressYUV420Frame(
+        context, {.output_buffer = thumbnail_jpeg_buffer.get(),
+                  .output_buffer_size = kThumbnailBufferSize,
+                  .yuv_planes = thumb_planes,
+                  .width = thumbnail_width,
+                  .height = thumbnail_height,
+                  .app1_buffer = nullptr,
+                  .app1_buffer_size = 0,
+                  .color_space = job->input->color_space});
+    if (encoded_thumbnail_size == 0) {
+      ALOGE("%s: Failed encoding thumbail!", __FUNCTION__);
+    }
+  }
+
+  job->exif_utils->SetMake(exif_make_);
+  job->exif_utils->SetModel(exif_model_);
+  job->exif_utils->SetColorSpace(COLOR_SPACE_ICC_PROFILE);
+  // The APP1 marker keeps its own copy of the thumbnail
+  if (job->exif_utils->GenerateApp1(encoded_thumbnail_size > 0
+                                        ? thumbnail_jpeg_buffer.get()
+                                        : nullptr,
+                                    encoded_thumbnail_size)) {
+    *app1_buffer = job->exif_utils->GetApp1Buffer();
+    *app1_buffer_size = job->exif_utils->GetApp1Length();
+  } else {
+    ALOGE("%s: Unable to generate App1 buffer", __FUNCTION__);
+  }
+
+  if (thumbnail_jpeg_buffer.get() != nullptr) {
+    ReturnThumbnailBuffer(std::move(thumbnail_jpeg_buffer));
+  }
+}
+
+size_t JpegCompressor::CompressMainImage(WorkerContext* context,
+                                         JpegYUV420Job* job, size_t offset,
+                                         const uint8_t* app1_buffer,
+                                         size_t app1_buffer_size) {
+  return CompressYUV420Frame(
+      context,
+      {.output_buffer = job->output->plane.img.img + offset,
+       .output_buffer_size = job->output->plane.img.buffer_size - offset,
        .yuv_planes = job->input->yuv_planes,
        .width = job->input->width,
        .height = job->input->height,
        .app1_buffer = app1_buffer,
        .app1_buffer_size = app1_buffer_size,
        .color_space = job->input->color_space});
+}
+
+size_t JpegCompressor::SpliceApp1(uint8_t* buffer, size_t encoded_size,
+                                  const uint8_t* app1_buffer,
+                                  size_t app1_buffer_size) {
+  ATRACE_CALL();
+  const uint8_t* image = buffer + kApp1ReserveSize;
+  if ((app1_buffer == nullptr) || (app1_buffer_size == 0)) {
+    memmove(buffer, image, encoded_size);
+    return encoded_size;
+  }
+
+  // libjpeg writes the APP1 marker right after SOI and the JFIF APP0 marker
+  size_t header_size = 2;
+  if ((encoded_size >= header_size + 4) && (image[header_size] == 0xFF) &&
+      (image[header_size + 1] == JPEG_APP0)) {
+    header_size +=
+        2 + ((image[header_size + 2] << 8) | image[header_size + 3]);
+  }
+  if (header_size > encoded_size) {
+    ALOGE("%s: Invalid image header", __FUNCTION__);
+    return 0;
+  }
+
+  // 'image' starts past the final position of the APP1 marker, so the parts
+  // behind it can be moved first.
+  size_t marker_size = 4 + app1_buffer_size;
+  memmove(buffer, image, header_size);
+  memmove(buffer + header_size + marker_size, image + header_size,
+          encoded_size - header_size);
+  uint8_t* marker = buffer + header_size;
+  marker[0] = 0xFF;
+  marker[1] = JPEG_APP0 + 1;
+  marker[2] = ((app1_buffer_size + 2) >> 8) & 0xFF;
+  marker[3] = (app1_buffer_size + 2) & 0xFF;
+  memcpy(marker + 4, app1_buffer, app1_buffer_size);
+
+  return encoded_size + marker_size;
+}
+
+void JpegCompressor::FinishJob(JpegYUV420Job* job, size_t encoded_size) {
   if (encoded_size > 0) {
     job->output->stream_buffer.status = BufferStatus::kOk;
   } else {
@@ -348,76 +594,103 @@ void JpegCompressor::CompressYUV420(std::unique_ptr<JpegYUV420Job> job) {
   }
 }
 
-size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
-  ATRACE_CALL();
+std::unique_ptr<uint8_t[]> JpegCompressor::AcquireThumbnailBuffer() {
+  {
+    std::lock_guard<std::mutex> lock(thumbnail_mutex_);
+    if (!thumbnail_buffers_.empty()) {
+      auto buffer = std::move(thumbnail_buffers_.back());
+      thumbnail_buffers_.pop_back();
+      return buffer;
+    }
+  }
 
-  struct CustomJpegDestMgr : public jpeg_destination_mgr {
-    JOCTET* buffer;
-    size_t buffer_size;
-    size_t encoded_size;
-    bool success;
-  } dmgr;
+  return std::unique_ptr<uint8_t[]>(new uint8_t[kThumbnailBufferSize]);
+}
 
-  // Set up error management
-  jpeg_error_info_ = NULL;
-  jpeg_error_mgr jerr;
+void JpegCompressor::ReturnThumbnailBuffer(std::unique_ptr<uint8_t[]> buffer) {
+  std::lock_guard<std::mutex> lock(thumbnail_mutex_);
+  thumbnail_buffers_.push_back(std::move(buffer));
+}
 
-  auto cinfo = std::make_unique<jpeg_compress_struct>();
-  cinfo->err = jpeg_std_error(&jerr);
-  cinfo->err->error_exit = [](j_common_ptr cinfo) {
+void JpegCompressor::InitializeContext(WorkerContext* context) {
+  context->cinfo = std::make_unique<jpeg_compress_struct>();
+  context->cinfo->err = jpeg_std_error(&context->error_mgr);
+  context->cinfo->err->error_exit = [](j_common_ptr cinfo) {
     (*cinfo->err->output_message)(cinfo);
     if (cinfo->client_data) {
-      auto& dmgr = *static_cast<CustomJpegDestMgr*>(cinfo->client_data);
-      dmgr.success = false;
+      auto context = static_cast<WorkerContext*>(cinfo->client_data);
+      context->error_info = cinfo;
     }
   };
+  context->cinfo->client_data = static_cast<void*>(context);
+  jpeg_create_compress(context->cinfo.get());
+}
 
-  jpeg_create_compress(cinfo.get());
-  if (CheckError("Error initializing compression")) {
-    return 0;
-  }
-
-  dmgr.buffer = static_cast<JOCTET*>(frame.output_buffer);
-  dmgr.buffer_size = frame.output_buffer_size;
-  dmgr.encoded_size = 0;
-  dmgr.success = true;
-  cinfo->client_data = static_cast<void*>(&dmgr);
-  dmgr.init_destination = [](j_compress_ptr cinfo) {
+void JpegCompressor::SetDestination(j_compress_ptr cinfo,
+                                    CustomJpegDestMgr* dmgr) {
+  dmgr->encoded_size = 0;
+  dmgr->init_destination = [](j_compress_ptr cinfo) {
     auto& dmgr = static_cast<CustomJpegDestMgr&>(*cinfo->dest);
+    if (dmgr.growable_buffer != nullptr) {
+      dmgr.buffer = dmgr.growable_buffer->data();
+      dmgr.buffer_size = dmgr.growable_buffer->size();
+    }
     dmgr.next_output_byte = dmgr.buffer;
     dmgr.free_in_buffer = dmgr.buffer_size;
     ALOGV("%s:%d jpeg start: %p [%zu]", __FUNCTION__, __LINE__, dmgr.buffer,
           dmgr.buffer_size);
   };
 
-  dmgr.empty_output_buffer = [](j_compress_ptr) {
-    ALOGE("%s:%d Out of buffer", __FUNCTION__, __LINE__);
-    return 0;
+  dmgr->empty_output_buffer = [](j_compress_ptr cinfo) {
+    auto& dmgr = static_cast<CustomJpegDestMgr&>(*cinfo->dest);
+    if (dmgr.growable_buffer == nullptr) {
+      ALOGE("%s:%d Out of buffer", __FUNCTION__, __LINE__);
+      return 0;
+    }
+
+    // The whole buffer is in use, continue at its end
+    size_t used_size = dmgr.buffer_size;
+    dmgr.growable_buffer->resize(std::max(2 * used_size, kMinSliceBufferSize));
+    dmgr.buffer = dmgr.growable_buffer->data();
+    dmgr.buffer_size = dmgr.growable_buffer->size();
+    dmgr.next_output_byte = dmgr.buffer + used_size;
+    dmgr.free_in_buffer = dmgr.buffer_size - used_size;
+    return 1;
   };
 
-  dmgr.term_destination = [](j_compress_ptr cinfo) {
+  dmgr->term_destination = [](j_compress_ptr cinfo) {
     auto& dmgr = static_cast<CustomJpegDestMgr&>(*cinfo->dest);
     dmgr.encoded_size = dmgr.buffer_size - dmgr.free_in_buffer;
     ALOGV("%s:%d Done with jpeg: %zu", __FUNCTION__, __LINE__,
           dmgr.encoded_size);
   };
 
-  cinfo->dest = reinterpret_cast<struct jpeg_destination_mgr*>(&dmgr);
+  cinfo->dest = reinterpret_cast<struct jpeg_destination_mgr*>(dmgr);
+}
+
+bool JpegCompressor::SetUpCompress(WorkerContext* context, size_t width,
+                                   size_t height) {
+  // The compression objects are created once per worker and slice, see
+  // InitializeContext().
+  // Anything left over from the previous frame is discarded here.
+  auto cinfo = context->cinfo.get();
+  context->error_info = nullptr;
+  jpeg_abort_compress(cinfo);
 
   // Set up compression parameters
-  cinfo->image_width = frame.width;
-  cinfo->image_height = frame.height;
+  cinfo->image_width = width;
+  cinfo->image_height = height;
   cinfo->input_components = 3;
   cinfo->in_color_space = JCS_YCbCr;
 
-  jpeg_set_defaults(cinfo.get());
-  if (CheckError("Error configuring defaults")) {
-    return 0;
+  jpeg_set_defaults(cinfo);
+  if (CheckError(context, "Error configuring defaults")) {
+    return false;
   }
 
-  jpeg_set_colorspace(cinfo.get(), JCS_YCbCr);
-  if (CheckError("Error configuring color space")) {
-    return 0;
+  jpeg_set_colorspace(cinfo, JCS_YCbCr);
+  if (CheckError(context, "Error configuring color space")) {
+    return false;
   }
 
   cinfo->raw_data_in = 1;
@@ -429,20 +702,13 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
   cinfo->comp_info[2].h_samp_factor = 1;
   cinfo->comp_info[2].v_samp_factor = 1;
 
-  int max_vsamp_factor = std::max({cinfo->comp_info[0].v_samp_factor,
-                                   cinfo->comp_info[1].v_samp_factor,
-                                   cinfo->comp_info[2].v_samp_factor});
-  int c_vsub_sampling =
-      cinfo->comp_info[0].v_samp_factor / cinfo->comp_info[1].v_samp_factor;
-
-  // Start compression
-  jpeg_start_compress(cinfo.get(), TRUE);
-  if (CheckError("Error starting compression")) {
-    return 0;
-  }
+  return true;
+}
 
+void JpegCompressor::WriteAppMarkers(j_compress_ptr cinfo,
+                                     const YUV420Frame& frame) {
   if ((frame.app1_buffer != nullptr) && (frame.app1_buffer_size > 0)) {
-    jpeg_write_marker(cinfo.get(), JPEG_APP0 + 1,
+    jpeg_write_marker(cinfo, JPEG_APP0 + 1,
                       static_cast<const JOCTET*>(frame.app1_buffer),
                       frame.app1_buffer_size);
   }
@@ -465,9 +731,19 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
   }
 
   if (icc_profile != nullptr && icc_profile_size > 0) {
-    jpeg_write_icc_profile(cinfo.get(), static_cast<const JOCTET*>(icc_profile),
+    jpeg_write_icc_profile(cinfo, static_cast<const JOCTET*>(icc_profile),
                            icc_profile_size);
   }
+}
+
+bool JpegCompressor::WriteRawRows(WorkerContext* context,
+                                  const YUV420Frame& frame, size_t row_begin) {
+  auto cinfo = context->cinfo.get();
+  int max_vsamp_factor = std::max({cinfo->comp_info[0].v_samp_factor,
+                                   cinfo->comp_info[1].v_samp_factor,
+                                   cinfo->comp_info[2].v_samp_factor});
+  int c_vsub_sampling =
+      cinfo->comp_info[0].v_samp_factor / cinfo->comp_info[1].v_samp_factor;
 
   // Compute our macroblock height, so we can pad our input to be vertically
   // macroblock aligned.
@@ -483,13 +759,15 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
   uint8_t* pcr = static_cast<uint8_t*>(frame.yuv_planes.img_cr);
   uint8_t* pcb = static_cast<uint8_t*>(frame.yuv_planes.img_cb);
 
-  for (uint32_t i = 0; i < padded_height; i++) {
+  // 'cinfo' may only cover a slice of 'frame' starting at 'row_begin'
+  for (size_t i = 0; i < padded_height; i++) {
     /* Once we are in the padding territory we still point to the last line
      * effectively replicating it several times ~ CLAMP_TO_EDGE */
-    int li = std::min(i, cinfo->image_height - 1);
+    size_t li = std::min(row_begin + i, frame.height - 1);
     y_lines[i] = static_cast<JSAMPROW>(py + li * frame.yuv_planes.y_stride);
     if (i < padded_height / c_vsub_sampling) {
-      li = std::min(i, (cinfo->image_height - 1) / c_vsub_sampling);
+      li = std::min(row_begin / c_vsub_sampling + i,
+                    (frame.height - 1) / c_vsub_sampling);
       cr_lines[i] =
           static_cast<JSAMPROW>(pcr + li * frame.yuv_planes.cbcr_stride);
       cb_lines[i] =
@@ -503,32 +781,186 @@ size_t JpegCompressor::CompressYUV420Frame(YUV420Frame frame) {
                          &cb_lines[cinfo->next_scanline / c_vsub_sampling],
                          &cr_lines[cinfo->next_scanline / c_vsub_sampling]};
 
-    jpeg_write_raw_data(cinfo.get(), planes, batch_size);
-    if (CheckError("Error while compressing")) {
-      return 0;
+    jpeg_write_raw_data(cinfo, planes, batch_size);
+    if (CheckError(context, "Error while compressing")) {
+      return false;
     }
 
     if (jpeg_done_) {
       ALOGV("%s: Cancel called, exiting early", __FUNCTION__);
-      jpeg_finish_compress(cinfo.get());
-      return 0;
+      jpeg_abort_compress(cinfo);
+      return false;
     }
   }
 
-  jpeg_finish_compress(cinfo.get());
-  if (CheckError("Error while finishing compression")) {
+  jpeg_finish_compress(cinfo);
+  if (CheckError(context, "Error while finishing compression")) {
+    return false;
+  }
+
+  return true;
+}
+
+size_t JpegCompressor::CompressYUV420Frame(WorkerContext* context,
+                                           YUV420Frame frame) {
+  ATRACE_CALL();
+
+  if ((slice_pool_.get() != nullptr) &&
+      (frame.width * frame.height >= kMinSlicedPixelCount)) {
+    // One sliced frame at a time. Workers that find the slice pool busy
+    // encode in a single pass instead of waiting for it.
+    std::unique_lock<std::mutex> slice_lock(slice_mutex_, std::try_to_lock);
+    if (slice_lock.owns_lock()) {
+      return CompressYUV420FrameSliced(frame);
+    }
+  }
+
+  CustomJpegDestMgr dmgr;
+  dmgr.buffer = static_cast<JOCTET*>(frame.output_buffer);
+  dmgr.buffer_size = frame.output_buffer_size;
+  dmgr.growable_buffer = nullptr;
+  auto cinfo = context->cinfo.get();
+  SetDestination(cinfo, &dmgr);
+
+  if (!SetUpCompress(context, frame.width, frame.height)) {
+    return 0;
+  }
+
+  // Start compression
+  jpeg_start_compress(cinfo, TRUE);
+  if (CheckError(context, "Error starting compression")) {
+    return 0;
+  }
+
+  WriteAppMarkers(cinfo, frame);
+  if (!WriteRawRows(context, frame, /*row_begin*/ 0)) {
     return 0;
   }
 
   return dmgr.encoded_size;
 }
 
-bool JpegCompressor::CheckError(const char* msg) {
-  if (jpeg_error_info_) {
+size_t JpegCompressor::CompressYUV420FrameSliced(const YUV420Frame& frame) {
+  ATRACE_CALL();
+
+  // Every slice is encoded as a standalone image with a restart marker after
+  // each MCU row. Slices start at a multiple of 8 MCU rows, so their restart
+  // markers are numbered exactly as they would be in the full image. The
+  // first slice writes the headers, the others only contribute their scan
+  // data, separated by the restart marker the full image would have there.
+  slice_pool_->Render(
+      frame.height, kSliceRowAlignment,
+      [this, &frame](uint32_t band_idx, uint32_t row_begin, uint32_t row_end) {
+        auto& slice = *slices_[band_idx];
+        slice.row_begin = row_begin;
+        slice.encoded_size = 0;
+
+        CustomJpegDestMgr dmgr;
+        if (band_idx == 0) {
+          dmgr.buffer = static_cast<JOCTET*>(frame.output_buffer);
+          dmgr.buffer_size = frame.output_buffer_size;
+          dmgr.growable_buffer = nullptr;
+        } else {
+          if (slice.buffer.empty()) {
+            slice.buffer.resize(kMinSliceBufferSize);
+          }
+          dmgr.growable_buffer = &slice.buffer;
+        }
+        auto cinfo = slice.context.cinfo.get();
+        SetDestination(cinfo, &dmgr);
+
+        if (!SetUpCompress(&slice.context, frame.width,
+                           row_end - row_begin)) {
+          return;
+        }
+        cinfo->restart_in_rows = 1;
+
+        jpeg_start_compress(cinfo, TRUE);
+        if (CheckError(&slice.context, "Error starting compression")) {
+          return;
+        }
+        if (band_idx == 0) {
+          WriteAppMarkers(cinfo, frame);
+        }
+        if (WriteRawRows(&slice.context, frame, row_begin)) {
+          slice.encoded_size = dmgr.encoded_size;
+        }
+      });
+
+  uint32_t slice_count =
+      slice_pool_->GetBandCount(frame.height, kSliceRowAlignment);
+  for (uint32_t i = 0; i < slice_count; i++) {
+    if (slices_[i]->encoded_size < 2) {
+      return 0;
+    }
+  }
+
+  // The first slice is already in place. Fix up its frame height and
+  // replace its EOI with the scan data of the remaining slices.
+  uint8_t* output = frame.output_buffer;
+  size_t sof_offset = FindMarker(output, slices_[0]->encoded_size, kMarkerSOF0);
+  if (sof_offset == 0) {
+    ALOGE("%s: Frame header not found", __FUNCTION__);
+    return 0;
+  }
+  output[sof_offset + 5] = (frame.height >> 8) & 0xFF;
+  output[sof_offset + 6] = frame.height & 0xFF;
+
+  size_t offset = slices_[0]->encoded_size - 2;
+  for (uint32_t i = 1; i < slice_count; i++) {
+    const auto& slice = *slices_[i];
+    const uint8_t* data = slice.buffer.data();
+    size_t sos_offset = FindMarker(data, slice.encoded_size, kMarkerSOS);
+    if (sos_offset == 0) {
+      ALOGE("%s: Scan header of slice %u not found", __FUNCTION__, i);
+      return 0;
+    }
+    size_t scan_begin =
+        sos_offset + 2 + ((data[sos_offset + 2] << 8) | data[sos_offset + 3]);
+    size_t scan_size = slice.encoded_size - 2 - scan_begin;
+    if (offset + 2 + scan_size + 2 > frame.output_buffer_size) {
+      ALOGE("%s: Out of buffer", __FUNCTION__);
+      return 0;
+    }
+
+    uint32_t mcu_row = slice.row_begin / (DCTSIZE * 2);
+    output[offset++] = 0xFF;
+    output[offset++] = JPEG_RST0 + ((mcu_row - 1) % 8);
+    memcpy(output + offset, data + scan_begin, scan_size);
+    offset += scan_size;
+  }
+  output[offset++] = 0xFF;
+  output[offset++] = JPEG_EOI;
+
+  return offset;
+}
+
+size_t JpegCompressor::FindMarker(const uint8_t* data, size_t size,
+                                  uint8_t marker) {
+  // Walk the marker segments following SOI until the scan data starts
+  size_t offset = 2;
+  while (offset + 4 <= size) {
+    if (data[offset] != 0xFF) {
+      return 0;
+    }
+    if (data[offset + 1] == marker) {
+      return offset;
+    }
+    if (data[offset + 1] == kMarkerSOS) {
+      return 0;
+    }
+    offset += 2 + ((data[offset + 2] << 8) | data[offset + 3]);
+  }
+
+  return 0;
+}
+
+bool JpegCompressor::CheckError(WorkerContext* context, const char* msg) {
+  if (context->error_info) {
     char err_buffer[JMSG_LENGTH_MAX];
-    jpeg_error_info_->err->format_message(jpeg_error_info_, err_buffer);
+    context->error_info->err->format_message(context->error_info, err_buffer);
     ALOGE("%s: %s: %s", __FUNCTION__, msg, err_buffer);
-    jpeg_error_info_ = NULL;
+    context->error_info = nullptr;
     return true;
   }
 
@@ -18,11 +18,15 @@
 #define HW_EMULATOR_CAMERA_JPEG_H
 
 #include <hwl_types.h>
+#include <utils/Timers.h>
 
+#include <atomic>
 #include <condition_variable>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <vector>
 
 #include "Base.h"
 
@@ -30,7 +34,18 @@ extern "C" {
 #include <jpeglib.h>
 }
 
+template <>
+struct std::default_delete<jpeg_compress_struct> {
+  inline void operator()(jpeg_compress_struct* cinfo) const {
+    if (cinfo != nullptr) {
+      jpeg_destroy_compress(cinfo);
+      delete cinfo;
+    }
+  }
+};
+
 #include "utils/ExifUtils.h"
+#include "utils/ReadoutThreadPool.h"
 
 namespace android {
 
@@ -66,22 +81,152 @@ struct JpegYUV420Job {
 
 class JpegCompressor {
  public:
-  JpegCompressor();
+  // Encoder statistics, meant to help sizing the worker pool.
+  struct Stats {
+    uint64_t completed_jobs = 0;
+    // Tasks waiting for a worker, current and highest seen. A job with an
+    // EXIF thumbnail may be split in two tasks, see QueueYUV420().
+    size_t queue_depth = 0;
+    size_t max_queue_depth = 0;
+    // Time from QueueYUV420() until a worker picks up the job
+    nsecs_t total_queue_time = 0;
+    // Time spent encoding, including thumbnail and EXIF
+    nsecs_t total_encode_time = 0;
+    nsecs_t max_encode_time = 0;
+  };
+
+  // 'thread_count' workers encode concurrently. A value of 0 selects the
+  // number of online cores, up to kMaxThreadCount.
+  // Large frames are split in horizontal slices that 'slice_thread_count'
+  // threads encode in parallel. A value of 0 selects the number of online
+  // cores, 1 disables slicing.
+  explicit JpegCompressor(uint32_t thread_count = 1,
+                          uint32_t slice_thread_count = 1);
   virtual ~JpegCompressor();
 
+  static const uint32_t kMaxThreadCount = 4;
+
+  // Jobs complete, that is release their output buffer, in the order they
+  // were queued regardless of which worker encodes them. With more than one
+  // worker the thumbnail and APP1 marker of a job are generated concurrently
+  // with its main image.
   status_t QueueYUV420(std::unique_ptr<JpegYUV420Job> job);
 
+  // Aborts the ongoing compressions and fails all pending jobs. Blocks until
+  // every job queued so far has completed.
+  void Flush();
+
+  uint32_t GetThreadCount() const {
+    return workers_.size();
+  }
+
+  Stats GetStats();
+
  private:
+  // libjpeg state of a worker, reused for every job it encodes
+  struct WorkerContext {
+    std::unique_ptr<jpeg_compress_struct> cinfo;
+    jpeg_error_mgr error_mgr;
+    j_common_ptr error_info = nullptr;
+    // Downscaled thumbnail input
+    std::vector<uint8_t> thumbnail_yuv;
+  };
+
+  // Restart interval slice of a frame, see CompressYUV420FrameSliced()
+  struct Slice {
+    WorkerContext context;
+    std::vector<uint8_t> buffer;
+    uint32_t row_begin = 0;
+    size_t encoded_size = 0;
+  };
+
+  struct CustomJpegDestMgr : public jpeg_destination_mgr {
+    JOCTET* buffer;
+    size_t buffer_size;
+    size_t encoded_size;
+    // Grows on demand, used instead of 'buffer' when set
+    std::vector<uint8_t>* growable_buffer;
+  };
+
+  enum class TaskType {
+    kFull,       // Thumbnail, APP1 and main image in sequence
+    kThumbnail,  // Thumbnail and APP1 only
+    kMainImage,  // Main image only, APP1 is spliced in afterwards
+  };
+
+  struct JobState {
+    uint64_t sequence;
+    nsecs_t queue_time;
+    nsecs_t start_time = 0;
+    std::unique_ptr<JpegYUV420Job> job;
+    bool split = false;
+    // Guarded by 'mutex_'
+    uint32_t pending_tasks = 1;
+    bool canceled = false;
+    // Task results
+    const uint8_t* app1_buffer = nullptr;
+    size_t app1_buffer_size = 0;
+    size_t encoded_size = 0;
+  };
+
+  struct PendingTask {
+    TaskType type;
+    std::shared_ptr<JobState> state;
+  };
+
   std::mutex mutex_;
   std::condition_variable condition_;
+  std::condition_variable idle_condition_;
+  bool exit_ = false;
+  // Makes the workers abort the current compression
   std::atomic_bool jpeg_done_ = false;
-  std::thread jpeg_processing_thread_;
-  std::queue<std::unique_ptr<JpegYUV420Job>> pending_yuv_jobs_;
+  std::vector<std::thread> workers_;
+  std::queue<PendingTask> pending_tasks_;
+  // Tasks being worked on
+  size_t active_tasks_ = 0;
+  uint64_t next_sequence_ = 0;
+  Stats stats_;
+
+  // Encoded jobs waiting for their predecessors. 'release_mutex_' serializes
+  // returning the buffers so that they go out in sequence order.
+  std::mutex release_mutex_;
+  std::map<uint64_t, std::unique_ptr<JpegYUV420Job>> completed_jobs_;
+  uint64_t next_release_sequence_ = 0;
+
+  // Only one frame at a time can use the slice pool
+  std::mutex slice_mutex_;
+  std::unique_ptr<ReadoutThreadPool> slice_pool_;
+  std::vector<std::unique_ptr<Slice>> slices_;
+
+  // Encoded thumbnails, reused across jobs
+  std::mutex thumbnail_mutex_;
+  std::vector<std::unique_ptr<uint8_t[]>> thumbnail_buffers_;
+
   std::string exif_make_, exif_model_;
 
-  j_common_ptr jpeg_error_info_;
-  bool CheckError(const char* msg);
-  void CompressYUV420(std::unique_ptr<JpegYUV420Job> job);
+  static void InitializeContext(WorkerContext* context);
+  bool CheckError(WorkerContext* context, const char* msg);
+  void RunTask(WorkerContext* context, const PendingTask& task);
+  // Called once all tasks of a job are done
+  void CompleteJob(const std::shared_ptr<JobState>& state);
+  // Encodes the thumbnail and builds the APP1 marker. On success the marker
+  // is owned by the job's ExifUtils.
+  void GenerateApp1(WorkerContext* context, JpegYUV420Job* job,
+                    const uint8_t** app1_buffer /*out*/,
+                    size_t* app1_buffer_size /*out*/);
+  // Encodes the main image at 'offset' bytes into the output buffer
+  size_t CompressMainImage(WorkerContext* context, JpegYUV420Job* job,
+                           size_t offset, const uint8_t* app1_buffer,
+                           size_t app1_buffer_size);
+  // Moves an image encoded at kApp1ReserveSize to the start of 'buffer' and
+  // inserts the APP1 marker in the place libjpeg would have written it.
+  static size_t SpliceApp1(uint8_t* buffer, size_t encoded_size,
+                           const uint8_t* app1_buffer,
+                           size_t app1_buffer_size);
+  // Sets the buffer status and the blob header
+  static void FinishJob(JpegYUV420Job* job, size_t encoded_size);
+  std::unique_ptr<uint8_t[]> AcquireThumbnailBuffer();
+  void ReturnThumbnailBuffer(std::unique_ptr<uint8_t[]> buffer);
   struct YUV420Frame {
     uint8_t* output_buffer;
     size_t output_buffer_size;
@@ -92,8 +237,22 @@ class JpegCompressor {
     size_t app1_buffer_size;
     int32_t color_space;
   };
-  size_t CompressYUV420Frame(YUV420Frame frame);
+  size_t CompressYUV420Frame(WorkerContext* context, YUV420Frame frame);
+  size_t CompressYUV420FrameSliced(const YUV420Frame& frame);
+  static void SetDestination(j_compress_ptr cinfo, CustomJpegDestMgr* dmgr);
+  bool SetUpCompress(WorkerContext* context, size_t width, size_t height);
+  static void WriteAppMarkers(j_compress_ptr cinfo, const YUV420Frame& frame);
+  // Feeds the rows of 'frame' starting at 'row_begin' to the compressor and
+  // finishes the compression.
+  bool WriteRawRows(WorkerContext* context, const YUV420Frame& frame,
+                    size_t row_begin);
+  // Returns the offset of 'marker' among the segments in front of the scan
+  // data, or 0 if there is none.
+  static size_t FindMarker(const uint8_t* data, size_t size, uint8_t marker);
   void ThreadLoop();
+  // Returns the output buffers of all completed jobs whose predecessors
+  // completed as well.
+  void ReleaseCompletedJobs();
 
   JpegCompressor(const JpegCompressor&) = delete;
   JpegCompressor& operator=(const JpegCompressor&) = delete;
@@ -101,14 +260,4 @@ class JpegCompressor {
 
 }  // namespace android
 
-template <>
-struct std::default_delete<jpeg_compress_struct> {
-  inline void operator()(jpeg_compress_struct* cinfo) const {
-    if (cinfo != nullptr) {
-      jpeg_destroy_compress(cinfo);
-      delete cinfo;
-    }
-  }
-};
-
 #endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+#include "EmulatedScene.h"
+
+namespace android {
+
+// Sensor size of the emulated back camera
+static constexpr int kSensorWidth = 4032;
+static constexpr int kSensorHeight = 3024;
+static constexpr float kSensorSensitivity = 3846.f;  // electrons per lux-sec
+
+static std::unique_ptr<EmulatedScene> CreateScene() {
+  auto scene = std::make_unique<EmulatedScene>(
+      kSensorWidth, kSensorHeight, kSensorSensitivity, /*sensor_orientation*/ 0,
+      /*is_front_facing*/ false);
+  scene->SetTestPattern(false);
+  scene->CalculateScene(/*time*/ 0, /*handshake_divider*/ 1);
+  return scene;
+}
+
+// Reads out a full frame one pixel at a time, the way Capture* used to
+static void BM_ScenePerPixelCursor(benchmark::State& state) {
+  auto scene = CreateScene();
+  std::vector<uint32_t> out(kSensorWidth);
+  for (auto _ : state) {
+    for (int y = 0; y < kSensorHeight; y++) {
+      for (int x = 0; x < kSensorWidth; x++) {
+        scene->SetReadoutPixel(x, y);
+        out[x] = scene->GetPixelElectrons()[EmulatedScene::Gr];
+      }
+      benchmark::DoNotOptimize(out.data());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kSensorWidth * kSensorHeight);
+}
+BENCHMARK(BM_ScenePerPixelCursor);
+
+// Reads out a full frame using the auto-incrementing cursor
+static void BM_SceneStreamingCursor(benchmark::State& state) {
+  auto scene = CreateScene();
+  std::vector<uint32_t> out(kSensorWidth);
+  for (auto _ : state) {
+    for (int y = 0; y < kSensorHeight; y++) {
+      scene->SetReadoutPixel(0, y);
+      for (int x = 0; x < kSensorWidth; x++) {
+        out[x] = scene->GetPixelElectrons()[EmulatedScene::Gr];
+      }
+      benchmark::DoNotOptimize(out.data());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kSensorWidth * kSensorHeight);
+}
+BENCHMARK(BM_SceneStreamingCursor);
+
+// Reads out a full frame one row at a time into a structure of arrays
+static void BM_SceneRowSpan(benchmark::State& state) {
+  auto scene = CreateScene();
+  std::vector<uint32_t> electrons(4 * kSensorWidth);
+  EmulatedScene::ElectronSpan span = {
+      .r = electrons.data(),
+      .gr = electrons.data() + kSensorWidth,
+      .gb = electrons.data() + 2 * kSensorWidth,
+      .b = electrons.data() + 3 * kSensorWidth};
+  for (auto _ : state) {
+    for (int y = 0; y < kSensorHeight; y++) {
+      scene->GetRowElectrons(/*x*/ 0, y, kSensorWidth, span);
+      benchmark::DoNotOptimize(electrons.data());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kSensorWidth * kSensorHeight);
+}
+BENCHMARK(BM_SceneRowSpan);
+
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FenceReactorTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include "utils/FenceReactor.h"
+
+namespace android {
+
+// eventfd stands in for a sync_file, both become readable once signaled.
+class FenceReactorTests : public ::testing::Test {
+ protected:
+  void TearDown() override {
+    for (int fd : fences_) {
+      reactor_.Unwatch(fd);
+      close(fd);
+    }
+  }
+
+  int CreateFence() {
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(reactor_.Watch(fd), OK);
+    fences_.push_back(fd);
+    return fd;
+  }
+
+  static void Signal(int fd) {
+    uint64_t value = 1;
+    ASSERT_EQ(write(fd, &value, sizeof(value)),
+              static_cast<ssize_t>(sizeof(value)));
+  }
+
+  FenceReactor reactor_;
+  std::vector<int> fences_;
+};
+
+TEST_F(FenceReactorTests, SignaledFenceDoesNotWaitForOthers) {
+  int slow = CreateFence();
+  int fast = CreateFence();
+  Signal(fast);
+
+  EXPECT_EQ(reactor_.WaitForFences({fast}, ms2ns(1000)), OK);
+  EXPECT_TRUE(reactor_.IsSignaled(fast));
+  EXPECT_FALSE(reactor_.IsSignaled(slow));
+
+  // Both together time out on the slow one, the fast one stays ready
+  EXPECT_EQ(reactor_.WaitForFences({slow, fast}, ms2ns(10)), TIMED_OUT);
+  EXPECT_TRUE(reactor_.IsSignaled(fast));
+
+  Signal(slow);
+  EXPECT_EQ(reactor_.WaitForFences({slow, fast}, ms2ns(1000)), OK);
+}
+
+TEST_F(FenceReactorTests, WaitResolvesOtherFences) {
+  int first = CreateFence();
+  int second = CreateFence();
+  Signal(second);
+  Signal(first);
+
+  // A fence that signaled while waiting on another one is already known
+  EXPECT_EQ(reactor_.WaitForFences({first}, ms2ns(1000)), OK);
+  EXPECT_EQ(reactor_.WaitForFences({second}, 0), OK);
+}
+
+TEST_F(FenceReactorTests, SignalWakesWaiter) {
+  int fence = CreateFence();
+  std::thread signaler([fence] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    Signal(fence);
+  });
+
+  nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+  EXPECT_EQ(reactor_.WaitForFences({fence}, ms2ns(5000)), OK);
+  EXPECT_LT(systemTime(SYSTEM_TIME_MONOTONIC) - start, ms2ns(5000));
+  signaler.join();
+}
+
+// A flush interrupts the wait on a fence that is still unsignaled
+TEST_F(FenceReactorTests, InterruptWakesWaiter) {
+  int fence = CreateFence();
+  std::thread interrupter([this] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    reactor_.Interrupt();
+  });
+
+  nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+  EXPECT_EQ(reactor_.WaitForFences({fence}, ms2ns(5000)), INVALID_OPERATION);
+  EXPECT_LT(systemTime(SYSTEM_TIME_MONOTONIC) - start, ms2ns(5000));
+  interrupter.join();
+  EXPECT_FALSE(reactor_.IsSignaled(fence));
+
+  // Later waits fail as well until the interrupt is cleared
+  EXPECT_EQ(reactor_.WaitForFences({fence}, ms2ns(5000)), INVALID_OPERATION);
+  reactor_.ClearInterrupt();
+  start = systemTime(SYSTEM_TIME_MONOTONIC);
+  EXPECT_EQ(reactor_.WaitForFences({fence}, ms2ns(20)), TIMED_OUT);
+  EXPECT_GE(systemTime(SYSTEM_TIME_MONOTONIC) - start, ms2ns(20));
+
+  Signal(fence);
+  EXPECT_EQ(reactor_.WaitForFences({fence}, ms2ns(1000)), OK);
+}
+
+TEST_F(FenceReactorTests, UnwatchedFence) {
+  int fence = CreateFence();
+  Signal(fence);
+  reactor_.Unwatch(fence);
+  EXPECT_FALSE(reactor_.IsSignaled(fence));
+  EXPECT_EQ(reactor_.WaitForFences({fence}, 0), BAD_VALUE);
+  EXPECT_EQ(reactor_.Watch(-1), BAD_VALUE);
+}
+
+}  // namespace android
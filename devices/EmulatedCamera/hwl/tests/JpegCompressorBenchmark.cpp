@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "JpegCompressor.h"
+
+namespace android {
+
+// Sensor size of the emulated back camera
+static constexpr uint32_t kSensorWidth = 4032;
+static constexpr uint32_t kSensorHeight = 3024;
+
+namespace {
+
+// Signals when the compressor returns it
+struct BenchmarkSensorBuffer : public SensorBuffer {
+  BenchmarkSensorBuffer(std::vector<uint8_t>* storage, std::mutex* mutex,
+                        std::condition_variable* condition, bool* done)
+      : mutex_(mutex), condition_(condition), done_(done) {
+    format = PixelFormat::BLOB;
+    dataSpace = HAL_DATASPACE_V0_JFIF;
+    plane.img.img = storage->data();
+    plane.img.buffer_size = storage->size();
+  }
+
+  ~BenchmarkSensorBuffer() override {
+    std::lock_guard<std::mutex> lock(*mutex_);
+    *done_ = true;
+    condition_->notify_one();
+  }
+
+  std::mutex* mutex_;
+  std::condition_variable* condition_;
+  bool* done_;
+};
+
+}  // namespace
+
+// Time from queueing a full resolution frame until its buffer returns
+static void BM_JpegSnapshot(benchmark::State& state) {
+  JpegCompressor compressor(/*thread_count*/ 1,
+                            /*slice_thread_count*/ state.range(0));
+  std::vector<uint8_t> yuv((kSensorWidth * kSensorHeight * 3) / 2);
+  for (size_t i = 0; i < yuv.size(); i++) {
+    yuv[i] = (i * 7) ^ (i >> 11);
+  }
+  std::vector<uint8_t> output(kSensorWidth * kSensorHeight * 3);
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  for (auto _ : state) {
+    bool done = false;
+    auto job = std::make_unique<JpegYUV420Job>();
+    job->input = std::make_unique<JpegYUV420Input>();
+    job->input->width = kSensorWidth;
+    job->input->height = kSensorHeight;
+    job->input->color_space = 0;
+    job->input->yuv_planes = {
+        .img_y = yuv.data(),
+        .img_cb = yuv.data() + kSensorWidth * kSensorHeight,
+        .img_cr = yuv.data() + (kSensorWidth * kSensorHeight * 5) / 4,
+        .y_stride = kSensorWidth,
+        .cbcr_stride = kSensorWidth / 2,
+        .cbcr_step = 1};
+    job->output = std::make_unique<BenchmarkSensorBuffer>(&output, &mutex,
+                                                          &condition, &done);
+    compressor.QueueYUV420(std::move(job));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&done] { return done; });
+  }
+  state.SetItemsProcessed(state.iterations() * kSensorWidth * kSensorHeight);
+}
+BENCHMARK(BM_JpegSnapshot)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "JpegCompressorTests"
+#include <log/log.h>
+
+#include <camera_blob.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "JpegCompressor.h"
+
+namespace android {
+
+using google_camera_hal::CameraBlob;
+using google_camera_hal::CameraBlobId;
+
+namespace {
+
+// Records the order in which the compressor returns its output buffers
+struct ReleaseLog {
+  std::mutex mutex;
+  std::vector<uint32_t> frame_numbers;
+  std::vector<BufferStatus> statuses;
+  std::vector<std::vector<uint8_t>> outputs;
+
+  void WaitForReleases(size_t count) {
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (frame_numbers.size() >= count) {
+          return;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+};
+
+struct TestSensorBuffer : public SensorBuffer {
+  TestSensorBuffer(ReleaseLog* log, uint32_t frame, size_t size)
+      : log_(log), storage(size) {
+    frame_number = frame;
+    format = PixelFormat::BLOB;
+    dataSpace = HAL_DATASPACE_V0_JFIF;
+    plane.img.img = storage.data();
+    plane.img.buffer_size = size;
+  }
+
+  ~TestSensorBuffer() override {
+    std::lock_guard<std::mutex> lock(log_->mutex);
+    log_->frame_numbers.push_back(frame_number);
+    log_->statuses.push_back(stream_buffer.status);
+    log_->outputs.push_back(std::move(storage));
+  }
+
+  ReleaseLog* log_;
+  std::vector<uint8_t> storage;
+};
+
+// Produces an APP1 payload that embeds the thumbnail as is
+class FakeExifUtils : public ExifUtils {
+ public:
+  bool Initialize() override {
+    return true;
+  }
+  bool SetFromMetadata(const HalCameraMetadata&, size_t, size_t) override {
+    return true;
+  }
+  bool SetAperture(float) override {
+    return true;
+  }
+  bool SetColorSpace(uint16_t) override {
+    return true;
+  }
+  bool SetDateTime(const struct tm&) override {
+    return true;
+  }
+  bool SetMake(const std::string&) override {
+    return true;
+  }
+  bool SetModel(const std::string&) override {
+    return true;
+  }
+  bool SetDigitalZoomRatio(uint32_t, uint32_t, uint32_t, uint32_t) override {
+    return true;
+  }
+  bool SetExposureBias(int32_t, uint32_t, uint32_t) override {
+    return true;
+  }
+  bool SetExposureMode(uint8_t) override {
+    return true;
+  }
+  bool SetExposureTime(float) override {
+    return true;
+  }
+  bool SetFlash(uint8_t, uint8_t, uint8_t) override {
+    return true;
+  }
+  bool SetFNumber(float) override {
+    return true;
+  }
+  bool SetFocalLength(float) override {
+    return true;
+  }
+  bool SetFocalLengthIn35mmFilm(float, float, float) override {
+    return true;
+  }
+  bool SetGpsAltitude(double) override {
+    return true;
+  }
+  bool SetGpsLatitude(double) override {
+    return true;
+  }
+  bool SetGpsLongitude(double) override {
+    return true;
+  }
+  bool SetGpsProcessingMethod(const std::string&) override {
+    return true;
+  }
+  bool SetGpsTimestamp(const struct tm&) override {
+    return true;
+  }
+  bool SetImageHeight(uint32_t) override {
+    return true;
+  }
+  bool SetImageWidth(uint32_t) override {
+    return true;
+  }
+  bool SetIsoSpeedRating(uint16_t) override {
+    return true;
+  }
+  bool SetMaxAperture(float) override {
+    return true;
+  }
+  bool SetOrientation(uint16_t) override {
+    return true;
+  }
+  bool SetOrientationValue(ExifOrientation) override {
+    return true;
+  }
+  bool SetShutterSpeed(float) override {
+    return true;
+  }
+  bool SetSubjectDistance(float) override {
+    return true;
+  }
+  bool SetSubsecTime(const std::string&) override {
+    return true;
+  }
+  bool SetWhiteBalance(uint8_t) override {
+    return true;
+  }
+  bool GenerateApp1(unsigned char* thumbnail_buffer, uint32_t size) override {
+    const char header[] = "Exif\0";
+    app1_.assign(header, header + sizeof(header));
+    if (thumbnail_buffer != nullptr) {
+      app1_.insert(app1_.end(), thumbnail_buffer, thumbnail_buffer + size);
+    }
+    return true;
+  }
+  const uint8_t* GetApp1Buffer() override {
+    return app1_.data();
+  }
+  unsigned int GetApp1Length() override {
+    return app1_.size();
+  }
+
+ private:
+  std::vector<uint8_t> app1_;
+};
+
+std::unique_ptr<JpegYUV420Job> CreateJob(ReleaseLog* log, uint32_t frame,
+                                         uint32_t width, uint32_t height) {
+  auto input = std::make_unique<JpegYUV420Input>();
+  input->width = width;
+  input->height = height;
+  input->color_space = 0;
+  auto img = new uint8_t[(width * height * 3) / 2];
+  for (size_t i = 0; i < (width * height * 3) / 2; i++) {
+    img[i] = (i * 7 + frame) & 0xFF;
+  }
+  input->yuv_planes = {.img_y = img,
+                       .img_cb = img + width * height,
+                       .img_cr = img + (width * height * 5) / 4,
+                       .y_stride = width,
+                       .cbcr_stride = width / 2,
+                       .cbcr_step = 1};
+  input->buffer_owner = true;
+
+  auto job = std::make_unique<JpegYUV420Job>();
+  job->input = std::move(input);
+  job->output = std::make_unique<TestSensorBuffer>(log, frame,
+                                                   width * height * 2);
+  job->output->stream_buffer.status = BufferStatus::kError;
+  return job;
+}
+
+std::vector<uint8_t> EncodeFrame(JpegCompressor* compressor, uint32_t width,
+                                 uint32_t height) {
+  ReleaseLog log;
+  EXPECT_EQ(compressor->QueueYUV420(CreateJob(&log, 0, width, height)), OK);
+  log.WaitForReleases(1);
+
+  std::lock_guard<std::mutex> lock(log.mutex);
+  EXPECT_EQ(log.statuses[0], BufferStatus::kOk);
+  auto& output = log.outputs[0];
+  auto blob = reinterpret_cast<const CameraBlob*>(
+      output.data() + output.size() - sizeof(CameraBlob));
+  output.resize(blob->blob_size);
+  return std::move(output);
+}
+
+// Decodes 'jpeg' to interleaved YCbCr
+std::vector<uint8_t> DecodeFrame(const std::vector<uint8_t>& jpeg,
+                                 uint32_t* width, uint32_t* height) {
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, jpeg.data(), jpeg.size());
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_YCbCr;
+  jpeg_start_decompress(&cinfo);
+  *width = cinfo.output_width;
+  *height = cinfo.output_height;
+
+  size_t row_size = cinfo.output_width * cinfo.output_components;
+  std::vector<uint8_t> pixels(row_size * cinfo.output_height);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = pixels.data() + cinfo.output_scanline * row_size;
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  EXPECT_EQ(jerr.num_warnings, 0);
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+
+  return pixels;
+}
+
+std::unique_ptr<JpegYUV420Job> CreateExifJob(ReleaseLog* log, uint32_t frame,
+                                             uint32_t width, uint32_t height) {
+  auto job = CreateJob(log, frame, width, height);
+  job->exif_utils = std::make_unique<FakeExifUtils>();
+  job->result_metadata = HalCameraMetadata::Create(1, 10);
+  const int32_t thumbnail_size[] = {320, 240};
+  job->result_metadata->Set(ANDROID_JPEG_THUMBNAIL_SIZE, thumbnail_size, 2);
+  return job;
+}
+
+bool HasMarker(const std::vector<uint8_t>& jpeg, uint8_t marker) {
+  for (size_t i = 0; i + 1 < jpeg.size(); i++) {
+    if ((jpeg[i] == 0xFF) && (jpeg[i + 1] == marker)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+TEST(JpegCompressorTests, EncodesValidJpeg) {
+  ReleaseLog log;
+  JpegCompressor compressor(/*thread_count*/ 1);
+  ASSERT_EQ(compressor.QueueYUV420(CreateJob(&log, /*frame*/ 1, 320, 240)),
+            OK);
+  log.WaitForReleases(1);
+
+  std::lock_guard<std::mutex> lock(log.mutex);
+  EXPECT_EQ(log.frame_numbers[0], 1u);
+  ASSERT_EQ(log.statuses[0], BufferStatus::kOk);
+  const auto& output = log.outputs[0];
+  auto blob = reinterpret_cast<const CameraBlob*>(
+      output.data() + output.size() - sizeof(CameraBlob));
+  EXPECT_EQ(blob->blob_id, CameraBlobId::JPEG);
+  ASSERT_GT(blob->blob_size, 4u);
+  ASSERT_LT(blob->blob_size, output.size());
+  // SOI and EOI markers
+  EXPECT_EQ(output[0], 0xFF);
+  EXPECT_EQ(output[1], 0xD8);
+  EXPECT_EQ(output[blob->blob_size - 2], 0xFF);
+  EXPECT_EQ(output[blob->blob_size - 1], 0xD9);
+}
+
+TEST(JpegCompressorTests, CompletesInQueueOrder) {
+  ReleaseLog log;
+  const uint32_t frame_count = 24;
+  JpegCompressor compressor(/*thread_count*/ 4);
+  EXPECT_EQ(compressor.GetThreadCount(), 4u);
+
+  for (uint32_t frame = 0; frame < frame_count; frame++) {
+    // Alternate sizes so that workers finish out of order
+    uint32_t width = (frame % 3 == 0) ? 1280 : 64;
+    uint32_t height = (frame % 3 == 0) ? 960 : 48;
+    ASSERT_EQ(compressor.QueueYUV420(CreateJob(&log, frame, width, height)),
+              OK);
+  }
+  log.WaitForReleases(frame_count);
+
+  std::lock_guard<std::mutex> lock(log.mutex);
+  ASSERT_EQ(log.frame_numbers.size(), frame_count);
+  for (uint32_t frame = 0; frame < frame_count; frame++) {
+    EXPECT_EQ(log.frame_numbers[frame], frame);
+    EXPECT_EQ(log.statuses[frame], BufferStatus::kOk);
+  }
+
+  auto stats = compressor.GetStats();
+  EXPECT_GE(stats.max_queue_depth, 1u);
+  EXPECT_EQ(stats.queue_depth, 0u);
+  EXPECT_GT(stats.total_encode_time, 0);
+  EXPECT_GE(stats.max_encode_time * frame_count, stats.total_encode_time);
+}
+
+TEST(JpegCompressorTests, FlushFailsPendingJobs) {
+  ReleaseLog log;
+  const uint32_t frame_count = 16;
+  JpegCompressor compressor(/*thread_count*/ 2);
+  for (uint32_t frame = 0; frame < frame_count; frame++) {
+    // Jobs with EXIF are split in two tasks
+    auto job = (frame % 2) ? CreateExifJob(&log, frame, 1920, 1080)
+                           : CreateJob(&log, frame, 1920, 1080);
+    ASSERT_EQ(compressor.QueueYUV420(std::move(job)), OK);
+  }
+  compressor.Flush();
+
+  {
+    // Every job is back, in order, once Flush() returns
+    std::lock_guard<std::mutex> lock(log.mutex);
+    ASSERT_EQ(log.frame_numbers.size(), frame_count);
+    for (uint32_t frame = 0; frame < frame_count; frame++) {
+      EXPECT_EQ(log.frame_numbers[frame], frame);
+    }
+    EXPECT_EQ(log.statuses.back(), BufferStatus::kError);
+  }
+
+  // The workers survive a flush
+  ASSERT_EQ(compressor.QueueYUV420(CreateJob(&log, frame_count, 64, 48)), OK);
+  log.WaitForReleases(frame_count + 1);
+  std::lock_guard<std::mutex> lock(log.mutex);
+  EXPECT_EQ(log.frame_numbers.back(), frame_count);
+  EXPECT_EQ(log.statuses.back(), BufferStatus::kOk);
+}
+
+TEST(JpegCompressorTests, SlicedMatchesSinglePass) {
+  JpegCompressor single_pass(/*thread_count*/ 1, /*slice_thread_count*/ 1);
+  JpegCompressor sliced(/*thread_count*/ 1, /*slice_thread_count*/ 4);
+
+  for (auto [width, height] : {std::pair{1920u, 1080u},
+                               std::pair{2048u, 1536u},
+                               std::pair{4000u, 3000u}}) {
+    auto reference = EncodeFrame(&single_pass, width, height);
+    auto jpeg = EncodeFrame(&sliced, width, height);
+    ASSERT_FALSE(reference.empty());
+    ASSERT_FALSE(jpeg.empty());
+    EXPECT_FALSE(HasMarker(reference, JPEG_RST0));
+    EXPECT_TRUE(HasMarker(jpeg, JPEG_RST0));
+    EXPECT_TRUE(HasMarker(jpeg, JPEG_RST0 + 7));
+    // The ICC profile goes with the headers of the first slice
+    EXPECT_TRUE(HasMarker(jpeg, JPEG_APP0 + 2));
+
+    // Restart markers don't change the coefficients, both decode the same
+    uint32_t reference_width, reference_height, decoded_width, decoded_height;
+    auto expected = DecodeFrame(reference, &reference_width,
+                                &reference_height);
+    auto decoded = DecodeFrame(jpeg, &decoded_width, &decoded_height);
+    EXPECT_EQ(decoded_width, width);
+    EXPECT_EQ(decoded_height, height);
+    EXPECT_TRUE(decoded == expected) << width << "x" << height;
+  }
+}
+
+TEST(JpegCompressorTests, ThumbnailOverlapsMainImage) {
+  const uint32_t frame_count = 6;
+  const uint32_t width = 1280, height = 720;
+  ReleaseLog sequential_log, split_log;
+  {
+    JpegCompressor sequential(/*thread_count*/ 1);
+    JpegCompressor split(/*thread_count*/ 3);
+    for (uint32_t frame = 0; frame < frame_count; frame++) {
+      ASSERT_EQ(sequential.QueueYUV420(
+                    CreateExifJob(&sequential_log, frame, width, height)),
+                OK);
+      ASSERT_EQ(split.QueueYUV420(
+                    CreateExifJob(&split_log, frame, width, height)),
+                OK);
+    }
+    sequential_log.WaitForReleases(frame_count);
+    split_log.WaitForReleases(frame_count);
+  }
+
+  // Splicing the APP1 marker in yields the same file a single pass writes
+  for (uint32_t frame = 0; frame < frame_count; frame++) {
+    EXPECT_EQ(split_log.frame_numbers[frame], frame);
+    ASSERT_EQ(split_log.statuses[frame], BufferStatus::kOk);
+    ASSERT_EQ(sequential_log.statuses[frame], BufferStatus::kOk);
+    const auto& expected = sequential_log.outputs[frame];
+    const auto& output = split_log.outputs[frame];
+    auto blob = reinterpret_cast<const CameraBlob*>(
+        output.data() + output.size() - sizeof(CameraBlob));
+    auto expected_blob = reinterpret_cast<const CameraBlob*>(
+        expected.data() + expected.size() - sizeof(CameraBlob));
+    ASSERT_EQ(blob->blob_size, expected_blob->blob_size);
+    EXPECT_TRUE(std::equal(output.begin(), output.begin() + blob->blob_size,
+                           expected.begin()));
+
+    std::vector<uint8_t> jpeg(output.begin(),
+                              output.begin() + blob->blob_size);
+    EXPECT_TRUE(HasMarker(jpeg, JPEG_APP0 + 1));
+    uint32_t decoded_width, decoded_height;
+    DecodeFrame(jpeg, &decoded_width, &decoded_height);
+    EXPECT_EQ(decoded_width, width);
+    EXPECT_EQ(decoded_height, height);
+  }
+}
+
+TEST(JpegCompressorTests, RejectsInvalidJobs) {
+  ReleaseLog log;
+  JpegCompressor compressor(/*thread_count*/ 1);
+  auto job = CreateJob(&log, /*frame*/ 0, 64, 48);
+  job->output->format = PixelFormat::YCBCR_420_888;
+  EXPECT_EQ(compressor.QueueYUV420(std::move(job)), BAD_VALUE);
+}
+
+}  // namespace android
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ScratchArenaTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include "utils/ScratchArena.h"
+
+namespace android {
+
+static bool IsAligned(const uint8_t* ptr) {
+  return (reinterpret_cast<uintptr_t>(ptr) % ScratchArena::kAlignment) == 0;
+}
+
+TEST(ScratchArenaTests, AllocationsAreAlignedAndDisjoint) {
+  ScratchArena arena;
+  arena.Reserve(4096);
+  EXPECT_GE(arena.GetCapacity(), 4096u);
+  EXPECT_EQ(arena.GetHeapAllocationCount(), 1u);
+
+  uint8_t* a = arena.Allocate(100);
+  uint8_t* b = arena.Allocate(1);
+  uint8_t* c = arena.Allocate(1000);
+  ASSERT_NE(a, nullptr);
+  EXPECT_TRUE(IsAligned(a));
+  EXPECT_TRUE(IsAligned(b));
+  EXPECT_TRUE(IsAligned(c));
+  EXPECT_GE(b, a + 100);
+  EXPECT_GE(c, b + 1);
+
+  // Writing all of them must not corrupt each other
+  memset(a, 0xA, 100);
+  memset(b, 0xB, 1);
+  memset(c, 0xC, 1000);
+  EXPECT_EQ(a[99], 0xA);
+  EXPECT_EQ(b[0], 0xB);
+  EXPECT_EQ(c[0], 0xC);
+  EXPECT_EQ(arena.GetHeapAllocationCount(), 1u);
+}
+
+TEST(ScratchArenaTests, ResetReusesMemory) {
+  ScratchArena arena;
+  arena.Reserve(1024);
+  uint8_t* first = arena.Allocate(512);
+  arena.Reset();
+  EXPECT_EQ(arena.Allocate(512), first);
+
+  // Reserving less than the current capacity keeps the block
+  arena.Reserve(256);
+  EXPECT_EQ(arena.Allocate(512), first);
+  EXPECT_EQ(arena.GetHeapAllocationCount(), 1u);
+}
+
+TEST(ScratchArenaTests, OverflowGrowsOnReset) {
+  ScratchArena arena;
+  arena.Reserve(256);
+  arena.Allocate(200);
+  uint8_t* overflow = arena.Allocate(1000);
+  ASSERT_NE(overflow, nullptr);
+  EXPECT_TRUE(IsAligned(overflow));
+  memset(overflow, 0, 1000);
+  EXPECT_EQ(arena.GetHeapAllocationCount(), 2u);
+
+  // The next frame with the same allocations fits in one block
+  arena.Reset();
+  EXPECT_GE(arena.GetCapacity(), 1200u);
+  EXPECT_EQ(arena.GetHeapAllocationCount(), 3u);
+  arena.Allocate(200);
+  arena.Allocate(1000);
+  arena.Reset();
+  EXPECT_EQ(arena.GetHeapAllocationCount(), 3u);
+}
+
+TEST(ScratchArenaTests, SteadyStateDoesNotAllocate) {
+  // Same pattern as a semi-planar reprocess in ProcessYUV420
+  const size_t width = 1920, height = 1080;
+  ScratchArena arena;
+  arena.Reserve(2 * ScratchArena::kAlignment + width * height);
+  uint64_t allocations = arena.GetHeapAllocationCount();
+
+  for (int frame = 0; frame < 100; frame++) {
+    arena.Reset();
+    uint8_t* input_uv = arena.Allocate(width * height / 2);
+    uint8_t* output_uv = arena.Allocate(width * height / 2);
+    memset(input_uv, frame, width * height / 2);
+    memset(output_uv, frame, width * height / 2);
+  }
+  EXPECT_EQ(arena.GetHeapAllocationCount(), allocations);
+}
+
+}  // namespace android
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SensorNoiseGeneratorTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+#include "utils/SensorNoiseGenerator.h"
+
+namespace android {
+
+static constexpr uint64_t kSeed = 0x123456789ABCDEF0;
+
+// Known answers from the Random123 distribution
+TEST(SensorNoiseGeneratorTests, PhiloxKnownAnswers) {
+  EXPECT_EQ(Philox4x32::Generate({0, 0, 0, 0}, {0, 0}),
+            (Philox4x32::Counter{0x6627e8d5, 0xe169c58d, 0xbc57ac4c,
+                                 0x9b00dbd8}));
+  EXPECT_EQ(Philox4x32::Generate(
+                {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+                {0xffffffff, 0xffffffff}),
+            (Philox4x32::Counter{0x408f276d, 0x41c83b0e, 0xa20bc7c6,
+                                 0x6d5451fd}));
+  EXPECT_EQ(Philox4x32::Generate(
+                {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+                {0xa4093822, 0x299f31d0}),
+            (Philox4x32::Counter{0xd16cfe09, 0x94fdcceb, 0x5001e420,
+                                 0x24126ea1}));
+}
+
+TEST(SensorNoiseGeneratorTests, RowsAreReproducible) {
+  SensorNoiseGenerator generator(kSeed);
+  const size_t width = 1003;
+  std::vector<float> first(width), second(width);
+
+  generator.FillGaussianRow(/*frame_number*/ 7, /*row*/ 12, width,
+                            first.data());
+  // Unrelated rows in between must not change the result
+  generator.FillGaussianRow(/*frame_number*/ 7, /*row*/ 13, width,
+                            second.data());
+  generator.FillGaussianRow(/*frame_number*/ 8, /*row*/ 12, width,
+                            second.data());
+  generator.FillGaussianRow(/*frame_number*/ 7, /*row*/ 12, width,
+                            second.data());
+  EXPECT_EQ(first, second);
+
+  SensorNoiseGenerator other_generator(kSeed);
+  other_generator.FillGaussianRow(/*frame_number*/ 7, /*row*/ 12, width,
+                                  second.data());
+  EXPECT_EQ(first, second);
+
+  // A shorter row is a prefix of a longer one
+  std::vector<float> prefix(width / 3);
+  generator.FillGaussianRow(/*frame_number*/ 7, /*row*/ 12, prefix.size(),
+                            prefix.data());
+  EXPECT_TRUE(std::equal(prefix.begin(), prefix.end(), first.begin()));
+}
+
+TEST(SensorNoiseGeneratorTests, RowsAreIndependent) {
+  SensorNoiseGenerator generator(kSeed);
+  const size_t width = 64;
+  std::vector<float> a(width), b(width), c(width);
+  generator.FillGaussianRow(/*frame_number*/ 1, /*row*/ 0, width, a.data());
+  generator.FillGaussianRow(/*frame_number*/ 1, /*row*/ 1, width, b.data());
+  generator.FillGaussianRow(/*frame_number*/ 2, /*row*/ 0, width, c.data());
+  EXPECT_NE(a, b);
+  EXPECT_NE(a, c);
+
+  SensorNoiseGenerator other_seed(kSeed + 1);
+  other_seed.FillGaussianRow(/*frame_number*/ 1, /*row*/ 0, width, b.data());
+  EXPECT_NE(a, b);
+}
+
+TEST(SensorNoiseGeneratorTests, SamplesAreStandardNormal) {
+  SensorNoiseGenerator generator(kSeed);
+  const size_t width = 4000;
+  const size_t rows = 250;
+  std::vector<float> samples(width);
+  double sum = 0, sum_sq = 0, sum_4 = 0;
+  size_t within_one_sigma = 0;
+  for (uint32_t row = 0; row < rows; row++) {
+    generator.FillGaussianRow(/*frame_number*/ 3, row, width, samples.data());
+    for (float sample : samples) {
+      ASSERT_TRUE(std::isfinite(sample));
+      sum += sample;
+      sum_sq += sample * sample;
+      sum_4 += sample * sample * sample * sample;
+      within_one_sigma += std::fabs(sample) < 1.0f ? 1 : 0;
+    }
+  }
+
+  const double n = width * rows;
+  double mean = sum / n;
+  double variance = sum_sq / n - mean * mean;
+  EXPECT_NEAR(mean, 0.0, 0.005);
+  EXPECT_NEAR(variance, 1.0, 0.01);
+  // Kurtosis of a normal distribution is 3, 1.8 for a uniform one
+  EXPECT_NEAR(sum_4 / n, 3.0, 0.05);
+  EXPECT_NEAR(within_one_sigma / n, 0.6827, 0.005);
+}
+
+TEST(SensorNoiseGeneratorTests, StddevTable) {
+  SensorNoiseGenerator generator(kSeed);
+  const float gain = 2.5f;
+  const float var_before_gain = 1.177f * 1.177f;
+  const float var_after_gain = 2.1f * 2.1f;
+  const uint32_t max_electrons = 2000;
+  generator.SetGain(gain, var_before_gain, var_after_gain, max_electrons);
+
+  for (uint32_t electrons : {0u, 1u, 100u, 1999u, 2000u}) {
+    float expected = std::sqrt(var_before_gain * gain * gain + var_after_gain +
+                               electrons * gain * gain);
+    EXPECT_FLOAT_EQ(generator.GetStddev(electrons), expected);
+  }
+  // Counts past saturation are clamped
+  EXPECT_EQ(generator.GetStddev(5000), generator.GetStddev(max_electrons));
+
+  float before = generator.GetStddev(100);
+  generator.SetGain(2 * gain, var_before_gain, var_after_gain, max_electrons);
+  EXPECT_GT(generator.GetStddev(100), before);
+}
+
+}  // namespace android
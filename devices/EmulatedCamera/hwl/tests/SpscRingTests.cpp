@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SpscRingTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+
+#include "utils/SpscRing.h"
+
+namespace android {
+
+TEST(SpscRingTests, PushUntilFull) {
+  SpscRing<std::unique_ptr<int>> ring(3);
+  EXPECT_EQ(ring.Capacity(), 3u);
+  EXPECT_EQ(ring.Size(), 0u);
+
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(ring.TryPush(std::make_unique<int>(i)));
+  }
+  EXPECT_EQ(ring.Size(), 3u);
+
+  // A rejected value must stay with the caller
+  auto extra = std::make_unique<int>(3);
+  EXPECT_FALSE(ring.TryPush(std::move(extra)));
+  ASSERT_NE(extra, nullptr);
+  EXPECT_EQ(*extra, 3);
+
+  std::unique_ptr<int> value;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(ring.TryPop(&value));
+    EXPECT_EQ(*value, i);
+  }
+  EXPECT_FALSE(ring.TryPop(&value));
+  EXPECT_EQ(ring.Size(), 0u);
+}
+
+TEST(SpscRingTests, WrapsAround) {
+  SpscRing<int> ring(2);
+  int value = -1;
+  for (int i = 0; i < 10; i++) {
+    ASSERT_TRUE(ring.TryPush(std::move(i)));
+    ASSERT_TRUE(ring.TryPop(&value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_EQ(ring.Size(), 0u);
+}
+
+TEST(SpscRingTests, ConcurrentProducerConsumer) {
+  const uint32_t kCount = 100000;
+  SpscRing<uint32_t> ring(3);
+
+  std::thread producer([&ring] {
+    for (uint32_t i = 0; i < kCount; i++) {
+      uint32_t value = i;
+      while (!ring.TryPush(std::move(value))) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  // Values must arrive in order, none lost or duplicated
+  uint32_t expected = 0;
+  while (expected < kCount) {
+    uint32_t value;
+    if (ring.TryPop(&value)) {
+      ASSERT_EQ(value, expected);
+      EXPECT_LE(ring.Size(), ring.Capacity());
+      expected++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_EQ(ring.Size(), 0u);
+}
+
+}  // namespace android
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "YCbCrRowConverterTests"
+#include <log/log.h>
+
+#include <endian.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "utils/YCbCrRowConverter.h"
+
+// Same rounding as the converter, see YCbCrRowConverter.cpp
+#ifdef __clang__
+#pragma clang fp contract(off)
+#endif
+
+namespace android {
+
+using Isa = YCbCrRowConverter::Isa;
+using TransferFunction = YCbCrRowConverter::TransferFunction;
+
+static constexpr int32_t kSaturationPoint = 64 * 255;
+
+enum class ChromaLayout { kI420, kNV12, kNV21 };
+
+// Per-pixel conversion as done by EmulatedSensor::CaptureYUV420 before the
+// row converter was introduced.
+static int32_t ReferenceGamma(int32_t value, TransferFunction transfer) {
+  float n_value = (static_cast<float>(value) / kSaturationPoint);
+  switch (transfer) {
+    case TransferFunction::kSRGB:
+      n_value = (n_value <= 0.0031308f)
+                    ? n_value * 12.92f
+                    : 1.055f * pow(n_value, 0.4166667f) - 0.055f;
+      break;
+    case TransferFunction::kSMPTE170M:
+      n_value = (n_value <= 0.018f) ? n_value * 4.5f
+                                    : 1.099f * pow(n_value, 0.45f) - 0.099f;
+      break;
+    case TransferFunction::kST2084: {
+      float c2 = 32.f * 2413.f / 4096.f;
+      float c3 = 32.f * 2392.f / 4096.f;
+      float c1 = c3 - c2 + 1.f;
+      float m = 128.f * 2523.f / 4096.f;
+      float n = 0.25f * 2610.f / 4096.f;
+      n_value =
+          pow((c1 + c2 * pow(n_value, n)) / (1 + c3 * pow(n_value, n)), m);
+      break;
+    }
+    case TransferFunction::kHLG:
+      n_value = 0.5f * pow(n_value, 0.5f);
+      break;
+  }
+  return n_value * kSaturationPoint;
+}
+
+static void ReferenceConvertRow(const YCbCrRowConverter::Params& params,
+                                const uint32_t* r, const uint32_t* g,
+                                const uint32_t* b, size_t width,
+                                const YCbCrRowConverter::Row& out) {
+  const int rgb_to_y[] = {19, 37, 7};
+  const int rgb_to_cb[] = {-10, -21, 32, 524288};
+  const int rgb_to_cr[] = {32, -26, -5, 524288};
+  const int scale_out_sq = 64 * 64;
+  const float* m = params.color_matrix;
+
+  uint8_t* px_y = out.y;
+  uint8_t* px_cb = out.cb;
+  uint8_t* px_cr = out.cr;
+  for (size_t out_x = 0; out_x < width; out_x++) {
+    uint32_t r_count = r[out_x] * params.scale64x;
+    uint32_t g_count = g[out_x] * params.scale64x;
+    uint32_t b_count = b[out_x] * params.scale64x;
+
+    if (params.apply_color_matrix) {
+      uint32_t rr = r_count;
+      uint32_t gg = g_count;
+      uint32_t bb = b_count;
+      r_count = (uint32_t)std::max(rr * m[0] + gg * m[1] + bb * m[2], 0.0f);
+      g_count = (uint32_t)std::max(rr * m[3] + gg * m[4] + bb * m[5], 0.0f);
+      b_count = (uint32_t)std::max(rr * m[6] + gg * m[7] + bb * m[8], 0.0f);
+    }
+
+    r_count = r_count < kSaturationPoint ? r_count : kSaturationPoint;
+    g_count = g_count < kSaturationPoint ? g_count : kSaturationPoint;
+    b_count = b_count < kSaturationPoint ? b_count : kSaturationPoint;
+
+    r_count = ReferenceGamma(r_count, params.transfer);
+    g_count = ReferenceGamma(g_count, params.transfer);
+    b_count = ReferenceGamma(b_count, params.transfer);
+
+    uint8_t y8 = (rgb_to_y[0] * r_count + rgb_to_y[1] * g_count +
+                  rgb_to_y[2] * b_count) /
+                 scale_out_sq;
+    if (params.bytes_per_pixel == 1) {
+      *px_y = y8;
+    } else {
+      *(reinterpret_cast<uint16_t*>(px_y)) = htole16(y8 << 8);
+    }
+    px_y += params.bytes_per_pixel;
+
+    if ((px_cb != nullptr) && (out_x % 2 == 0)) {
+      uint8_t cb8 = (rgb_to_cb[0] * r_count + rgb_to_cb[1] * g_count +
+                     rgb_to_cb[2] * b_count + rgb_to_cb[3]) /
+                    scale_out_sq;
+      uint8_t cr8 = (rgb_to_cr[0] * r_count + rgb_to_cr[1] * g_count +
+                     rgb_to_cr[2] * b_count + rgb_to_cr[3]) /
+                    scale_out_sq;
+      if (params.bytes_per_pixel == 1) {
+        *px_cb = cb8;
+        *px_cr = cr8;
+      } else {
+        *(reinterpret_cast<uint16_t*>(px_cb)) = htole16(cb8 << 8);
+        *(reinterpret_cast<uint16_t*>(px_cr)) = htole16(cr8 << 8);
+      }
+      px_cr += out.cbcr_step;
+      px_cb += out.cbcr_step;
+    }
+  }
+}
+
+// Output buffer of a single row with luma and chroma
+struct RowBuffer {
+  std::vector<uint8_t> y;
+  std::vector<uint8_t> chroma;
+  YCbCrRowConverter::Row row;
+
+  RowBuffer(size_t width, size_t bytes_per_pixel, ChromaLayout layout) {
+    size_t chroma_width = (width + 1) / 2;
+    y.resize(width * bytes_per_pixel, 0xAA);
+    chroma.resize(2 * chroma_width * bytes_per_pixel, 0xAA);
+    row.y = y.data();
+    switch (layout) {
+      case ChromaLayout::kI420:
+        row.cb = chroma.data();
+        row.cr = chroma.data() + chroma_width * bytes_per_pixel;
+        row.cbcr_step = bytes_per_pixel;
+        break;
+      case ChromaLayout::kNV12:
+        row.cb = chroma.data();
+        row.cr = chroma.data() + bytes_per_pixel;
+        row.cbcr_step = 2 * bytes_per_pixel;
+        break;
+      case ChromaLayout::kNV21:
+        row.cr = chroma.data();
+        row.cb = chroma.data() + bytes_per_pixel;
+        row.cbcr_step = 2 * bytes_per_pixel;
+        break;
+    }
+  }
+};
+
+static std::vector<Isa> GetSupportedIsas() {
+  std::vector<Isa> isas;
+  for (Isa isa : {Isa::kPortable, Isa::kSSE41, Isa::kAVX2, Isa::kNEON}) {
+    if (YCbCrRowConverter::IsIsaSupported(isa)) {
+      isas.push_back(isa);
+    }
+  }
+  return isas;
+}
+
+static YCbCrRowConverter::Params GetParams(TransferFunction transfer,
+                                           size_t bytes_per_pixel,
+                                           bool apply_color_matrix) {
+  YCbCrRowConverter::Params params;
+  // Gain of the default emulated back camera at ISO 100
+  params.scale64x = 64 * 255 / 1000;
+  params.transfer = transfer;
+  params.bytes_per_pixel = bytes_per_pixel;
+  params.apply_color_matrix = apply_color_matrix;
+  // sRGB to Display P3, including negative coefficients
+  const float color_matrix[] = {0.8225f, 0.1900f, -0.0125f,
+                                0.0332f, 0.9669f, 0.0000f,
+                                0.0171f, 0.0724f, 0.9108f};
+  std::copy(std::begin(color_matrix), std::end(color_matrix),
+            params.color_matrix);
+  return params;
+}
+
+// Electron counts covering the dark range, the knee of the curves and values
+// far past saturation.
+static void FillElectrons(size_t width, std::mt19937* engine,
+                          std::vector<uint32_t>* r, std::vector<uint32_t>* g,
+                          std::vector<uint32_t>* b) {
+  std::uniform_int_distribution<uint32_t> range(0, 3);
+  std::uniform_int_distribution<uint32_t> dark(0, 64);
+  std::uniform_int_distribution<uint32_t> mid(0, 1100);
+  std::uniform_int_distribution<uint32_t> bright(0, 1 << 24);
+  for (auto* channel : {r, g, b}) {
+    channel->resize(width);
+    for (auto& value : *channel) {
+      switch (range(*engine)) {
+        case 0:
+          value = dark(*engine);
+          break;
+        case 1:
+        case 2:
+          value = mid(*engine);
+          break;
+        default:
+          value = bright(*engine);
+      }
+    }
+  }
+}
+
+static void CompareWithReference(TransferFunction transfer,
+                                 size_t bytes_per_pixel,
+                                 bool apply_color_matrix) {
+  std::mt19937 engine(1234);
+  auto params = GetParams(transfer, bytes_per_pixel, apply_color_matrix);
+  for (size_t width : {1, 2, 7, 8, 15, 16, 17, 255, 256, 257, 641, 4032}) {
+    std::vector<uint32_t> r, g, b;
+    FillElectrons(width, &engine, &r, &g, &b);
+    for (auto layout :
+         {ChromaLayout::kI420, ChromaLayout::kNV12, ChromaLayout::kNV21}) {
+      RowBuffer expected(width, bytes_per_pixel, layout);
+      ReferenceConvertRow(params, r.data(), g.data(), b.data(), width,
+                          expected.row);
+      for (Isa isa : GetSupportedIsas()) {
+        YCbCrRowConverter converter(isa);
+        RowBuffer actual(width, bytes_per_pixel, layout);
+        converter.ConvertRow(params, r.data(), g.data(), b.data(), width,
+                             actual.row);
+        EXPECT_EQ(expected.y, actual.y)
+            << "Luma mismatch, isa: " << static_cast<int>(isa)
+            << " width: " << width;
+        EXPECT_EQ(expected.chroma, actual.chroma)
+            << "Chroma mismatch, isa: " << static_cast<int>(isa)
+            << " width: " << width << " layout: " << static_cast<int>(layout);
+      }
+    }
+  }
+}
+
+TEST(YCbCrRowConverterTests, BestIsaIsSupported) {
+  EXPECT_TRUE(
+      YCbCrRowConverter::IsIsaSupported(YCbCrRowConverter::GetBestIsa()));
+  EXPECT_TRUE(YCbCrRowConverter::IsIsaSupported(Isa::kPortable));
+}
+
+TEST(YCbCrRowConverterTests, TransferTables) {
+  for (auto transfer :
+       {TransferFunction::kSRGB, TransferFunction::kSMPTE170M,
+        TransferFunction::kST2084, TransferFunction::kHLG}) {
+    const int32_t* table = YCbCrRowConverter::GetTransferTable(transfer);
+    ASSERT_NE(table, nullptr);
+    for (int32_t i = 0; i <= kSaturationPoint; i++) {
+      ASSERT_EQ(table[i], ReferenceGamma(i, transfer))
+          << "Transfer: " << static_cast<int>(transfer) << " value: " << i;
+    }
+  }
+}
+
+TEST(YCbCrRowConverterTests, MatchesReference8Bit) {
+  for (auto transfer :
+       {TransferFunction::kSRGB, TransferFunction::kSMPTE170M,
+        TransferFunction::kST2084, TransferFunction::kHLG}) {
+    CompareWithReference(transfer, /*bytes_per_pixel*/ 1,
+                         /*apply_color_matrix*/ false);
+    CompareWithReference(transfer, /*bytes_per_pixel*/ 1,
+                         /*apply_color_matrix*/ true);
+  }
+}
+
+TEST(YCbCrRowConverterTests, MatchesReferenceP010) {
+  for (auto transfer :
+       {TransferFunction::kSRGB, TransferFunction::kSMPTE170M,
+        TransferFunction::kST2084, TransferFunction::kHLG}) {
+    CompareWithReference(transfer, /*bytes_per_pixel*/ 2,
+                         /*apply_color_matrix*/ false);
+    CompareWithReference(transfer, /*bytes_per_pixel*/ 2,
+                         /*apply_color_matrix*/ true);
+  }
+}
+
+TEST(YCbCrRowConverterTests, LumaOnlyRow) {
+  std::mt19937 engine(5678);
+  const size_t width = 333;
+  std::vector<uint32_t> r, g, b;
+  FillElectrons(width, &engine, &r, &g, &b);
+  auto params = GetParams(TransferFunction::kSRGB, /*bytes_per_pixel*/ 1,
+                          /*apply_color_matrix*/ false);
+
+  RowBuffer expected(width, 1, ChromaLayout::kNV12);
+  expected.row.cb = expected.row.cr = nullptr;
+  ReferenceConvertRow(params, r.data(), g.data(), b.data(), width,
+                      expected.row);
+  for (Isa isa : GetSupportedIsas()) {
+    YCbCrRowConverter converter(isa);
+    RowBuffer actual(width, 1, ChromaLayout::kNV12);
+    actual.row.cb = actual.row.cr = nullptr;
+    converter.ConvertRow(params, r.data(), g.data(), b.data(), width,
+                         actual.row);
+    EXPECT_EQ(expected.y, actual.y);
+    // Chroma planes must stay untouched
+    EXPECT_EQ(expected.chroma, actual.chroma);
+  }
+}
+
+}  // namespace android
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "FenceReactor"
+
+#include "FenceReactor.h"
+
+#include <errno.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace android {
+
+FenceReactor::FenceReactor()
+    : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      interrupt_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+  if (epoll_fd_ < 0) {
+    ALOGE("%s: Failed to create epoll instance: %s (%d)", __FUNCTION__,
+          strerror(errno), errno);
+    return;
+  }
+
+  epoll_event event = {.events = EPOLLIN, .data = {.fd = interrupt_fd_}};
+  if ((interrupt_fd_ < 0) ||
+      (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, interrupt_fd_, &event) != 0)) {
+    ALOGE("%s: Failed to set up the interrupt eventfd: %s (%d)", __FUNCTION__,
+          strerror(errno), errno);
+  }
+}
+
+FenceReactor::~FenceReactor() {
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+  if (interrupt_fd_ >= 0) {
+    close(interrupt_fd_);
+  }
+}
+
+status_t FenceReactor::Watch(int fence_fd) {
+  if (fence_fd < 0) {
+    return BAD_VALUE;
+  }
+  if (epoll_fd_ < 0) {
+    return NO_INIT;
+  }
+
+  // Publish the state first, a concurrent wait may observe the fence as soon
+  // as it is added to the epoll set.
+  std::lock_guard<std::mutex> lock(fence_mutex_);
+  fences_[fence_fd] = FenceState::kPending;
+  epoll_event event = {.events = EPOLLIN, .data = {.fd = fence_fd}};
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fence_fd, &event) != 0) {
+    int err = errno;
+    ALOGE("%s: Failed to watch fence %d: %s (%d)", __FUNCTION__, fence_fd,
+          strerror(err), err);
+    fences_.erase(fence_fd);
+    return -err;
+  }
+
+  return OK;
+}
+
+void FenceReactor::Unwatch(int fence_fd) {
+  std::lock_guard<std::mutex> lock(fence_mutex_);
+  auto fence = fences_.find(fence_fd);
+  if (fence == fences_.end()) {
+    return;
+  }
+
+  // Resolved fences were already removed from the epoll set
+  if (fence->second == FenceState::kPending) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fence_fd, nullptr);
+  }
+  fences_.erase(fence);
+}
+
+bool FenceReactor::IsSignaled(int fence_fd) {
+  std::lock_guard<std::mutex> lock(fence_mutex_);
+  auto fence = fences_.find(fence_fd);
+  return (fence != fences_.end()) && (fence->second == FenceState::kSignaled);
+}
+
+status_t FenceReactor::GetStatusLocked(const std::vector<int>& fence_fds) {
+  status_t res = OK;
+  for (int fence_fd : fence_fds) {
+    auto fence = fences_.find(fence_fd);
+    if (fence == fences_.end()) {
+      return BAD_VALUE;
+    }
+    if (fence->second == FenceState::kError) {
+      return UNKNOWN_ERROR;
+    }
+    if (fence->second == FenceState::kPending) {
+      res = NO_INIT;
+    }
+  }
+
+  return res;
+}
+
+void FenceReactor::UpdateLocked(int fence_fd, FenceState state) {
+  auto fence = fences_.find(fence_fd);
+  if ((fence == fences_.end()) || (fence->second != FenceState::kPending)) {
+    return;
+  }
+
+  // Signaled fences stay readable, stop polling them.
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fence_fd, nullptr);
+  fence->second = state;
+}
+
+status_t FenceReactor::WaitForFences(const std::vector<int>& fence_fds,
+                                     nsecs_t timeout) {
+  nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + timeout;
+  epoll_event events[kMaxEvents];
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(fence_mutex_);
+      if (interrupted_) {
+        return INVALID_OPERATION;
+      }
+      auto res = GetStatusLocked(fence_fds);
+      if (res != NO_INIT) {
+        return res;
+      }
+    }
+
+    nsecs_t remaining = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+    if (remaining <= 0) {
+      return TIMED_OUT;
+    }
+
+    // Round up so that a short remainder doesn't turn into a busy loop
+    int timeout_ms = static_cast<int>((remaining + 999999) / 1000000);
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = errno;
+      ALOGE("%s: epoll_wait failed: %s (%d)", __FUNCTION__, strerror(err),
+            err);
+      return -err;
+    }
+
+    std::lock_guard<std::mutex> lock(fence_mutex_);
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.fd == interrupt_fd_) {
+        continue;
+      }
+      bool failed = (events[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+      UpdateLocked(events[i].data.fd,
+                   failed ? FenceState::kError : FenceState::kSignaled);
+    }
+  }
+}
+
+void FenceReactor::Interrupt() {
+  std::lock_guard<std::mutex> lock(fence_mutex_);
+  if (interrupted_) {
+    return;
+  }
+
+  interrupted_ = true;
+  uint64_t value = 1;
+  if ((interrupt_fd_ >= 0) &&
+      (write(interrupt_fd_, &value, sizeof(value)) !=
+       static_cast<ssize_t>(sizeof(value)))) {
+    ALOGE("%s: Failed to wake up the waiting thread: %s (%d)", __FUNCTION__,
+          strerror(errno), errno);
+  }
+}
+
+void FenceReactor::ClearInterrupt() {
+  std::lock_guard<std::mutex> lock(fence_mutex_);
+  if (!interrupted_) {
+    return;
+  }
+
+  interrupted_ = false;
+  // Resets the counter so that epoll stops reporting the eventfd
+  uint64_t value;
+  if ((interrupt_fd_ >= 0) &&
+      (read(interrupt_fd_, &value, sizeof(value)) < 0)) {
+    ALOGE("%s: Failed to reset the interrupt eventfd: %s (%d)", __FUNCTION__,
+          strerror(errno), errno);
+  }
+}
+
+}  // namespace android
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_FENCE_REACTOR_H_
+#define EMULATOR_CAMERA_HAL_HWL_FENCE_REACTOR_H_
+
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+
+// Watches acquire fences in a single epoll set. Fences are registered as soon
+// as their request arrives and are marked signaled by whichever wait observes
+// them, so waiting on one fence also resolves every other fence that signaled
+// in the meantime. Works with any file descriptor that becomes readable when
+// signaled, i.e. sync_file and eventfd.
+//
+// Watch(), Unwatch(), IsSignaled() and the interrupt calls can be called from
+// any thread, only one thread may wait at a time.
+class FenceReactor {
+ public:
+  FenceReactor();
+  ~FenceReactor();
+
+  // Starts watching 'fence_fd'. The descriptor is not owned and must stay open
+  // until Unwatch() is called.
+  status_t Watch(int fence_fd);
+
+  // Stops watching 'fence_fd' and forgets its state.
+  void Unwatch(int fence_fd);
+
+  // Returns true if 'fence_fd' is watched and has signaled without error.
+  bool IsSignaled(int fence_fd);
+
+  // Waits until all 'fence_fds' are resolved or 'timeout' elapsed. Returns OK
+  // if all of them signaled, TIMED_OUT if any is still pending, or an error
+  // if any of them failed or isn't watched. Use IsSignaled() to find out
+  // which fences are ready in the latter cases.
+  status_t WaitForFences(const std::vector<int>& fence_fds, nsecs_t timeout);
+
+  // Makes an ongoing WaitForFences() and all later ones return
+  // INVALID_OPERATION right away, until ClearInterrupt() is called.
+  void Interrupt();
+  void ClearInterrupt();
+
+ private:
+  enum class FenceState { kPending, kSignaled, kError };
+
+  // Returns OK once all fences are signaled, NO_INIT while some are pending.
+  status_t GetStatusLocked(const std::vector<int>& fence_fds);
+  void UpdateLocked(int fence_fd, FenceState state);
+
+  static const int kMaxEvents = 16;
+
+  int epoll_fd_ = -1;
+  // Readable while interrupted, wakes up the waiting thread.
+  int interrupt_fd_ = -1;
+
+  std::mutex fence_mutex_;
+  std::unordered_map<int, FenceState> fences_;
+  bool interrupted_ = false;
+
+  FenceReactor(const FenceReactor&) = delete;
+  FenceReactor& operator=(const FenceReactor&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_FENCE_REACTOR_H_
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "ReadoutThreadPool"
+
+#include "ReadoutThreadPool.h"
+
+#include <log/log.h>
+
+#include <algorithm>
+
+namespace android {
+
+ReadoutThreadPool::ReadoutThreadPool(uint32_t thread_count) {
+  if (thread_count == 0) {
+    thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  thread_count_ = thread_count;
+
+  // The calling thread renders as well, so spawn one worker less.
+  for (uint32_t i = 1; i < thread_count_; i++) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+  ALOGV("%s: Readout using %u threads", __FUNCTION__, thread_count_);
+}
+
+ReadoutThreadPool::~ReadoutThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_ = true;
+  }
+  job_condition_.notify_all();
+
+  for (auto& worker : workers_) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+uint32_t ReadoutThreadPool::GetRowsPerBand(uint32_t row_count,
+                                           uint32_t row_alignment) const {
+  row_alignment = std::max(row_alignment, 1u);
+  uint32_t rows_per_band = (row_count + thread_count_ - 1) / thread_count_;
+  rows_per_band =
+      ((rows_per_band + row_alignment - 1) / row_alignment) * row_alignment;
+
+  return std::max(rows_per_band, 1u);
+}
+
+uint32_t ReadoutThreadPool::GetBandCount(uint32_t row_count,
+                                         uint32_t row_alignment) const {
+  if ((row_count == 0) || (thread_count_ <= 1)) {
+    return 1;
+  }
+
+  uint32_t rows_per_band = GetRowsPerBand(row_count, row_alignment);
+  return (row_count + rows_per_band - 1) / rows_per_band;
+}
+
+void ReadoutThreadPool::Render(uint32_t row_count, uint32_t row_alignment,
+                               const RenderBandFunc& render) {
+  uint32_t band_count = GetBandCount(row_count, row_alignment);
+  if (band_count <= 1) {
+    render(/*band_idx*/ 0, /*row_begin*/ 0, row_count);
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Workers that woke up too late for the previous job may still be
+    // looking at its parameters.
+    done_condition_.wait(lock, [this] { return active_workers_ == 0; });
+
+    render_ = &render;
+    row_count_ = row_count;
+    band_count_ = band_count;
+    rows_per_band_ = GetRowsPerBand(row_count, row_alignment);
+    next_band_ = 0;
+    pending_bands_ = band_count;
+    job_generation_++;
+  }
+  job_condition_.notify_all();
+
+  RenderPendingBands();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_condition_.wait(lock, [this] {
+    return (pending_bands_ == 0) && (active_workers_ == 0);
+  });
+  render_ = nullptr;
+}
+
+void ReadoutThreadPool::RenderPendingBands() {
+  while (true) {
+    uint32_t band_idx = next_band_.fetch_add(1);
+    if (band_idx >= band_count_) {
+      break;
+    }
+
+    uint32_t row_begin = band_idx * rows_per_band_;
+    uint32_t row_end = std::min(row_begin + rows_per_band_, row_count_);
+    if (row_begin < row_end) {
+      (*render_)(band_idx, row_begin, row_end);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_bands_--;
+    if (pending_bands_ == 0) {
+      done_condition_.notify_all();
+    }
+  }
+}
+
+void ReadoutThreadPool::WorkerLoop() {
+  uint64_t last_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_condition_.wait(lock, [this, last_generation] {
+        return exit_ || (job_generation_ != last_generation);
+      });
+      if (exit_) {
+        return;
+      }
+      last_generation = job_generation_;
+      active_workers_++;
+    }
+
+    RenderPendingBands();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_workers_--;
+    if (active_workers_ == 0) {
+      done_condition_.notify_all();
+    }
+  }
+}
+
+}  // namespace android
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_READOUT_THREAD_POOL_H_
+#define EMULATOR_CAMERA_HAL_HWL_READOUT_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+
+// Splits the rows of an output image in horizontal bands and renders them
+// concurrently. The calling thread always takes part in rendering, so a pool
+// with a single thread does not spawn any workers and renders in place.
+class ReadoutThreadPool {
+ public:
+  // Renders rows [row_begin, row_end) of band 'band_idx'.
+  using RenderBandFunc =
+      std::function<void(uint32_t band_idx, uint32_t row_begin,
+                         uint32_t row_end)>;
+
+  // 'thread_count' includes the calling thread. A value of 0 selects the
+  // number of online cores.
+  explicit ReadoutThreadPool(uint32_t thread_count);
+  ~ReadoutThreadPool();
+
+  uint32_t GetThreadCount() const {
+    return thread_count_;
+  }
+
+  // Returns the number of bands 'Render' will use for an image with
+  // 'row_count' rows. Callers can use it to prepare per-band state.
+  uint32_t GetBandCount(uint32_t row_count, uint32_t row_alignment) const;
+
+  // Splits [0, row_count) in bands whose boundaries are multiples of
+  // 'row_alignment' and invokes 'render' once per band. Blocks until all
+  // bands are complete.
+  void Render(uint32_t row_count, uint32_t row_alignment,
+              const RenderBandFunc& render);
+
+ private:
+  uint32_t GetRowsPerBand(uint32_t row_count, uint32_t row_alignment) const;
+  void WorkerLoop();
+  // Renders bands of the current job until none are left.
+  void RenderPendingBands();
+
+  uint32_t thread_count_ = 1;
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable job_condition_;
+  std::condition_variable done_condition_;
+  bool exit_ = false;
+  // Incremented for every new job so that sleeping workers can tell new work
+  // apart from spurious wakeups.
+  uint64_t job_generation_ = 0;
+
+  // Current job, valid while 'pending_bands_' is non-zero.
+  const RenderBandFunc* render_ = nullptr;
+  uint32_t row_count_ = 0;
+  uint32_t rows_per_band_ = 0;
+  uint32_t band_count_ = 0;
+  std::atomic_uint32_t next_band_ = 0;
+  uint32_t pending_bands_ = 0;
+  // Workers currently looking at the job parameters.
+  uint32_t active_workers_ = 0;
+
+  ReadoutThreadPool(const ReadoutThreadPool&) = delete;
+  ReadoutThreadPool& operator=(const ReadoutThreadPool&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_READOUT_THREAD_POOL_H_
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "ScratchArena"
+
+#include "ScratchArena.h"
+
+#include <log/log.h>
+
+namespace android {
+
+std::unique_ptr<uint8_t[]> ScratchArena::AllocateBlock(size_t size,
+                                                       uint8_t** aligned) {
+  // No value initialization, the callers overwrite the whole buffer anyway.
+  std::unique_ptr<uint8_t[]> block(new uint8_t[size + kAlignment - 1]);
+  uintptr_t address = reinterpret_cast<uintptr_t>(block.get());
+  *aligned = reinterpret_cast<uint8_t*>(Align(address));
+  heap_allocation_count_++;
+
+  return block;
+}
+
+void ScratchArena::Reserve(size_t size) {
+  size = Align(size);
+  overflow_blocks_.clear();
+  overflow_size_ = 0;
+  offset_ = 0;
+  if (size <= capacity_) {
+    return;
+  }
+
+  block_.reset();
+  block_ = AllocateBlock(size, &block_start_);
+  capacity_ = size;
+  ALOGV("%s: Scratch capacity %zu bytes", __FUNCTION__, capacity_);
+}
+
+uint8_t* ScratchArena::Allocate(size_t size) {
+  size = Align(size);
+  if (offset_ + size <= capacity_) {
+    uint8_t* ret = block_start_ + offset_;
+    offset_ += size;
+    return ret;
+  }
+
+  uint8_t* ret = nullptr;
+  overflow_blocks_.push_back(AllocateBlock(size, &ret));
+  overflow_size_ += size;
+  return ret;
+}
+
+void ScratchArena::Reset() {
+  if (overflow_blocks_.empty()) {
+    offset_ = 0;
+    return;
+  }
+
+  // Fit everything the last frame needed in a single block from now on
+  size_t required = offset_ + overflow_size_;
+  ALOGW("%s: Scratch capacity %zu bytes exceeded, growing to %zu bytes",
+        __FUNCTION__, capacity_, required);
+  Reserve(required);
+}
+
+}  // namespace android
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_SCRATCH_ARENA_H_
+#define EMULATOR_CAMERA_HAL_HWL_SCRATCH_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+namespace android {
+
+// Memory for temporary buffers that don't outlive a single frame. All
+// allocations come from one block that is sized up front and released at once
+// by Reset(). Requests that don't fit are served from the heap and the block
+// grows on the next Reset(), so the arena stops allocating once it has seen
+// the largest frame. Not thread-safe.
+class ScratchArena {
+ public:
+  static const size_t kAlignment = 64;
+
+  ScratchArena() = default;
+
+  // Grows the block to hold at least 'size' bytes. Invalidates all
+  // outstanding allocations.
+  void Reserve(size_t size);
+
+  // Returns 'size' uninitialized bytes aligned to kAlignment, valid until the
+  // next Reset() or Reserve().
+  uint8_t* Allocate(size_t size);
+
+  // Releases all allocations.
+  void Reset();
+
+  size_t GetCapacity() const {
+    return capacity_;
+  }
+
+  // Number of heap allocations the arena made so far. Stays constant in the
+  // steady state.
+  uint64_t GetHeapAllocationCount() const {
+    return heap_allocation_count_;
+  }
+
+ private:
+  static size_t Align(size_t size) {
+    return (size + kAlignment - 1) & ~(kAlignment - 1);
+  }
+
+  std::unique_ptr<uint8_t[]> AllocateBlock(size_t size, uint8_t** aligned);
+
+  std::unique_ptr<uint8_t[]> block_;
+  uint8_t* block_start_ = nullptr;  // 'block_' rounded up to kAlignment
+  size_t capacity_ = 0;
+  size_t offset_ = 0;
+
+  // Allocations that didn't fit in 'block_' during the current frame
+  std::vector<std::unique_ptr<uint8_t[]>> overflow_blocks_;
+  size_t overflow_size_ = 0;
+
+  uint64_t heap_allocation_count_ = 0;
+
+  ScratchArena(const ScratchArena&) = delete;
+  ScratchArena& operator=(const ScratchArena&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_SCRATCH_ARENA_H_
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SensorNoiseGenerator"
+
+#include "SensorNoiseGenerator.h"
+
+#include <log/log.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+// The Gaussian transform below only uses basic arithmetic so that a frame
+// replays bit-exactly on any host. Keep the compiler from fusing it.
+#ifdef __clang__
+#pragma clang fp contract(off)
+#endif
+
+namespace android {
+
+namespace {
+
+const uint32_t kPhiloxM0 = 0xD2511F53;
+const uint32_t kPhiloxM1 = 0xCD9E8D57;
+const uint32_t kPhiloxW0 = 0x9E3779B9;
+const uint32_t kPhiloxW1 = 0xBB67AE85;
+const int kPhiloxRounds = 10;
+
+// Philox blocks generated per batch. Each block yields four samples.
+const size_t kBatchBlocks = 64;
+
+inline void PhiloxRound(uint32_t k0, uint32_t k1, uint32_t* c0, uint32_t* c1,
+                        uint32_t* c2, uint32_t* c3) {
+  uint64_t p0 = static_cast<uint64_t>(kPhiloxM0) * *c0;
+  uint64_t p1 = static_cast<uint64_t>(kPhiloxM1) * *c2;
+  uint32_t hi0 = p0 >> 32, lo0 = static_cast<uint32_t>(p0);
+  uint32_t hi1 = p1 >> 32, lo1 = static_cast<uint32_t>(p1);
+  *c0 = hi1 ^ *c1 ^ k0;
+  *c1 = lo1;
+  *c2 = hi0 ^ *c3 ^ k1;
+  *c3 = lo0;
+}
+
+// Uniform sample in (0, 1) built from the upper 24 bits of 'bits'. Never
+// returns zero, so the logarithm below stays finite.
+inline float ToOpenUnit(uint32_t bits) {
+  return ((bits >> 8) + 0.5f) * (1.0f / 16777216.0f);
+}
+
+// Natural logarithm of a normal, positive 'value'.
+inline float Log(float value) {
+  const float kLn2 = 0.69314718f;
+  const float kSqrt2 = 1.41421356f;
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int32_t exponent = static_cast<int32_t>(bits >> 23) - 127;
+  bits = (bits & 0x007FFFFF) | 0x3F800000;
+  float mantissa;
+  memcpy(&mantissa, &bits, sizeof(mantissa));
+  // Center the mantissa around 1 to speed up the series below
+  if (mantissa > kSqrt2) {
+    mantissa *= 0.5f;
+    exponent++;
+  }
+
+  // ln(m) = 2 * atanh(s), |s| < 0.172
+  float s = (mantissa - 1.0f) / (mantissa + 1.0f);
+  float s2 = s * s;
+  float series =
+      1.0f + s2 * (1.0f / 3 + s2 * (1.0f / 5 + s2 * (1.0f / 7 + s2 / 9)));
+  return exponent * kLn2 + 2.0f * s * series;
+}
+
+// Sine and cosine of a uniformly distributed angle taken from 'bits'. The
+// top two bits select the quadrant, the rest the angle within [-pi/4, pi/4).
+inline void SinCos(uint32_t bits, float* sin_out, float* cos_out) {
+  const float kHalfPi = 1.57079633f;
+  uint32_t quadrant = bits >> 30;
+  float angle =
+      ((bits & 0x3FFFFFFF) * (1.0f / 1073741824.0f) - 0.5f) * kHalfPi;
+  float a2 = angle * angle;
+  float sin_a =
+      angle *
+      (1.0f - a2 * (1.0f / 6 - a2 * (1.0f / 120 - a2 * (1.0f / 5040))));
+  float cos_a =
+      1.0f - a2 * (0.5f - a2 * (1.0f / 24 - a2 * (1.0f / 720 -
+                                                  a2 * (1.0f / 40320))));
+
+  // Rotate by the quadrant
+  float s = (quadrant & 1) ? cos_a : sin_a;
+  float c = (quadrant & 1) ? -sin_a : cos_a;
+  *sin_out = (quadrant & 2) ? -s : s;
+  *cos_out = (quadrant & 2) ? -c : c;
+}
+
+}  // namespace
+
+Philox4x32::Counter Philox4x32::Generate(const Counter& counter,
+                                         const Key& key) {
+  uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int round = 0; round < kPhiloxRounds; round++) {
+    if (round > 0) {
+      k0 += kPhiloxW0;
+      k1 += kPhiloxW1;
+    }
+    PhiloxRound(k0, k1, &c0, &c1, &c2, &c3);
+  }
+
+  return {c0, c1, c2, c3};
+}
+
+SensorNoiseGenerator::SensorNoiseGenerator(uint64_t seed)
+    : key_({static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)}) {
+}
+
+void SensorNoiseGenerator::SetGain(float total_gain,
+                                   float read_noise_var_before_gain,
+                                   float read_noise_var_after_gain,
+                                   uint32_t max_electrons) {
+  if ((total_gain == total_gain_) &&
+      (read_noise_var_before_gain == read_noise_var_before_gain_) &&
+      (read_noise_var_after_gain == read_noise_var_after_gain_) &&
+      (stddev_table_.size() == max_electrons + 1)) {
+    return;
+  }
+
+  total_gain_ = total_gain;
+  read_noise_var_before_gain_ = read_noise_var_before_gain;
+  read_noise_var_after_gain_ = read_noise_var_after_gain;
+
+  float noise_var_gain = total_gain * total_gain;
+  float read_noise_var =
+      read_noise_var_before_gain * noise_var_gain + read_noise_var_after_gain;
+  stddev_table_.resize(max_electrons + 1);
+  for (uint32_t electron_count = 0; electron_count <= max_electrons;
+       electron_count++) {
+    float photon_noise_var = electron_count * noise_var_gain;
+    stddev_table_[electron_count] =
+        std::sqrt(read_noise_var + photon_noise_var);
+  }
+  ALOGV("%s: Noise table rebuilt for gain %f", __FUNCTION__, total_gain);
+}
+
+void SensorNoiseGenerator::FillGaussianRow(uint32_t frame_number, uint32_t row,
+                                           size_t count,
+                                           float* samples) const {
+  uint32_t c0[kBatchBlocks], c1[kBatchBlocks], c2[kBatchBlocks],
+      c3[kBatchBlocks];
+  const size_t block_count = (count + 3) / 4;
+
+  for (size_t first_block = 0; first_block < block_count;
+       first_block += kBatchBlocks) {
+    const size_t batch = std::min(kBatchBlocks, block_count - first_block);
+
+    // Counter: block index, row, frame number
+    for (size_t i = 0; i < batch; i++) {
+      c0[i] = static_cast<uint32_t>(first_block + i);
+      c1[i] = row;
+      c2[i] = frame_number;
+      c3[i] = 0;
+    }
+    // Round by round over the whole batch, the blocks are independent.
+    uint32_t k0 = key_[0], k1 = key_[1];
+    for (int round = 0; round < kPhiloxRounds; round++) {
+      if (round > 0) {
+        k0 += kPhiloxW0;
+        k1 += kPhiloxW1;
+      }
+      for (size_t i = 0; i < batch; i++) {
+        PhiloxRound(k0, k1, &c0[i], &c1[i], &c2[i], &c3[i]);
+      }
+    }
+
+    // Box-Muller, each pair of words yields two independent samples.
+    float* out = samples + first_block * 4;
+    size_t out_count = std::min(batch * 4, count - first_block * 4);
+    for (size_t i = 0; i < batch; i++) {
+      float z[4];
+      float radius0 = std::sqrt(-2.0f * Log(ToOpenUnit(c0[i])));
+      float radius1 = std::sqrt(-2.0f * Log(ToOpenUnit(c2[i])));
+      float sin0, cos0, sin1, cos1;
+      SinCos(c1[i], &sin0, &cos0);
+      SinCos(c3[i], &sin1, &cos1);
+      z[0] = radius0 * cos0;
+      z[1] = radius0 * sin0;
+      z[2] = radius1 * cos1;
+      z[3] = radius1 * sin1;
+
+      size_t n = std::min<size_t>(4, out_count - i * 4);
+      std::copy(z, z + n, out + i * 4);
+    }
+  }
+}
+
+}  // namespace android
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_SENSOR_NOISE_GENERATOR_H_
+#define EMULATOR_CAMERA_HAL_HWL_SENSOR_NOISE_GENERATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <vector>
+
+namespace android {
+
+// Philox4x32-10 counter-based random number generator (Salmon et al., "Parallel
+// Random Numbers: As Easy as 1, 2, 3"). Every output block is a pure function
+// of the key and the counter, so any part of the stream can be generated
+// independently of the rest.
+class Philox4x32 {
+ public:
+  using Counter = std::array<uint32_t, 4>;
+  using Key = std::array<uint32_t, 2>;
+
+  static Counter Generate(const Counter& counter, const Key& key);
+};
+
+// Read and photon noise of the emulated sensor. Samples are normally
+// distributed and only depend on the seed, the frame number and the row, so
+// rows can be rendered concurrently and a frame can be replayed exactly.
+class SensorNoiseGenerator {
+ public:
+  explicit SensorNoiseGenerator(uint64_t seed);
+
+  // Rebuilds the noise standard deviation table for pixels holding
+  // [0, max_electrons] electrons, unless it was built for the same parameters
+  // already. Must not run concurrently with GetStddev().
+  void SetGain(float total_gain, float read_noise_var_before_gain,
+               float read_noise_var_after_gain, uint32_t max_electrons);
+
+  // Standard deviation in raw digital units of a pixel holding
+  // 'electron_count' electrons. Counts past the table end are clamped.
+  float GetStddev(uint32_t electron_count) const {
+    return stddev_table_[electron_count < stddev_table_.size()
+                             ? electron_count
+                             : stddev_table_.size() - 1];
+  }
+
+  // Writes 'count' standard normal samples for row 'row' of frame
+  // 'frame_number' to 'samples'. Thread-safe.
+  void FillGaussianRow(uint32_t frame_number, uint32_t row, size_t count,
+                       float* samples /*out*/) const;
+
+ private:
+  Philox4x32::Key key_;
+
+  float total_gain_ = -1.f;
+  float read_noise_var_before_gain_ = 0.f;
+  float read_noise_var_after_gain_ = 0.f;
+  std::vector<float> stddev_table_ = {0.f};
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_SENSOR_NOISE_GENERATOR_H_
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_SPSC_RING_H_
+#define EMULATOR_CAMERA_HAL_HWL_SPSC_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+namespace android {
+
+// Bounded lock-free queue with exactly one producer thread and one consumer
+// thread. Slots are allocated once at construction; pushing and popping only
+// move values in and out of them.
+template <typename T>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity) : slots_(capacity) {
+  }
+
+  // Producer only. Returns false and leaves 'value' untouched if the ring is
+  // full.
+  bool TryPush(T&& value) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= slots_.size()) {
+      return false;
+    }
+
+    slots_[tail % slots_.size()] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns false if the ring is empty.
+  bool TryPop(T* value /*out*/) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    *value = std::move(slots_[head % slots_.size()]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Safe to call from any thread, the result may be stale by the time it
+  // returns.
+  size_t Size() const {
+    // Load 'head_' first, 'tail_' can only be ahead of it
+    uint64_t head = head_.load(std::memory_order_acquire);
+    return tail_.load(std::memory_order_acquire) - head;
+  }
+
+  size_t Capacity() const {
+    return slots_.size();
+  }
+
+ private:
+  std::vector<T> slots_;
+
+  // Monotonic counters, the producer owns 'tail_' and the consumer 'head_'.
+  // Kept on separate cache lines so the two threads don't contend.
+  alignas(64) std::atomic<uint64_t> head_ = 0;
+  alignas(64) std::atomic<uint64_t> tail_ = 0;
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_SPSC_RING_H_
@@ -0,0 +1,673 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "YCbCrRowConverter"
+
+#include "YCbCrRowConverter.h"
+
+#include <endian.h>
+#include <log/log.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YCBCR_ROW_CONVERTER_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define YCBCR_ROW_CONVERTER_NEON
+#include <arm_neon.h>
+#endif
+
+// The vector paths multiply and add in separate steps. Keep the compiler from
+// fusing the portable path so all paths round the color transform the same.
+#ifdef __clang__
+#pragma clang fp contract(off)
+#endif
+
+namespace android {
+
+const int32_t YCbCrRowConverter::kSaturationPoint = 64 * 255;
+
+struct YCbCrRowConverter::Kernels {
+  // Scales the electron counts, applies the optional color transform and
+  // clamps to kSaturationPoint.
+  void (*linearize)(const Params& params, const uint32_t* r, const uint32_t* g,
+                    const uint32_t* b, size_t count, int32_t* out_r,
+                    int32_t* out_g, int32_t* out_b);
+  // Replaces every sample with its transfer function table entry.
+  void (*apply_transfer)(const int32_t* table, size_t count,
+                         int32_t* r /*in/out*/, int32_t* g /*in/out*/,
+                         int32_t* b /*in/out*/);
+  // Computes 8-bit luma for every pixel and 8-bit chroma for every even
+  // pixel when 'chroma' is set.
+  void (*to_ycbcr)(const int32_t* r, const int32_t* g, const int32_t* b,
+                   size_t count, bool chroma, int32_t* y, int32_t* cb,
+                   int32_t* cr);
+};
+
+namespace {
+
+// Pixels converted per pass, the intermediate buffers live on the stack.
+// Must be even so that chroma sub-sampling lines up across passes.
+const size_t kChunkSize = 256;
+
+// Fixed-point coefficients for RGB-YUV transform
+// Based on JFIF RGB->YUV transform.
+// Cb/Cr offset scaled by 64x twice since they're applied post-multiply
+const int32_t kRgbToY[] = {19, 37, 7};
+const int32_t kRgbToCb[] = {-10, -21, 32, 524288};
+const int32_t kRgbToCr[] = {32, -26, -5, 524288};
+// Scale back to 8bpp non-fixed-point, log2(64 * 64)
+const int kScaleOutShift = 12;
+
+int32_t ApplySRGBGamma(int32_t value, int32_t saturation) {
+  float n_value = (static_cast<float>(value) / saturation);
+  n_value = (n_value <= 0.0031308f)
+                ? n_value * 12.92f
+                : 1.055f * pow(n_value, 0.4166667f) - 0.055f;
+  return n_value * saturation;
+}
+
+int32_t ApplySMPTE170MGamma(int32_t value, int32_t saturation) {
+  float n_value = (static_cast<float>(value) / saturation);
+  n_value = (n_value <= 0.018f) ? n_value * 4.5f
+                                : 1.099f * pow(n_value, 0.45f) - 0.099f;
+  return n_value * saturation;
+}
+
+int32_t ApplyST2084Gamma(int32_t value, int32_t saturation) {
+  float n_value = (static_cast<float>(value) / saturation);
+  float c2 = 32.f * 2413.f / 4096.f;
+  float c3 = 32.f * 2392.f / 4096.f;
+  float c1 = c3 - c2 + 1.f;
+  float m = 128.f * 2523.f / 4096.f;
+  float n = 0.25f * 2610.f / 4096.f;
+  n_value = pow((c1 + c2 * pow(n_value, n)) / (1 + c3 * pow(n_value, n)), m);
+  return n_value * saturation;
+}
+
+int32_t ApplyHLGGamma(int32_t value, int32_t saturation) {
+  float n_value = (static_cast<float>(value) / saturation);
+  // The full HLG gamma curve has additional parameters for n_value > 1, but
+  // n_value in the emulated camera is always <= 1 due to lack of HDR display
+  // features.
+  n_value = 0.5f * pow(n_value, 0.5f);
+  return n_value * saturation;
+}
+
+void LinearizePortable(const YCbCrRowConverter::Params& params,
+                       const uint32_t* r, const uint32_t* g, const uint32_t* b,
+                       size_t begin, size_t count, int32_t* out_r,
+                       int32_t* out_g, int32_t* out_b) {
+  const uint32_t saturation = YCbCrRowConverter::kSaturationPoint;
+  const float* m = params.color_matrix;
+  for (size_t i = begin; i < count; i++) {
+    uint32_t r_count = r[i] * params.scale64x;
+    uint32_t g_count = g[i] * params.scale64x;
+    uint32_t b_count = b[i] * params.scale64x;
+
+    if (params.apply_color_matrix) {
+      uint32_t rr = r_count;
+      uint32_t gg = g_count;
+      uint32_t bb = b_count;
+      r_count =
+          (uint32_t)std::max(rr * m[0] + gg * m[1] + bb * m[2], 0.0f);
+      g_count =
+          (uint32_t)std::max(rr * m[3] + gg * m[4] + bb * m[5], 0.0f);
+      b_count =
+          (uint32_t)std::max(rr * m[6] + gg * m[7] + bb * m[8], 0.0f);
+    }
+
+    out_r[i] = std::min(r_count, saturation);
+    out_g[i] = std::min(g_count, saturation);
+    out_b[i] = std::min(b_count, saturation);
+  }
+}
+
+void ApplyTransferPortable(const int32_t* table, size_t begin, size_t count,
+                           int32_t* r, int32_t* g, int32_t* b) {
+  for (size_t i = begin; i < count; i++) {
+    r[i] = table[r[i]];
+    g[i] = table[g[i]];
+    b[i] = table[b[i]];
+  }
+}
+
+void ToYCbCrPortable(const int32_t* r, const int32_t* g, const int32_t* b,
+                     size_t begin, size_t count, bool chroma, int32_t* y,
+                     int32_t* cb, int32_t* cr) {
+  // All sums are positive, so the shifts match the original divisions.
+  for (size_t i = begin; i < count; i++) {
+    y[i] = (kRgbToY[0] * r[i] + kRgbToY[1] * g[i] + kRgbToY[2] * b[i]) >>
+           kScaleOutShift;
+    if (chroma && (i % 2 == 0)) {
+      cb[i / 2] = (kRgbToCb[0] * r[i] + kRgbToCb[1] * g[i] +
+                   kRgbToCb[2] * b[i] + kRgbToCb[3]) >>
+                  kScaleOutShift;
+      cr[i / 2] = (kRgbToCr[0] * r[i] + kRgbToCr[1] * g[i] +
+                   kRgbToCr[2] * b[i] + kRgbToCr[3]) >>
+                  kScaleOutShift;
+    }
+  }
+}
+
+void Linearize(const YCbCrRowConverter::Params& params, const uint32_t* r,
+               const uint32_t* g, const uint32_t* b, size_t count,
+               int32_t* out_r, int32_t* out_g, int32_t* out_b) {
+  LinearizePortable(params, r, g, b, /*begin*/ 0, count, out_r, out_g, out_b);
+}
+
+void ApplyTransfer(const int32_t* table, size_t count, int32_t* r, int32_t* g,
+                   int32_t* b) {
+  ApplyTransferPortable(table, /*begin*/ 0, count, r, g, b);
+}
+
+void ToYCbCr(const int32_t* r, const int32_t* g, const int32_t* b,
+             size_t count, bool chroma, int32_t* y, int32_t* cb, int32_t* cr) {
+  ToYCbCrPortable(r, g, b, /*begin*/ 0, count, chroma, y, cb, cr);
+}
+
+#ifdef YCBCR_ROW_CONVERTER_X86
+
+// Exact unsigned conversion, both halves convert without rounding and the
+// sum rounds once like a scalar conversion does.
+__attribute__((target("sse4.1"))) inline __m128 ConvertU32ToFloatSSE41(
+    __m128i value) {
+  __m128 hi = _mm_cvtepi32_ps(_mm_srli_epi32(value, 16));
+  __m128 lo = _mm_cvtepi32_ps(_mm_and_si128(value, _mm_set1_epi32(0xFFFF)));
+  return _mm_add_ps(_mm_mul_ps(hi, _mm_set1_ps(65536.0f)), lo);
+}
+
+// Values past the saturation point are clamped in float, the truncating
+// conversion of the clamped value matches clamping after the conversion.
+__attribute__((target("sse4.1"))) inline __m128i TransformChannelSSE41(
+    __m128 r, __m128 g, __m128 b, const float* m) {
+  __m128 sum = _mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(m[0])),
+                          _mm_mul_ps(g, _mm_set1_ps(m[1])));
+  sum = _mm_add_ps(sum, _mm_mul_ps(b, _mm_set1_ps(m[2])));
+  sum = _mm_max_ps(sum, _mm_setzero_ps());
+  const float saturation = YCbCrRowConverter::kSaturationPoint;
+  sum = _mm_min_ps(sum, _mm_set1_ps(saturation));
+  return _mm_cvttps_epi32(sum);
+}
+
+__attribute__((target("sse4.1"))) void LinearizeSSE41(
+    const YCbCrRowConverter::Params& params, const uint32_t* r,
+    const uint32_t* g, const uint32_t* b, size_t count, int32_t* out_r,
+    int32_t* out_g, int32_t* out_b) {
+  const __m128i scale = _mm_set1_epi32(params.scale64x);
+  const __m128i saturation =
+      _mm_set1_epi32(YCbCrRowConverter::kSaturationPoint);
+  const float* m = params.color_matrix;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i r_count = _mm_mullo_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i)), scale);
+    __m128i g_count = _mm_mullo_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i)), scale);
+    __m128i b_count = _mm_mullo_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)), scale);
+    if (params.apply_color_matrix) {
+      __m128 rf = ConvertU32ToFloatSSE41(r_count);
+      __m128 gf = ConvertU32ToFloatSSE41(g_count);
+      __m128 bf = ConvertU32ToFloatSSE41(b_count);
+      r_count = TransformChannelSSE41(rf, gf, bf, m);
+      g_count = TransformChannelSSE41(rf, gf, bf, m + 3);
+      b_count = TransformChannelSSE41(rf, gf, bf, m + 6);
+    } else {
+      r_count = _mm_min_epu32(r_count, saturation);
+      g_count = _mm_min_epu32(g_count, saturation);
+      b_count = _mm_min_epu32(b_count, saturation);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out_r + i), r_count);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out_g + i), g_count);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out_b + i), b_count);
+  }
+  LinearizePortable(params, r, g, b, i, count, out_r, out_g, out_b);
+}
+
+__attribute__((target("sse4.1"))) inline __m128i DotSSE41(__m128i r, __m128i g,
+                                                          __m128i b,
+                                                          const int32_t* c) {
+  __m128i sum = _mm_add_epi32(_mm_mullo_epi32(r, _mm_set1_epi32(c[0])),
+                              _mm_mullo_epi32(g, _mm_set1_epi32(c[1])));
+  return _mm_add_epi32(sum, _mm_mullo_epi32(b, _mm_set1_epi32(c[2])));
+}
+
+// Returns the even elements of 'a' followed by the even elements of 'b'.
+__attribute__((target("sse4.1"))) inline __m128i EvenSSE41(__m128i a,
+                                                           __m128i b) {
+  return _mm_castps_si128(_mm_shuffle_ps(
+      _mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+__attribute__((target("sse4.1"))) void ToYCbCrSSE41(
+    const int32_t* r, const int32_t* g, const int32_t* b, size_t count,
+    bool chroma, int32_t* y, int32_t* cb, int32_t* cr) {
+  const __m128i cbcr_offset = _mm_set1_epi32(kRgbToCb[3]);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+    __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i + 4));
+    __m128i g0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i));
+    __m128i g1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i + 4));
+    __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 4));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(y + i),
+        _mm_srli_epi32(DotSSE41(r0, g0, b0, kRgbToY), kScaleOutShift));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(y + i + 4),
+        _mm_srli_epi32(DotSSE41(r1, g1, b1, kRgbToY), kScaleOutShift));
+    if (chroma) {
+      __m128i re = EvenSSE41(r0, r1);
+      __m128i ge = EvenSSE41(g0, g1);
+      __m128i be = EvenSSE41(b0, b1);
+      __m128i cb_sum = _mm_add_epi32(DotSSE41(re, ge, be, kRgbToCb),
+                                     cbcr_offset);
+      __m128i cr_sum = _mm_add_epi32(DotSSE41(re, ge, be, kRgbToCr),
+                                     cbcr_offset);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(cb + i / 2),
+                       _mm_srli_epi32(cb_sum, kScaleOutShift));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(cr + i / 2),
+                       _mm_srli_epi32(cr_sum, kScaleOutShift));
+    }
+  }
+  ToYCbCrPortable(r, g, b, i, count, chroma, y, cb, cr);
+}
+
+__attribute__((target("avx2"))) inline __m256 ConvertU32ToFloatAVX2(
+    __m256i value) {
+  __m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(value, 16));
+  __m256 lo =
+      _mm256_cvtepi32_ps(_mm256_and_si256(value, _mm256_set1_epi32(0xFFFF)));
+  return _mm256_add_ps(_mm256_mul_ps(hi, _mm256_set1_ps(65536.0f)), lo);
+}
+
+__attribute__((target("avx2"))) inline __m256i TransformChannelAVX2(
+    __m256 r, __m256 g, __m256 b, const float* m) {
+  __m256 sum = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(m[0])),
+                             _mm256_mul_ps(g, _mm256_set1_ps(m[1])));
+  sum = _mm256_add_ps(sum, _mm256_mul_ps(b, _mm256_set1_ps(m[2])));
+  sum = _mm256_max_ps(sum, _mm256_setzero_ps());
+  sum = _mm256_min_ps(sum, _mm256_set1_ps(static_cast<float>(
+                               YCbCrRowConverter::kSaturationPoint)));
+  return _mm256_cvttps_epi32(sum);
+}
+
+__attribute__((target("avx2"))) void LinearizeAVX2(
+    const YCbCrRowConverter::Params& params, const uint32_t* r,
+    const uint32_t* g, const uint32_t* b, size_t count, int32_t* out_r,
+    int32_t* out_g, int32_t* out_b) {
+  const __m256i scale = _mm256_set1_epi32(params.scale64x);
+  const __m256i saturation =
+      _mm256_set1_epi32(YCbCrRowConverter::kSaturationPoint);
+  const float* m = params.color_matrix;
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i r_count = _mm256_mullo_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + i)), scale);
+    __m256i g_count = _mm256_mullo_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g + i)), scale);
+    __m256i b_count = _mm256_mullo_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)), scale);
+    if (params.apply_color_matrix) {
+      __m256 rf = ConvertU32ToFloatAVX2(r_count);
+      __m256 gf = ConvertU32ToFloatAVX2(g_count);
+      __m256 bf = ConvertU32ToFloatAVX2(b_count);
+      r_count = TransformChannelAVX2(rf, gf, bf, m);
+      g_count = TransformChannelAVX2(rf, gf, bf, m + 3);
+      b_count = TransformChannelAVX2(rf, gf, bf, m + 6);
+    } else {
+      r_count = _mm256_min_epu32(r_count, saturation);
+      g_count = _mm256_min_epu32(g_count, saturation);
+      b_count = _mm256_min_epu32(b_count, saturation);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out_r + i), r_count);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out_g + i), g_count);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out_b + i), b_count);
+  }
+  LinearizePortable(params, r, g, b, i, count, out_r, out_g, out_b);
+}
+
+__attribute__((target("avx2"))) void ApplyTransferAVX2(const int32_t* table,
+                                                      size_t count, int32_t* r,
+                                                      int32_t* g, int32_t* b) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    int32_t* channels[] = {r + i, g + i, b + i};
+    for (int32_t* channel : channels) {
+      __m256i idx =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(channel));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(channel),
+                          _mm256_i32gather_epi32(table, idx, 4));
+    }
+  }
+  ApplyTransferPortable(table, i, count, r, g, b);
+}
+
+__attribute__((target("avx2"))) inline __m256i DotAVX2(__m256i r, __m256i g,
+                                                       __m256i b,
+                                                       const int32_t* c) {
+  __m256i sum =
+      _mm256_add_epi32(_mm256_mullo_epi32(r, _mm256_set1_epi32(c[0])),
+                       _mm256_mullo_epi32(g, _mm256_set1_epi32(c[1])));
+  return _mm256_add_epi32(sum, _mm256_mullo_epi32(b, _mm256_set1_epi32(c[2])));
+}
+
+// Returns the even elements of 'a' followed by the even elements of 'b'.
+__attribute__((target("avx2"))) inline __m256i EvenAVX2(__m256i a, __m256i b) {
+  __m256 even =
+      _mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b),
+                        _MM_SHUFFLE(2, 0, 2, 0));
+  return _mm256_permute4x64_epi64(_mm256_castps_si256(even),
+                                  _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+__attribute__((target("avx2"))) void ToYCbCrAVX2(const int32_t* r,
+                                                const int32_t* g,
+                                                const int32_t* b, size_t count,
+                                                bool chroma, int32_t* y,
+                                                int32_t* cb, int32_t* cr) {
+  const __m256i cbcr_offset = _mm256_set1_epi32(kRgbToCb[3]);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i r0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + i));
+    __m256i r1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + i + 8));
+    __m256i g0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g + i));
+    __m256i g1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g + i + 8));
+    __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    __m256i b1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 8));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(y + i),
+        _mm256_srli_epi32(DotAVX2(r0, g0, b0, kRgbToY), kScaleOutShift));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(y + i + 8),
+        _mm256_srli_epi32(DotAVX2(r1, g1, b1, kRgbToY), kScaleOutShift));
+    if (chroma) {
+      __m256i re = EvenAVX2(r0, r1);
+      __m256i ge = EvenAVX2(g0, g1);
+      __m256i be = EvenAVX2(b0, b1);
+      __m256i cb_sum =
+          _mm256_add_epi32(DotAVX2(re, ge, be, kRgbToCb), cbcr_offset);
+      __m256i cr_sum =
+          _mm256_add_epi32(DotAVX2(re, ge, be, kRgbToCr), cbcr_offset);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(cb + i / 2),
+                          _mm256_srli_epi32(cb_sum, kScaleOutShift));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(cr + i / 2),
+                          _mm256_srli_epi32(cr_sum, kScaleOutShift));
+    }
+  }
+  ToYCbCrPortable(r, g, b, i, count, chroma, y, cb, cr);
+}
+
+#endif  // YCBCR_ROW_CONVERTER_X86
+
+#ifdef YCBCR_ROW_CONVERTER_NEON
+
+inline uint32x4_t TransformChannelNEON(float32x4_t r, float32x4_t g,
+                                       float32x4_t b, const float* m) {
+  // Separate multiplies and adds, vmlaq_f32 may be fused on some targets.
+  float32x4_t sum = vaddq_f32(vmulq_n_f32(r, m[0]), vmulq_n_f32(g, m[1]));
+  sum = vaddq_f32(sum, vmulq_n_f32(b, m[2]));
+  sum = vmaxq_f32(sum, vdupq_n_f32(0.0f));
+  sum = vminq_f32(sum, vdupq_n_f32(static_cast<float>(
+                           YCbCrRowConverter::kSaturationPoint)));
+  return vcvtq_u32_f32(sum);
+}
+
+void LinearizeNEON(const YCbCrRowConverter::Params& params, const uint32_t* r,
+                   const uint32_t* g, const uint32_t* b, size_t count,
+                   int32_t* out_r, int32_t* out_g, int32_t* out_b) {
+  const uint32_t scale = params.scale64x;
+  const uint32x4_t saturation =
+      vdupq_n_u32(YCbCrRowConverter::kSaturationPoint);
+  const float* m = params.color_matrix;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    uint32x4_t r_count = vmulq_n_u32(vld1q_u32(r + i), scale);
+    uint32x4_t g_count = vmulq_n_u32(vld1q_u32(g + i), scale);
+    uint32x4_t b_count = vmulq_n_u32(vld1q_u32(b + i), scale);
+    if (params.apply_color_matrix) {
+      float32x4_t rf = vcvtq_f32_u32(r_count);
+      float32x4_t gf = vcvtq_f32_u32(g_count);
+      float32x4_t bf = vcvtq_f32_u32(b_count);
+      r_count = TransformChannelNEON(rf, gf, bf, m);
+      g_count = TransformChannelNEON(rf, gf, bf, m + 3);
+      b_count = TransformChannelNEON(rf, gf, bf, m + 6);
+    } else {
+      r_count = vminq_u32(r_count, saturation);
+      g_count = vminq_u32(g_count, saturation);
+      b_count = vminq_u32(b_count, saturation);
+    }
+    vst1q_s32(out_r + i, vreinterpretq_s32_u32(r_count));
+    vst1q_s32(out_g + i, vreinterpretq_s32_u32(g_count));
+    vst1q_s32(out_b + i, vreinterpretq_s32_u32(b_count));
+  }
+  LinearizePortable(params, r, g, b, i, count, out_r, out_g, out_b);
+}
+
+inline int32x4_t DotNEON(int32x4_t r, int32x4_t g, int32x4_t b,
+                         const int32_t* c) {
+  int32x4_t sum = vmulq_n_s32(r, c[0]);
+  sum = vmlaq_n_s32(sum, g, c[1]);
+  return vmlaq_n_s32(sum, b, c[2]);
+}
+
+void ToYCbCrNEON(const int32_t* r, const int32_t* g, const int32_t* b,
+                 size_t count, bool chroma, int32_t* y, int32_t* cb,
+                 int32_t* cr) {
+  const int32x4_t cbcr_offset = vdupq_n_s32(kRgbToCb[3]);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    int32x4_t r0 = vld1q_s32(r + i);
+    int32x4_t r1 = vld1q_s32(r + i + 4);
+    int32x4_t g0 = vld1q_s32(g + i);
+    int32x4_t g1 = vld1q_s32(g + i + 4);
+    int32x4_t b0 = vld1q_s32(b + i);
+    int32x4_t b1 = vld1q_s32(b + i + 4);
+    vst1q_s32(y + i, vshrq_n_s32(DotNEON(r0, g0, b0, kRgbToY), kScaleOutShift));
+    vst1q_s32(y + i + 4,
+              vshrq_n_s32(DotNEON(r1, g1, b1, kRgbToY), kScaleOutShift));
+    if (chroma) {
+      int32x4_t re = vuzpq_s32(r0, r1).val[0];
+      int32x4_t ge = vuzpq_s32(g0, g1).val[0];
+      int32x4_t be = vuzpq_s32(b0, b1).val[0];
+      int32x4_t cb_sum = vaddq_s32(DotNEON(re, ge, be, kRgbToCb), cbcr_offset);
+      int32x4_t cr_sum = vaddq_s32(DotNEON(re, ge, be, kRgbToCr), cbcr_offset);
+      vst1q_s32(cb + i / 2, vshrq_n_s32(cb_sum, kScaleOutShift));
+      vst1q_s32(cr + i / 2, vshrq_n_s32(cr_sum, kScaleOutShift));
+    }
+  }
+  ToYCbCrPortable(r, g, b, i, count, chroma, y, cb, cr);
+}
+
+#endif  // YCBCR_ROW_CONVERTER_NEON
+
+void StoreLuma(const int32_t* y, size_t count, size_t bytes_per_pixel,
+               uint8_t* out) {
+  if (bytes_per_pixel == 1) {
+    for (size_t i = 0; i < count; i++) {
+      out[i] = static_cast<uint8_t>(y[i]);
+    }
+  } else {
+    uint16_t* out16 = reinterpret_cast<uint16_t*>(out);
+    for (size_t i = 0; i < count; i++) {
+      out16[i] = htole16(static_cast<uint8_t>(y[i]) << 8);
+    }
+  }
+}
+
+// Chroma samples are written in pixel order, Cb before Cr, so that any
+// overlap between the planes resolves the same way as in the per-pixel loop
+// this replaced.
+void StoreChroma(const int32_t* cb, const int32_t* cr, size_t count,
+                 size_t bytes_per_pixel, size_t step, uint8_t* out_cb,
+                 uint8_t* out_cr) {
+  if (bytes_per_pixel == 1) {
+    for (size_t i = 0; i < count; i++) {
+      out_cb[i * step] = static_cast<uint8_t>(cb[i]);
+      out_cr[i * step] = static_cast<uint8_t>(cr[i]);
+    }
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      *(reinterpret_cast<uint16_t*>(out_cb + i * step)) =
+          htole16(static_cast<uint8_t>(cb[i]) << 8);
+      *(reinterpret_cast<uint16_t*>(out_cr + i * step)) =
+          htole16(static_cast<uint8_t>(cr[i]) << 8);
+    }
+  }
+}
+
+}  // namespace
+
+const YCbCrRowConverter::Kernels* YCbCrRowConverter::GetKernels(Isa isa) {
+  static const Kernels portable_kernels = {Linearize, ApplyTransfer, ToYCbCr};
+#ifdef YCBCR_ROW_CONVERTER_X86
+  static const Kernels sse41_kernels = {LinearizeSSE41, ApplyTransfer,
+                                        ToYCbCrSSE41};
+  static const Kernels avx2_kernels = {LinearizeAVX2, ApplyTransferAVX2,
+                                       ToYCbCrAVX2};
+#endif
+#ifdef YCBCR_ROW_CONVERTER_NEON
+  static const Kernels neon_kernels = {LinearizeNEON, ApplyTransfer,
+                                       ToYCbCrNEON};
+#endif
+
+  switch (isa) {
+#ifdef YCBCR_ROW_CONVERTER_X86
+    case Isa::kSSE41:
+      return &sse41_kernels;
+    case Isa::kAVX2:
+      return &avx2_kernels;
+#endif
+#ifdef YCBCR_ROW_CONVERTER_NEON
+    case Isa::kNEON:
+      return &neon_kernels;
+#endif
+    default:
+      return &portable_kernels;
+  }
+}
+
+bool YCbCrRowConverter::IsIsaSupported(Isa isa) {
+  switch (isa) {
+    case Isa::kPortable:
+      return true;
+#ifdef YCBCR_ROW_CONVERTER_X86
+    case Isa::kSSE41:
+      return __builtin_cpu_supports("sse4.1");
+    case Isa::kAVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+#ifdef YCBCR_ROW_CONVERTER_NEON
+    case Isa::kNEON:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+YCbCrRowConverter::Isa YCbCrRowConverter::GetBestIsa() {
+  for (Isa isa : {Isa::kAVX2, Isa::kSSE41, Isa::kNEON}) {
+    if (IsIsaSupported(isa)) {
+      return isa;
+    }
+  }
+
+  return Isa::kPortable;
+}
+
+const int32_t* YCbCrRowConverter::GetTransferTable(TransferFunction transfer) {
+  struct TransferTables {
+    std::vector<int32_t> srgb;
+    std::vector<int32_t> smpte170m;
+    std::vector<int32_t> st2084;
+    std::vector<int32_t> hlg;
+
+    TransferTables()
+        : srgb(kSaturationPoint + 1),
+          smpte170m(kSaturationPoint + 1),
+          st2084(kSaturationPoint + 1),
+          hlg(kSaturationPoint + 1) {
+      for (int32_t i = 0; i <= kSaturationPoint; i++) {
+        srgb[i] = ApplySRGBGamma(i, kSaturationPoint);
+        smpte170m[i] = ApplySMPTE170MGamma(i, kSaturationPoint);
+        st2084[i] = ApplyST2084Gamma(i, kSaturationPoint);
+        hlg[i] = ApplyHLGGamma(i, kSaturationPoint);
+      }
+    }
+  };
+  static const TransferTables tables;
+
+  switch (transfer) {
+    case TransferFunction::kSMPTE170M:
+      return tables.smpte170m.data();
+    case TransferFunction::kST2084:
+      return tables.st2084.data();
+    case TransferFunction::kHLG:
+      return tables.hlg.data();
+    case TransferFunction::kSRGB:
+    default:
+      return tables.srgb.data();
+  }
+}
+
+YCbCrRowConverter::YCbCrRowConverter(Isa isa) {
+  if (!IsIsaSupported(isa)) {
+    ALOGW("%s: Instruction set %d not supported, using portable code",
+          __FUNCTION__, static_cast<int>(isa));
+    isa = Isa::kPortable;
+  }
+  isa_ = isa;
+  kernels_ = GetKernels(isa);
+}
+
+void YCbCrRowConverter::ConvertRow(const Params& params, const uint32_t* r,
+                                   const uint32_t* g, const uint32_t* b,
+                                   size_t width, const Row& out) const {
+  const int32_t* table = GetTransferTable(params.transfer);
+  const bool chroma = (out.cb != nullptr) && (out.cr != nullptr);
+  int32_t r_buf[kChunkSize], g_buf[kChunkSize], b_buf[kChunkSize];
+  int32_t y_buf[kChunkSize], cb_buf[kChunkSize / 2], cr_buf[kChunkSize / 2];
+
+  for (size_t offset = 0; offset < width; offset += kChunkSize) {
+    size_t count = std::min(kChunkSize, width - offset);
+    kernels_->linearize(params, r + offset, g + offset, b + offset, count,
+                        r_buf, g_buf, b_buf);
+    kernels_->apply_transfer(table, count, r_buf, g_buf, b_buf);
+    kernels_->to_ycbcr(r_buf, g_buf, b_buf, count, chroma, y_buf, cb_buf,
+                       cr_buf);
+
+    StoreLuma(y_buf, count, params.bytes_per_pixel,
+              out.y + offset * params.bytes_per_pixel);
+    if (chroma) {
+      size_t chroma_offset = (offset / 2) * out.cbcr_step;
+      StoreChroma(cb_buf, cr_buf, (count + 1) / 2, params.bytes_per_pixel,
+                  out.cbcr_step, out.cb + chroma_offset,
+                  out.cr + chroma_offset);
+    }
+  }
+}
+
+}  // namespace android
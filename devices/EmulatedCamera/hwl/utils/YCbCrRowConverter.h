@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_YCBCR_ROW_CONVERTER_H_
+#define EMULATOR_CAMERA_HAL_HWL_YCBCR_ROW_CONVERTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Converts rows of linear sensor RGB electron counts to gamma corrected
+// YCbCr using the sensor's 6-bit fixed-point pipeline. Every instruction set
+// produces exactly the same output as the portable implementation.
+class YCbCrRowConverter {
+ public:
+  enum class Isa { kPortable, kSSE41, kAVX2, kNEON };
+
+  enum class TransferFunction { kSRGB, kSMPTE170M, kST2084, kHLG };
+
+  // Saturation point of the fixed-point RGB samples after gain.
+  static const int32_t kSaturationPoint;
+
+  struct Params {
+    // Scaling from electrons to fixed-point 8bpp values.
+    int32_t scale64x = 0;
+    // Optional RGB->RGB transform applied before the transfer function.
+    // Row-major, each output channel is a row.
+    bool apply_color_matrix = false;
+    float color_matrix[9] = {};
+    TransferFunction transfer = TransferFunction::kSRGB;
+    // 1 for 8-bit output, 2 for 16-bit (P010) output where the 8-bit samples
+    // are stored little-endian in the most significant bits.
+    size_t bytes_per_pixel = 1;
+  };
+
+  // Output locations of a single row. Consecutive chroma samples are
+  // 'cbcr_step' bytes apart, so planar (I420) and semi-planar (NV12, NV21)
+  // layouts are all described by the plane pointers and the step. Rows
+  // without chroma leave 'cb' and 'cr' null.
+  struct Row {
+    uint8_t* y = nullptr;
+    uint8_t* cb = nullptr;
+    uint8_t* cr = nullptr;
+    size_t cbcr_step = 1;
+  };
+
+  // Returns the fastest instruction set available on the running CPU.
+  static Isa GetBestIsa();
+  static bool IsIsaSupported(Isa isa);
+
+  // Returns the kSaturationPoint + 1 entry lookup table of a transfer
+  // function.
+  static const int32_t* GetTransferTable(TransferFunction transfer);
+
+  explicit YCbCrRowConverter(Isa isa = GetBestIsa());
+
+  Isa GetIsa() const {
+    return isa_;
+  }
+
+  // Converts 'width' pixels. Luma is written for every pixel, chroma for every
+  // even pixel when the row carries chroma.
+  void ConvertRow(const Params& params, const uint32_t* r, const uint32_t* g,
+                  const uint32_t* b, size_t width, const Row& out) const;
+
+ private:
+  struct Kernels;
+  static const Kernels* GetKernels(Isa isa);
+
+  Isa isa_;
+  const Kernels* kernels_;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_YCBCR_ROW_CONVERTER_H_